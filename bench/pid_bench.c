@@ -0,0 +1,2713 @@
+/*
+ * Замеры производительности сбора сведений о процессах.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Сборка (из каталога bench):
+ *   gcc -O2 -I.. -o pid_bench pid_bench.c ../pid_info.c ../string_util.c \
+ *       ../module_config.c ../collector.c ../proc_walker.c ../proc_parse.c \
+ *       ../scan_pool.c ../proc_events.c ../pid_tracker.c ../proc_image.c \
+ *       ../self_stats.c ../trace.c ../user_cache.c ../proc_matcher.c \
+ *       ../proc_aggregate.c ../proc_tree.c -lpthread
+ *
+ * Ключи перед режимом: -r root - читать каталог root вместо /proc, как
+ * ProcRoot; -i image - читать процессы из образа, снятого режимом capture,
+ * отображённого в память.
+ *
+ * Режимы:
+ *   pid_bench scan [iterations]	обход /proc: время, PID-каталоги,
+ *					системные вызовы и прочитанные байты
+ *					на один обход
+ *   pid_bench stat [iterations]	разбор stat-файлов всех процессов хоста:
+ *					parse_linux_stat против прежнего
+ *					разбора через fscanf
+ *   pid_bench smaps			чтение PSS, USS и swap всех процессов
+ *					хоста из smaps_rollup и из smaps
+ *   pid_bench discovery [iterations]	построение JSON procinf.discovery:
+ *					с обходом /proc и по готовому снимку
+ *   pid_bench summary name [iterations]	vmrss, allmap, rwmap и shmap одного
+ *					имени процесса: четыре запроса против
+ *					одного procinf.summary
+ *   pid_bench threads name [iterations]	обход /proc и rwmap одного имени
+ *					процесса при разном числе потоков
+ *					ScanThreads
+ *   pid_bench events [iterations]	обновление снимка обходом /proc и по
+ *					событиям proc connector, между
+ *					обновлениями - BENCH_CHURN fork/exit
+ *   pid_bench maps [iterations]	разбор maps-файлов всех процессов хоста:
+ *					блочный разбор против прежнего
+ *					построчного через fgetc и strtok
+ *   pid_bench names [iterations]	vmrss всех различных имён процессов
+ *					по агрегатам снимка и с перебором
+ *					процессов
+ *   pid_bench synth dir pids maps comms [uniform|zipf]
+ *					создаёт синтетическое дерево /proc:
+ *					pids процессов по maps областей памяти,
+ *					comms имён процессов, распределённых
+ *					равномерно или по Ципфу
+ *   pid_bench params name [iterations]	get_proc_value_summ() по каждому
+ *					параметру proc_params: PID/с, байт/с,
+ *					выделения памяти и системные вызовы
+ *					на запрос, с обходом /proc и по снимку
+ *   pid_bench capture image		снимает образ stat, statm, status, maps,
+ *					smaps_rollup, cmdline, io, limits и
+ *					числа дескрипторов всех процессов
+ *					в файл
+ *   pid_bench extract image dir	записывает образ деревом каталогов
+ *					для -r dir
+ *   pid_bench trace name [iterations]	rwmap одного имени процесса с обходом
+ *					/proc при выключенной и включенной
+ *					трассировке, затем последние интервалы
+ *					трассировки
+ *   pid_bench tree [iterations]	поддеревья всех процессов хоста:
+ *					proc_tree против наивного подъёма
+ *					по ppid, с проверкой состава
+ *   pid_bench rates dir		скорости cpu, ошибок страниц,
+ *					переключений контекста и записи
+ *					на синтетическом дереве dir против
+ *					прироста счётчиков: первый обход,
+ *					известный и новый процесс, интервал
+ *					короче секунды
+ *   pid_bench status [iterations]	разбор status-файлов всех процессов
+ *					хоста: parse_linux_status против
+ *					построчного sscanf
+ *   pid_bench io [iterations]		разбор io-файлов всех процессов хоста:
+ *					parse_linux_io против построчного
+ *					sscanf
+ *   pid_bench fds [iterations]		дескрипторы всех процессов хоста и
+ *					процесса с BENCH_FDS_LARGE
+ *					дескрипторами: count_pid_fds против
+ *					readdir каталога fd, и разбор
+ *					limits-файлов:
+ *					parse_linux_nofile_limit против
+ *					построчного sscanf
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include "pid_info.h"
+#include "module_config.h"
+#include "proc_walker.h"
+#include "proc_parse.h"
+#include "string_util.h"
+#include "scan_pool.h"
+#include "proc_events.h"
+#include "proc_image.h"
+#include "proc_tree.h"
+#include "trace.h"
+
+#define BENCH_BLOCK_SIZE 65536 // Размер блока, которым читается maps
+#define LEGACY_BUF_SIZE 16384 // Размер файлового буфера прежнего разбора maps
+#define LEGACY_LINE_SIZE 1024 // Размер строки прежнего разбора maps
+#define BENCH_NAMES_MAX 1024 // Сколько различных имён процессов опрашивает замер names
+#define BENCH_CHURN 20 // Сколько процессов создаётся и завершается между обновлениями снимка
+#define SYNTH_FIRST_PID 1000 // PID первого процесса синтетического дерева
+#define SYNTH_PATH_SIZE 512 // Размер пути к файлу синтетического дерева
+#define SYNTH_PAGE_SIZE 4096 // Размер страницы синтетического дерева
+#define SYNTH_FDS_LIMIT 1024 // Предел открытых дескрипторов синтетического процесса
+#define BENCH_RATES 5 // Сколько скоростей сверяет замер rates
+#define RATES_OLD_PID 2000 // PID известного процесса замера rates
+#define RATES_NEW_PID 2001 // PID нового процесса замера rates
+#define RATES_OLD_AGE 3600 // Сколько секунд назад запущен известный процесс
+#define RATES_NEW_AGE 2 // Сколько секунд назад запущен новый процесс
+#define RATES_INTERVAL_US 1200000 // Пауза между обходами замера rates, в мкс
+#define BENCH_FDS_LARGE 100000 // Сколько дескрипторов открывает процесс замера fds
+
+/* Права-флаги региона памяти, как их разбирал прежний разбор maps */
+typedef struct legacy_maps_perms_s {
+	unsigned read; /* r - чтение */
+	unsigned write; /* w - запись */
+	unsigned shared; /* s - разделяемая память */
+} legacy_maps_perms_t;
+
+/* Параметр proc_params и его имя в отчёте */
+typedef struct bench_param_s {
+	int param; /* параметр, из proc_params */
+	const char *name; /* имя параметра */
+} bench_param_t;
+
+static const bench_param_t bench_params[] = {
+	{PROC_VMRSS, "vmrss"},
+	{PROC_MAP, "allmap"},
+	{PROC_MAP_SHARED, "shmap"},
+	{PROC_MAP_RW, "rwmap"},
+	{PROC_PSS, "pss"},
+	{PROC_USS, "uss"},
+	{PROC_SWAP, "swap"},
+	{PROC_ANONHUGE, "anonhuge"},
+	{PROC_CPU, "cpu"},
+	{PROC_MINFLT_RATE, "minflt/s"},
+	{PROC_MAJFLT_RATE, "majflt/s"},
+	{PROC_CTXSW_RATE, "ctxsw/s"},
+	{PROC_IO_READ_BYTES, "io.rbytes"},
+	{PROC_IO_WRITE_BYTES, "io.wbytes"},
+	{PROC_IO_SYSCR, "io.syscr"},
+	{PROC_IO_SYSCW, "io.syscw"},
+	{PROC_IO_READ_BYTES_RATE, "io.rbytes/s"},
+	{PROC_IO_WRITE_BYTES_RATE, "io.wbytes/s"},
+	{PROC_IO_SYSCR_RATE, "io.syscr/s"},
+	{PROC_IO_SYSCW_RATE, "io.syscw/s"},
+	{PROC_FDS, "fds"},
+	{PROC_FDS_MAXPCT, "fds.maxpct"}
+};
+
+/* Новый параметр proc_params должен попасть и в bench_params */
+typedef char bench_params_complete[sizeof(bench_params) / sizeof(bench_params[0]) ==
+	PROC_FDS_MAXPCT + 1 ? 1 : -1];
+
+/* Скорости, которые сверяет замер rates, в порядке счётчиков
+ * write_rates_process */
+static const bench_param_t rate_params[BENCH_RATES] = {
+	{PROC_CPU, "cpu"},
+	{PROC_MINFLT_RATE, "minflt"},
+	{PROC_MAJFLT_RATE, "majflt"},
+	{PROC_CTXSW_RATE, "ctxsw"},
+	{PROC_IO_WRITE_BYTES_RATE, "io.wbytes"}
+};
+
+/* Образцы status для сверки разбора: без переключений контекста и
+ * без завершающего перевода строки */
+static const char *status_samples[] = {
+	"Name:\tbash\nState:\tS (sleeping)\nvoluntary_ctxt_switches:\t12\n"
+		"nonvoluntary_ctxt_switches:\t3\n",
+	"Name:\tkthreadd\nState:\tS (sleeping)\n",
+	"voluntary_ctxt_switches:\t7\nnonvoluntary_ctxt_switches:\t18446744073709551615"
+};
+
+/* Образцы io для сверки разбора: без syscw и без завершающего перевода
+ * строки */
+static const char *io_samples[] = {
+	"rchar: 2012\nwchar: 1024\nsyscr: 7\nsyscw: 3\nread_bytes: 4096\n"
+		"write_bytes: 8192\ncancelled_write_bytes: 0\n",
+	"rchar: 2012\nwchar: 1024\nsyscr: 7\nread_bytes: 4096\nwrite_bytes: 8192\n",
+	"syscw: 1\nsyscr: 2\nwrite_bytes: 3\nread_bytes: 18446744073709551615"
+};
+
+/* Образец limits для сверки разбора и ожидаемый результат */
+typedef struct limits_sample_s {
+	const char *text; /* содержимое limits-файла */
+	int found; /* ожидаемый результат parse_linux_nofile_limit */
+	unsigned long long limit; /* ожидаемый мягкий предел */
+} limits_sample_t;
+
+/* Образцы limits: числовой предел, без предела и без строки предела */
+static const limits_sample_t limits_samples[] = {
+	{"Limit                     Soft Limit           Hard Limit           Units     \n"
+		"Max open files            1024                 524288               files     \n",
+		1, 1024},
+	{"Limit                     Soft Limit           Hard Limit           Units     \n"
+		"Max open files            unlimited            unlimited            files     \n",
+		1, 0},
+	{"Limit                     Soft Limit           Hard Limit           Units     \n"
+		"Max processes             63422                63422                processes \n",
+		0, 0}
+};
+
+/* Права и имена областей памяти синтетического дерева, по кругу */
+static const char *synth_perms[] = {"r-xp", "r--p", "rw-p", "rw-p", "rw-s", "---p"};
+static const char *synth_files[] = {"/usr/lib64/libc.so.6", "", "[heap]", "",
+	"/dev/shm/cache", "/usr/lib64/libssl.so.3"};
+
+/* Число выделений памяти malloc, calloc и realloc с запуска */
+static unsigned long bench_allocations = 0;
+
+/* Процесс замера дерева: PID и родитель */
+typedef struct bench_tree_proc_s {
+	int pid; /* PID процесса */
+	int ppid; /* PID родительского процесса */
+} bench_tree_proc_t;
+
+/* Прочитанные в память файлы процессов */
+typedef struct bench_files_s {
+	char **data; /* содержимое файлов */
+	size_t *length; /* длины файлов */
+	size_t count; /* число файлов */
+} bench_files_t;
+
+int bench_scan(int iterations);
+int bench_stat(int iterations);
+int load_proc_files(const char *name, bench_files_t *files);
+void free_bench_files(bench_files_t *files);
+int parse_stat_fscanf(const char *buf, linux_stat_t **result);
+int bench_maps(int iterations);
+int bench_smaps(void);
+int bench_discovery(int iterations);
+int bench_summary(char *proc_name, int iterations);
+int bench_names(int iterations);
+size_t collect_bench_names(char names[][PROC_COMM_SIZE], size_t size);
+int bench_threads(char *proc_name, int iterations);
+int bench_events(int iterations);
+double time_refreshes(int iterations, proc_scan_stats_t *total);
+void churn_processes(int count);
+double read_all_smaps(const char *name, linux_smaps_totals_t *totals,
+	proc_scan_stats_t *stats, unsigned long *processes);
+unsigned long parse_maps_blocks(const char *buf, size_t length, linux_maps_totals_t *totals);
+unsigned long parse_maps_legacy(char *buf, size_t length, linux_maps_totals_t *totals,
+	unsigned long *allocations);
+legacy_maps_perms_t *legacy_parse_perms(const char *str_perms);
+unsigned long legacy_htol(const char *hex);
+int bench_synth(const char *root, int pids, int maps, int comms, const char *spread);
+int write_synth_process(const char *root, int pid, const char *comm, int maps);
+int write_synth_fds(const char *root, int pid, int count);
+int write_synth_file(const char *root, int pid, const char *name, const char *data, size_t length);
+void make_synth_comm(char *comm, size_t size, int number);
+int pick_synth_comm(double *weights, int comms, unsigned *seed);
+int bench_params_mode(char *proc_name, int iterations);
+double time_param(char *proc_name, int param, int iterations, proc_scan_stats_t *stats,
+	unsigned long *allocations, unsigned long *value);
+int bench_capture(const char *image_path);
+int bench_extract(const char *image_path, const char *root);
+int bench_trace(char *proc_name, int iterations);
+int bench_tree(int iterations);
+int compare_tree_procs(const void *first, const void *second);
+unsigned find_tree_proc(const bench_tree_proc_t *procs, size_t count, int pid);
+int is_naive_descendant(const bench_tree_proc_t *procs, size_t count, size_t process,
+	size_t root);
+int bench_rates(const char *root);
+int write_rates_process(const char *root, int pid, const char *comm,
+	unsigned long long starttime, const unsigned long long *counters);
+void query_rates(char *proc_name, unsigned long *values, unsigned long long *bounds);
+double get_rate_bound(double delta, unsigned long long elapsed);
+int check_rate(const char *name, const char *process, unsigned long value,
+	double low, double high);
+int bench_status(int iterations);
+int compare_status(const char *buf, size_t length);
+int parse_status_sscanf(const char *buf, linux_status_t *status);
+const char *next_bench_line(const char *line);
+int bench_io(int iterations);
+int compare_io(const char *buf, size_t length);
+int parse_io_sscanf(const char *buf, linux_io_t *io);
+int bench_fds(int iterations);
+long count_fds_readdir(int pid);
+int bench_large_fds(int iterations, char *buf, unsigned long *mismatches);
+pid_t spawn_fds_process(long *count);
+int compare_limits(const char *buf, size_t length, int found, unsigned long long expected);
+int parse_limits_sscanf(const char *buf, unsigned long long *limit);
+double bench_clock(void);
+unsigned long long bench_boot_clock(void);
+void print_scan_stats(const char *title, double seconds, proc_scan_stats_t *stats, int scans);
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/* Подмена функций выделения памяти: считаем выделения модуля и libc */
+void *malloc(size_t size)
+{
+	__sync_fetch_and_add(&bench_allocations, 1);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	__sync_fetch_and_add(&bench_allocations, 1);
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__sync_fetch_and_add(&bench_allocations, 1);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	while (argc >= 3 && (strcmp(argv[1], "-r") == 0 || strcmp(argv[1], "-i") == 0)) {
+		if (strcmp(argv[1], "-i") == 0 && attach_proc_image(argv[2]) < 0) {
+			fprintf(stderr, "can't read image %s\n", argv[2]);
+			return 1;
+		}
+
+		snprintf(module_config.proc_root, PROC_ROOT_SIZE, "%s", argv[2]);
+		argv[2] = argv[0];
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc >= 2 && strcmp(argv[1], "scan") == 0)
+		return bench_scan(argc >= 3 ? atoi(argv[2]) : 10);
+	if (argc >= 2 && strcmp(argv[1], "stat") == 0)
+		return bench_stat(argc >= 3 ? atoi(argv[2]) : 100);
+	if (argc >= 2 && strcmp(argv[1], "smaps") == 0)
+		return bench_smaps();
+	if (argc >= 2 && strcmp(argv[1], "discovery") == 0)
+		return bench_discovery(argc >= 3 ? atoi(argv[2]) : 100);
+	if (argc >= 3 && strcmp(argv[1], "summary") == 0)
+		return bench_summary(argv[2], argc >= 4 ? atoi(argv[3]) : 100);
+	if (argc >= 2 && strcmp(argv[1], "names") == 0)
+		return bench_names(argc >= 3 ? atoi(argv[2]) : 100);
+	if (argc >= 3 && strcmp(argv[1], "threads") == 0)
+		return bench_threads(argv[2], argc >= 4 ? atoi(argv[3]) : 10);
+	if (argc >= 2 && strcmp(argv[1], "events") == 0)
+		return bench_events(argc >= 3 ? atoi(argv[2]) : 20);
+	if (argc >= 2 && strcmp(argv[1], "maps") == 0)
+		return bench_maps(argc >= 3 ? atoi(argv[2]) : 20);
+	if (argc >= 6 && strcmp(argv[1], "synth") == 0)
+		return bench_synth(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]),
+			argc >= 7 ? argv[6] : "zipf");
+	if (argc >= 3 && strcmp(argv[1], "params") == 0)
+		return bench_params_mode(argv[2], argc >= 4 ? atoi(argv[3]) : 10);
+	if (argc >= 3 && strcmp(argv[1], "capture") == 0)
+		return bench_capture(argv[2]);
+	if (argc >= 4 && strcmp(argv[1], "extract") == 0)
+		return bench_extract(argv[2], argv[3]);
+	if (argc >= 3 && strcmp(argv[1], "trace") == 0)
+		return bench_trace(argv[2], argc >= 4 ? atoi(argv[3]) : 10);
+	if (argc >= 2 && strcmp(argv[1], "tree") == 0)
+		return bench_tree(argc >= 3 ? atoi(argv[2]) : 10);
+	if (argc >= 3 && strcmp(argv[1], "rates") == 0)
+		return bench_rates(argv[2]);
+	if (argc >= 2 && strcmp(argv[1], "status") == 0)
+		return bench_status(argc >= 3 ? atoi(argv[2]) : 100);
+	if (argc >= 2 && strcmp(argv[1], "io") == 0)
+		return bench_io(argc >= 3 ? atoi(argv[2]) : 100);
+	if (argc >= 2 && strcmp(argv[1], "fds") == 0)
+		return bench_fds(argc >= 3 ? atoi(argv[2]) : 10);
+
+	fprintf(stderr, "usage: %s [-r root|-i image] scan|stat|smaps|discovery|names|summary name|threads name|events|maps|tree|status|io|fds [iterations]\n"
+		"       %s synth dir pids maps comms [uniform|zipf]\n"
+		"       %s rates dir\n"
+		"       %s [-r root|-i image] params|trace name [iterations]\n"
+		"       %s [-r root] capture image\n"
+		"       %s extract image dir\n", argv[0], argv[0], argv[0], argv[0], argv[0],
+		argv[0]);
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер обхода /proc. Первый обход выполняется по пустому снимку, т.е.
+ * все процессы для него новые. Последующие обходы инкрементальные.
+ * @param iterations	число инкрементальных обходов
+ * @return		код завершения программы
+ */
+int bench_scan(int iterations)
+{
+	proc_scan_stats_t stats, total;
+	double started, elapsed = 0;
+	int i;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	started = bench_clock();
+	if (!refresh_proc_snapshot()) {
+		fprintf(stderr, "can't read %s\n", module_config.proc_root);
+		return 1;
+	}
+	get_last_scan_stats(&stats);
+	print_scan_stats("cold scan", bench_clock() - started, &stats, 1);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < iterations; ++i) {
+		started = bench_clock();
+		refresh_proc_snapshot();
+		elapsed += bench_clock() - started;
+
+		get_last_scan_stats(&stats);
+		total.pids += stats.pids;
+		total.syscalls += stats.syscalls;
+		total.files_opened += stats.files_opened;
+		total.bytes_read += stats.bytes_read;
+	}
+	print_scan_stats("incremental scan", elapsed, &total, iterations);
+
+	release_proc_snapshot();
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер разбора stat-файлов. Файлы всех процессов хоста один раз читаются в
+ * память, после чего многократно разбираются без ввода-вывода.
+ * @param iterations	число проходов по всем файлам
+ * @return		код завершения программы
+ */
+int bench_stat(int iterations)
+{
+	bench_files_t files;
+	linux_stat_t stat, *old_stat;
+	double started, elapsed_new, elapsed_comm, elapsed_old;
+	unsigned long checksum = 0, mismatches = 0, allocations = 0;
+	size_t i;
+	int n;
+
+	if (load_proc_files("stat", &files) < 0 || files.count == 0) {
+		fprintf(stderr, "can't read %s\n", module_config.proc_root);
+		return 1;
+	}
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < files.count; ++i)
+			if (parse_linux_stat(files.data[i], files.length[i], &stat, STAT_UPTO_RSS))
+				checksum += stat.rss;
+	elapsed_new = bench_clock() - started;
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < files.count; ++i)
+			if (parse_linux_stat(files.data[i], files.length[i], &stat, STAT_UPTO_COMM))
+				checksum += stat.comm[0];
+	elapsed_comm = bench_clock() - started;
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n) {
+		for (i = 0; i < files.count; ++i) {
+			allocations += parse_stat_fscanf(files.data[i], &old_stat);
+			if (old_stat != NULL) {
+				checksum += old_stat->rss;
+				free(old_stat);
+			}
+		}
+	}
+	elapsed_old = bench_clock() - started;
+
+	// Сверяем результаты на именах без пробелов, которые прежний разбор
+	// читал правильно
+	for (i = 0; i < files.count; ++i) {
+		parse_stat_fscanf(files.data[i], &old_stat);
+		if (old_stat == NULL)
+			continue;
+		if (strchr(old_stat->comm, ' ') == NULL &&
+			(!parse_linux_stat(files.data[i], files.length[i], &stat, STAT_UPTO_RSS) ||
+			stat.rss != old_stat->rss || stat.starttime != old_stat->starttime ||
+			strcmp(stat.comm, old_stat->comm) != 0))
+			++mismatches;
+		free(old_stat);
+	}
+
+	printf("stat files:        %10lu\n", (unsigned long) files.count);
+	printf("parse_linux_stat:  %10.1f ns/file, 0 allocations/file\n",
+		elapsed_new * 1e9 / iterations / files.count);
+	printf("  comm only:       %10.1f ns/file\n",
+		elapsed_comm * 1e9 / iterations / files.count);
+	printf("fscanf:            %10.1f ns/file, %.1f allocations/file\n",
+		elapsed_old * 1e9 / iterations / files.count,
+		(double) allocations / iterations / files.count);
+	printf("speedup:           %10.2fx\n", elapsed_old / elapsed_new);
+	printf("mismatches:        %10lu (checksum %lu)\n", mismatches, checksum);
+
+	free_bench_files(&files);
+	return mismatches > 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Прежний разбор stat-файла: fscanf по 24 полям в выделяемую структуру и
+ * удаление скобок вокруг имени процесса. Оставлен для сравнения.
+ * @param buf		содержимое stat-файла
+ * @param result	сюда будет помещён результат, либо NULL
+ * @return		число выделений памяти
+ */
+int parse_stat_fscanf(const char *buf, linux_stat_t **result)
+{
+	static char linux_stat_fmt[] =
+		"%d %s %c %d %d %d %d %d %u %lu %lu %lu %lu %lu %lu %ld %ld %ld %ld %ld %ld %llu %lu %ld ";
+	char comm[256];
+	linux_stat_t *stat = calloc(1, sizeof(linux_stat_t));
+
+	int fields = sscanf(buf, linux_stat_fmt,
+		&stat->pid, comm, &stat->state, &stat->ppid,
+		&stat->pgrp, &stat->session, &stat->tty_nr, &stat->tpgid,
+		&stat->flags, &stat->minflt, &stat->cminflt, &stat->majflt,
+		&stat->cmajflt, &stat->utime, &stat->stime, &stat->cutime,
+		&stat->cstime, &stat->priority, &stat->nice, &stat->num_threads,
+		&stat->itrealvalue, &stat->starttime, &stat->vsize, &stat->rss);
+
+	if (fields < 2) {
+		free(stat);
+		*result = NULL;
+		return 1;
+	}
+
+	left_shift(comm);
+	comm[strlen(comm) - 1] = '\0';
+	snprintf(stat->comm, PROC_COMM_SIZE, "%s", comm);
+	*result = stat;
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер разбора maps-файлов. Файлы всех процессов хоста один раз читаются
+ * в память, после чего многократно разбираются без ввода-вывода: новым
+ * разбором - блоками по BENCH_BLOCK_SIZE байт, прежним - через FILE поверх
+ * памяти.
+ * @param iterations	число проходов по всем файлам
+ * @return		код завершения программы
+ */
+int bench_maps(int iterations)
+{
+	bench_files_t files;
+	linux_maps_totals_t totals, legacy;
+	double started, elapsed_new, elapsed_old;
+	unsigned long mappings = 0, legacy_mappings = 0;
+	unsigned long mismatches = 0, allocations = 0, checksum = 0, unused = 0;
+	size_t i;
+	int n;
+
+	if (load_proc_files("maps", &files) < 0 || files.count == 0) {
+		fprintf(stderr, "can't read %s\n", module_config.proc_root);
+		return 1;
+	}
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n) {
+		for (i = 0; i < files.count; ++i) {
+			mappings += parse_maps_blocks(files.data[i], files.length[i], &totals);
+			checksum += totals.all;
+		}
+	}
+	elapsed_new = bench_clock() - started;
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n) {
+		for (i = 0; i < files.count; ++i) {
+			legacy_mappings += parse_maps_legacy(files.data[i], files.length[i],
+				&legacy, &allocations);
+			checksum += legacy.all;
+		}
+	}
+	elapsed_old = bench_clock() - started;
+
+	for (i = 0; i < files.count; ++i) {
+		parse_maps_blocks(files.data[i], files.length[i], &totals);
+		parse_maps_legacy(files.data[i], files.length[i], &legacy, &unused);
+		// Исполняемые и частные области прежний разбор не считал
+		if (totals.all != legacy.all || totals.rw != legacy.rw ||
+			totals.shared != legacy.shared)
+			++mismatches;
+	}
+
+	printf("maps files:        %10lu\n", (unsigned long) files.count);
+	printf("mappings:          %10lu\n", mappings / iterations);
+	printf("block parser:      %10.0f mappings/s, 0 allocations/mapping\n",
+		mappings / elapsed_new);
+	printf("fgetc+strtok:      %10.0f mappings/s, %.1f allocations/mapping\n",
+		legacy_mappings / elapsed_old,
+		(double) allocations / legacy_mappings);
+	printf("speedup:           %10.2fx\n", elapsed_old / elapsed_new);
+	printf("mismatches:        %10lu (checksum %lu)\n", mismatches, checksum);
+
+	free_bench_files(&files);
+	return mismatches > 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер чтения smaps_rollup и smaps. Оба файла читаются у всех процессов
+ * хоста вместе с вводом-выводом, т.к. основная часть их стоимости - обход
+ * областей памяти в ядре.
+ * @return	код завершения программы
+ */
+int bench_smaps(void)
+{
+	linux_smaps_totals_t rollup, smaps;
+	proc_scan_stats_t rollup_stats, smaps_stats;
+	unsigned long rollup_processes, smaps_processes;
+	double rollup_time, smaps_time;
+
+	// Первый проход прогревает кэши ядра и не учитывается
+	read_all_smaps("smaps_rollup", &rollup, &rollup_stats, &rollup_processes);
+	rollup_time = read_all_smaps("smaps_rollup", &rollup, &rollup_stats, &rollup_processes);
+	smaps_time = read_all_smaps("smaps", &smaps, &smaps_stats, &smaps_processes);
+
+	if (smaps_processes == 0) {
+		fprintf(stderr, "can't read smaps\n");
+		return 1;
+	}
+
+	printf("%-14s %10s %12s %12s %10s %14s\n", "source", "processes",
+		"us/process", "bytes/proc", "syscalls", "PSS, KiB");
+	if (rollup_processes > 0)
+		printf("%-14s %10lu %12.1f %12.0f %10.1f %14lu\n", "smaps_rollup",
+			rollup_processes, rollup_time * 1e6 / rollup_processes,
+			(double) rollup_stats.bytes_read / rollup_processes,
+			(double) rollup_stats.syscalls / rollup_processes, rollup.pss / 1024);
+	else
+		printf("%-14s not supported by the kernel\n", "smaps_rollup");
+	printf("%-14s %10lu %12.1f %12.0f %10.1f %14lu\n", "smaps",
+		smaps_processes, smaps_time * 1e6 / smaps_processes,
+		(double) smaps_stats.bytes_read / smaps_processes,
+		(double) smaps_stats.syscalls / smaps_processes, smaps.pss / 1024);
+	if (rollup_processes > 0)
+		printf("speedup:       %10.2fx\n",
+			(smaps_time / smaps_processes) / (rollup_time / rollup_processes));
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Читает и разбирает smaps-файл всех процессов хоста. Процессы без
+ * пользовательской памяти (потоки ядра) не учитываются.
+ * @param name		smaps_rollup или smaps
+ * @param totals	сюда будут помещены суммы по всем процессам
+ * @param stats		сюда будут помещены счётчики чтения
+ * @param processes	сюда будет помещено число прочитанных файлов
+ * @return		время чтения и разбора, в секундах
+ */
+double read_all_smaps(const char *name, linux_smaps_totals_t *totals,
+	proc_scan_stats_t *stats, unsigned long *processes)
+{
+	linux_smaps_parser_t parser;
+	proc_walker_t walker;
+	proc_pid_t pid;
+	char *buf = malloc(BENCH_BLOCK_SIZE);
+	double started = bench_clock(), elapsed;
+	ssize_t length;
+	int fd;
+
+	memset(totals, 0, sizeof(linux_smaps_totals_t));
+	memset(stats, 0, sizeof(proc_scan_stats_t));
+	*processes = 0;
+	if (buf == NULL || open_proc_walker(&walker, module_config.proc_root) < 0) {
+		free(buf);
+		return 0;
+	}
+
+	while (next_proc_pid(&walker, &pid)) {
+		fd = open_pid_file(&walker, &pid, name);
+		if (fd < 0)
+			continue;
+
+		init_linux_smaps(&parser);
+		while ((length = read_pid_fd(&walker, fd, buf, BENCH_BLOCK_SIZE)) > 0)
+			feed_linux_smaps(&parser, buf, length);
+		finish_linux_smaps(&parser);
+		close_pid_fd(&walker, fd);
+
+		if (length < 0 || parser.lines == 0)
+			continue;
+		totals->pss += parser.totals.pss;
+		totals->uss += parser.totals.uss;
+		totals->swap += parser.totals.swap;
+		totals->anonhuge += parser.totals.anonhuge;
+		++(*processes);
+	}
+
+	elapsed = bench_clock() - started;
+	close_proc_walker(&walker);
+	*stats = walker.stats;
+	free(buf);
+
+	return elapsed;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер построения JSON procinf.discovery.
+ * @param iterations	число построений
+ * @return		код завершения программы
+ */
+int bench_discovery(int iterations)
+{
+	double started, fresh, cached;
+	size_t length = 0, rows = 0;
+	char *json, *pos;
+	int i;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	// SnapshotTTL = 0 - каждый запрос обходит /proc сам
+	module_config.snapshot_ttl = 0;
+	started = bench_clock();
+	for (i = 0; i < iterations; ++i)
+		free(get_proc_discovery(NULL, NULL));
+	fresh = bench_clock() - started;
+
+	module_config.snapshot_ttl = 3600;
+	free(get_proc_discovery(NULL, NULL));
+	started = bench_clock();
+	for (i = 0; i < iterations; ++i) {
+		json = get_proc_discovery(NULL, NULL);
+		if (json == NULL) {
+			fprintf(stderr, "not enough memory\n");
+			return 1;
+		}
+		length = strlen(json);
+		for (rows = 0, pos = json; (pos = strstr(pos, "{#PROCNAME}")) != NULL; ++pos)
+			++rows;
+		free(json);
+	}
+	cached = bench_clock() - started;
+
+	printf("rows:              %10lu\n", (unsigned long) rows);
+	printf("JSON bytes:        %10lu\n", (unsigned long) length);
+	printf("with /proc walk:   %10.3f ms\n", fresh * 1e3 / iterations);
+	printf("from snapshot:     %10.3f ms\n", cached * 1e3 / iterations);
+
+	release_proc_snapshot();
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер vmrss по всем различным именам процессов из одного снимка: по
+ * агрегатам (имя, владелец) и с перебором процессов снимка. Перебор
+ * включается режимом PidfdTracking, в котором агрегаты не используются;
+ * на отслеживание процессы берутся ещё до замера.
+ * @param iterations	число проходов по всем именам
+ * @return		код завершения программы
+ */
+int bench_names(int iterations)
+{
+	static char names[BENCH_NAMES_MAX][PROC_COMM_SIZE];
+	double started, aggregated, scanned;
+	unsigned long summ = 0, check = 0;
+	size_t count, i;
+	int n;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	module_config.snapshot_ttl = 3600;
+	count = collect_bench_names(names, BENCH_NAMES_MAX);
+	if (count == 0) {
+		fprintf(stderr, "no processes\n");
+		return 1;
+	}
+
+	// Первый проход собирает агрегаты
+	for (i = 0; i < count; ++i)
+		get_proc_value_summ(names[i], NULL, NULL, PROC_VMRSS);
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0, summ = 0; i < count; ++i)
+			summ += get_proc_value_summ(names[i], NULL, NULL, PROC_VMRSS);
+	aggregated = bench_clock() - started;
+
+	module_config.pidfd_tracking = 1;
+	for (i = 0; i < count; ++i)
+		get_proc_value_summ(names[i], NULL, NULL, PROC_VMRSS);
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0, check = 0; i < count; ++i)
+			check += get_proc_value_summ(names[i], NULL, NULL, PROC_VMRSS);
+	scanned = bench_clock() - started;
+	module_config.pidfd_tracking = 0;
+
+	printf("names:             %10lu\n", (unsigned long) count);
+	printf("vmrss of all:      %10lu%s\n", summ, summ == check ? "" : " (MISMATCH)");
+	printf("by aggregates:     %10.3f us/request\n", aggregated * 1e6 / iterations / count);
+	printf("by processes:      %10.3f us/request\n", scanned * 1e6 / iterations / count);
+	printf("speedup:           %10.2fx\n", scanned / aggregated);
+
+	release_proc_snapshot();
+	return summ == check ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает различные имена процессов из JSON procinf.discovery. Имена
+ * с экранированными символами пропускаются.
+ * @param names		сюда будут помещены имена
+ * @param size		наибольшее число имён
+ * @return		число имён
+ */
+size_t collect_bench_names(char names[][PROC_COMM_SIZE], size_t size)
+{
+	static const char tag[] = "\"{#PROCNAME}\":\"";
+	char *json = get_proc_discovery(NULL, NULL), *pos, *end;
+	size_t count = 0, i;
+
+	if (json == NULL)
+		return 0;
+
+	for (pos = json; count < size && (pos = strstr(pos, tag)) != NULL; pos = end) {
+		pos += sizeof(tag) - 1;
+		end = strchr(pos, '"');
+		if (end == NULL)
+			break;
+		if (end - pos >= PROC_COMM_SIZE || memchr(pos, '\\', end - pos) != NULL)
+			continue;
+
+		// Имя встречается по разу на каждого владельца
+		memcpy(names[count], pos, end - pos);
+		names[count][end - pos] = '\0';
+		for (i = 0; i < count && strcmp(names[i], names[count]) != 0; ++i)
+			;
+		if (i == count)
+			++count;
+	}
+
+	free(json);
+	return count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер ответа на vmrss, allmap, rwmap и shmap одного имени процесса.
+ * SnapshotTTL = 0, поэтому каждый запрос обходит /proc и разбирает
+ * maps-файлы сам, как при работе без снимка.
+ * @param proc_name	имя процесса
+ * @param iterations	число повторов
+ * @return		код завершения программы
+ */
+int bench_summary(char *proc_name, int iterations)
+{
+	static const int params[] = {PROC_VMRSS, PROC_MAP, PROC_MAP_RW, PROC_MAP_SHARED};
+	unsigned long values[4];
+	double started, separate, summary;
+	char *json = NULL;
+	int i, n;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	module_config.snapshot_ttl = 0;
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n) {
+		for (i = 0; i < 4; ++i)
+			values[i] = get_proc_value_summ(proc_name, NULL, NULL, params[i]);
+	}
+	separate = bench_clock() - started;
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n) {
+		free(json);
+		json = get_proc_summary(proc_name, NULL, NULL);
+	}
+	summary = bench_clock() - started;
+
+	printf("separate values:   vmrss %lu, allmap %lu, rwmap %lu, shmap %lu\n",
+		values[0], values[1], values[2], values[3]);
+	printf("summary:           %s\n", json != NULL ? json : "(no memory)");
+	printf("4 requests:        %10.3f ms\n", separate * 1e3 / iterations);
+	printf("procinf.summary:   %10.3f ms\n", summary * 1e3 / iterations);
+	printf("speedup:           %10.2fx\n", separate / summary);
+
+	free(json);
+	release_proc_snapshot();
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер масштабирования по числу потоков ScanThreads: 1, 2, 4 ... до
+ * числа процессоров, но не меньше 4. Для каждого числа потоков
+ * замеряется обход /proc по пустому снимку (все процессы новые) и запрос
+ * rwmap с SnapshotTTL=0, т.е. обход /proc и разбор maps-файлов всех
+ * процессов с этим именем.
+ * @param proc_name	имя процесса для запроса rwmap
+ * @param iterations	число замеров на каждое число потоков
+ * @return		код завершения программы
+ */
+int bench_threads(char *proc_name, int iterations)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	double started, walk, query, base_walk = 0, base_query = 0;
+	unsigned long value = 0;
+	unsigned threads;
+	int n;
+
+	if (iterations < 1)
+		iterations = 1;
+	// Хотя бы до 4 потоков, чтобы и на малых машинах была видна цена пула
+	if (cpus < 4)
+		cpus = 4;
+	if (cpus > SCAN_POOL_MAX_THREADS)
+		cpus = SCAN_POOL_MAX_THREADS;
+
+	module_config.snapshot_ttl = 0;
+	printf("threads      walk, ms   speedup    rwmap, ms   speedup\n");
+	for (threads = 1; threads <= (unsigned) cpus; threads *= 2) {
+		module_config.scan_threads = threads;
+
+		walk = 0;
+		for (n = 0; n < iterations; ++n) {
+			release_proc_snapshot();
+			started = bench_clock();
+			refresh_proc_snapshot();
+			walk += bench_clock() - started;
+		}
+
+		started = bench_clock();
+		for (n = 0; n < iterations; ++n)
+			value = get_proc_value_summ(proc_name, NULL, NULL, PROC_MAP_RW);
+		query = bench_clock() - started;
+
+		if (threads == 1) {
+			base_walk = walk;
+			base_query = query;
+		}
+		printf("%7u %12.3f %8.2fx %12.3f %8.2fx\n", threads,
+			walk * 1e3 / iterations, base_walk / walk,
+			query * 1e3 / iterations, base_query / query);
+	}
+	printf("rwmap of %s: %lu\n", proc_name, value);
+
+	release_proc_snapshot();
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер обновления снимка при постоянном создании процессов: полным
+ * обходом /proc и по событиям proc connector (ProcEvents). Перед каждым
+ * обновлением создаётся и завершается BENCH_CHURN процессов.
+ * @param iterations	число обновлений
+ * @return		код завершения программы
+ */
+int bench_events(int iterations)
+{
+	proc_scan_stats_t total;
+	double elapsed;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	module_config.snapshot_ttl = 0;
+	module_config.proc_events = 0;
+	elapsed = time_refreshes(iterations, &total);
+	print_scan_stats("/proc walk", elapsed, &total, iterations);
+
+	release_proc_snapshot();
+	if (open_proc_events() < 0) {
+		printf("proc connector: unavailable (needs CAP_NET_ADMIN)\n");
+		return 0;
+	}
+	close_proc_events();
+
+	module_config.proc_events = 1;
+	module_config.proc_events_reconcile = 3600;
+	elapsed = time_refreshes(iterations, &total);
+	print_scan_stats("proc connector events", elapsed, &total, iterations);
+
+	release_proc_snapshot();
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает снимок и затем замеряет его обновления, создавая перед каждым
+ * BENCH_CHURN короткоживущих процессов.
+ * @param iterations	число обновлений
+ * @param total		сюда помещаются суммарные счётчики обновлений
+ * @return		суммарное время обновлений, в секундах
+ */
+double time_refreshes(int iterations, proc_scan_stats_t *total)
+{
+	proc_scan_stats_t stats;
+	double started, elapsed = 0;
+	int i;
+
+	refresh_proc_snapshot();
+
+	memset(total, 0, sizeof(proc_scan_stats_t));
+	for (i = 0; i < iterations; ++i) {
+		churn_processes(BENCH_CHURN);
+
+		started = bench_clock();
+		refresh_proc_snapshot();
+		elapsed += bench_clock() - started;
+
+		get_last_scan_stats(&stats);
+		total->pids += stats.pids;
+		total->syscalls += stats.syscalls;
+		total->files_opened += stats.files_opened;
+		total->bytes_read += stats.bytes_read;
+	}
+
+	return elapsed;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Создаёт и сразу завершает процессы.
+ * @param count	число процессов
+ */
+void churn_processes(int count)
+{
+	pid_t child;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		child = fork();
+		if (child == 0)
+			_exit(0);
+		if (child > 0)
+			waitpid(child, NULL, 0);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает maps-файл блоками, как это делает модуль при чтении из /proc.
+ * @param buf		содержимое maps-файла
+ * @param length	длина содержимого
+ * @param totals	сюда будут помещены суммы областей памяти
+ * @return		число разобранных областей
+ */
+unsigned long parse_maps_blocks(const char *buf, size_t length, linux_maps_totals_t *totals)
+{
+	linux_maps_parser_t parser;
+	size_t pos, block;
+
+	init_linux_maps(&parser);
+	for (pos = 0; pos < length; pos += block) {
+		block = length - pos < BENCH_BLOCK_SIZE ? length - pos : BENCH_BLOCK_SIZE;
+		feed_linux_maps(&parser, buf + pos, block);
+	}
+	finish_linux_maps(&parser);
+
+	*totals = parser.totals;
+	return parser.mappings;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Прежний разбор maps-файла: построчное чтение через fgetc, разбиение
+ * strtok и выделение памяти под права каждой области. Оставлен для
+ * сравнения.
+ * @param buf		содержимое maps-файла
+ * @param length	длина содержимого
+ * @param totals	сюда будут помещены суммы областей памяти
+ * @param allocations	сюда добавляется число выделений памяти
+ * @return		число разобранных областей
+ */
+unsigned long parse_maps_legacy(char *buf, size_t length, linux_maps_totals_t *totals,
+	unsigned long *allocations)
+{
+	static char fbuf[LEGACY_BUF_SIZE];
+	FILE *maps_file = fmemopen(buf, length, "r");
+	char *lbuf = malloc(sizeof(char) * LEGACY_LINE_SIZE);
+	char *sbegin_addr, *send_addr, *perms;
+	unsigned long begin, end, mappings = 0;
+	legacy_maps_perms_t *flags;
+
+	memset(totals, 0, sizeof(linux_maps_totals_t));
+	setvbuf(maps_file, fbuf, _IOFBF, LEGACY_BUF_SIZE);
+	*allocations += 2;
+
+	while (read_line(maps_file, lbuf, LEGACY_LINE_SIZE)) {
+		sbegin_addr = strtok(lbuf, "-");
+		if (sbegin_addr == NULL) continue;
+		begin = legacy_htol(sbegin_addr);
+
+		send_addr = strtok(NULL, " ");
+		if (send_addr == NULL) continue;
+		end = legacy_htol(send_addr);
+
+		perms = strtok(NULL, " ");
+		if (perms == NULL) continue;
+		// Как и в новом разборе, области ядра ([vsyscall]) не считаются,
+		// иначе суммы не сравнить
+		if (sizeof(unsigned long) > 4 && begin >> (sizeof(unsigned long) * 8 - 1))
+			continue;
+
+		flags = legacy_parse_perms(perms);
+		if (flags == NULL) continue;
+		++(*allocations);
+
+		totals->all += end - begin;
+		if (flags->read && flags->write)
+			totals->rw += end - begin;
+		if (flags->shared)
+			totals->shared += end - begin;
+		++mappings;
+
+		free(flags);
+	}
+
+	free(lbuf);
+	fclose(maps_file);
+
+	return mappings;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Прежний разбор прав доступа области памяти.
+ * @param str_perms	подстрока с флагами из maps
+ * @return		права доступа. NULL - пустая подстрока.
+ */
+legacy_maps_perms_t *legacy_parse_perms(const char *str_perms)
+{
+	if (substr_len(str_perms) == 0)
+		return NULL;
+
+	legacy_maps_perms_t *perms = calloc(1, sizeof(legacy_maps_perms_t));
+	int i;
+
+	for (i = 0; str_perms[i] != '\0'; ++i) {
+		switch (str_perms[i]) {
+		case 'r':
+			perms->read = 1;
+			break;
+		case 'w':
+			perms->write = 1;
+			break;
+		case 's':
+			perms->shared = 1;
+			break;
+		}
+	}
+
+	return perms;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Прежнее преобразование hex-строки в число.
+ * @param hex	hex-строка
+ * @return	результат преобразования. 0 - строка не разобрана.
+ */
+unsigned long legacy_htol(const char *hex)
+{
+	unsigned long result = 0;
+	int i = 0, n;
+
+	if (substr_len(hex) >= 2 && hex[0] == '0' && tolower(hex[1]) == 'x')
+		i = 2;
+
+	for (; hex[i] != '\0'; ++i) {
+		if (isdigit(hex[i]))
+			n = hex[i] - '0';
+		else if (isalpha(hex[i]) && tolower(hex[i]) >= 'a' && tolower(hex[i]) <= 'h')
+			n = tolower(hex[i]) - 'a' + 10;
+		else
+			return 0;
+		result = result * 16 + n;
+	}
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Создаёт синтетическое дерево /proc: pids PID-каталогов со stat, statm,
+ * status, io, limits, maps, smaps_rollup и каталогом fd. Имена процессов -
+ * comms штук, каждое четвёртое с пробелом и скобками, как у настоящих
+ * процессов вроде "(sd-pam)".
+ * При распределении zipf k-е имя встречается в 1/k раз реже первого.
+ *
+ * @param root		каталог дерева, создаётся
+ * @param pids		число процессов
+ * @param maps		число областей памяти у каждого процесса
+ * @param comms		число имён процессов
+ * @param spread	распределение имён: uniform или zipf
+ * @return		код завершения программы
+ */
+int bench_synth(const char *root, int pids, int maps, int comms, const char *spread)
+{
+	char comm[PROC_COMM_SIZE];
+	double *weights;
+	unsigned seed = 1;
+	int i, k;
+
+	if (pids < 1 || maps < 1 || comms < 1 ||
+		(strcmp(spread, "uniform") != 0 && strcmp(spread, "zipf") != 0)) {
+		fprintf(stderr, "pids, maps and comms must be positive, spread uniform or zipf\n");
+		return 1;
+	}
+
+	if (mkdir(root, 0755) < 0 && errno != EEXIST) {
+		perror(root);
+		return 1;
+	}
+
+	// Накопленные веса имён: k-е имя с весом 1 или 1/k
+	weights = malloc(comms * sizeof(double));
+	if (weights == NULL)
+		return 1;
+	for (k = 0; k < comms; ++k)
+		weights[k] = (k > 0 ? weights[k - 1] : 0) +
+			(strcmp(spread, "zipf") == 0 ? 1.0 / (k + 1) : 1.0);
+
+	for (i = 0; i < pids; ++i) {
+		make_synth_comm(comm, sizeof(comm), pick_synth_comm(weights, comms, &seed));
+		if (write_synth_process(root, SYNTH_FIRST_PID + i, comm, maps) < 0) {
+			perror(root);
+			free(weights);
+			return 1;
+		}
+	}
+
+	make_synth_comm(comm, sizeof(comm), 0);
+	printf("%d processes with %d mappings each in %s, most frequent name \"%s\"\n",
+		pids, maps, root, comm);
+
+	free(weights);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Записывает файлы одного процесса синтетического дерева. Размеры в stat,
+ * statm и smaps_rollup согласованы с суммой областей maps, поэтому
+ * ValidateSources на таком дереве расхождений не находит.
+ *
+ * @param root	каталог дерева
+ * @param pid	PID процесса
+ * @param comm	имя процесса
+ * @param maps	число областей памяти
+ * @return	0 - успешно. -1 - ошибка записи.
+ */
+int write_synth_process(const char *root, int pid, const char *comm, int maps)
+{
+	char path[SYNTH_PATH_SIZE], head[1024];
+	unsigned long start = 0x400000, size, vsize = 0, rss_pages;
+	size_t length = 0, capacity = (size_t) maps * 128 + 1;
+	char *buf = malloc(capacity);
+	int i, n, result = 0;
+
+	if (buf == NULL)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/%d", root, pid);
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		free(buf);
+		return -1;
+	}
+
+	for (i = 0; i < maps; ++i) {
+		n = i % (int) (sizeof(synth_perms) / sizeof(synth_perms[0]));
+		size = (unsigned long) (1 + (pid + i) % 16) * SYNTH_PAGE_SIZE;
+		length += snprintf(buf + length, capacity - length,
+			"%08lx-%08lx %s %08lx 08:01 %lu %s\n", start, start + size,
+			synth_perms[n], (unsigned long) i * SYNTH_PAGE_SIZE,
+			*synth_files[n] != '\0' ? 131072UL + n : 0UL, synth_files[n]);
+		vsize += size;
+		start += size + SYNTH_PAGE_SIZE;
+	}
+	rss_pages = vsize / SYNTH_PAGE_SIZE / 2;
+
+	if (write_synth_file(root, pid, "maps", buf, length) < 0)
+		result = -1;
+
+	n = snprintf(head, sizeof(head), "%d (%s) S 1 %d %d 0 -1 4194560 %d 0 0 0 %d %d 0 0 "
+		"20 0 1 0 %d %lu %lu 18446744073709551615 1 1 0 0 0 0 0 4096 0 0 0 0 17 0 0 0 "
+		"0 0 0 0 0 0 0 0 0\n", pid, comm, pid, pid, pid % 977, pid % 31, pid % 7,
+		100 + pid, vsize, rss_pages);
+	if (write_synth_file(root, pid, "stat", head, n) < 0)
+		result = -1;
+
+	n = snprintf(head, sizeof(head), "%lu %lu %lu 1 0 %lu 0\n",
+		vsize / SYNTH_PAGE_SIZE, rss_pages, rss_pages / 4, rss_pages / 2);
+	if (write_synth_file(root, pid, "statm", head, n) < 0)
+		result = -1;
+
+	n = snprintf(head, sizeof(head), "Name:\t%s\nState:\tS (sleeping)\nPid:\t%d\n"
+		"voluntary_ctxt_switches:\t%d\nnonvoluntary_ctxt_switches:\t%d\n",
+		comm, pid, pid % 1009, pid % 13);
+	if (write_synth_file(root, pid, "status", head, n) < 0)
+		result = -1;
+
+	n = snprintf(head, sizeof(head), "rchar: %lu\nwchar: %lu\nsyscr: %d\nsyscw: %d\n"
+		"read_bytes: %lu\nwrite_bytes: %lu\ncancelled_write_bytes: 0\n",
+		rss_pages * 8192, vsize / 4, pid % 211, pid % 97,
+		rss_pages * SYNTH_PAGE_SIZE, vsize / 8);
+	if (write_synth_file(root, pid, "io", head, n) < 0)
+		result = -1;
+
+	n = snprintf(head, sizeof(head), "00400000-%08lx ---p 00000000 00:00 0 [rollup]\n"
+		"Rss: %lu kB\nPss: %lu kB\nShared_Clean: %lu kB\nShared_Dirty: 0 kB\n"
+		"Private_Clean: %lu kB\nPrivate_Dirty: %lu kB\nReferenced: %lu kB\n"
+		"Anonymous: %lu kB\nAnonHugePages: 0 kB\nSwap: %lu kB\nSwapPss: %lu kB\n"
+		"Locked: 0 kB\n", start, rss_pages * 4, rss_pages * 3, rss_pages,
+		rss_pages, rss_pages * 2, rss_pages * 4, rss_pages * 2,
+		(unsigned long) (pid % 5) * 64, (unsigned long) (pid % 5) * 64);
+	if (write_synth_file(root, pid, "smaps_rollup", head, n) < 0)
+		result = -1;
+
+	// Аргументы cmdline разделены '\0'
+	n = snprintf(head, sizeof(head), "/usr/bin/%s%c--worker%c%d%c", comm, 0, 0, pid, 0);
+	if (write_synth_file(root, pid, "cmdline", head, n) < 0)
+		result = -1;
+
+	n = snprintf(head, sizeof(head), "Limit                     Soft Limit           "
+		"Hard Limit           Units     \n"
+		"Max open files            %-20d 524288               files     \n",
+		SYNTH_FDS_LIMIT);
+	if (write_synth_file(root, pid, "limits", head, n) < 0)
+		result = -1;
+
+	if (write_synth_fds(root, pid, 3 + pid % 29) < 0)
+		result = -1;
+
+	free(buf);
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Создаёт каталог fd процесса синтетического дерева: count ссылок
+ * на /dev/null с номерами дескрипторов.
+ * @param root	каталог дерева
+ * @param pid	PID процесса
+ * @param count	число дескрипторов
+ * @return	0 - успешно. -1 - ошибка записи.
+ */
+int write_synth_fds(const char *root, int pid, int count)
+{
+	char path[SYNTH_PATH_SIZE];
+	int i;
+
+	snprintf(path, sizeof(path), "%s/%d/fd", root, pid);
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+		return -1;
+
+	for (i = 0; i < count; ++i) {
+		snprintf(path, sizeof(path), "%s/%d/fd/%d", root, pid, i);
+		if (symlink("/dev/null", path) < 0 && errno != EEXIST)
+			return -1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Записывает файл процесса синтетического дерева.
+ * @param root		каталог дерева
+ * @param pid		PID процесса
+ * @param name		имя файла в PID-каталоге
+ * @param data		содержимое
+ * @param length	длина содержимого
+ * @return		0 - успешно. -1 - ошибка записи.
+ */
+int write_synth_file(const char *root, int pid, const char *name, const char *data, size_t length)
+{
+	char path[SYNTH_PATH_SIZE];
+	FILE *file;
+	size_t written;
+
+	snprintf(path, sizeof(path), "%s/%d/%s", root, pid, name);
+	file = fopen(path, "w");
+	if (file == NULL)
+		return -1;
+
+	written = fwrite(data, 1, length, file);
+	if (fclose(file) != 0 || written != length)
+		return -1;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Составляет имя процесса синтетического дерева по его номеру.
+ * @param comm		сюда будет помещено имя
+ * @param size		размер comm
+ * @param number	номер имени
+ */
+void make_synth_comm(char *comm, size_t size, int number)
+{
+	if (number % 4 == 3)
+		snprintf(comm, size, "w %d (x)", number);
+	else
+		snprintf(comm, size, "app%d", number);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Выбирает номер имени процесса по накопленным весам.
+ * @param weights	накопленные веса имён
+ * @param comms		число имён
+ * @param seed		состояние генератора случайных чисел
+ * @return		номер имени
+ */
+int pick_synth_comm(double *weights, int comms, unsigned *seed)
+{
+	double point = weights[comms - 1] * rand_r(seed) / ((double) RAND_MAX + 1);
+	int low = 0, high = comms - 1, middle;
+
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (weights[middle] <= point)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер get_proc_value_summ() по каждому параметру proc_params. Сначала с
+ * SnapshotTTL = 0, когда каждый запрос обходит /proc и читает нужные
+ * файлы сам, затем по уже собранному снимку. Системные вызовы и байты
+ * берутся из счётчиков модуля, выделения памяти - из подменённого malloc.
+ *
+ * @param proc_name	имя процесса
+ * @param iterations	число запросов по каждому параметру
+ * @return		код завершения программы
+ */
+int bench_params_mode(char *proc_name, int iterations)
+{
+	proc_scan_stats_t stats;
+	unsigned long allocations, value;
+	double seconds;
+	size_t i;
+	int cached;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	printf("%-12s %-6s %10s %12s %12s %10s %10s %14s\n", "param", "mode", "ms/query",
+		"pids/sec", "MB/sec", "allocs/q", "syscalls/q", "value");
+
+	for (cached = 0; cached < 2; ++cached) {
+		for (i = 0; i < sizeof(bench_params) / sizeof(bench_params[0]); ++i) {
+			release_proc_snapshot();
+			module_config.snapshot_ttl = cached ? 3600 : 0;
+			if (cached)
+				get_proc_value_summ(proc_name, NULL, NULL, bench_params[i].param);
+
+			seconds = time_param(proc_name, bench_params[i].param, iterations,
+				&stats, &allocations, &value);
+			printf("%-12s %-6s %10.3f %12.0f %12.1f %10.1f %10.1f %14lu\n",
+				bench_params[i].name, cached ? "cached" : "walk",
+				seconds * 1e3 / iterations,
+				seconds > 0 ? stats.pids / seconds : 0,
+				seconds > 0 ? stats.bytes_read / seconds / 1e6 : 0,
+				(double) allocations / iterations,
+				(double) stats.syscalls / iterations, value);
+		}
+	}
+
+	release_proc_snapshot();
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Выполняет серию запросов одного параметра.
+ * @param proc_name	имя процесса
+ * @param param		параметр, из proc_params
+ * @param iterations	число запросов
+ * @param stats		сюда будут помещены счётчики чтения /proc за серию
+ * @param allocations	сюда будет помещено число выделений памяти за серию
+ * @param value		сюда будет помещён результат последнего запроса
+ * @return		время серии, в секундах
+ */
+double time_param(char *proc_name, int param, int iterations, proc_scan_stats_t *stats,
+	unsigned long *allocations, unsigned long *value)
+{
+	proc_scan_stats_t before;
+	unsigned long allocated;
+	double started, seconds;
+	int n;
+
+	get_total_scan_stats(&before);
+	allocated = __sync_fetch_and_add(&bench_allocations, 0);
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		*value = get_proc_value_summ(proc_name, NULL, NULL, param);
+	seconds = bench_clock() - started;
+
+	*allocations = __sync_fetch_and_add(&bench_allocations, 0) - allocated;
+	get_total_scan_stats(stats);
+	stats->pids -= before.pids;
+	stats->syscalls -= before.syscalls;
+	stats->files_opened -= before.files_opened;
+	stats->bytes_read -= before.bytes_read;
+
+	return seconds;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Снимает образ /proc для воспроизведения замеров на другой машине.
+ * @param image_path	путь к файлу образа
+ * @return		код завершения программы
+ */
+int bench_capture(const char *image_path)
+{
+	proc_image_stats_t stats;
+	double started = bench_clock();
+
+	if (capture_proc_image(module_config.proc_root, image_path, &stats) < 0) {
+		perror(image_path);
+		return 1;
+	}
+
+	printf("captured %lu processes, %lu files, %lu bytes in %.3f s\n",
+		stats.processes, stats.files, stats.bytes, bench_clock() - started);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Записывает образ /proc деревом каталогов.
+ * @param image_path	путь к файлу образа
+ * @param root		каталог дерева
+ * @return		код завершения программы
+ */
+int bench_extract(const char *image_path, const char *root)
+{
+	proc_image_stats_t stats;
+
+	if (extract_proc_image(image_path, root, &stats) < 0) {
+		fprintf(stderr, "can't extract %s to %s\n", image_path, root);
+		return 1;
+	}
+
+	printf("extracted %lu processes, %lu files, %lu bytes to %s\n",
+		stats.processes, stats.files, stats.bytes, root);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер цены трассировки: серия запросов rwmap с обходом /proc при
+ * выключенной и включенной трассировке. Затем выводит последние интервалы
+ * трассировки в формате procinf.self.trace.
+ * @param proc_name	имя процесса
+ * @param iterations	число запросов в серии
+ * @return		код завершения программы
+ */
+int bench_trace(char *proc_name, int iterations)
+{
+	proc_scan_stats_t stats;
+	unsigned long allocations, value;
+	double seconds;
+	char *json;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	module_config.snapshot_ttl = 0;
+	printf("%-6s %10s %10s %14s\n", "trace", "ms/query", "allocs/q", "value");
+
+	for (trace_enabled = 0; trace_enabled < 2; ++trace_enabled) {
+		release_proc_snapshot();
+		seconds = time_param(proc_name, PROC_MAP_RW, iterations, &stats,
+			&allocations, &value);
+		printf("%-6s %10.3f %10.1f %14lu\n", trace_enabled ? "on" : "off",
+			seconds * 1e3 / iterations, (double) allocations / iterations, value);
+	}
+
+	trace_enabled = 0;
+	release_proc_snapshot();
+
+	json = get_trace_json(TRACE_DEFAULT_SPANS);
+	if (json == NULL)
+		return 1;
+
+	printf("%s\n", json);
+	free(json);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверка дерева процессов (proc_tree) с наивным обходом по ppid. Для
+ * каждого процесса хоста как корня поддерево, отобранное add_proc_subtree,
+ * сравнивается с процессами, от которых цепочка родителей доходит до
+ * корня. Повторное добавление того же корня не должно ничего добавлять.
+ * @param iterations	число проходов по всем корням
+ * @return		код завершения программы
+ */
+int bench_tree(int iterations)
+{
+	bench_files_t files;
+	bench_tree_proc_t *procs;
+	proc_tree_t tree;
+	linux_stat_t stat;
+	double started, elapsed_tree, elapsed_naive;
+	unsigned long members = 0, naive_members = 0, mismatches = 0;
+	size_t i, j, count = 0;
+	int n;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	if (load_proc_files("stat", &files) < 0 || files.count == 0) {
+		fprintf(stderr, "can't read %s\n", module_config.proc_root);
+		return 1;
+	}
+
+	procs = malloc(files.count * sizeof(bench_tree_proc_t));
+	for (i = 0; i < files.count; ++i) {
+		if (!parse_linux_stat(files.data[i], files.length[i], &stat, STAT_UPTO_PPID))
+			continue;
+		procs[count].pid = stat.pid;
+		procs[count].ppid = stat.ppid;
+		++count;
+	}
+	free_bench_files(&files);
+	qsort(procs, count, sizeof(bench_tree_proc_t), compare_tree_procs);
+
+	memset(&tree, 0, sizeof(proc_tree_t));
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n) {
+		if (reserve_proc_tree(&tree, count) < 0) {
+			fprintf(stderr, "can't allocate the process tree\n");
+			free(procs);
+			return 1;
+		}
+		for (i = 0; i < count; ++i)
+			tree.parents[i] = find_tree_proc(procs, count, procs[i].ppid);
+		build_proc_tree(&tree);
+
+		for (i = 0; i < count; ++i) {
+			begin_proc_tree_walk(&tree);
+			members += add_proc_subtree(&tree, (unsigned) i);
+		}
+	}
+	elapsed_tree = bench_clock() - started;
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < count; ++i)
+			for (j = 0; j < count; ++j)
+				naive_members += is_naive_descendant(procs, count, j, i);
+	elapsed_naive = bench_clock() - started;
+
+	// Сверяем не только размеры поддеревьев, но и состав
+	for (i = 0; i < count; ++i) {
+		begin_proc_tree_walk(&tree);
+		add_proc_subtree(&tree, (unsigned) i);
+		for (j = 0; j < count; ++j)
+			if ((tree.marks[j] == tree.mark) != is_naive_descendant(procs, count, j, i))
+				++mismatches;
+		if (add_proc_subtree(&tree, (unsigned) i) != 0)
+			++mismatches;
+	}
+	if (members != naive_members)
+		++mismatches;
+
+	printf("processes:         %10lu\n", (unsigned long) count);
+	printf("subtree members:   %10lu\n", members / iterations);
+	printf("proc_tree:         %10.1f us/snapshot, build and all subtrees\n",
+		elapsed_tree * 1e6 / iterations);
+	printf("ppid walk:         %10.1f us/snapshot\n", elapsed_naive * 1e6 / iterations);
+	printf("speedup:           %10.2fx\n", elapsed_naive / elapsed_tree);
+	printf("mismatches:        %10lu\n", mismatches);
+
+	release_proc_tree(&tree);
+	free(procs);
+	return mismatches > 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сравнивает процессы замера дерева по PID, для qsort.
+ * @param first		первый процесс
+ * @param second	второй процесс
+ * @return		<0, 0, >0
+ */
+int compare_tree_procs(const void *first, const void *second)
+{
+	int a = ((const bench_tree_proc_t *) first)->pid;
+	int b = ((const bench_tree_proc_t *) second)->pid;
+
+	return (a > b) - (a < b);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Ищет процесс замера дерева по PID двоичным поиском.
+ * @param procs		процессы, по возрастанию PID
+ * @param count		число процессов
+ * @param pid		PID процесса
+ * @return		номер процесса + 1. 0 - процесса нет.
+ */
+unsigned find_tree_proc(const bench_tree_proc_t *procs, size_t count, int pid)
+{
+	size_t low = 0, high = count, middle;
+
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (procs[middle].pid < pid)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low < count && procs[low].pid == pid ? (unsigned) low + 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет, что процесс - корень или его потомок, поднимаясь по ppid.
+ * Цепочка длиннее числа процессов считается циклом.
+ * @param procs		процессы, по возрастанию PID
+ * @param count		число процессов
+ * @param process	номер процесса
+ * @param root		номер корня
+ * @return		1 - процесс в поддереве корня. 0 - нет.
+ */
+int is_naive_descendant(const bench_tree_proc_t *procs, size_t count, size_t process,
+	size_t root)
+{
+	size_t steps;
+	unsigned parent;
+
+	for (steps = 0; steps <= count; ++steps) {
+		if (process == root)
+			return 1;
+
+		parent = find_tree_proc(procs, count, procs[process].ppid);
+		if (parent == 0)
+			return 0;
+		process = parent - 1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверка скоростей процессов с расчётом по приросту счётчиков. В каталоге
+ * root создаётся синтетическое дерево /proc, и снимок строится по нему:
+ *   1. при первом обходе отсчёт только начинается - все скорости 0;
+ *   2. через RATES_INTERVAL_US известному процессу добавляются счётчики,
+ *      и появляется новый процесс, запущенный RATES_NEW_AGE секунд назад:
+ *      скорость известного считается по приросту за время между обходами,
+ *      нового - по его счётчикам за время с запуска;
+ *   3. сразу за этим счётчики снова растут, но с прошлого пересчёта прошло
+ *      меньше секунды, и скорости остаются прежними.
+ * Время между обходами известно с точностью до длительности серии
+ * запросов, поэтому ожидаемая скорость проверяется диапазоном.
+ *
+ * @param root	каталог дерева, создаётся
+ * @return	код завершения программы
+ */
+int bench_rates(const char *root)
+{
+	unsigned long long base[BENCH_RATES], grown[BENCH_RATES], born[BENCH_RATES];
+	unsigned long long first[2], second[2], third[2], old_start, new_start, started;
+	unsigned long known[BENCH_RATES], values[BENCH_RATES];
+	long tick = sysconf(_SC_CLK_TCK);
+	unsigned long mismatches = 0;
+	double unit;
+	size_t i;
+
+	if (mkdir(root, 0755) < 0 && errno != EEXIST) {
+		perror(root);
+		return 1;
+	}
+
+	snprintf(module_config.proc_root, PROC_ROOT_SIZE, "%s", root);
+	module_config.snapshot_ttl = 0;
+	release_proc_snapshot();
+
+	// Время старта в stat - в тактах от загрузки системы
+	old_start = (bench_boot_clock() / 1000000000ULL - RATES_OLD_AGE) * tick;
+	new_start = (bench_boot_clock() / 1000000000ULL - RATES_NEW_AGE) * tick;
+	started = new_start * 1000000000ULL / tick;
+
+	for (i = 0; i < BENCH_RATES; ++i) {
+		base[i] = 1000 * (i + 1);
+		grown[i] = base[i] + 150 * (i + 1);
+		born[i] = 70 * (i + 1);
+	}
+
+	printf("%-10s %-10s %12s %12s %12s\n", "param", "process", "value", "min", "max");
+
+	if (write_rates_process(root, RATES_OLD_PID, "rateold", old_start, base) < 0)
+		return 1;
+	query_rates("rateold", values, first);
+	for (i = 0; i < BENCH_RATES; ++i)
+		mismatches += check_rate(rate_params[i].name, "first", values[i], 0, 0);
+
+	if (write_rates_process(root, RATES_OLD_PID, "rateold", old_start, grown) < 0 ||
+		write_rates_process(root, RATES_NEW_PID, "ratenew", new_start, born) < 0)
+		return 1;
+	usleep(RATES_INTERVAL_US);
+
+	query_rates("rateold", known, second);
+	for (i = 0; i < BENCH_RATES; ++i) {
+		unit = rate_params[i].param == PROC_CPU ? 100.0 / tick : 1;
+		mismatches += check_rate(rate_params[i].name, "known", known[i],
+			get_rate_bound((grown[i] - base[i]) * unit, second[1] - first[0]),
+			get_rate_bound((grown[i] - base[i]) * unit, second[0] - first[1]));
+	}
+
+	query_rates("ratenew", values, third);
+	for (i = 0; i < BENCH_RATES; ++i) {
+		unit = rate_params[i].param == PROC_CPU ? 100.0 / tick : 1;
+		mismatches += check_rate(rate_params[i].name, "new", values[i],
+			get_rate_bound(born[i] * unit, third[1] - started),
+			get_rate_bound(born[i] * unit, second[0] - started));
+	}
+
+	for (i = 0; i < BENCH_RATES; ++i)
+		grown[i] += 500 * (i + 1);
+	if (write_rates_process(root, RATES_OLD_PID, "rateold", old_start, grown) < 0)
+		return 1;
+
+	query_rates("rateold", values, third);
+	if (third[1] < second[0] + 1000000000ULL) {
+		for (i = 0; i < BENCH_RATES; ++i)
+			mismatches += check_rate(rate_params[i].name, "subsecond", values[i],
+				known[i], known[i]);
+	} else {
+		printf("subsecond check skipped: queries took %.3f s\n",
+			(third[1] - second[0]) / 1e9);
+	}
+
+	release_proc_snapshot();
+	printf("mismatches:        %10lu\n", mismatches);
+
+	return mismatches > 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Записывает stat, status и io процесса синтетического дерева замера
+ * скоростей. Счётчики задаются в порядке rate_params.
+ * @param root		каталог дерева
+ * @param pid		PID процесса
+ * @param comm		имя процесса
+ * @param starttime	время старта, в тактах от загрузки системы
+ * @param counters	счётчики: такты процессора, minflt, majflt,
+ *			переключения контекста и записанные байты
+ * @return		0 - успешно. -1 - ошибка записи.
+ */
+int write_rates_process(const char *root, int pid, const char *comm,
+	unsigned long long starttime, const unsigned long long *counters)
+{
+	char path[SYNTH_PATH_SIZE], buf[1024];
+	int n;
+
+	snprintf(path, sizeof(path), "%s/%d", root, pid);
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		perror(path);
+		return -1;
+	}
+
+	// Такты процессора делятся между utime и stime
+	n = snprintf(buf, sizeof(buf), "%d (%s) S 1 %d %d 0 -1 4194560 %llu 0 %llu 0 %llu %llu "
+		"0 0 20 0 1 0 %llu 1048576 64 18446744073709551615 1 1 0 0 0 0 0 4096 0 0 0 0 "
+		"17 0 0 0 0 0 0 0 0 0 0 0 0\n", pid, comm, pid, pid, counters[1], counters[2],
+		counters[0] / 2, counters[0] - counters[0] / 2, starttime);
+	if (write_synth_file(root, pid, "stat", buf, n) < 0) {
+		perror(path);
+		return -1;
+	}
+
+	n = snprintf(buf, sizeof(buf), "Name:\t%s\nState:\tS (sleeping)\nPid:\t%d\n"
+		"voluntary_ctxt_switches:\t%llu\nnonvoluntary_ctxt_switches:\t%llu\n",
+		comm, pid, counters[3] / 3, counters[3] - counters[3] / 3);
+	if (write_synth_file(root, pid, "status", buf, n) < 0) {
+		perror(path);
+		return -1;
+	}
+
+	n = snprintf(buf, sizeof(buf), "rchar: 0\nwchar: %llu\nsyscr: 0\nsyscw: 0\n"
+		"read_bytes: 0\nwrite_bytes: %llu\ncancelled_write_bytes: 0\n",
+		counters[4], counters[4]);
+	if (write_synth_file(root, pid, "io", buf, n) < 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Запрашивает все сверяемые скорости одного имени процесса.
+ * @param proc_name	имя процесса
+ * @param values	сюда будут помещены значения, по rate_params
+ * @param bounds	сюда будет помещено время начала и конца запросов,
+ *			в нс от загрузки системы
+ */
+void query_rates(char *proc_name, unsigned long *values, unsigned long long *bounds)
+{
+	size_t i;
+
+	bounds[0] = bench_boot_clock();
+	for (i = 0; i < BENCH_RATES; ++i)
+		values[i] = get_proc_value_summ(proc_name, NULL, NULL, rate_params[i].param);
+	bounds[1] = bench_boot_clock();
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Считает скорость, как её отдаёт модуль: в PROC_RATE_SCALE раз мельче
+ * единицы в секунду.
+ * @param delta		прирост счётчика в единицах результата
+ * @param elapsed	время прироста, в нс
+ * @return		скорость
+ */
+double get_rate_bound(double delta, unsigned long long elapsed)
+{
+	return elapsed > 0 ? delta * 1e9 * PROC_RATE_SCALE / (double) elapsed : 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет скорость по диапазону. Значение может отличаться от границ
+ * на единицу округления.
+ * @param name		имя параметра
+ * @param process	проверяемый случай, для отчёта
+ * @param value		полученная скорость
+ * @param low		наименьшая ожидаемая скорость
+ * @param high		наибольшая ожидаемая скорость
+ * @return		1 - скорость вне диапазона. 0 - совпала.
+ */
+int check_rate(const char *name, const char *process, unsigned long value,
+	double low, double high)
+{
+	int mismatch = (double) value + 1 < low || (double) value > high + 1;
+
+	printf("%-10s %-10s %12lu %12.0f %12.0f%s\n", name, process, value, low, high,
+		mismatch ? "  mismatch" : "");
+
+	return mismatch;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер разбора status-файлов. Файлы всех процессов хоста один раз читаются
+ * в память и многократно разбираются parse_linux_status и построчным
+ * sscanf. Результаты сверяются на файлах хоста и на образцах status_samples.
+ * @param iterations	число проходов по всем файлам
+ * @return		код завершения программы
+ */
+int bench_status(int iterations)
+{
+	bench_files_t files;
+	linux_status_t status;
+	double started, elapsed_new, elapsed_old;
+	unsigned long checksum = 0, mismatches = 0;
+	size_t i;
+	int n;
+
+	if (load_proc_files("status", &files) < 0 || files.count == 0) {
+		fprintf(stderr, "can't read %s\n", module_config.proc_root);
+		return 1;
+	}
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < files.count; ++i)
+			if (parse_linux_status(files.data[i], files.length[i], &status))
+				checksum += status.voluntary_ctxt_switches;
+	elapsed_new = bench_clock() - started;
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < files.count; ++i)
+			if (parse_status_sscanf(files.data[i], &status))
+				checksum += status.voluntary_ctxt_switches;
+	elapsed_old = bench_clock() - started;
+
+	for (i = 0; i < files.count; ++i)
+		mismatches += compare_status(files.data[i], files.length[i]);
+	for (i = 0; i < sizeof(status_samples) / sizeof(status_samples[0]); ++i)
+		mismatches += compare_status(status_samples[i], strlen(status_samples[i]));
+
+	printf("status files:      %10lu\n", (unsigned long) files.count);
+	printf("parse_linux_status:%10.1f ns/file\n",
+		elapsed_new * 1e9 / iterations / files.count);
+	printf("sscanf:            %10.1f ns/file\n",
+		elapsed_old * 1e9 / iterations / files.count);
+	printf("speedup:           %10.2fx\n", elapsed_old / elapsed_new);
+	printf("mismatches:        %10lu (checksum %lu)\n", mismatches, checksum);
+
+	free_bench_files(&files);
+	return mismatches > 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверяет разбор status-файла parse_linux_status и построчным sscanf.
+ * @param buf		содержимое status-файла, с завершающим нулём
+ * @param length	длина содержимого
+ * @return		1 - результаты расходятся. 0 - совпали.
+ */
+int compare_status(const char *buf, size_t length)
+{
+	linux_status_t status, reference;
+	int found = parse_linux_status(buf, length, &status);
+
+	if (found != parse_status_sscanf(buf, &reference))
+		return 1;
+
+	return found && (status.voluntary_ctxt_switches != reference.voluntary_ctxt_switches ||
+		status.nonvoluntary_ctxt_switches != reference.nonvoluntary_ctxt_switches);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбор status-файла построчным sscanf. Оставлен для сравнения.
+ * @param buf		содержимое status-файла, с завершающим нулём
+ * @param status	сюда будет помещён результат
+ * @return		1 - найдены оба счётчика переключений контекста. 0 - нет.
+ */
+int parse_status_sscanf(const char *buf, linux_status_t *status)
+{
+	const char *line;
+	int found = 0;
+
+	memset(status, 0, sizeof(linux_status_t));
+	for (line = buf; line != NULL; line = next_bench_line(line)) {
+		if (sscanf(line, "voluntary_ctxt_switches: %llu",
+			&status->voluntary_ctxt_switches) == 1)
+			++found;
+		else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu",
+			&status->nonvoluntary_ctxt_switches) == 1)
+			++found;
+	}
+
+	return found == 2;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Находит начало следующей строки текста.
+ * @param line	начало текущей строки
+ * @return	начало следующей строки. NULL - строк больше нет.
+ */
+const char *next_bench_line(const char *line)
+{
+	line = strchr(line, '\n');
+
+	return line != NULL && line[1] != '\0' ? line + 1 : NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер разбора io-файлов, как bench_status: parse_linux_io против
+ * построчного sscanf на файлах хоста и на образцах io_samples. io чужих
+ * процессов доступен только root.
+ * @param iterations	число проходов по всем файлам
+ * @return		код завершения программы
+ */
+int bench_io(int iterations)
+{
+	bench_files_t files;
+	linux_io_t io;
+	double started, elapsed_new, elapsed_old;
+	unsigned long checksum = 0, mismatches = 0;
+	size_t i;
+	int n;
+
+	if (load_proc_files("io", &files) < 0 || files.count == 0) {
+		fprintf(stderr, "can't read %s\n", module_config.proc_root);
+		return 1;
+	}
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < files.count; ++i)
+			if (parse_linux_io(files.data[i], files.length[i], &io))
+				checksum += io.syscr;
+	elapsed_new = bench_clock() - started;
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < files.count; ++i)
+			if (parse_io_sscanf(files.data[i], &io))
+				checksum += io.syscr;
+	elapsed_old = bench_clock() - started;
+
+	for (i = 0; i < files.count; ++i)
+		mismatches += compare_io(files.data[i], files.length[i]);
+	for (i = 0; i < sizeof(io_samples) / sizeof(io_samples[0]); ++i)
+		mismatches += compare_io(io_samples[i], strlen(io_samples[i]));
+
+	printf("io files:          %10lu\n", (unsigned long) files.count);
+	printf("parse_linux_io:    %10.1f ns/file\n",
+		elapsed_new * 1e9 / iterations / files.count);
+	printf("sscanf:            %10.1f ns/file\n",
+		elapsed_old * 1e9 / iterations / files.count);
+	printf("speedup:           %10.2fx\n", elapsed_old / elapsed_new);
+	printf("mismatches:        %10lu (checksum %lu)\n", mismatches, checksum);
+
+	free_bench_files(&files);
+	return mismatches > 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверяет разбор io-файла parse_linux_io и построчным sscanf.
+ * @param buf		содержимое io-файла, с завершающим нулём
+ * @param length	длина содержимого
+ * @return		1 - результаты расходятся. 0 - совпали.
+ */
+int compare_io(const char *buf, size_t length)
+{
+	linux_io_t io, reference;
+	int found = parse_linux_io(buf, length, &io);
+
+	if (found != parse_io_sscanf(buf, &reference))
+		return 1;
+
+	return found && (io.read_bytes != reference.read_bytes ||
+		io.write_bytes != reference.write_bytes ||
+		io.syscr != reference.syscr || io.syscw != reference.syscw);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбор io-файла построчным sscanf. Оставлен для сравнения.
+ * @param buf		содержимое io-файла, с завершающим нулём
+ * @param io		сюда будет помещён результат
+ * @return		1 - найдены все четыре счётчика. 0 - нет.
+ */
+int parse_io_sscanf(const char *buf, linux_io_t *io)
+{
+	const char *line;
+	char key[64];
+	unsigned long long value;
+	int found = 0;
+
+	memset(io, 0, sizeof(linux_io_t));
+	for (line = buf; line != NULL; line = next_bench_line(line)) {
+		if (sscanf(line, "%63[^:]: %llu", key, &value) != 2)
+			continue;
+
+		if (strcmp(key, "read_bytes") == 0)
+			io->read_bytes = value;
+		else if (strcmp(key, "write_bytes") == 0)
+			io->write_bytes = value;
+		else if (strcmp(key, "syscr") == 0)
+			io->syscr = value;
+		else if (strcmp(key, "syscw") == 0)
+			io->syscw = value;
+		else
+			continue;
+		++found;
+	}
+
+	return found == 4;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверка подсчёта дескрипторов и разбора пределов. У каждого процесса
+ * дескрипторы считаются count_pid_fds и через readdir каталога fd, а
+ * limits-файлы разбираются parse_linux_nofile_limit и построчным sscanf.
+ * Разбор пределов проверяется и на образцах limits_samples с известным
+ * результатом. Процессы открывают и закрывают дескрипторы между двумя
+ * подсчётами, поэтому расхождение пересчитывается один раз. Первый подсчёт
+ * прогревает кэш каталога в ядре, поэтому способы чередуются по проходам.
+ * На хосте у большинства процессов по десятку дескрипторов, и время уходит
+ * на открытие каталога, так что отдельно замеряется процесс с
+ * BENCH_FDS_LARGE дескрипторами.
+ * @param iterations	число проходов по всем процессам и файлам
+ * @return		код завершения программы
+ */
+int bench_fds(int iterations)
+{
+	proc_walker_t walker;
+	proc_pid_t pid;
+	bench_files_t files;
+	double started, elapsed_new = 0, elapsed_old = 0, elapsed_limits, elapsed_sscanf;
+	unsigned long processes = 0, descriptors = 0, mismatches = 0, checksum = 0;
+	unsigned long long limit;
+	char *buf;
+	long fds, listed;
+	size_t i;
+	int n;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	// В образе каталогов fd нет - сверять подсчёт не с чем
+	if (is_proc_image_attached()) {
+		fprintf(stderr, "fds needs /proc or -r root, not an image\n");
+		return 1;
+	}
+
+	buf = malloc(BENCH_BLOCK_SIZE);
+	for (n = 0; n < iterations; ++n) {
+		if (buf == NULL || open_proc_walker(&walker, module_config.proc_root) < 0) {
+			fprintf(stderr, "can't read %s\n", module_config.proc_root);
+			free(buf);
+			return 1;
+		}
+
+		while (next_proc_pid(&walker, &pid)) {
+			if (n % 2) {
+				started = bench_clock();
+				listed = count_fds_readdir(pid.pid);
+				elapsed_old += bench_clock() - started;
+			}
+
+			started = bench_clock();
+			fds = count_pid_fds(&walker, &pid, buf, BENCH_BLOCK_SIZE);
+			elapsed_new += bench_clock() - started;
+
+			if (n % 2 == 0) {
+				started = bench_clock();
+				listed = count_fds_readdir(pid.pid);
+				elapsed_old += bench_clock() - started;
+			}
+
+			if (n == 0 && fds != listed &&
+				count_pid_fds(&walker, &pid, buf, BENCH_BLOCK_SIZE) != count_fds_readdir(pid.pid))
+				++mismatches;
+			release_proc_pid(&walker, &pid);
+
+			if (n == 0 && fds >= 0) {
+				++processes;
+				descriptors += fds;
+			}
+		}
+		close_proc_walker(&walker);
+	}
+
+	printf("processes:         %10lu\n", processes);
+	printf("descriptors:       %10lu\n", descriptors);
+	printf("count_pid_fds:     %10.1f us/process %10.1f ns/descriptor\n",
+		processes > 0 ? elapsed_new * 1e6 / iterations / processes : 0,
+		descriptors > 0 ? elapsed_new * 1e9 / iterations / descriptors : 0);
+	printf("readdir:           %10.1f us/process %10.1f ns/descriptor\n",
+		processes > 0 ? elapsed_old * 1e6 / iterations / processes : 0,
+		descriptors > 0 ? elapsed_old * 1e9 / iterations / descriptors : 0);
+	printf("speedup:           %10.2fx\n", elapsed_old / elapsed_new);
+
+	// Дочерний процесс виден только в настоящем /proc
+	if (strcmp(module_config.proc_root, "/proc") == 0 &&
+		bench_large_fds(iterations, buf, &mismatches) < 0) {
+		free(buf);
+		return 1;
+	}
+	free(buf);
+
+	if (load_proc_files("limits", &files) < 0 || files.count == 0) {
+		fprintf(stderr, "can't read %s\n", module_config.proc_root);
+		return 1;
+	}
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < files.count; ++i)
+			if (parse_linux_nofile_limit(files.data[i], files.length[i], &limit))
+				checksum += limit;
+	elapsed_limits = bench_clock() - started;
+
+	started = bench_clock();
+	for (n = 0; n < iterations; ++n)
+		for (i = 0; i < files.count; ++i)
+			if (parse_limits_sscanf(files.data[i], &limit))
+				checksum += limit;
+	elapsed_sscanf = bench_clock() - started;
+
+	for (i = 0; i < files.count; ++i)
+		mismatches += compare_limits(files.data[i], files.length[i], -1, 0);
+	for (i = 0; i < sizeof(limits_samples) / sizeof(limits_samples[0]); ++i)
+		mismatches += compare_limits(limits_samples[i].text, strlen(limits_samples[i].text),
+			limits_samples[i].found, limits_samples[i].limit);
+
+	printf("limits files:      %10lu\n", (unsigned long) files.count);
+	printf("nofile limit:      %10.1f ns/file\n",
+		elapsed_limits * 1e9 / iterations / files.count);
+	printf("sscanf:            %10.1f ns/file\n",
+		elapsed_sscanf * 1e9 / iterations / files.count);
+	printf("mismatches:        %10lu (checksum %lu)\n", mismatches, checksum);
+
+	free_bench_files(&files);
+	return mismatches > 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Замер подсчёта дескрипторов процесса, у которого их BENCH_FDS_LARGE
+ * или сколько позволяет предел: здесь время уходит на чтение записей
+ * каталога, а не на его открытие.
+ * @param iterations	число подсчётов каждым способом
+ * @param buf		буфер размером BENCH_BLOCK_SIZE
+ * @param mismatches	сюда прибавляется число расхождений
+ * @return		0 - успешно. -1 - процесс создать не удалось.
+ */
+int bench_large_fds(int iterations, char *buf, unsigned long *mismatches)
+{
+	proc_walker_t walker;
+	proc_pid_t pid;
+	double started, elapsed_new = 0, elapsed_old = 0;
+	long fds = -1, listed = -1, opened = BENCH_FDS_LARGE;
+	pid_t child;
+	int n;
+
+	child = spawn_fds_process(&opened);
+	if (child < 0) {
+		fprintf(stderr, "can't start a process with %d descriptors\n", BENCH_FDS_LARGE);
+		return -1;
+	}
+	if (open_proc_walker(&walker, module_config.proc_root) < 0) {
+		kill(child, SIGKILL);
+		waitpid(child, NULL, 0);
+		return -1;
+	}
+	set_proc_pid(&pid, (int) child);
+
+	// Первое чтение fd/ заводит в dcache записи всех дескрипторов -
+	// оно не замеряется
+	count_fds_readdir(pid.pid);
+
+	for (n = 0; n < iterations; ++n) {
+		if (n % 2) {
+			started = bench_clock();
+			listed = count_fds_readdir(pid.pid);
+			elapsed_old += bench_clock() - started;
+		}
+
+		started = bench_clock();
+		fds = count_pid_fds(&walker, &pid, buf, BENCH_BLOCK_SIZE);
+		elapsed_new += bench_clock() - started;
+
+		if (n % 2 == 0) {
+			started = bench_clock();
+			listed = count_fds_readdir(pid.pid);
+			elapsed_old += bench_clock() - started;
+		}
+
+		if (fds != listed || fds < opened)
+			++(*mismatches);
+	}
+	close_proc_walker(&walker);
+	kill(child, SIGKILL);
+	waitpid(child, NULL, 0);
+
+	printf("large process:     %10ld descriptors\n", fds);
+	if (fds > 0) {
+		printf("count_pid_fds:     %10.1f us/process %10.1f ns/descriptor\n",
+			elapsed_new * 1e6 / iterations, elapsed_new * 1e9 / iterations / fds);
+		printf("readdir:           %10.1f us/process %10.1f ns/descriptor\n",
+			elapsed_old * 1e6 / iterations, elapsed_old * 1e9 / iterations / fds);
+		printf("speedup:           %10.2fx\n", elapsed_old / elapsed_new);
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Запускает процесс, который открывает дескрипторы на /dev/null и ждёт
+ * завершения. Предел дескрипторов процесс поднимает сам; если поднять
+ * его до count не удаётся, открывается сколько позволяет жёсткий предел.
+ * @param count	число дескрипторов, сюда будет помещено число открытых
+ * @return	PID процесса, дескрипторы уже открыты. -1 - ошибка.
+ */
+pid_t spawn_fds_process(long *count)
+{
+	struct rlimit limit;
+	int ready[2], fd;
+	long opened = 0;
+	pid_t child;
+
+	if (pipe(ready) < 0)
+		return -1;
+
+	child = fork();
+	if (child == 0) {
+		close(ready[0]);
+		limit.rlim_cur = limit.rlim_max = (rlim_t) *count + 64;
+		if (setrlimit(RLIMIT_NOFILE, &limit) < 0 && getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+
+		fd = open("/dev/null", O_RDONLY);
+		for (opened = fd >= 0; opened > 0 && opened < *count; ++opened)
+			if (dup(fd) < 0)
+				break;
+		if (write(ready[1], &opened, sizeof(opened)) != sizeof(opened))
+			_exit(1);
+		for (;;)
+			pause();
+	}
+
+	close(ready[1]);
+	if (child > 0 && (read(ready[0], &opened, sizeof(opened)) != sizeof(opened) || opened == 0)) {
+		kill(child, SIGKILL);
+		waitpid(child, NULL, 0);
+		child = -1;
+	}
+	close(ready[0]);
+	*count = opened;
+
+	return child;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Считает дескрипторы процесса через opendir и readdir каталога fd.
+ * @param pid	PID процесса
+ * @return	число дескрипторов. -1 - каталог прочитать не удалось.
+ */
+long count_fds_readdir(int pid)
+{
+	char path[SYNTH_PATH_SIZE];
+	struct dirent *direntry;
+	DIR *dir;
+	long count = 0;
+
+	snprintf(path, sizeof(path), "%s/%d/fd", module_config.proc_root, pid);
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+
+	while ((direntry = readdir(dir)) != NULL)
+		if (strcmp(direntry->d_name, ".") != 0 && strcmp(direntry->d_name, "..") != 0)
+			++count;
+	closedir(dir);
+
+	return count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверяет разбор limits-файла parse_linux_nofile_limit и построчным
+ * sscanf, а для образцов - ещё и с известным результатом.
+ * @param buf		содержимое limits-файла, с завершающим нулём
+ * @param length	длина содержимого
+ * @param found		ожидаемый результат разбора. -1 - неизвестен
+ * @param expected	ожидаемый предел, если found равен 1
+ * @return		1 - результаты расходятся. 0 - совпали.
+ */
+int compare_limits(const char *buf, size_t length, int found, unsigned long long expected)
+{
+	unsigned long long limit, reference;
+	int result = parse_linux_nofile_limit(buf, length, &limit);
+
+	if (result != parse_limits_sscanf(buf, &reference) || (result && limit != reference))
+		return 1;
+
+	return found >= 0 && (result != found || (result && limit != expected));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбор мягкого предела дескрипторов построчным sscanf. Оставлен для
+ * сравнения.
+ * @param buf		содержимое limits-файла, с завершающим нулём
+ * @param limit		сюда будет помещён предел. 0 - не ограничен
+ * @return		1 - строка с пределом найдена. 0 - нет.
+ */
+int parse_limits_sscanf(const char *buf, unsigned long long *limit)
+{
+	static const char name[] = "Max open files";
+	const char *line;
+	char soft[32];
+
+	*limit = 0;
+	for (line = buf; line != NULL; line = next_bench_line(line)) {
+		if (strncmp(line, name, sizeof(name) - 1) != 0)
+			continue;
+
+		if (sscanf(line + sizeof(name) - 1, "%31s", soft) == 1 &&
+			strcmp(soft, "unlimited") != 0)
+			*limit = strtoull(soft, NULL, 10);
+		return 1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Читает в память одноимённый файл всех процессов /proc.
+ * @param name	имя файла в PID-каталоге
+ * @param files	сюда будут помещены файлы
+ * @return	0 - успешно. -1 - /proc прочитать не удалось.
+ */
+int load_proc_files(const char *name, bench_files_t *files)
+{
+	proc_walker_t walker;
+	proc_pid_t pid;
+	size_t buf_size = 1 << 20;
+	char *buf = malloc(buf_size);
+	ssize_t length, chunk;
+	size_t capacity = 0;
+	int fd;
+
+	memset(files, 0, sizeof(bench_files_t));
+	if (buf == NULL || open_proc_walker(&walker, module_config.proc_root) < 0) {
+		free(buf);
+		return -1;
+	}
+
+	while (next_proc_pid(&walker, &pid)) {
+		fd = open_pid_file(&walker, &pid, name);
+		if (fd < 0)
+			continue;
+
+		// maps и подобные файлы отдаются ядром частями - читаем до конца
+		length = 0;
+		while ((chunk = read_pid_fd(&walker, fd, buf + length, buf_size - length - 1)) > 0) {
+			length += chunk;
+			if (buf_size - length - 1 == 0) {
+				buf_size *= 2;
+				buf = realloc(buf, buf_size);
+			}
+		}
+		close_pid_fd(&walker, fd);
+		if (length <= 0)
+			continue;
+		buf[length] = '\0';
+
+		if (files->count == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			files->data = realloc(files->data, capacity * sizeof(char *));
+			files->length = realloc(files->length, capacity * sizeof(size_t));
+		}
+
+		files->data[files->count] = malloc(length + 1);
+		memcpy(files->data[files->count], buf, length + 1);
+		files->length[files->count++] = length;
+	}
+
+	close_proc_walker(&walker);
+	free(buf);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Освобождает прочитанные в память файлы.
+ * @param files	файлы
+ */
+void free_bench_files(bench_files_t *files)
+{
+	size_t i;
+
+	for (i = 0; i < files->count; ++i)
+		free(files->data[i]);
+	free(files->data);
+	free(files->length);
+	memset(files, 0, sizeof(bench_files_t));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Выводит счётчики обхода в пересчёте на один обход.
+ * @param title		название замера
+ * @param seconds	общее время всех обходов
+ * @param stats		суммарные счётчики всех обходов
+ * @param scans		число обходов
+ */
+void print_scan_stats(const char *title, double seconds, proc_scan_stats_t *stats, int scans)
+{
+	double pids = (double) stats->pids / scans;
+
+	printf("%s:\n", title);
+	printf("  time/scan      %10.3f ms\n", seconds * 1000 / scans);
+	printf("  pids/scan      %10.0f\n", pids);
+	printf("  pids/sec       %10.0f\n", seconds > 0 ? stats->pids / seconds : 0);
+	printf("  syscalls/scan  %10.0f (%.2f per pid)\n", (double) stats->syscalls / scans,
+		pids > 0 ? stats->syscalls / scans / pids : 0);
+	printf("  files/scan     %10.0f\n", (double) stats->files_opened / scans);
+	printf("  bytes/scan     %10.0f\n", (double) stats->bytes_read / scans);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Монотонное время, в секундах.
+ * @return	текущее значение CLOCK_MONOTONIC
+ */
+double bench_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Время от загрузки системы - в тех же часах модуль отсчитывает
+ * скорости и время старта процессов.
+ * @return	время, в нс
+ */
+unsigned long long bench_boot_clock(void)
+{
+	struct timespec now;
+
+#ifdef CLOCK_BOOTTIME
+	clock_gettime(CLOCK_BOOTTIME, &now);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+
+	return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
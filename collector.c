@@ -0,0 +1,238 @@
+/*
+ * Фоновый сборщик снимка /proc.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include "pid_info.h"
+#include "module_config.h"
+#include "collector.h"
+
+/* Через сколько интервалов без запросов сборщик приостанавливается.
+ * Например, в главном процессе агента, который сам запросы не обслуживает */
+#define COLLECTOR_IDLE_PASSES 3
+
+static pthread_t collector_thread;
+static pthread_mutex_t collector_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t collector_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t collector_once = PTHREAD_ONCE_INIT;
+static int collector_running = 0; // Поток сборщика запущен в этом процессе
+static int collector_stop = 0; // Запрошена остановка сборщика
+static int collector_wakeup = 0; // Запрошено внеочередное обновление
+static int collector_idle = 0; // Сборщик приостановлен
+static time_t collector_last_read = 0; // Момент последнего обращения к данным
+
+int start_collector(void);
+void stop_collector(void);
+void touch_collector(void);
+void wakeup_collector(void);
+void *collector_main(void *arg);
+void collector_register_atfork(void);
+void collector_atfork_prepare(void);
+void collector_atfork_parent(void);
+void collector_atfork_child(void);
+time_t collector_clock(void);
+
+/**
+ * Запускает поток фонового сборщика в текущем процессе.
+ * @return	0 - сборщик запущен. -1 - поток создать не удалось.
+ */
+int start_collector(void)
+{
+	int result = 0;
+
+	pthread_once(&collector_once, collector_register_atfork);
+
+	pthread_mutex_lock(&collector_lock);
+	if (!collector_running) {
+		collector_stop = 0;
+		collector_wakeup = 0;
+		collector_idle = 0;
+		collector_last_read = collector_clock();
+
+		if (pthread_create(&collector_thread, NULL, collector_main, NULL) == 0)
+			collector_running = 1;
+		else
+			result = -1;
+	}
+	pthread_mutex_unlock(&collector_lock);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Останавливает поток фонового сборщика и дожидается его завершения.
+ */
+void stop_collector(void)
+{
+	pthread_mutex_lock(&collector_lock);
+	if (!collector_running) {
+		pthread_mutex_unlock(&collector_lock);
+		return;
+	}
+
+	collector_stop = 1;
+	pthread_cond_signal(&collector_cond);
+	pthread_mutex_unlock(&collector_lock);
+
+	pthread_join(collector_thread, NULL);
+
+	pthread_mutex_lock(&collector_lock);
+	collector_running = 0;
+	pthread_mutex_unlock(&collector_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Отмечает обращение к данным сборщика, запускает или будит его
+ * при необходимости.
+ */
+void touch_collector(void)
+{
+	pthread_mutex_lock(&collector_lock);
+	collector_last_read = collector_clock();
+	if (collector_idle)
+		pthread_cond_signal(&collector_cond);
+	pthread_mutex_unlock(&collector_lock);
+
+	start_collector();
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Просит сборщик обновить снимок /proc, не дожидаясь окончания интервала.
+ */
+void wakeup_collector(void)
+{
+	pthread_mutex_lock(&collector_lock);
+	collector_wakeup = 1;
+	pthread_cond_signal(&collector_cond);
+	pthread_mutex_unlock(&collector_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Основной цикл потока сборщика.
+ * @param arg	не используется
+ * @return	NULL
+ */
+void *collector_main(void *arg)
+{
+	struct timespec deadline;
+	time_t idle_after;
+
+	(void) arg;
+	pthread_mutex_lock(&collector_lock);
+	while (!collector_stop) {
+		// Запросов давно не было - ждём, пока о нас вспомнят
+		idle_after = (time_t) module_config.collector_interval * COLLECTOR_IDLE_PASSES;
+		if (collector_clock() - collector_last_read > idle_after) {
+			collector_idle = 1;
+			pthread_cond_wait(&collector_cond, &collector_lock);
+			collector_idle = 0;
+			continue;
+		}
+
+		pthread_mutex_unlock(&collector_lock);
+		refresh_proc_snapshot();
+		pthread_mutex_lock(&collector_lock);
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += module_config.collector_interval;
+		while (!collector_stop && !collector_wakeup) {
+			if (pthread_cond_timedwait(&collector_cond, &collector_lock, &deadline) == ETIMEDOUT)
+				break;
+		}
+		collector_wakeup = 0;
+	}
+	pthread_mutex_unlock(&collector_lock);
+
+	return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Регистрирует обработчики fork(). Рабочие процессы агента получают копию
+ * состояния сборщика без самого потока, поэтому в дочернем процессе
+ * сборщик считается не запущенным и стартует при первом запросе.
+ */
+void collector_register_atfork(void)
+{
+	pthread_atfork(collector_atfork_prepare, collector_atfork_parent,
+		collector_atfork_child);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Перед fork() захватываем блокировки, чтобы дочерний процесс не получил их
+ * в захваченном потоком сборщика состоянии.
+ */
+void collector_atfork_prepare(void)
+{
+	lock_proc_snapshot();
+	pthread_mutex_lock(&collector_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * После fork() в родительском процессе освобождаем блокировки.
+ */
+void collector_atfork_parent(void)
+{
+	pthread_mutex_unlock(&collector_lock);
+	unlock_proc_snapshot();
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * После fork() в дочернем процессе потока сборщика нет.
+ */
+void collector_atfork_child(void)
+{
+	collector_running = 0;
+	collector_stop = 0;
+	collector_wakeup = 0;
+	collector_idle = 0;
+	pthread_cond_init(&collector_cond, NULL);
+	pthread_mutex_unlock(&collector_lock);
+	unlock_proc_snapshot();
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Монотонное время, в секундах.
+ * @return	текущее значение CLOCK_MONOTONIC
+ */
+time_t collector_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec;
+}
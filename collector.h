@@ -0,0 +1,61 @@
+/*
+ * Фоновый сборщик снимка /proc.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * Запускает поток фонового сборщика в текущем процессе.
+	 * Сборщик обновляет снимок /proc раз в CollectorInterval секунд.
+	 * Повторный вызов при запущенном сборщике ничего не делает.
+	 *
+	 * @return	0 - сборщик запущен. -1 - поток создать не удалось.
+	 */
+	extern int start_collector(void);
+
+	/**
+	 * Останавливает поток фонового сборщика и дожидается его завершения.
+	 */
+	extern void stop_collector(void);
+
+	/**
+	 * Отмечает обращение к данным сборщика.
+	 *
+	 * Если сборщик в этом процессе не запущен (агент создаёт рабочие
+	 * процессы через fork() уже после инициализации модуля, а потоки
+	 * при этом не наследуются) - запускает его.
+	 * Если сборщик простаивал из-за отсутствия запросов - будит его.
+	 */
+	extern void touch_collector(void);
+
+	/**
+	 * Просит сборщик обновить снимок /proc, не дожидаясь окончания
+	 * интервала.
+	 */
+	extern void wakeup_collector(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COLLECTOR_H */
@@ -0,0 +1,186 @@
+/*
+ * Настройки модуля, считываемые из конфигурационного файла.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "string_util.h"
+#include "module_config.h"
+#include "scan_pool.h"
+#include "self_stats.h"
+
+#define CLINE_SIZE 1024 // Размер строки конфигурационного файла
+
+/* Описание числового параметра конфигурационного файла */
+typedef struct module_option_s {
+	const char *name; /* имя параметра в файле */
+	unsigned *value; /* куда помещается значение */
+	unsigned min; /* минимально допустимое значение */
+	unsigned max; /* максимально допустимое значение */
+} module_option_t;
+
+/* Описание строкового параметра конфигурационного файла */
+typedef struct module_text_option_s {
+	const char *name; /* имя параметра в файле */
+	char *value; /* куда помещается значение */
+	size_t size; /* размер value, с учётом '\0' */
+} module_text_option_t;
+
+module_config_t module_config = {
+	5, /* snapshot_ttl */
+	0, /* collector_interval */
+	1000, /* collector_wait */
+	0, /* validate_sources */
+	1, /* scan_threads */
+	0, /* proc_events */
+	60, /* proc_events_reconcile */
+	0, /* pidfd_tracking */
+	300, /* user_cache_ttl */
+	30, /* user_cache_negative_ttl */
+	0, /* trace */
+	"/proc" /* proc_root */
+};
+
+static module_option_t options[] = {
+	/* NAME            VALUE                        MIN  MAX */
+	{"SnapshotTTL", &module_config.snapshot_ttl, 0, 3600},
+	{"CollectorInterval", &module_config.collector_interval, 0, 3600},
+	{"CollectorWait", &module_config.collector_wait, 0, 30000},
+	{"ValidateSources", &module_config.validate_sources, 0, 1},
+	{"ScanThreads", &module_config.scan_threads, 1, SCAN_POOL_MAX_THREADS},
+	{"ProcEvents", &module_config.proc_events, 0, 1},
+	{"ProcEventsReconcile", &module_config.proc_events_reconcile, 1, 3600},
+	{"PidfdTracking", &module_config.pidfd_tracking, 0, 1},
+	{"UserCacheTTL", &module_config.user_cache_ttl, 0, 86400},
+	{"UserCacheNegativeTTL", &module_config.user_cache_negative_ttl, 0, 86400},
+	{"Trace", &module_config.trace, 0, 1},
+	{NULL}
+};
+
+static module_text_option_t text_options[] = {
+	/* NAME       VALUE                   SIZE */
+	{"ProcRoot", module_config.proc_root, PROC_ROOT_SIZE},
+	{NULL}
+};
+
+int load_module_config(const char *path);
+int set_module_option(char *name, char *value);
+
+/**
+ * Считывает настройки модуля из файла.
+ *
+ * @param path	путь к конфигурационному файлу
+ * @return	0 - успешно. -1 - файл содержит неизвестный параметр
+ *		или недопустимое значение.
+ */
+int load_module_config(const char *path)
+{
+	FILE *config_file = fopen(path, "rt");
+
+	// Файла нет - работаем с настройками по умолчанию
+	if (config_file == NULL)
+		return 0;
+
+	int result = 0;
+	char *lbuf = self_malloc(sizeof(char) * CLINE_SIZE);
+	char *name, *value;
+	size_t length;
+
+	if (lbuf == NULL) {
+		fclose(config_file);
+		return -1;
+	}
+
+	while (result == 0 && read_line(config_file, lbuf, CLINE_SIZE)) {
+		// Файлы с переводами строк windows: отбрасываем '\r'
+		length = strlen(lbuf);
+		if (length > 0 && lbuf[length - 1] == '\r')
+			lbuf[length - 1] = '\0';
+
+		if (line_is_comment(lbuf))
+			continue;
+
+		value = strchr(lbuf, '=');
+		if (value == NULL) {
+			result = -1;
+			break;
+		}
+
+		*(value++) = '\0';
+		name = lbuf;
+		while (*name == ' ')
+			++name;
+		while (*value == ' ')
+			++value;
+		trim_substring(name);
+		trim_substring(value);
+
+		result = set_module_option(name, value);
+	}
+
+	free(lbuf);
+	fclose(config_file);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Устанавливает значение параметра модуля.
+ * @param name	имя параметра
+ * @param value	значение параметра, строка
+ * @return	0 - значение установлено.
+ *		-1 - неизвестный параметр или недопустимое значение.
+ */
+int set_module_option(char *name, char *value)
+{
+	module_option_t *option;
+	module_text_option_t *text_option;
+	char *end;
+	unsigned long number;
+
+	for (text_option = text_options; text_option->name != NULL; ++text_option) {
+		if (strcmp(text_option->name, name) != 0)
+			continue;
+
+		if (*value == '\0' || strlen(value) >= text_option->size)
+			return -1;
+
+		strcpy(text_option->value, value);
+		return 0;
+	}
+
+	for (option = options; option->name != NULL; ++option) {
+		if (strcmp(option->name, name) != 0)
+			continue;
+
+		if (*value == '\0')
+			return -1;
+
+		number = strtoul(value, &end, 10);
+		if (*end != '\0' || number < option->min || number > option->max)
+			return -1;
+
+		*(option->value) = (unsigned) number;
+		return 0;
+	}
+
+	return -1;
+}
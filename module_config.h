@@ -0,0 +1,97 @@
+/*
+ * Настройки модуля, считываемые из конфигурационного файла.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef MODULE_CONFIG_H
+#define MODULE_CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Путь к конфигурационному файлу модуля по умолчанию */
+#ifndef MODULE_CONFIG_PATH
+#define MODULE_CONFIG_PATH "/etc/zabbix/pid_info.conf"
+#endif
+
+#define PROC_ROOT_SIZE 256 // Размер пути к /proc
+
+	/* Настройки модуля. Значения по умолчанию заданы в module_config.c */
+	typedef struct module_config_s {
+		unsigned snapshot_ttl; /* SnapshotTTL - время жизни снимка /proc,
+					* в секундах. 0 - каждый запрос
+					* выполняет собственный обход /proc */
+		unsigned collector_interval; /* CollectorInterval - интервал
+					* обновления снимка /proc фоновым
+					* сборщиком, в секундах. 0 - сборщик
+					* выключен */
+		unsigned collector_wait; /* CollectorWait - сколько запрос может
+					* ждать свежий снимок от сборщика, в
+					* миллисекундах */
+		unsigned validate_sources; /* ValidateSources - 1: сверять
+					* значения из дешёвых файлов /proc
+					* со значениями из дорогих */
+		unsigned scan_threads; /* ScanThreads - число потоков, которыми
+					* читаются stat, maps и smaps
+					* процессов. 1 - в потоке обхода */
+		unsigned proc_events; /* ProcEvents - 1: обновлять снимок по
+					* событиям proc connector, без обхода
+					* /proc */
+		unsigned proc_events_reconcile; /* ProcEventsReconcile - как
+					* часто снимок, обновляемый по
+					* событиям, сверяется полным обходом
+					* /proc, в секундах */
+		unsigned pidfd_tracking; /* PidfdTracking - 1: следить за
+					* завершением запрошенных процессов
+					* через pidfd и сразу убирать их
+					* из снимка */
+		unsigned user_cache_ttl; /* UserCacheTTL - сколько секунд
+					* помнить найденного пользователя или
+					* группу. 0 - не кэшировать */
+		unsigned user_cache_negative_ttl; /* UserCacheNegativeTTL -
+					* сколько секунд помнить, что
+					* пользователя или группы нет */
+		unsigned trace; /* Trace - 1: записывать длительность этапов
+					* сбора в кольцевой буфер, см.
+					* procinf.self.trace */
+		char proc_root[PROC_ROOT_SIZE]; /* ProcRoot - каталог, который
+					* читается вместо /proc. proc connector
+					* и pidfd работают только с /proc */
+	} module_config_t;
+
+	extern module_config_t module_config;
+
+	/**
+	 * Считывает настройки модуля из файла.
+	 *
+	 * Формат файла - строки вида Параметр=Значение, строки,
+	 * начинающиеся с #, считаются комментариями.
+	 * Отсутствие файла не является ошибкой, в этом случае используются
+	 * значения по умолчанию.
+	 *
+	 * @param path	путь к конфигурационному файлу
+	 * @return	0 - успешно. -1 - файл содержит неизвестный параметр
+	 *		или недопустимое значение, либо не хватило памяти.
+	 */
+	extern int load_module_config(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODULE_CONFIG_H */
@@ -28,537 +28,3591 @@
 #include <string.h>
 #include <pwd.h>
 #include <limits.h>
-#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include "module_config.h"
+#include "collector.h"
+#include "proc_walker.h"
+#include "proc_parse.h"
+#include "scan_pool.h"
+#include "proc_events.h"
+#include "pid_tracker.h"
+#include "proc_image.h"
+#include "self_stats.h"
+#include "trace.h"
+#include "user_cache.h"
+#include "proc_matcher.h"
+#include "proc_aggregate.h"
+#include "proc_tree.h"
+#include "pid_info.h"
 // solaris
 #if defined(__sun) && defined(__SVR4)
 #include <procfs.h>
 #endif
 
-#define DEBUG   0 // Режим отладки.
 #define NBUF_SIZE 16384 // Размер буфера чтения из файла
-#define NLINE_SIZE 1024 // Размер строки при чтении из файла
-
-enum proc_params /* параметры, которые можно просчитывать при вызове
-			 * get_proc_value_summ */ {
-	PROC_VMRSS, /* подсчёт резидентной памяти */
-	PROC_MAP, /* подсчёт маппинга, целиком */
-	PROC_MAP_SHARED, /* подсчёт маппинга, только shared-области */
-	PROC_MAP_RW /* подсчёт маппинга, только rw-области */
+#define MBUF_SIZE 65536 // Размер блока чтения maps-файла
+#define UID_STABLE_SCANS 2 // Сколько обходов подряд перечитывается владелец нового процесса
+#define RSS_COUNTER_BATCH 64 // Сколько страниц счётчик rss ядра может накопить на процессор
+#define USER_NAME_SIZE 256 // Размер буфера под имя пользователя
+#define SCAN_CHUNK_PIDS 128 // Сколько PID-каталогов поток обхода берёт за раз
+#define SCAN_CHUNK_ENTRIES 8 // Сколько процессов поток берёт за раз при чтении maps и smaps
+#define EXITED_BATCH 256 // Сколько завершившихся процессов забирается за раз
+#define RATE_SAMPLE_MIN_NS 1000000000ULL // Интервал, короче которого скорости не пересчитываются
+
+#if defined(__linux__) || (defined(__CYGWIN__) && !defined(_WIN32))
+#define LINUX_PROC 1 // /proc в формате linux, доступен снимок /proc
+#endif
+
+/* Файлы процесса, из которых берутся значения параметров. stat читается
+ * при каждом обходе /proc, остальные - только для процессов, попавших
+ * в запрос */
+enum proc_sources {
+	SOURCE_STAT = 1, /* stat - имя, время старта, rss, VmSize */
+	SOURCE_STATM = 2, /* statm - размеры памяти в страницах */
+	SOURCE_MAPS = 4, /* maps - суммы областей памяти */
+	SOURCE_SMAPS = 8, /* smaps_rollup или smaps - PSS, USS, swap, THP */
+	SOURCE_STATUS = 16, /* status - переключения контекста */
+	SOURCE_IO = 32, /* io - счётчики ввода-вывода */
+	SOURCE_FDS = 64 /* каталог fd и limits - открытые дескрипторы и их предел */
 };
 
-typedef struct linux_stat_s {
-	int pid; /* (1) %d ID процесса. */
-	char comm[256]; /* (2) %s Имя исполнимого файла */
-	char state; /* (3) %c Состояние процесса */
-	int ppid; /* (4) %d PID родительского процесса */
-	int pgrp; /* (5) %d ID группы процесса */
-	int session; /* (6) %d ID сессии процесса */
-	int tty_nr; /* (7) %d Номер терминала (tty),
-				 * контроллирующего процесс */
-	int tpgid; /* (8) %d ID группы приоритетного процесса
-				 *  терминала управления процессов */
-	unsigned flags; /* (9) %u Флаги ядра процесса */
-	unsigned long minflt; /* (10) %lu Число незначительных отказов,
-				 * произведённых процессом, которые не
-				 * потребовали загрузки страницы памяти с
-				 * диска. */
-	unsigned long cminflt; /* (11) %lu Число незначительных отказов,
-				 * которые произошли при ожидании выполнения
-				 * действий дочерних процессов */
-	unsigned long majflt; /* (12) %lu Число значительных отказов,
-				 * проиведённых процессом, которые
-				 * потребовали загрузки страниц памяти с
-				 * диска */
-	unsigned long cmajflt; /* (13) %lu Число значительных отказов,
-				 * которые произошли при ожидании выполнения
-				 * действий дочерних процессов */
-	unsigned long utime; /* (14) %lu Время выполнения процесса в
-				 * пространстве пользователя
-				 * (непривелегированный режим). Измеряется
-				 * в тактах */
-	unsigned long stime; /* (15) %lu Время выполнения процесса в
-				 * пространстве ядра. Измеряется в тактах */
-	long cutime; /* (16) %ld Время ожидания исполнения действий
-				 * доверних процессов в пространсве пользователя.
-				 * Измеряется в тактах */
-	long cstime; /* (17) %ld Время ожидания исполнения действия
-				 * дочерних процессов в пространстве ядра.
-				 * Измеряется в тактах */
-	long priority; /* (18) %ld Приоритет процесса. Измеряется
-				 * по-разному, в зависимости от параметров
-				 * планировщика процессов */
-	long nice; /* (19) %ld Приоритет процесса */
-	long num_threads; /* (20) %ld Число потоков процесса
-				 * (подпроцессов) */
-	long itrealvalue; /* (21) %ld Не используется, здесь всегда 0 */
-	unsigned long long starttime; /* (22) %llu Время старта процесса после
-				   * загрузки системы. Измеряется в тактах */
-	unsigned long vsize; /* (23) %lu Размер виртуальной памяти, в
-				 * байтах. */
-	long rss; /* (24) %ld Расход резидентной памяти. Показывает,
-				 * сколько процесс использует реальной физической
-				 * памяти за вычетом свопа и выгруженных данных */
-} linux_stat_t;
-
-/* Права-флаги региона памяти процесса linux */
-typedef struct linux_maps_perms {
-	unsigned read; /* r - чтение */
-	unsigned write; /* w - запись */
-	unsigned executable; /* e - исполнение */
-	unsigned shared; /* s - разделяемая память */
-	unsigned private; /* p - приватная, копирование при записи */
-} linux_maps_perms_t;
+/* План получения параметра: самый дешёвый по числу системных вызовов и
+ * прочитанных байт файл, которым на него можно ответить, и более дорогой
+ * файл, с которым значение сверяется в режиме ValidateSources */
+typedef struct param_plan_s {
+	unsigned source; /* источник значения, из proc_sources */
+	unsigned check; /* источник для сверки, 0 - не сверяется */
+	int maximum; /* 1 - по процессам берётся наибольшее значение, а не сумма */
+} param_plan_t;
+
+/* Состояние подсчёта maps или smaps процесса в снимке /proc */
+enum maps_state {
+	MAPS_NONE, /* ещё не подсчитывались */
+	MAPS_WANTED, /* процесс попал в запрос, сборщик должен их подсчитать */
+	MAPS_READY, /* подсчитаны */
+	MAPS_FAILED /* файл прочитать не удалось */
+};
+
+/* Счётчики процесса и скорости их роста между двумя последними пересчётами.
+ * Переносятся из снимка в снимок, пока под PID тот же процесс, так что
+ * скорость считается по предыдущему значению этого же процесса */
+typedef struct proc_counters_s {
+	unsigned long long cpu_ticks; /* utime + stime */
+	unsigned long long minflt; /* ошибки страниц без чтения с диска */
+	unsigned long long majflt; /* ошибки страниц с чтением с диска */
+	unsigned long long stat_read; /* момент пересчёта по stat, в нс от
+				       * загрузки системы. 0 - отсчёт не начат */
+	unsigned long long ctxsw; /* переключения контекста, добровольные
+				   * и принудительные */
+	unsigned long long status_read; /* момент пересчёта по status, в нс от
+					 * загрузки системы. 0 - отсчёт не начат */
+	linux_io_t io; /* счётчики ввода-вывода */
+	unsigned long long io_read; /* момент пересчёта по io, в нс от
+				     * загрузки системы. 0 - отсчёт не начат */
+	unsigned long cpu; /* загрузка процессора, в сотых долях процента
+			    * одного ядра */
+	unsigned long minflt_rate; /* minflt в секунду, в сотых долях */
+	unsigned long majflt_rate; /* majflt в секунду, в сотых долях */
+	unsigned long ctxsw_rate; /* переключений контекста в секунду,
+				   * в сотых долях */
+	linux_io_t io_rates; /* счётчики ввода-вывода в секунду, в сотых долях */
+} proc_counters_t;
+
+/* Сведения о процессе, собранные за один обход /proc.
+ * Процесс однозначно определяется парой (pid, starttime): PID может быть
+ * повторно выдан новому процессу, но время старта у него будет другим */
+typedef struct proc_entry_s {
+	int pid; /* PID процесса */
+	int ppid; /* PID родительского процесса */
+	unsigned long long starttime; /* Время старта процесса, в тактах */
+	unsigned scans_seen; /* Сколько обходов подряд процесс уже видели */
+	long uid; /* UID владельца процесса */
+	char comm[PROC_COMM_SIZE]; /* Имя исполнимого файла */
+	int stat_state; /* Состояние rss и VmSize, из maps_state. При обновлении
+			 * снимка по событиям (ProcEvents) stat процессов, о
+			 * которых событий не было, не читается, и они
+			 * перечитываются только для процессов, попавших в запрос */
+	unsigned long rss; /* Резидентная память, в байтах */
+	unsigned long vsize; /* Виртуальная память (VmSize), в байтах */
+	proc_counters_t counters; /* Счётчики и скорости: загрузка процессора,
+				   * ошибки страниц, переключения контекста */
+	int status_state; /* Состояние чтения status, из maps_state */
+	int io_state; /* Состояние чтения io, из maps_state */
+	linux_io_t io; /* Счётчики ввода-вывода, читаются только по
+			* первому запросу */
+	int fds_state; /* Состояние подсчёта дескрипторов, из maps_state */
+	unsigned long fds; /* Открытые дескрипторы, считаются только по
+			    * первому запросу */
+	unsigned long long fds_limit; /* Мягкий предел числа дескрипторов,
+				       * 0 - не ограничен */
+	int maps_state; /* Состояние подсчёта maps, из maps_state */
+	linux_maps_totals_t maps; /* Суммы областей памяти, считаются
+				   * только по первому запросу */
+	int smaps_state; /* Состояние подсчёта smaps, из maps_state */
+	linux_smaps_totals_t smaps; /* PSS, USS, swap и THP, считаются
+				     * только по первому запросу */
+	int check_state; /* Состояние сверки источников, из maps_state */
+	int tracked; /* 1 - завершение процесса отслеживается через pidfd,
+		      * читается и пишется через __sync */
+} proc_entry_t;
+
+/* Снимок /proc - таблица процессов, собранная за один обход.
+ * Следующий обход переносит из неё сведения об уже известных процессах */
+typedef struct proc_snapshot_s {
+	proc_entry_t *entries; /* процессы */
+	size_t count; /* число процессов в снимке */
+	size_t capacity; /* размер выделенной под процессы памяти */
+	unsigned *index; /* индекс по PID: номер процесса в entries + 1,
+			  * 0 - свободная ячейка */
+	size_t index_size; /* размер индекса, степень двойки */
+	struct timespec taken; /* момент обхода /proc */
+	int valid; /* 1 - снимок собран */
+	proc_aggregates_t aggregates; /* суммы по паре (имя, владелец), собираются
+				       * по первому запросу к снимку */
+	proc_tree_t tree; /* дерево процессов, строится по первому запросу
+			   * по дереву */
+} proc_snapshot_t;
 
+#if defined(__sun) && defined(__SVR4)
 static char path_separator[] = "/"; // Разделитель каталогов
-static char proc_path[] = "/proc"; // Путь к /proc
-
-unsigned long get_proc_value_summ(char *proc_name, char *user_name, int param);
-int is_valid_dir(struct dirent *dir_entry, int uid_filter, long uid);
-int use_filter(char *user_name, long *uid);
-unsigned long get_vmrss_linux(char *pid_dir, char *fbuf, char *proc_name);
-linux_stat_t *read_linux_stat(char *pid_dir, char *fbuf);
-int is_valid_linux_proc(char *pid_dir, char *proc_name, char *fbuf);
-unsigned long calc_linux_proc_map(char *pid_dir, char *proc_name, char* fbuf, int mode);
-linux_maps_perms_t *parse_linux_perms(const char *str_perms);
-unsigned long htol(const char *hex);
+#endif
+
+/* Группа одноимённых процессов одного владельца */
+typedef struct proc_group_s {
+	char comm[PROC_COMM_SIZE]; /* имя процесса */
+	long uid; /* UID владельца */
+	unsigned long count; /* число процессов */
+} proc_group_t;
+
+/* Параллельная обработка снимка пулом потоков (ScanThreads > 1).
+ * У каждого потока своё состояние обхода /proc и свой буфер, открываемые
+ * при первой порции; общие данные потоки только читают, а пишут каждый
+ * в свои процессы снимка */
+typedef struct scan_job_s {
+	proc_snapshot_t *snap; /* обрабатываемый снимок */
+	proc_snapshot_t *prev; /* предыдущий снимок, для обхода /proc */
+	int *pids; /* PID-каталоги /proc, для обхода */
+	proc_walker_t walkers[SCAN_POOL_MAX_THREADS]; /* состояние обхода потоков */
+	char *fbufs[SCAN_POOL_MAX_THREADS]; /* буферы потоков, MBUF_SIZE */
+	int opened[SCAN_POOL_MAX_THREADS]; /* 1 - состояние обхода потока открыто */
+} scan_job_t;
+
+/* Изменение процесса, полученное от proc connector */
+typedef struct proc_change_s {
+	int pid; /* PID процесса */
+	int kind; /* что произошло, из proc_change_kind */
+	size_t order; /* порядковый номер события */
+} proc_change_t;
+
+/* События, накопившиеся между обновлениями снимка */
+typedef struct proc_changes_s {
+	proc_change_t *items; /* события */
+	size_t count; /* число событий */
+	size_t capacity; /* размер выделенной под события памяти */
+	int failed; /* 1 - не хватило памяти, часть событий потеряна */
+} proc_changes_t;
+
+/* Сводка по одноимённым процессам для procinf.summary */
+typedef struct proc_summary_s {
+	unsigned long instances; /* число процессов */
+	unsigned long rss; /* резидентная память, в байтах */
+	linux_maps_totals_t maps; /* суммы областей памяти */
+} proc_summary_t;
+
+/* Снимок /proc собирается в свободный буфер и затем подменяет текущий.
+ * Собирает снимок всегда один поток: сборщик, либо, если сборщик выключен,
+ * сам запрос. Подмена текущего снимка и его чтение выполняются
+ * под snapshot_lock */
+static proc_snapshot_t snapshots[2]; // Текущий и собираемый снимки /proc
+static proc_snapshot_t *snapshot = NULL; // Текущий снимок /proc
+static unsigned long snapshot_generation = 0; // Номер текущего снимка
+static unsigned long snapshot_walks = 0; // Число выполненных обходов снимка
+static unsigned long snapshot_walks_saved = 0; // Число запросов без обхода /proc
+static proc_scan_stats_t last_scan_stats; // Счётчики последнего обхода /proc
+static proc_scan_stats_t total_scan_stats; // Счётчики всех чтений /proc, изменяются атомарно
+static struct timespec last_full_walk; // Момент последнего полного обхода /proc
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_updated = PTHREAD_COND_INITIALIZER;
+
+/* Завершившиеся процессы убираются из текущего снимка сразу (PidfdTracking).
+ * Пока собирается следующий снимок, текущий читается без блокировки как
+ * предыдущий, поэтому завершения откладываются и применяются к собранному
+ * снимку перед подменой */
+static int snapshot_refreshing = 0; // 1 - собирается следующий снимок
+static tracked_pid_t exited_pending[PID_TRACKER_MAX]; // Отложенные завершения
+static size_t exited_pending_count = 0;
+static unsigned long exits_dropped = 0; // Убрано процессов по pidfd
+
+/* Попадания запросов в снимок, изменяются атомарно */
+static unsigned long cache_hits = 0; // Запрос ответил по готовому снимку
+static unsigned long cache_misses = 0; // Запросу пришлось обойти /proc или ждать сборщик
+
+/* Условие отбора процессов, для которых сборщик читает maps или smaps */
+typedef struct maps_interest_s {
+	proc_matcher_t *matcher; /* условие отбора, по нему сверяется имя */
+	unsigned sources; /* какие файлы читать, из proc_sources */
+	int tree; /* 1 - файлы читаются и у всех потомков отобранных процессов */
+} maps_interest_t;
+
+/* Условия отбора процессов, для которых сборщик считает области памяти */
+static maps_interest_t *maps_interest = NULL;
+static size_t maps_interest_count = 0;
+
+/* 1 - ядро не поддерживает smaps_rollup, читается smaps */
+static int smaps_rollup_missing = 0;
+
+/* Планы получения параметров, по номеру параметра из proc_params.
+ * Резидентная и виртуальная память есть в stat, который читается при
+ * обходе в любом случае, поэтому statm и maps для них не нужны */
+static const param_plan_t param_plans[] = {
+	/* PARAM             SOURCE        CHECK  MAXIMUM */
+	[PROC_VMRSS] = {SOURCE_STAT, SOURCE_STATM},
+	[PROC_MAP] = {SOURCE_STAT, SOURCE_MAPS},
+	[PROC_MAP_SHARED] = {SOURCE_MAPS, 0},
+	[PROC_MAP_RW] = {SOURCE_MAPS, 0},
+	[PROC_PSS] = {SOURCE_SMAPS, 0},
+	[PROC_USS] = {SOURCE_SMAPS, 0},
+	[PROC_SWAP] = {SOURCE_SMAPS, 0},
+	[PROC_ANONHUGE] = {SOURCE_SMAPS, 0},
+	[PROC_CPU] = {SOURCE_STAT, 0},
+	[PROC_MINFLT_RATE] = {SOURCE_STAT, 0},
+	[PROC_MAJFLT_RATE] = {SOURCE_STAT, 0},
+	[PROC_CTXSW_RATE] = {SOURCE_STATUS, 0},
+	[PROC_IO_READ_BYTES] = {SOURCE_IO, 0},
+	[PROC_IO_WRITE_BYTES] = {SOURCE_IO, 0},
+	[PROC_IO_SYSCR] = {SOURCE_IO, 0},
+	[PROC_IO_SYSCW] = {SOURCE_IO, 0},
+	[PROC_IO_READ_BYTES_RATE] = {SOURCE_IO, 0},
+	[PROC_IO_WRITE_BYTES_RATE] = {SOURCE_IO, 0},
+	[PROC_IO_SYSCR_RATE] = {SOURCE_IO, 0},
+	[PROC_IO_SYSCW_RATE] = {SOURCE_IO, 0},
+	[PROC_FDS] = {SOURCE_FDS, 0},
+	[PROC_FDS_MAXPCT] = {SOURCE_FDS, 0, 1}
+};
+
+#define PARAM_PLANS_COUNT (sizeof(param_plans) / sizeof(param_plans[0]))
+
+/* Счётчики режима ValidateSources, изменяются под snapshot_lock */
+static unsigned long source_checks = 0; // Выполнено сверок источников
+static unsigned long source_mismatches = 0; // Из них с расхождением
+
+unsigned long get_proc_value_summ(char *proc_name, char *user_name, char *cmdline, int param);
+unsigned long get_proc_tree_summ(char *proc_name, char *user_name, char *cmdline, int param);
+int is_valid_dir(DIR *directory, struct dirent *dir_entry, const uid_filter_t *filter);
+unsigned long get_snapshot_walks_saved(void);
+unsigned long get_source_mismatches(void);
+unsigned long get_exits_dropped(void);
+char *get_proc_discovery(const char *include, const char *exclude);
+char *get_proc_summary(char *proc_name, char *user_name, char *cmdline);
+void add_maps_totals(linux_maps_totals_t *summ, const linux_maps_totals_t *totals);
+void release_proc_snapshot(void);
+int refresh_proc_snapshot(void);
+void lock_proc_snapshot(void);
+void unlock_proc_snapshot(void);
+void get_last_scan_stats(proc_scan_stats_t *stats);
+void get_total_scan_stats(proc_scan_stats_t *stats);
+void count_scan_stats(const proc_scan_stats_t *stats);
+int is_host_proc(void);
+double get_cache_hit_ratio(void);
+#ifdef LINUX_PROC
+unsigned long get_snapshot_value_summ(proc_matcher_t *matcher, const uid_filter_t *filter, int param,
+	int tree);
+unsigned long get_collected_value_summ(proc_matcher_t *matcher, const uid_filter_t *filter, int param,
+	int tree);
+void get_snapshot_summary(proc_matcher_t *matcher, const uid_filter_t *filter, proc_summary_t *summary);
+void summarize_proc_snapshot(proc_snapshot_t *snap, proc_matcher_t *matcher,
+	const uid_filter_t *filter, proc_summary_t *summary, int *missing);
+unsigned long summ_proc_snapshot(proc_snapshot_t *snap, proc_matcher_t *matcher,
+	const uid_filter_t *filter, int param, int *missing);
+int summ_proc_aggregates(proc_snapshot_t *snap, proc_matcher_t *matcher,
+	const uid_filter_t *filter, int param, unsigned long *result);
+proc_aggregates_t *get_snapshot_aggregates(proc_snapshot_t *snap);
+unsigned long summ_proc_tree(proc_snapshot_t *snap, proc_matcher_t *matcher,
+	const uid_filter_t *filter, int param, int *missing);
+proc_tree_t *get_snapshot_tree(proc_snapshot_t *snap);
+unsigned long get_entry_value(proc_entry_t *entry, const param_plan_t *plan, int param,
+	proc_walker_t *walker, char *fbuf, int *missing);
+proc_snapshot_t *acquire_proc_snapshot(void);
+proc_snapshot_t *hold_proc_snapshot(void);
+void drop_proc_snapshot(void);
+void wait_proc_snapshot(unsigned long generation);
+size_t group_proc_snapshot(proc_snapshot_t *snap, const char *include,
+	const char *exclude, proc_group_t **result);
+int is_group_excluded(const char *comm, const char *include, const char *exclude);
+int compare_proc_groups(const void *first, const void *second);
+void get_user_name(long uid, char *name, size_t size);
+int add_maps_interest(proc_matcher_t *matcher, unsigned sources, int tree);
+unsigned get_maps_interest(const char *comm);
+size_t want_tree_interest(proc_snapshot_t *snap);
+const param_plan_t *get_param_plan(int param);
+unsigned get_param_sources(int param);
+int is_entry_pending(const proc_entry_t *entry, unsigned sources);
+int is_state_pending(int state);
+char *open_entry_files(proc_walker_t *walker);
+unsigned long add_param_value(const param_plan_t *plan, unsigned long total, unsigned long value);
+void check_entry_sources(proc_entry_t *entry, proc_walker_t *walker, char *fbuf);
+int match_entry_cmdline(proc_matcher_t *matcher, proc_entry_t *entry, proc_walker_t *walker,
+	char *fbuf);
+void count_source_check(int matched);
+unsigned long get_page_size(void);
+unsigned long get_rss_check_slack(void);
+unsigned long long get_boot_clock(void);
+unsigned long get_counter_rate(unsigned long long previous, unsigned long long current,
+	unsigned long long elapsed, double per_unit);
+void update_entry_rates(proc_entry_t *entry, const linux_stat_t *stat);
+int load_entry_status(proc_entry_t *entry, proc_walker_t *walker, char *fbuf);
+int load_entry_io(proc_entry_t *entry, proc_walker_t *walker, char *fbuf);
+int load_entry_fds(proc_entry_t *entry, proc_walker_t *walker, char *fbuf);
+int update_proc_snapshot(proc_snapshot_t *snap, proc_snapshot_t *prev);
+int apply_proc_events(proc_snapshot_t *snap, proc_snapshot_t *prev);
+void collect_proc_change(void *context, int pid, int kind);
+int compare_proc_changes(const void *first, const void *second);
+const proc_change_t *find_proc_change(const proc_changes_t *changes, int pid);
+int walk_proc_snapshot(proc_snapshot_t *snap, proc_snapshot_t *prev);
+int track_proc_entry(proc_entry_t *entry);
+void drop_exited_entries(proc_snapshot_t *snap);
+size_t remove_exited_entries(proc_snapshot_t *snap, const tracked_pid_t *exited, size_t count);
+int walk_proc_parallel(proc_snapshot_t *snap, proc_snapshot_t *prev);
+int scan_proc_entry(proc_walker_t *walker, proc_pid_t *pid, proc_snapshot_t *prev,
+	int changed, proc_entry_t *entry);
+void scan_pids_task(void *context, unsigned worker, size_t begin, size_t end);
+size_t want_proc_entries(proc_snapshot_t *snap, proc_matcher_t *matcher, const uid_filter_t *filter,
+	unsigned sources);
+int want_entry_sources(proc_entry_t *entry, unsigned sources);
+void load_wanted_entries(proc_snapshot_t *snap);
+void load_entries_task(void *context, unsigned worker, size_t begin, size_t end);
+int open_scan_worker(scan_job_t *job, unsigned worker, int need_buffer);
+void close_scan_job(scan_job_t *job, proc_scan_stats_t *stats);
+void add_scan_stats(proc_scan_stats_t *total, const proc_scan_stats_t *stats);
+int reserve_snapshot_entries(proc_snapshot_t *snap, size_t count);
+proc_entry_t *add_snapshot_entry(proc_snapshot_t *snap);
+int index_proc_snapshot(proc_snapshot_t *snap);
+proc_entry_t *find_snapshot_entry(proc_snapshot_t *snap, int pid);
+int read_linux_stat(proc_walker_t *walker, proc_pid_t *pid, linux_stat_t *stat, int last_field);
+int load_entry_stat(proc_entry_t *entry, proc_walker_t *walker);
+int load_entry_maps(proc_entry_t *entry, proc_walker_t *walker, char *fbuf);
+unsigned long get_entry_maps(proc_entry_t *entry, proc_walker_t *walker, char *fbuf, int mode);
+unsigned long get_entry_smaps(proc_entry_t *entry, proc_walker_t *walker, char *fbuf, int mode);
+#endif
+int read_linux_maps_totals(proc_walker_t *walker, proc_pid_t *pid, char *fbuf,
+	linux_maps_totals_t *totals);
+int read_linux_smaps_totals(proc_walker_t *walker, proc_pid_t *pid, char *fbuf,
+	linux_smaps_totals_t *totals);
+unsigned long select_stat_total(proc_entry_t *entry, int mode);
+unsigned long select_aggregate_total(const proc_aggregate_t *item, int mode);
+unsigned long select_io_total(proc_entry_t *entry, int mode);
+unsigned long select_fds_total(proc_entry_t *entry, int mode);
+unsigned long select_maps_total(linux_maps_totals_t *totals, int mode);
+unsigned long select_smaps_total(linux_smaps_totals_t *totals, int mode);
 
 #if defined(__sun) && defined(__SVR4)
-unsigned long get_vmrss_solaris(char *pid_dir, char *fbuf, char *proc_name);
+unsigned long get_vmrss_solaris(char *pid_dir, char *fbuf, proc_matcher_t *matcher);
 psinfo_t *read_solaris_psinfo(char *pid_dir, char *fbuf);
-unsigned long calc_solaris_proc_map(char *pid_dir, char *proc_name, char* fbuf, int mode);
-int is_valid_solaris_proc(char *pid_dir, char *proc_name, char *fbuf);
+unsigned long calc_solaris_proc_map(char *pid_dir, proc_matcher_t *matcher, char* fbuf, int mode);
+int is_valid_solaris_proc(char *pid_dir, proc_matcher_t *matcher, char *fbuf);
+#endif
+
+/*
+int main()
+{
+	printf("bash: %lu\n", get_proc_value_summ("java", "tomcat", PROC_VMRSS));
+	return 0;
+}
+ */
+
+/**
+ * Просчитывает сумму значений параметра одноимённых процессов.
+ * Для Unix-систем.
+ * Сейчас поддерживается:
+ * - Linux, Cygwin-Windows, Solaris (VmRSS, подсчёт размера областей памяти)
+ * // дополнять список по мере разработки
+ *
+ * @param proc_name	имя процесса или шаблон имени, см. acquire_proc_matcher()
+ * @param user_name	имя пользователя, может быть NULL.
+ *                      Если указанный пользователь не будет найден, то
+ *                      функция вернёт 0. Если будет указан NULL, то фильтрации
+ *                      по имени пользователя производиться не будет.
+ * @param cmdline	шаблон командной строки, может быть NULL
+ * @param param		рассчитываемый параметр.
+ * 			Берётся из proc_params
+ * @return 		значений параметра одноимённого процесса.
+ */
+unsigned long get_proc_value_summ(char *proc_name, char *user_name, char *cmdline, int param)
+{
+	// Определяем фильтр по владельцу: имя, UID или группа
+	uid_filter_t filter;
+	proc_matcher_t *matcher;
+
+	if (resolve_uid_filter(user_name, &filter) < 0)
+		return 0;
+
+	// и условие отбора по имени и командной строке, из кэша шаблонов
+	matcher = acquire_proc_matcher(proc_name, cmdline);
+	if (matcher == NULL) {
+		release_uid_filter(&filter);
+		return 0;
+	}
+
+#ifdef LINUX_PROC
+	unsigned long result;
+
+	// Отвечаем по снимку /proc. Если снимок старше SnapshotTTL, или
+	// SnapshotTTL равен 0 - запрос сам обходит /proc
+	if (module_config.collector_interval > 0)
+		result = get_collected_value_summ(matcher, &filter, param, 0);
+	else
+		result = get_snapshot_value_summ(matcher, &filter, param, 0);
+
+	release_proc_matcher(matcher);
+	release_uid_filter(&filter);
+	return result;
+#else
+	DIR *directory;
+	struct dirent *direntry;
+
+	directory = opendir(module_config.proc_root);
+	if (directory == NULL) {
+		release_proc_matcher(matcher);
+		release_uid_filter(&filter);
+		return 0;
+	}
+
+	unsigned long result = 0, pids = 0;
+	unsigned long long started;
+	char *fbuf = self_malloc(sizeof(char) * NBUF_SIZE);
+
+	TRACE_BEGIN(started);
+
+	// Обрабатываем список pid-каталогов в /proc
+	while ((direntry = readdir(directory))) {
+		if (strcmp(".", direntry->d_name) == 0 || strcmp("..", direntry->d_name) == 0)
+			continue;
+		++pids;
+
+		if (is_valid_dir(directory, direntry, &filter)) {
+			switch (param) {
+			case PROC_VMRSS:
+#if defined(__sun) && defined(__SVR4)
+				// реализация для solaris и opensolaris/openindiana
+				result += get_vmrss_solaris(direntry->d_name, fbuf, matcher);
+#endif
+				break;
+			case PROC_MAP:
+			case PROC_MAP_SHARED:
+			case PROC_MAP_RW:
+#if defined(__sun) && defined(__SVR4)
+				result += calc_solaris_proc_map(direntry->d_name, matcher, fbuf, param);
+#endif
+				break;
+			}
+		}
+	}
+
+	free(fbuf);
+	closedir(directory);
+	release_proc_matcher(matcher);
+	release_uid_filter(&filter);
+	TRACE_END(started, TRACE_WALK, 0, pids);
+
+	return result;
+#endif /* LINUX_PROC */
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Просчитывает сумму значений параметра процессов, подходящих под условие,
+ * и всех их потомков, с любыми именами и владельцами. Потомок, подходящий
+ * под условие сам, учитывается один раз. Только для Linux.
+ *
+ * @param proc_name	имя процесса или шаблон имени, см. acquire_proc_matcher()
+ * @param user_name	владелец отбираемых процессов, может быть NULL
+ * @param cmdline	шаблон командной строки, может быть NULL
+ * @param param		рассчитываемый параметр, из proc_params
+ * @return		сумма значений параметра по деревьям процессов
+ */
+unsigned long get_proc_tree_summ(char *proc_name, char *user_name, char *cmdline, int param)
+{
+#ifdef LINUX_PROC
+	unsigned long result;
+	uid_filter_t filter;
+	proc_matcher_t *matcher;
+
+	if (resolve_uid_filter(user_name, &filter) < 0)
+		return 0;
+
+	matcher = acquire_proc_matcher(proc_name, cmdline);
+	if (matcher == NULL) {
+		release_uid_filter(&filter);
+		return 0;
+	}
+
+	if (module_config.collector_interval > 0)
+		result = get_collected_value_summ(matcher, &filter, param, 1);
+	else
+		result = get_snapshot_value_summ(matcher, &filter, param, 1);
+
+	release_proc_matcher(matcher);
+	release_uid_filter(&filter);
+	return result;
+#else
+	return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число запросов, на которые был дан ответ по уже собранному
+ * снимку /proc, т.е. число сэкономленных обходов /proc.
+ * @return	число сэкономленных обходов
+ */
+unsigned long get_snapshot_walks_saved(void)
+{
+	unsigned long result;
+
+	pthread_mutex_lock(&snapshot_lock);
+	result = snapshot_walks_saved;
+	pthread_mutex_unlock(&snapshot_lock);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Освобождает память, занятую снимками /proc.
+ * Сборщик к этому моменту должен быть остановлен.
+ */
+void release_proc_snapshot(void)
+{
+	size_t i;
+
+	pthread_mutex_lock(&snapshot_lock);
+	for (i = 0; i < 2; ++i) {
+		free(snapshots[i].entries);
+		free(snapshots[i].index);
+		release_proc_aggregates(&snapshots[i].aggregates);
+		release_proc_tree(&snapshots[i].tree);
+	}
+	memset(snapshots, 0, sizeof(snapshots));
+	snapshot = NULL;
+
+	close_proc_events();
+	memset(&last_full_walk, 0, sizeof(last_full_walk));
+
+	release_pid_tracker();
+	exited_pending_count = 0;
+
+	for (i = 0; i < maps_interest_count; ++i)
+		release_proc_matcher(maps_interest[i].matcher);
+	free(maps_interest);
+	maps_interest = NULL;
+	maps_interest_count = 0;
+	pthread_mutex_unlock(&snapshot_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число расхождений между дешёвыми и дорогими источниками
+ * значений, найденных в режиме ValidateSources.
+ * @return	число расхождений
+ */
+unsigned long get_source_mismatches(void)
+{
+	unsigned long result;
+
+	pthread_mutex_lock(&snapshot_lock);
+	result = source_mismatches;
+	pthread_mutex_unlock(&snapshot_lock);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число процессов, убранных из снимка сразу после завершения
+ * в режиме PidfdTracking.
+ * @return	число убранных процессов
+ */
+unsigned long get_exits_dropped(void)
+{
+	unsigned long result;
+
+	pthread_mutex_lock(&snapshot_lock);
+	result = exits_dropped;
+	pthread_mutex_unlock(&snapshot_lock);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает JSON низкоуровневого обнаружения Zabbix: по одной записи на
+ * каждую пару (имя процесса, владелец) с числом таких процессов.
+ * Строится по одному снимку /proc.
+ *
+ * @param include	шаблон имён процессов (fnmatch), которые попадают
+ *			в результат. NULL или "" - все имена.
+ * @param exclude	шаблон имён процессов, которые в результат не
+ *			попадают. NULL или "" - не отбрасывать ничего.
+ * @return		JSON, освобождается через free(). NULL - не хватило
+ *			памяти.
+ */
+char *get_proc_discovery(const char *include, const char *exclude)
+{
+	str_buffer_t json;
+	char user_name[USER_NAME_SIZE];
+
+	str_buffer_init(&json);
+	str_buffer_printf(&json, "{\"data\":[");
+
+#ifdef LINUX_PROC
+	proc_snapshot_t *snap = hold_proc_snapshot();
+	proc_group_t *groups = NULL;
+	size_t count = 0, i;
+
+	if (snap != NULL)
+		count = group_proc_snapshot(snap, include, exclude, &groups);
+	drop_proc_snapshot();
+
+	// Группы упорядочены по владельцу - имя пользователя ищется один раз
+	// на владельца
+	for (i = 0; i < count; ++i) {
+		if (i == 0 || groups[i].uid != groups[i - 1].uid)
+			get_user_name(groups[i].uid, user_name, sizeof(user_name));
+
+		str_buffer_printf(&json, "%s{\"{#PROCNAME}\":", i > 0 ? "," : "");
+		str_buffer_json(&json, groups[i].comm);
+		str_buffer_printf(&json, ",\"{#USER}\":");
+		str_buffer_json(&json, user_name);
+		str_buffer_printf(&json, ",\"{#INSTANCES}\":\"%lu\"}", groups[i].count);
+	}
+
+	free(groups);
+#endif
+
+	str_buffer_printf(&json, "]}");
+
+	return str_buffer_take(&json);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает JSON со сводкой по одноимённым процессам: число процессов,
+ * резидентная память и суммы областей памяти. Все значения берутся из
+ * одного снимка /proc, maps-файл каждого процесса разбирается один раз
+ * сразу для всех сумм.
+ *
+ * @param proc_name	имя процесса или шаблон имени
+ * @param user_name	имя пользователя, может быть NULL
+ * @param cmdline	шаблон командной строки, может быть NULL
+ * @return		JSON, освобождается через free(). NULL - не хватило
+ *			памяти.
+ */
+char *get_proc_summary(char *proc_name, char *user_name, char *cmdline)
+{
+	proc_summary_t summary;
+	str_buffer_t json;
+	uid_filter_t filter;
+	proc_matcher_t *matcher;
+
+	memset(&summary, 0, sizeof(proc_summary_t));
+	if (resolve_uid_filter(user_name, &filter) == 0) {
+#ifdef LINUX_PROC
+		matcher = acquire_proc_matcher(proc_name, cmdline);
+		if (matcher != NULL)
+			get_snapshot_summary(matcher, &filter, &summary);
+		release_proc_matcher(matcher);
+#else
+		// Без снимка /proc каждая сумма требует отдельного обхода
+		summary.rss = get_proc_value_summ(proc_name, user_name, cmdline, PROC_VMRSS);
+		summary.maps.all = get_proc_value_summ(proc_name, user_name, cmdline, PROC_MAP);
+		summary.maps.rw = get_proc_value_summ(proc_name, user_name, cmdline, PROC_MAP_RW);
+		summary.maps.shared = get_proc_value_summ(proc_name, user_name, cmdline, PROC_MAP_SHARED);
+#endif
+		release_uid_filter(&filter);
+	}
+
+	str_buffer_init(&json);
+	str_buffer_printf(&json, "{\"instances\":%lu,\"vmrss\":%lu,\"allmap\":%lu,"
+		"\"rwmap\":%lu,\"shmap\":%lu,\"execmap\":%lu,\"privmap\":%lu}",
+		summary.instances, summary.rss, summary.maps.all, summary.maps.rw,
+		summary.maps.shared, summary.maps.exec, summary.maps.priv);
+
+	return str_buffer_take(&json);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет суммы областей памяти процесса к общим суммам.
+ * @param summ		общие суммы
+ * @param totals	суммы областей памяти процесса
+ */
+void add_maps_totals(linux_maps_totals_t *summ, const linux_maps_totals_t *totals)
+{
+	summ->all += totals->all;
+	summ->rw += totals->rw;
+	summ->shared += totals->shared;
+	summ->exec += totals->exec;
+	summ->priv += totals->priv;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает счётчики последнего обхода /proc.
+ * @param stats	сюда будут помещены счётчики
+ */
+void get_last_scan_stats(proc_scan_stats_t *stats)
+{
+	pthread_mutex_lock(&snapshot_lock);
+	*stats = last_scan_stats;
+	pthread_mutex_unlock(&snapshot_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает счётчики всех чтений /proc с запуска: обходов и чтения
+ * файлов процессов, попавших в запросы.
+ * @param stats	сюда будут помещены счётчики
+ */
+void get_total_scan_stats(proc_scan_stats_t *stats)
+{
+	stats->pids = __sync_fetch_and_add(&total_scan_stats.pids, 0);
+	stats->syscalls = __sync_fetch_and_add(&total_scan_stats.syscalls, 0);
+	stats->files_opened = __sync_fetch_and_add(&total_scan_stats.files_opened, 0);
+	stats->bytes_read = __sync_fetch_and_add(&total_scan_stats.bytes_read, 0);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет счётчики чтения /proc к счётчикам с запуска. Вызывается как
+ * под snapshot_lock, так и без неё, поэтому счётчики изменяются атомарно.
+ * @param stats	счётчики одного чтения
+ */
+void count_scan_stats(const proc_scan_stats_t *stats)
+{
+	__sync_fetch_and_add(&total_scan_stats.pids, stats->pids);
+	__sync_fetch_and_add(&total_scan_stats.syscalls, stats->syscalls);
+	__sync_fetch_and_add(&total_scan_stats.files_opened, stats->files_opened);
+	__sync_fetch_and_add(&total_scan_stats.bytes_read, stats->bytes_read);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает долю запросов, ответивших по уже собранному снимку, без
+ * обхода /proc и без ожидания сборщика.
+ * @return	доля, от 0 до 1. 0 - запросов ещё не было.
+ */
+double get_cache_hit_ratio(void)
+{
+	unsigned long hits = __sync_fetch_and_add(&cache_hits, 0);
+	unsigned long misses = __sync_fetch_and_add(&cache_misses, 0);
+
+	return hits + misses > 0 ? (double) hits / (hits + misses) : 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет, читается ли настоящий /proc хоста. proc connector и pidfd
+ * сообщают о процессах хоста, к другому каталогу (ProcRoot) и к образу
+ * /proc они неприменимы.
+ * @return	1 - читается /proc. 0 - другой каталог или образ.
+ */
+int is_host_proc(void)
+{
+	return !is_proc_image_attached() && strcmp(module_config.proc_root, "/proc") == 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Захватывает блокировку текущего снимка /proc.
+ */
+void lock_proc_snapshot(void)
+{
+	pthread_mutex_lock(&snapshot_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Освобождает блокировку текущего снимка /proc.
+ */
+void unlock_proc_snapshot(void)
+{
+	pthread_mutex_unlock(&snapshot_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает новый снимок /proc и делает его текущим.
+ * Для процессов, имена которых уже запрашивались у сборщика, сразу
+ * считаются области памяти и читается smaps.
+ *
+ * @return	1 - снимок обновлён. 0 - /proc прочитать не удалось.
+ */
+int refresh_proc_snapshot(void)
+{
+#ifdef LINUX_PROC
+	proc_snapshot_t *next = snapshot == snapshots ? snapshots + 1 : snapshots;
+	size_t i, wanted = 0;
+	struct timespec started, finished;
+	unsigned sources;
+	int updated;
+
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_refreshing = 1;
+	pthread_mutex_unlock(&snapshot_lock);
+
+	updated = update_proc_snapshot(next, snapshot);
+	if (!updated) {
+		pthread_mutex_lock(&snapshot_lock);
+		snapshot_refreshing = 0;
+		pthread_mutex_unlock(&snapshot_lock);
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &next->taken);
+	next->valid = 1;
+
+	// Отмечаем процессы, для которых нужны области памяти или smaps
+	pthread_mutex_lock(&snapshot_lock);
+	if (maps_interest_count > 0) {
+		for (i = 0; i < next->count; ++i) {
+			sources = get_maps_interest(next->entries[i].comm);
+			if ((sources & SOURCE_STAT) && next->entries[i].stat_state == MAPS_NONE)
+				next->entries[i].stat_state = MAPS_WANTED;
+			if ((sources & SOURCE_STATUS) && next->entries[i].status_state == MAPS_NONE)
+				next->entries[i].status_state = MAPS_WANTED;
+			if ((sources & SOURCE_IO) && next->entries[i].io_state == MAPS_NONE)
+				next->entries[i].io_state = MAPS_WANTED;
+			if ((sources & SOURCE_FDS) && next->entries[i].fds_state == MAPS_NONE)
+				next->entries[i].fds_state = MAPS_WANTED;
+			if (sources & SOURCE_MAPS)
+				next->entries[i].maps_state = MAPS_WANTED;
+			if (sources & SOURCE_SMAPS)
+				next->entries[i].smaps_state = MAPS_WANTED;
+			if (sources && module_config.validate_sources)
+				next->entries[i].check_state = MAPS_WANTED;
+			if (sources)
+				++wanted;
+		}
+		wanted += want_tree_interest(next);
+	}
+	pthread_mutex_unlock(&snapshot_lock);
+
+	// и считаем их вне блокировки
+	if (wanted > 0)
+		load_wanted_entries(next);
+
+	// Процессы, завершившиеся во время сборки, в новый снимок не попадают
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_refreshing = 0;
+	remove_exited_entries(next, exited_pending, exited_pending_count);
+	exited_pending_count = 0;
+	drop_exited_entries(next);
+	snapshot = next;
+	++snapshot_generation;
+	++snapshot_walks;
+	pthread_cond_broadcast(&snapshot_updated);
+	pthread_mutex_unlock(&snapshot_lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	count_self_scan((finished.tv_sec - started.tv_sec) * 1000000000ULL +
+		finished.tv_nsec - started.tv_nsec);
+
+	return 1;
+#else
+	return 0;
 #endif
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef LINUX_PROC
+
+/**
+ * Просчитывает сумму значений параметра одноимённых процессов по снимку /proc.
+ * Снимок обновляется самим запросом, если он старше SnapshotTTL.
+ * Результат совпадает с результатом обхода /proc в get_proc_value_summ.
+ *
+ * @param matcher	условие отбора процессов
+ * @param filter	фильтр по владельцу процесса
+ * @param param		рассчитываемый параметр, из proc_params
+ * @param tree		1 - суммировать и потомков отобранных процессов
+ * @return		сумма значений параметра одноимённых процессов
+ */
+unsigned long get_snapshot_value_summ(proc_matcher_t *matcher, const uid_filter_t *filter, int param,
+	int tree)
+{
+	proc_snapshot_t *snap = acquire_proc_snapshot();
+	if (snap == NULL)
+		return 0;
+
+	if (tree)
+		return summ_proc_tree(snap, matcher, filter, param, NULL);
+
+	return summ_proc_snapshot(snap, matcher, filter, param, NULL);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Просчитывает сумму значений параметра одноимённых процессов по снимку,
+ * собранному фоновым сборщиком. Сам запрос /proc не читает, поэтому время
+ * ответа не зависит от числа процессов.
+ *
+ * Если по процессу ещё не считались области памяти или smaps, имя процесса
+ * передаётся сборщику, и запрос ждёт следующего снимка не дольше
+ * CollectorWait миллисекунд.
+ *
+ * @param matcher	условие отбора процессов
+ * @param filter	фильтр по владельцу процесса
+ * @param param		рассчитываемый параметр, из proc_params
+ * @param tree		1 - суммировать и потомков отобранных процессов
+ * @return		сумма значений параметра одноимённых процессов
+ */
+unsigned long get_collected_value_summ(proc_matcher_t *matcher, const uid_filter_t *filter, int param,
+	int tree)
+{
+	unsigned long result = 0;
+	int missing = 0;
+
+	if (hold_proc_snapshot() != NULL) {
+		result = tree ? summ_proc_tree(snapshot, matcher, filter, param, &missing) :
+			summ_proc_snapshot(snapshot, matcher, filter, param, &missing);
+
+		if (missing > 0 && add_maps_interest(matcher, get_param_sources(param), tree)) {
+			wakeup_collector();
+			wait_proc_snapshot(snapshot_generation);
+			result = tree ? summ_proc_tree(snapshot, matcher, filter, param, &missing) :
+				summ_proc_snapshot(snapshot, matcher, filter, param, &missing);
+		}
+	}
+
+	drop_proc_snapshot();
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает сводку по одноимённым процессам из снимка /proc. Если работает
+ * сборщик и по части процессов ещё не считались области памяти - имя
+ * процесса передаётся сборщику, и запрос ждёт следующего снимка не дольше
+ * CollectorWait миллисекунд.
+ *
+ * @param matcher	условие отбора процессов
+ * @param filter	фильтр по владельцу процесса
+ * @param summary	сюда будет помещена сводка
+ */
+void get_snapshot_summary(proc_matcher_t *matcher, const uid_filter_t *filter, proc_summary_t *summary)
+{
+	unsigned sources = get_param_sources(PROC_VMRSS) | get_param_sources(PROC_MAP_RW);
+	int collected = module_config.collector_interval > 0;
+	int missing = 0;
+
+	if (hold_proc_snapshot() != NULL) {
+		summarize_proc_snapshot(snapshot, matcher, filter, summary,
+			collected ? &missing : NULL);
+
+		if (missing > 0 && add_maps_interest(matcher, sources, 0)) {
+			wakeup_collector();
+			wait_proc_snapshot(snapshot_generation);
+			summarize_proc_snapshot(snapshot, matcher, filter, summary, &missing);
+		}
+	}
+
+	drop_proc_snapshot();
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает сводку по одноимённым процессам снимка за один проход:
+ * rss берётся из stat, суммы областей памяти - из одного разбора maps
+ * каждого процесса.
+ *
+ * @param snap		снимок /proc
+ * @param matcher	условие отбора процессов
+ * @param filter	фильтр по владельцу процесса
+ * @param summary	сюда будет помещена сводка
+ * @param missing	NULL - недостающие области памяти процессов
+ *			считываются сразу. Иначе сюда помещается число
+ *			процессов, по которым они не подсчитаны.
+ */
+void summarize_proc_snapshot(proc_snapshot_t *snap, proc_matcher_t *matcher,
+	const uid_filter_t *filter, proc_summary_t *summary, int *missing)
+{
+	proc_walker_t walker;
+	char *fbuf = NULL;
+	proc_entry_t *entry;
+	size_t i;
+	unsigned long long started;
+
+	TRACE_BEGIN(started);
+	memset(summary, 0, sizeof(proc_summary_t));
+	if (missing != NULL)
+		*missing = 0;
+
+	if (missing == NULL && module_config.scan_threads > 1 &&
+		want_proc_entries(snap, matcher, filter,
+		get_param_sources(PROC_VMRSS) | get_param_sources(PROC_MAP_RW)) > 0)
+		load_wanted_entries(snap);
+
+	for (i = 0; i < snap->count; ++i) {
+		entry = snap->entries + i;
+
+		if (!match_uid_filter(filter, entry->uid))
+			continue;
+		if (!match_proc_comm(matcher, entry->comm))
+			continue;
+
+		if (fbuf == NULL && (needs_proc_cmdline(matcher) ||
+			(missing == NULL && is_entry_pending(entry, SOURCE_STAT | SOURCE_MAPS)))) {
+			fbuf = open_entry_files(&walker);
+			if (fbuf == NULL) {
+				memset(summary, 0, sizeof(proc_summary_t));
+				break;
+			}
+		}
+
+		if (!match_entry_cmdline(matcher, entry, &walker, fbuf))
+			continue;
+		if (!track_proc_entry(entry))
+			continue;
+
+		++summary->instances;
+
+		if (missing == NULL)
+			load_entry_stat(entry, &walker);
+		if (entry->stat_state == MAPS_READY)
+			summary->rss += entry->rss;
+		else if (missing != NULL && entry->stat_state != MAPS_FAILED)
+			++(*missing);
+
+		if (module_config.validate_sources && entry->check_state != MAPS_READY) {
+			if (missing != NULL)
+				++(*missing);
+			else
+				check_entry_sources(entry, &walker, fbuf);
+		}
+
+		if (missing != NULL) {
+			if (entry->maps_state == MAPS_READY)
+				add_maps_totals(&summary->maps, &entry->maps);
+			else if (entry->maps_state != MAPS_FAILED)
+				++(*missing);
+			continue;
+		}
+
+		if (load_entry_maps(entry, &walker, fbuf))
+			add_maps_totals(&summary->maps, &entry->maps);
+	}
+
+	if (fbuf != NULL) {
+		close_proc_walker(&walker);
+		count_scan_stats(&walker.stats);
+		free(fbuf);
+	}
+	TRACE_END(started, TRACE_AGGREGATE, 0, summary->instances);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Суммирует значения параметра одноимённых процессов снимка.
+ *
+ * @param snap		снимок /proc
+ * @param matcher	условие отбора процессов
+ * @param filter	фильтр по владельцу процесса
+ * @param param		рассчитываемый параметр, из proc_params
+ * @param missing	NULL - недостающие области памяти и smaps процессов
+ *			считываются сразу. Иначе сюда помещается число
+ *			процессов, по которым они не подсчитаны.
+ * @return		сумма значений параметра одноимённых процессов
+ */
+unsigned long summ_proc_snapshot(proc_snapshot_t *snap, proc_matcher_t *matcher,
+	const uid_filter_t *filter, int param, int *missing)
+{
+	const param_plan_t *plan = get_param_plan(param);
+	unsigned long result = 0, matched = 0;
+	proc_walker_t walker;
+	char *fbuf = NULL;
+	proc_entry_t *entry;
+	size_t i;
+	unsigned long long started;
+	int aggregated;
+
+	if (missing != NULL)
+		*missing = 0;
+	if (plan == NULL)
+		return 0;
+
+	// Значение из stat по имени - берём из агрегатов снимка, не
+	// перебирая процессы
+	aggregated = summ_proc_aggregates(snap, matcher, filter, param, &result);
+	if (aggregated > 0)
+		return result;
+
+	TRACE_BEGIN(started);
+
+	// Несколько потоков чтения - недостающие файлы читаются пулом заранее
+	if (missing == NULL && module_config.scan_threads > 1 &&
+		want_proc_entries(snap, matcher, filter, get_param_sources(param)) > 0)
+		load_wanted_entries(snap);
+
+	for (i = 0; i < snap->count; ++i) {
+		entry = snap->entries + i;
+
+		if (!match_uid_filter(filter, entry->uid))
+			continue;
+		if (!match_proc_comm(matcher, entry->comm))
+			continue;
+
+		// Недостающие файлы и командная строка читаются сразу -
+		// /proc открывается при первом процессе, которому он нужен
+		if (fbuf == NULL && (needs_proc_cmdline(matcher) ||
+			(missing == NULL && is_entry_pending(entry, plan->source)))) {
+			fbuf = open_entry_files(&walker);
+			if (fbuf == NULL) {
+				result = 0;
+				break;
+			}
+		}
+
+		if (!match_entry_cmdline(matcher, entry, &walker, fbuf))
+			continue;
+		if (!track_proc_entry(entry))
+			continue;
+
+		++matched;
+		result = add_param_value(plan, result,
+			get_entry_value(entry, plan, param, &walker, fbuf, missing));
+	}
+
+	if (fbuf != NULL) {
+		close_proc_walker(&walker);
+		count_scan_stats(&walker.stats);
+		free(fbuf);
+	}
+
+	// Недостающие rss и VmSize дочитаны - агрегаты собираются заново
+	if (aggregated < 0 && missing == NULL)
+		snap->aggregates.valid = 0;
+	TRACE_END(started, TRACE_AGGREGATE, 0, matched);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает значение параметра процесса снимка. Недостающие файлы процесса
+ * дочитываются, либо, если их ждут от сборщика, учитываются в missing.
+ *
+ * @param entry		процесс из снимка
+ * @param plan		план получения параметра
+ * @param param		рассчитываемый параметр, из proc_params
+ * @param walker	состояние обхода /proc, открыто, если missing - NULL
+ * @param fbuf		буфер размером MBUF_SIZE, если missing - NULL
+ * @param missing	NULL - недостающие файлы считываются сразу. Иначе
+ *			здесь увеличивается число процессов, по которым
+ *			значение ещё не подсчитано.
+ * @return		значение параметра. 0 - значения нет.
+ */
+unsigned long get_entry_value(proc_entry_t *entry, const param_plan_t *plan, int param,
+	proc_walker_t *walker, char *fbuf, int *missing)
+{
+	if (module_config.validate_sources && entry->check_state != MAPS_READY) {
+		if (missing != NULL)
+			++(*missing);
+		else
+			check_entry_sources(entry, walker, fbuf);
+	}
+
+	switch (plan->source) {
+	case SOURCE_STAT:
+		if (missing == NULL)
+			load_entry_stat(entry, walker);
+		if (entry->stat_state == MAPS_READY)
+			return select_stat_total(entry, param);
+		if (missing != NULL && entry->stat_state != MAPS_FAILED)
+			++(*missing);
+		break;
+	case SOURCE_MAPS:
+		if (missing == NULL)
+			return get_entry_maps(entry, walker, fbuf, param);
+		if (entry->maps_state == MAPS_READY)
+			return select_maps_total(&entry->maps, param);
+		if (entry->maps_state != MAPS_FAILED)
+			++(*missing);
+		break;
+	case SOURCE_STATUS:
+		if (missing == NULL)
+			load_entry_status(entry, walker, fbuf);
+		if (entry->status_state == MAPS_READY)
+			return entry->counters.ctxsw_rate;
+		if (missing != NULL && entry->status_state != MAPS_FAILED)
+			++(*missing);
+		break;
+	case SOURCE_IO:
+		if (missing == NULL)
+			load_entry_io(entry, walker, fbuf);
+		if (entry->io_state == MAPS_READY)
+			return select_io_total(entry, param);
+		if (missing != NULL && entry->io_state != MAPS_FAILED)
+			++(*missing);
+		break;
+	case SOURCE_FDS:
+		if (missing == NULL)
+			load_entry_fds(entry, walker, fbuf);
+		if (entry->fds_state == MAPS_READY)
+			return select_fds_total(entry, param);
+		if (missing != NULL && entry->fds_state != MAPS_FAILED)
+			++(*missing);
+		break;
+	case SOURCE_SMAPS:
+		if (missing == NULL)
+			return get_entry_smaps(entry, walker, fbuf, param);
+		if (entry->smaps_state == MAPS_READY)
+			return select_smaps_total(&entry->smaps, param);
+		if (entry->smaps_state != MAPS_FAILED)
+			++(*missing);
+		break;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Суммирует значение параметра по агрегатам снимка: точное имя ищется
+ * в таблице имён, шаблон сверяется с каждым различным именем один раз.
+ * Процессы снимка при этом не перебираются, так что время ответа
+ * не зависит от их числа.
+ *
+ * Агрегаты не подходят, если значение берётся не из stat, условию нужна
+ * командная строка, включены ValidateSources или PidfdTracking - тогда
+ * каждый процесс проверяется отдельно.
+ *
+ * @param snap		снимок /proc
+ * @param matcher	условие отбора процессов
+ * @param filter	фильтр по владельцу процесса
+ * @param param		рассчитываемый параметр, из proc_params
+ * @param result	сюда будет помещена сумма
+ * @return		1 - сумма получена. 0 - агрегаты не подходят.
+ *			-1 - у части процессов stat ещё не прочитан.
+ */
+int summ_proc_aggregates(proc_snapshot_t *snap, proc_matcher_t *matcher,
+	const uid_filter_t *filter, int param, unsigned long *result)
+{
+	proc_aggregates_t *table;
+	const proc_aggregate_t *item;
+	unsigned name, last;
+	unsigned long summ = 0, matched = 0;
+	unsigned long long started;
+
+	if (get_param_plan(param)->source != SOURCE_STAT || needs_proc_cmdline(matcher) ||
+		module_config.validate_sources || module_config.pidfd_tracking)
+		return 0;
+
+	TRACE_BEGIN(started);
+	table = get_snapshot_aggregates(snap);
+	if (table == NULL)
+		return 0;
+
+	if (matcher->comm.kind == PATTERN_EXACT) {
+		last = find_proc_aggregate_name(table, matcher->comm.text);
+		name = last > 0 ? last - 1 : 0;
+	} else {
+		name = 0;
+		last = (unsigned) table->name_count;
+	}
+
+	for (; name < last; ++name) {
+		if (!match_proc_comm(matcher, get_proc_aggregate_name(table, name)))
+			continue;
+
+		for (item = first_proc_aggregate(table, name); item != NULL;
+			item = next_proc_aggregate(table, item)) {
+			if (!match_uid_filter(filter, item->uid))
+				continue;
+			if (item->pending > 0)
+				return -1;
+
+			matched += item->count;
+			summ += select_aggregate_total(item, param);
+		}
+	}
+
+	*result = summ;
+	TRACE_END(started, TRACE_AGGREGATE, 0, matched);
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает агрегаты снимка по паре (имя, владелец), собирая их за один
+ * проход по снимку, если снимок изменился с прошлого вызова. Вызывается
+ * под snapshot_lock, либо, без сборщика, единственным потоком запроса.
+ *
+ * @param snap	снимок /proc
+ * @return	агрегаты. NULL - не хватило памяти.
+ */
+proc_aggregates_t *get_snapshot_aggregates(proc_snapshot_t *snap)
+{
+	proc_aggregates_t *table = &snap->aggregates;
+	proc_aggregate_values_t values;
+	proc_entry_t *entry;
+	size_t i;
+
+	if (table->valid)
+		return table;
+
+	if (begin_proc_aggregates(table, snap->count) < 0)
+		return NULL;
+
+	for (i = 0; i < snap->count; ++i) {
+		entry = snap->entries + i;
+
+		// stat, который прочитать не удалось, в сумму не входит, но
+		// и дочитывать его не нужно
+		memset(&values, 0, sizeof(proc_aggregate_values_t));
+		if (entry->stat_state == MAPS_READY) {
+			values.rss = entry->rss;
+			values.vsize = entry->vsize;
+			values.cpu = entry->counters.cpu;
+			values.minflt = entry->counters.minflt_rate;
+			values.majflt = entry->counters.majflt_rate;
+		}
+		if (add_proc_aggregate(table, entry->comm, entry->uid,
+			entry->stat_state == MAPS_READY || entry->stat_state == MAPS_FAILED ?
+			&values : NULL) < 0)
+			return NULL;
+	}
+
+	table->valid = 1;
+
+	return table;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Суммирует значения параметра процессов снимка, подходящих под условие,
+ * и всех их потомков. Дерево процессов строится один раз на снимок,
+ * поддеревья обходятся за время, линейное по их размеру; процесс, попавший
+ * в несколько поддеревьев, учитывается один раз.
+ *
+ * @param snap		снимок /proc
+ * @param matcher	условие отбора корней
+ * @param filter	фильтр по владельцу корней
+ * @param param		рассчитываемый параметр, из proc_params
+ * @param missing	NULL - недостающие файлы процессов считываются
+ *			сразу. Иначе сюда помещается число процессов, по
+ *			которым значение ещё не подсчитано.
+ * @return		сумма значений параметра по деревьям
+ */
+unsigned long summ_proc_tree(proc_snapshot_t *snap, proc_matcher_t *matcher,
+	const uid_filter_t *filter, int param, int *missing)
+{
+	const param_plan_t *plan = get_param_plan(param);
+	unsigned long result = 0;
+	proc_walker_t walker;
+	char *fbuf = NULL;
+	proc_tree_t *tree;
+	proc_entry_t *entry;
+	size_t i, wanted = 0;
+	unsigned long long started;
+
+	if (missing != NULL)
+		*missing = 0;
+	if (plan == NULL)
+		return 0;
+
+	TRACE_BEGIN(started);
+	tree = get_snapshot_tree(snap);
+	if (tree == NULL)
+		return 0;
+
+	// Корни отбираются так же, как процессы обычного запроса
+	begin_proc_tree_walk(tree);
+	for (i = 0; i < snap->count; ++i) {
+		entry = snap->entries + i;
+
+		if (!match_uid_filter(filter, entry->uid))
+			continue;
+		if (!match_proc_comm(matcher, entry->comm))
+			continue;
+
+		if (fbuf == NULL && (needs_proc_cmdline(matcher) || missing == NULL)) {
+			fbuf = open_entry_files(&walker);
+			if (fbuf == NULL)
+				return 0;
+		}
+
+		if (match_entry_cmdline(matcher, entry, &walker, fbuf))
+			add_proc_subtree(tree, (unsigned) i);
+	}
+
+	// Потомки отобраны - недостающие файлы читаются пулом заранее
+	if (missing == NULL && module_config.scan_threads > 1) {
+		for (i = 0; i < tree->queued; ++i)
+			wanted += want_entry_sources(snap->entries + tree->queue[i],
+				get_param_sources(param));
+		if (wanted > 0)
+			load_wanted_entries(snap);
+	}
+
+	for (i = 0; i < tree->queued; ++i) {
+		entry = snap->entries + tree->queue[i];
+		if (track_proc_entry(entry))
+			result = add_param_value(plan, result,
+				get_entry_value(entry, plan, param, &walker, fbuf, missing));
+	}
+
+	if (fbuf != NULL) {
+		close_proc_walker(&walker);
+		count_scan_stats(&walker.stats);
+		free(fbuf);
+	}
+	TRACE_END(started, TRACE_AGGREGATE, 0, tree->queued);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает дерево процессов снимка, строя его, если снимок изменился
+ * с прошлого вызова. Родитель каждого процесса ищется по индексу PID,
+ * так что дерево строится за линейное время. Процесс, родителя которого
+ * в снимке нет, становится корнем. Вызывается под snapshot_lock, либо,
+ * без сборщика, единственным потоком запроса.
+ *
+ * @param snap	снимок /proc
+ * @return	дерево. NULL - не хватило памяти.
+ */
+proc_tree_t *get_snapshot_tree(proc_snapshot_t *snap)
+{
+	proc_tree_t *tree = &snap->tree;
+	proc_entry_t *parent;
+	size_t i;
+
+	if (tree->valid)
+		return tree;
+
+	if (reserve_proc_tree(tree, snap->count) < 0)
+		return NULL;
+
+	// При обновлении по событиям ppid сирот не перечитывается, и PID
+	// завершившегося родителя может получить новый процесс - такой
+	// "родитель" запущен позже ребёнка и не считается
+	for (i = 0; i < snap->count; ++i) {
+		parent = snap->entries[i].ppid > 0 ?
+			find_snapshot_entry(snap, snap->entries[i].ppid) : NULL;
+		if (parent != NULL && parent->starttime > snap->entries[i].starttime)
+			parent = NULL;
+		tree->parents[i] = parent != NULL ? (unsigned) (parent - snap->entries) + 1 : 0;
+	}
+
+	build_proc_tree(tree);
+
+	return tree;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает актуальный снимок /proc.
+ * Если снимок старше SnapshotTTL - выполняется новый обход /proc.
+ *
+ * @return	указатель на снимок. NULL - если /proc прочитать не удалось.
+ */
+proc_snapshot_t *acquire_proc_snapshot(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (snapshot != NULL && now.tv_sec - snapshot->taken.tv_sec < module_config.snapshot_ttl) {
+		drop_exited_entries(snapshot);
+		++snapshot_walks_saved;
+		__sync_fetch_and_add(&cache_hits, 1);
+		return snapshot;
+	}
+
+	__sync_fetch_and_add(&cache_misses, 1);
+	if (!refresh_proc_snapshot())
+		return NULL;
+
+	return snapshot;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает снимок /proc для чтения. Если работает сборщик, то захватывает
+ * snapshot_lock и, если снимка ещё нет или сборщик простаивал и снимок
+ * устарел, ждёт свежий снимок. Иначе снимок при необходимости собирается
+ * самим запросом. После чтения снимка нужно вызвать drop_proc_snapshot().
+ *
+ * @return	указатель на снимок. NULL - если /proc прочитать не удалось.
+ */
+proc_snapshot_t *hold_proc_snapshot(void)
+{
+	struct timespec now;
+
+	if (module_config.collector_interval == 0)
+		return acquire_proc_snapshot();
+
+	touch_collector();
+
+	pthread_mutex_lock(&snapshot_lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (snapshot == NULL ||
+		now.tv_sec - snapshot->taken.tv_sec > 2 * (time_t) module_config.collector_interval) {
+		__sync_fetch_and_add(&cache_misses, 1);
+		wakeup_collector();
+		wait_proc_snapshot(snapshot_generation);
+	} else {
+		__sync_fetch_and_add(&cache_hits, 1);
+	}
+
+	if (snapshot != NULL) {
+		drop_exited_entries(snapshot);
+		++snapshot_walks_saved;
+	}
+
+	return snapshot;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Завершает чтение снимка, полученного через hold_proc_snapshot().
+ */
+void drop_proc_snapshot(void)
+{
+	if (module_config.collector_interval > 0)
+		pthread_mutex_unlock(&snapshot_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Начинает отслеживать завершение процесса снимка, попавшего в запрос,
+ * если включён PidfdTracking и процесс ещё не отслеживается.
+ *
+ * @param entry	процесс снимка
+ * @return	1 - процесс учитывается в запросе. 0 - процесса уже нет.
+ */
+int track_proc_entry(proc_entry_t *entry)
+{
+	int result;
+
+	// Флаг читается сборщиком без snapshot_lock при переносе процесса
+	// в следующий снимок, поэтому доступ к нему атомарный
+	if (!module_config.pidfd_tracking ||
+		__sync_fetch_and_add(&entry->tracked, 0) || !is_host_proc())
+		return 1;
+
+	result = track_pid(module_config.proc_root, entry->pid, entry->starttime);
+	if (result > 0)
+		__sync_fetch_and_or(&entry->tracked, 1);
+
+	return result >= 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Убирает из снимка процессы, завершившиеся с момента прошлого вызова.
+ * Если в это время собирается следующий снимок, завершения откладываются
+ * до его подмены. Вызывается под snapshot_lock, либо, без сборщика,
+ * единственным потоком запроса.
+ *
+ * @param snap	снимок /proc
+ */
+void drop_exited_entries(proc_snapshot_t *snap)
+{
+	tracked_pid_t exited[EXITED_BATCH];
+	size_t count, i;
+
+	if (!module_config.pidfd_tracking)
+		return;
+
+	do {
+		count = take_exited_pids(exited, EXITED_BATCH);
+		if (!snapshot_refreshing) {
+			remove_exited_entries(snap, exited, count);
+			continue;
+		}
+
+		// Переполнение не страшно: сборка сама не найдёт этих процессов
+		for (i = 0; i < count && exited_pending_count < PID_TRACKER_MAX; ++i)
+			exited_pending[exited_pending_count++] = exited[i];
+	} while (count == EXITED_BATCH);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Убирает из снимка завершившиеся процессы. Процесс убирается, только если
+ * совпадает и время старта, иначе под тем же PID уже другой процесс.
+ * Порядок остальных процессов сохраняется, индекс перестраивается.
+ *
+ * @param snap		снимок /proc
+ * @param exited	завершившиеся процессы
+ * @param count		число завершившихся процессов
+ * @return		число убранных процессов
+ */
+size_t remove_exited_entries(proc_snapshot_t *snap, const tracked_pid_t *exited, size_t count)
+{
+	proc_entry_t *entry;
+	size_t i, kept = 0, removed = 0;
+
+	if (!snap->valid)
+		return 0;
+
+	// Сначала отмечаем, затем сжимаем снимок и перестраиваем индекс один раз
+	for (i = 0; i < count; ++i) {
+		entry = find_snapshot_entry(snap, exited[i].pid);
+		if (entry == NULL || entry->starttime != exited[i].starttime)
+			continue;
+
+		entry->pid = 0;
+		++removed;
+	}
+
+	if (removed == 0)
+		return 0;
+
+	for (i = 0; i < snap->count; ++i)
+		if (snap->entries[i].pid != 0)
+			snap->entries[kept++] = snap->entries[i];
+	snap->count = kept;
+	index_proc_snapshot(snap);
+	snap->aggregates.valid = 0;
+	snap->tree.valid = 0;
+
+	exits_dropped += removed;
+
+	return removed;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Ждёт, пока сборщик не соберёт снимок новее указанного, но не дольше
+ * CollectorWait миллисекунд. Вызывается под snapshot_lock.
+ *
+ * @param generation	номер снимка, который считается устаревшим
+ */
+void wait_proc_snapshot(unsigned long generation)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += module_config.collector_wait / 1000;
+	deadline.tv_nsec += (long) (module_config.collector_wait % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_nsec -= 1000000000L;
+		++deadline.tv_sec;
+	}
+
+	while (snapshot_generation == generation) {
+		if (pthread_cond_timedwait(&snapshot_updated, &snapshot_lock, &deadline) == ETIMEDOUT)
+			break;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет условие отбора к списку, по которому сборщик считает области
+ * памяти или читает smaps. Вызывается под snapshot_lock.
+ *
+ * @param matcher	условие отбора процессов
+ * @param sources	какие файлы читать, из proc_sources
+ * @param tree		1 - файлы нужны и потомкам отобранных процессов
+ * @return		1 - список изменился. 0 - эти файлы для имени уже
+ *			читаются, либо имя не удалось добавить.
+ */
+int add_maps_interest(proc_matcher_t *matcher, unsigned sources, int tree)
+{
+	size_t i;
+
+	for (i = 0; i < maps_interest_count; ++i) {
+		if (maps_interest[i].tree != tree ||
+			strcmp(maps_interest[i].matcher->key, matcher->key) != 0)
+			continue;
+		if ((maps_interest[i].sources & sources) == sources)
+			return 0;
+
+		maps_interest[i].sources |= sources;
+		return 1;
+	}
+
+	maps_interest_t *names = self_realloc(maps_interest,
+		(maps_interest_count + 1) * sizeof(maps_interest_t));
+	if (names == NULL)
+		return 0;
+	maps_interest = names;
+
+	maps_interest[maps_interest_count].matcher = matcher;
+	__sync_fetch_and_add(&matcher->refs, 1);
+	maps_interest[maps_interest_count].sources = sources;
+	maps_interest[maps_interest_count].tree = tree;
+	++maps_interest_count;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Определяет, какие файлы сборщик читает для процессов с таким именем.
+ * Командная строка не сверяется - файлы читаются с запасом, отбор
+ * выполняет запрос. Вызывается под snapshot_lock.
+ *
+ * @param comm	имя процесса
+ * @return	файлы, из proc_sources. 0 - никакие.
+ */
+unsigned get_maps_interest(const char *comm)
+{
+	unsigned sources = 0;
+	size_t i;
+
+	for (i = 0; i < maps_interest_count; ++i)
+		if (match_proc_comm(maps_interest[i].matcher, comm))
+			sources |= maps_interest[i].sources;
+
+	return sources;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Отмечает файлы, которые сборщик читает у потомков процессов, попавших
+ * в запросы по дереву. Сами отобранные процессы уже отмечены по имени.
+ * Вызывается под snapshot_lock.
+ *
+ * @param snap	собираемый снимок
+ * @return	число отмеченных процессов
+ */
+size_t want_tree_interest(proc_snapshot_t *snap)
+{
+	proc_tree_t *tree = NULL;
+	size_t i, k, wanted = 0;
+
+	for (i = 0; i < maps_interest_count; ++i) {
+		if (!maps_interest[i].tree)
+			continue;
+		if (tree == NULL && (tree = get_snapshot_tree(snap)) == NULL)
+			return wanted;
+
+		begin_proc_tree_walk(tree);
+		for (k = 0; k < snap->count; ++k)
+			if (match_proc_comm(maps_interest[i].matcher, snap->entries[k].comm))
+				add_proc_subtree(tree, (unsigned) k);
+
+		for (k = 0; k < tree->queued; ++k)
+			wanted += want_entry_sources(snap->entries + tree->queue[k],
+				maps_interest[i].sources);
+	}
+
+	return wanted;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверяет командную строку процесса с условием отбора, если условию она
+ * нужна. Командная строка читается один раз за время жизни процесса.
+ *
+ * @param matcher	условие отбора, имя процесса уже сверено
+ * @param entry		процесс из снимка
+ * @param walker	состояние обхода /proc, относительно которого
+ *			открывается cmdline
+ * @param fbuf		буфер размером MBUF_SIZE
+ * @return		1 - процесс подходит. 0 - нет, или его уже нет.
+ */
+int match_entry_cmdline(proc_matcher_t *matcher, proc_entry_t *entry, proc_walker_t *walker,
+	char *fbuf)
+{
+	if (!needs_proc_cmdline(matcher))
+		return 1;
+
+	if (read_proc_cmdline(walker, entry->pid, entry->starttime, fbuf, MBUF_SIZE) < 0)
+		return 0;
+
+	return match_proc_cmdline(matcher, fbuf);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает план получения параметра.
+ * @param param	параметр, из proc_params
+ * @return	план. NULL - неизвестный параметр.
+ */
+const param_plan_t *get_param_plan(int param)
+{
+	if (param < 0 || (size_t) param >= PARAM_PLANS_COUNT)
+		return NULL;
+
+	return param_plans + param;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Определяет, какие файлы процесса нужно прочитать для параметра сверх
+ * stat, с учётом сверки источников в режиме ValidateSources.
+ * @param param	параметр, из proc_params
+ * @return	файлы, из proc_sources. 0 - достаточно stat.
+ */
+unsigned get_param_sources(int param)
+{
+	const param_plan_t *plan = get_param_plan(param);
+	unsigned sources;
+
+	if (plan == NULL)
+		return 0;
+
+	sources = plan->source;
+	if (module_config.validate_sources)
+		sources |= plan->check | SOURCE_STAT;
+
+	return sources;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет, придётся ли читать файлы процесса снимка, чтобы получить
+ * значения из sources.
+ *
+ * @param entry		процесс из снимка
+ * @param sources	какие файлы нужны, из proc_sources
+ * @return		1 - часть файлов ещё не прочитана. 0 - всё готово.
+ */
+int is_entry_pending(const proc_entry_t *entry, unsigned sources)
+{
+	if (module_config.validate_sources && entry->check_state != MAPS_READY)
+		return 1;
+
+	return ((sources & SOURCE_STAT) && is_state_pending(entry->stat_state)) ||
+		((sources & SOURCE_STATUS) && is_state_pending(entry->status_state)) ||
+		((sources & SOURCE_IO) && is_state_pending(entry->io_state)) ||
+		((sources & SOURCE_FDS) && is_state_pending(entry->fds_state)) ||
+		((sources & SOURCE_MAPS) && is_state_pending(entry->maps_state)) ||
+		((sources & SOURCE_SMAPS) && is_state_pending(entry->smaps_state));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет, что файл процесса ещё не читался.
+ * @param state	состояние подсчёта, из maps_state
+ * @return	1 - не читался. 0 - значение готово или прочитать не удалось.
+ */
+int is_state_pending(int state)
+{
+	return state == MAPS_NONE || state == MAPS_WANTED;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Открывает /proc и выделяет буфер для дочитывания файлов процессов снимка.
+ *
+ * @param walker	сюда будет помещено состояние обхода /proc
+ * @return		буфер размером MBUF_SIZE. NULL - не хватило памяти
+ *			или /proc открыть не удалось.
+ */
+char *open_entry_files(proc_walker_t *walker)
+{
+	char *fbuf = self_malloc(sizeof(char) * MBUF_SIZE);
+
+	if (fbuf == NULL)
+		return NULL;
+	if (open_proc_walker(walker, module_config.proc_root) < 0) {
+		free(fbuf);
+		return NULL;
+	}
+
+	return fbuf;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет значение процесса к итогу по процессам: к сумме или, для
+ * параметров с maximum, к наибольшему значению.
+ * @param plan		план получения параметра
+ * @param total		итог по уже учтённым процессам
+ * @param value		значение процесса
+ * @return		новый итог
+ */
+unsigned long add_param_value(const param_plan_t *plan, unsigned long total, unsigned long value)
+{
+	if (plan->maximum)
+		return value > total ? value : total;
+
+	return total + value;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверяет значения, взятые из дешёвых источников, с дорогими: rss из stat
+ * с resident из statm и VmSize из stat с суммой областей maps. Выполняется
+ * в режиме ValidateSources, не больше одного раза за снимок для процесса.
+ *
+ * rss в stat ядро отдаёт без сведения счётчиков отдельных процессоров,
+ * поэтому для него допускается расхождение в пределах их накопления.
+ * VmSize меняется при каждом mmap/munmap, поэтому maps читается заново
+ * между двумя чтениями stat, и если VmSize за это время изменился, сверка
+ * не учитывается.
+ *
+ * @param entry		процесс из снимка
+ * @param walker	состояние обхода /proc
+ * @param fbuf		буфер размером MBUF_SIZE
+ */
+void check_entry_sources(proc_entry_t *entry, proc_walker_t *walker, char *fbuf)
+{
+	unsigned long page_size = get_page_size(), resident;
+	char buf[LINUX_STAT_BUF_SIZE];
+	linux_statm_t statm;
+	linux_stat_t before, after;
+	linux_maps_totals_t totals;
+	proc_pid_t pid;
+	ssize_t length;
+
+	entry->check_state = MAPS_READY;
+	if (!load_entry_stat(entry, walker))
+		return;
+	set_proc_pid(&pid, entry->pid);
+
+	length = read_pid_file(walker, &pid, "statm", buf, sizeof(buf));
+	if (length > 0 && parse_linux_statm(buf, length, &statm)) {
+		resident = statm.resident * page_size;
+		count_source_check((resident > entry->rss ? resident - entry->rss :
+			entry->rss - resident) <= get_rss_check_slack() * page_size);
+	}
+
+	if (read_linux_stat(walker, &pid, &before, STAT_UPTO_RSS) &&
+		read_linux_maps_totals(walker, &pid, fbuf, &totals) &&
+		read_linux_stat(walker, &pid, &after, STAT_UPTO_RSS) &&
+		before.starttime == entry->starttime && after.starttime == entry->starttime &&
+		before.vsize == after.vsize)
+		count_source_check(totals.all == after.vsize);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Учитывает результат сверки источников.
+ * @param matched	1 - значения совпали. 0 - расходятся.
+ */
+void count_source_check(int matched)
+{
+	pthread_mutex_lock(&snapshot_lock);
+	++source_checks;
+	if (!matched)
+		++source_mismatches;
+	pthread_mutex_unlock(&snapshot_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает допустимое расхождение rss из stat и statm: каждый из трёх
+ * счётчиков rss (файловые, анонимные и shmem-страницы) может накопить на
+ * каждом процессоре до RSS_COUNTER_BATCH страниц, но не меньше двух страниц
+ * на процессор в системе.
+ * @return	допустимое расхождение, в страницах
+ */
+unsigned long get_rss_check_slack(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	unsigned long batch;
+
+	if (cpus < 1)
+		cpus = 1;
+	batch = 2 * (unsigned long) cpus > RSS_COUNTER_BATCH ? 2 * (unsigned long) cpus : RSS_COUNTER_BATCH;
+
+	return 3 * batch * (unsigned long) cpus;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает размер страницы памяти, в которых linux указывает rss.
+ * @return	размер страницы, в байтах
+ */
+unsigned long get_page_size(void)
+{
+#if defined(__CYGWIN__) && !defined(_WIN32)
+	// У cygwin pagesize == 64k, для корректного рассчёта map.
+	// Что не подходит в нашем случае
+	return 4096;
+#else
+	return (unsigned long) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает время от загрузки системы - в тех же часах отсчитывается
+ * starttime процессов.
+ * @return	время, в нс
+ */
+unsigned long long get_boot_clock(void)
+{
+	struct timespec now;
+
+#ifdef CLOCK_BOOTTIME
+	clock_gettime(CLOCK_BOOTTIME, &now);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+
+	return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Считает скорость роста счётчика процесса.
+ * @param previous	значение счётчика при прошлом пересчёте
+ * @param current	текущее значение счётчика
+ * @param elapsed	время с прошлого пересчёта, в нс, больше 0
+ * @param per_unit	сколько единиц результата даёт единица счётчика
+ * @return		скорость в секунду, умноженная на PROC_RATE_SCALE.
+ *			0 - счётчик уменьшился.
+ */
+unsigned long get_counter_rate(unsigned long long previous, unsigned long long current,
+	unsigned long long elapsed, double per_unit)
+{
+	if (current < previous)
+		return 0;
+
+	return (unsigned long) ((double) (current - previous) * per_unit * 1e9 * PROC_RATE_SCALE /
+		(double) elapsed + 0.5);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Пересчитывает загрузку процессора и ошибки страниц процесса по свежему
+ * stat: прирост utime + stime, minflt и majflt, делённый на время с прошлого
+ * пересчёта. Если с прошлого пересчёта прошло меньше RATE_SAMPLE_MIN_NS,
+ * остаются прежние значения - на коротком интервале такты дают слишком
+ * грубую оценку.
+ *
+ * @param entry		процесс из снимка
+ * @param stat		только что прочитанный stat процесса
+ */
+void update_entry_rates(proc_entry_t *entry, const linux_stat_t *stat)
+{
+	proc_counters_t *counters = &entry->counters;
+	unsigned long long now = get_boot_clock();
+	unsigned long long ticks = (unsigned long long) stat->utime + stat->stime;
+	unsigned long long elapsed = now - counters->stat_read;
+
+	if (counters->stat_read != 0) {
+		if (now < counters->stat_read + RATE_SAMPLE_MIN_NS)
+			return;
+
+		counters->cpu = get_counter_rate(counters->cpu_ticks, ticks, elapsed,
+			100.0 / sysconf(_SC_CLK_TCK));
+		counters->minflt_rate = get_counter_rate(counters->minflt, stat->minflt, elapsed, 1);
+		counters->majflt_rate = get_counter_rate(counters->majflt, stat->majflt, elapsed, 1);
+	}
+
+	counters->cpu_ticks = ticks;
+	counters->minflt = stat->minflt;
+	counters->majflt = stat->majflt;
+	counters->stat_read = now;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Группирует процессы снимка по паре (имя процесса, владелец) по агрегатам
+ * снимка. Фильтры проверяются один раз на имя.
+ *
+ * @param snap		снимок /proc
+ * @param include	шаблон имён, которые попадают в результат, может
+ *			быть NULL
+ * @param exclude	шаблон имён, которые не попадают в результат, может
+ *			быть NULL
+ * @param result	сюда будет помещён массив групп, упорядоченный по
+ *			владельцу и имени. Освобождается через free().
+ * @return		число групп в результате
+ */
+size_t group_proc_snapshot(proc_snapshot_t *snap, const char *include,
+	const char *exclude, proc_group_t **result)
+{
+	proc_aggregates_t *table;
+	const proc_aggregate_t *item;
+	proc_group_t *groups;
+	const char *comm;
+	size_t count = 0;
+	unsigned name;
+	unsigned long long started;
+
+	TRACE_BEGIN(started);
+	*result = NULL;
+	table = get_snapshot_aggregates(snap);
+	if (table == NULL || table->count == 0)
+		return 0;
+
+	groups = self_malloc(table->count * sizeof(proc_group_t));
+	if (groups == NULL)
+		return 0;
+
+	for (name = 0; name < table->name_count; ++name) {
+		comm = get_proc_aggregate_name(table, name);
+		if (is_group_excluded(comm, include, exclude))
+			continue;
+
+		for (item = first_proc_aggregate(table, name); item != NULL;
+			item = next_proc_aggregate(table, item)) {
+			snprintf(groups[count].comm, PROC_COMM_SIZE, "%s", comm);
+			groups[count].uid = item->uid;
+			groups[count].count = item->count;
+			++count;
+		}
+	}
+
+	if (count > 0)
+		qsort(groups, count, sizeof(proc_group_t), compare_proc_groups);
+	TRACE_END(started, TRACE_AGGREGATE, 0, snap->count);
+
+	*result = groups;
+	return count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет имя процесса по фильтрам обнаружения.
+ * @param comm		имя процесса
+ * @param include	шаблон имён, которые попадают в результат, может
+ *			быть NULL
+ * @param exclude	шаблон имён, которые не попадают в результат, может
+ *			быть NULL
+ * @return		1 - имя отброшено фильтром. 0 - нет.
+ */
+int is_group_excluded(const char *comm, const char *include, const char *exclude)
+{
+	if (include != NULL && *include != '\0' && fnmatch(include, comm, 0) != 0)
+		return 1;
+	if (exclude != NULL && *exclude != '\0' && fnmatch(exclude, comm, 0) == 0)
+		return 1;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сравнивает группы процессов для упорядочивания по владельцу и имени.
+ * @param first		первая группа
+ * @param second	вторая группа
+ * @return		<0, 0, >0 - как у strcmp
+ */
+int compare_proc_groups(const void *first, const void *second)
+{
+	const proc_group_t *a = first, *b = second;
+
+	if (a->uid != b->uid)
+		return a->uid < b->uid ? -1 : 1;
+
+	return strcmp(a->comm, b->comm);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Определяет имя пользователя по UID. Если пользователь не найден,
+ * возвращается сам UID.
+ * @param uid	UID пользователя
+ * @param name	сюда будет помещено имя пользователя
+ * @param size	размер буфера под имя
+ */
+void get_user_name(long uid, char *name, size_t size)
+{
+	struct passwd user, *found = NULL;
+	char buf[NBUF_SIZE];
+
+	if (getpwuid_r((uid_t) uid, &user, buf, sizeof(buf), &found) == 0 && found != NULL)
+		snprintf(name, size, "%s", found->pw_name);
+	else
+		snprintf(name, size, "%ld", uid);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Заполняет снимок: по событиям proc connector, если включён ProcEvents и
+ * подписка действует, иначе полным обходом /proc. Полный обход также
+ * выполняется раз в ProcEventsReconcile секунд и после потери событий,
+ * чтобы восстановить снимок, если события пропущены.
+ *
+ * @param snap	заполняемый снимок
+ * @param prev	предыдущий снимок, может быть NULL
+ * @return	1 - успешно. 0 - /proc прочитать не удалось.
+ */
+int update_proc_snapshot(proc_snapshot_t *snap, proc_snapshot_t *prev)
+{
+	struct timespec now;
+	int events = module_config.proc_events && is_host_proc() ? open_proc_events() : -1;
+
+	snap->aggregates.valid = 0;
+	snap->tree.valid = 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (events == 0 && prev != NULL && prev->valid &&
+		now.tv_sec - last_full_walk.tv_sec < (time_t) module_config.proc_events_reconcile) {
+		if (apply_proc_events(snap, prev))
+			return 1;
+	} else if (events >= 0) {
+		// События до обхода не нужны - обход и так их увидит. События,
+		// пришедшие во время обхода, применятся повторно, это безопасно
+		read_proc_events(NULL, NULL);
+	}
+
+	if (!walk_proc_snapshot(snap, prev))
+		return 0;
+
+	last_full_walk = now;
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Строит снимок из предыдущего по накопившимся событиям, без обхода /proc.
+ * Завершившиеся процессы выбрасываются, новые, сменившие имя или владельца
+ * - перечитываются. Остальные переносятся как есть, их rss и VmSize
+ * перечитываются позже, только если процесс попадёт в запрос.
+ *
+ * @param snap	заполняемый снимок
+ * @param prev	предыдущий снимок
+ * @return	1 - успешно. 0 - события потеряны, нужен полный обход.
+ */
+int apply_proc_events(proc_snapshot_t *snap, proc_snapshot_t *prev)
+{
+	proc_changes_t changes;
+	proc_walker_t walker;
+	proc_pid_t pid;
+	proc_entry_t *entry;
+	size_t i, unique = 0;
+	unsigned long long started;
+
+	TRACE_BEGIN(started);
+	memset(&changes, 0, sizeof(proc_changes_t));
+	if (read_proc_events(collect_proc_change, &changes) < 0 || changes.failed ||
+		open_proc_walker(&walker, module_config.proc_root) < 0) {
+		free(changes.items);
+		return 0;
+	}
+
+	// Оставляем по процессу только последнее событие
+	qsort(changes.items, changes.count, sizeof(proc_change_t), compare_proc_changes);
+	for (i = 0; i < changes.count; ++i) {
+		if (i + 1 < changes.count && changes.items[i + 1].pid == changes.items[i].pid)
+			continue;
+		changes.items[unique++] = changes.items[i];
+	}
+	changes.count = unique;
+
+	snap->count = 0;
+	if (!reserve_snapshot_entries(snap, prev->count + changes.count)) {
+		close_proc_walker(&walker);
+		free(changes.items);
+		return 0;
+	}
+
+	for (i = 0; i < prev->count; ++i) {
+		if (find_proc_change(&changes, prev->entries[i].pid) != NULL)
+			continue;
+
+		entry = snap->entries + snap->count++;
+		*entry = prev->entries[i];
+		entry->stat_state = MAPS_NONE;
+		entry->status_state = MAPS_NONE;
+		entry->io_state = MAPS_NONE;
+		entry->fds_state = MAPS_NONE;
+		entry->maps_state = MAPS_NONE;
+		entry->smaps_state = MAPS_NONE;
+		entry->check_state = MAPS_NONE;
+	}
+
+	// Изменившийся процесс читается как новый: с владельцем и именем
+	for (i = 0; i < changes.count; ++i) {
+		if (changes.items[i].kind != PROC_CHANGE_UPDATED)
+			continue;
+
+		entry = snap->entries + snap->count;
+		set_proc_pid(&pid, changes.items[i].pid);
+		if (scan_proc_entry(&walker, &pid, prev, 1, entry))
+			++snap->count;
+	}
+
+	close_proc_walker(&walker);
+	free(changes.items);
+	TRACE_END(started, TRACE_EVENTS, 0, changes.count);
+
+	pthread_mutex_lock(&snapshot_lock);
+	last_scan_stats = walker.stats;
+	pthread_mutex_unlock(&snapshot_lock);
+	count_scan_stats(&walker.stats);
+
+	return index_proc_snapshot(snap);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет событие процесса к накопленным.
+ * @param context	накопленные события, proc_changes_t
+ * @param pid		PID процесса
+ * @param kind		что произошло, из proc_change_kind
+ */
+void collect_proc_change(void *context, int pid, int kind)
+{
+	proc_changes_t *changes = (proc_changes_t *) context;
+	proc_change_t *items;
+	size_t capacity;
+
+	if (changes->count == changes->capacity) {
+		capacity = changes->capacity ? changes->capacity * 2 : 256;
+		items = self_realloc(changes->items, capacity * sizeof(proc_change_t));
+		if (items == NULL) {
+			changes->failed = 1;
+			return;
+		}
+		changes->items = items;
+		changes->capacity = capacity;
+	}
+
+	changes->items[changes->count].pid = pid;
+	changes->items[changes->count].kind = kind;
+	changes->items[changes->count].order = changes->count;
+	++changes->count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сравнивает события для сортировки по PID, а события одного процесса -
+ * по порядку поступления.
+ * @param first		первое событие
+ * @param second	второе событие
+ * @return		<0, 0, >0 - как у strcmp
+ */
+int compare_proc_changes(const void *first, const void *second)
+{
+	const proc_change_t *a = (const proc_change_t *) first;
+	const proc_change_t *b = (const proc_change_t *) second;
+
+	if (a->pid != b->pid)
+		return a->pid < b->pid ? -1 : 1;
+	if (a->order != b->order)
+		return a->order < b->order ? -1 : 1;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Ищет событие процесса среди упорядоченных по PID событий.
+ * @param changes	события, по одному на процесс
+ * @param pid		PID процесса
+ * @return		событие. NULL - событий по процессу не было.
+ */
+const proc_change_t *find_proc_change(const proc_changes_t *changes, int pid)
+{
+	size_t low = 0, high = changes->count, middle;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (changes->items[middle].pid == pid)
+			return changes->items + middle;
+		if (changes->items[middle].pid < pid)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Обходит /proc и заполняет снимок сведениями о всех процессах.
+ *
+ * Записи /proc читаются через getdents64, файлы процесса открываются
+ * относительно дескриптора /proc или PID-каталога, так что на известный
+ * процесс тратится 3 системных вызова (openat, read, close), на новый - 6.
+ *
+ * Для каждого процесса читается только stat-файл. Если процесс с тем же
+ * PID, временем старта и именем уже был в предыдущем снимке, то сведения о
+ * нём переносятся оттуда и обновляются только резидентная и виртуальная
+ * память. Владелец
+ * определяется только для новых процессов (и ещё раз на следующем обходе,
+ * т.к. сразу после fork() процесс может сменить uid). Завершившиеся процессы
+ * в новый снимок не попадают.
+ *
+ * Области памяти процессов здесь не считаются, это делается только
+ * для процессов, попавших в запрос.
+ *
+ * При ScanThreads > 1 stat-файлы читаются пулом потоков,
+ * см. walk_proc_parallel().
+ *
+ * @param snap	заполняемый снимок
+ * @param prev	предыдущий снимок, может быть NULL
+ * @return	1 - успешно. 0 - /proc прочитать не удалось или не хватило
+ *		памяти.
+ */
+int walk_proc_snapshot(proc_snapshot_t *snap, proc_snapshot_t *prev)
+{
+	proc_walker_t walker;
+	proc_pid_t pid;
+	proc_entry_t *entry;
+	unsigned long long started, batch_started = 0;
+	size_t batch = 0;
+
+	if (module_config.scan_threads > 1)
+		return walk_proc_parallel(snap, prev);
+
+	TRACE_BEGIN(started);
+	if (open_proc_walker(&walker, module_config.proc_root) < 0)
+		return 0;
+
+	snap->count = 0;
+	while (next_proc_pid(&walker, &pid)) {
+		// stat-файлы в трассировке - порциями, как при параллельном обходе
+		if (batch == 0)
+			TRACE_BEGIN(batch_started);
+
+		// Урезанный снимок занижал бы все ключи до следующего обхода -
+		// лучше оставить прежний
+		entry = add_snapshot_entry(snap);
+		if (entry == NULL) {
+			close_proc_walker(&walker);
+			return 0;
+		}
+
+		if (!scan_proc_entry(&walker, &pid, prev, 0, entry))
+			--(snap->count);
+
+		if (++batch == SCAN_CHUNK_PIDS) {
+			TRACE_END(batch_started, TRACE_STAT, 0, batch);
+			batch = 0;
+		}
+	}
+	if (batch > 0)
+		TRACE_END(batch_started, TRACE_STAT, 0, batch);
+
+	close_proc_walker(&walker);
+	TRACE_END(started, TRACE_WALK, 0, walker.stats.pids);
+
+	pthread_mutex_lock(&snapshot_lock);
+	last_scan_stats = walker.stats;
+	pthread_mutex_unlock(&snapshot_lock);
+	count_scan_stats(&walker.stats);
+
+	return index_proc_snapshot(snap);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Обходит /proc в несколько потоков (ScanThreads). Список PID-каталогов
+ * читается один раз, затем потоки пула разбирают его порциями, и каждый
+ * пишет процесс в ячейку снимка с тем же номером, что у PID-каталога в
+ * списке. Завершившиеся за время обхода процессы затем выбрасываются,
+ * порядок остальных сохраняется.
+ *
+ * @param snap	заполняемый снимок
+ * @param prev	предыдущий снимок, может быть NULL
+ * @return	1 - успешно. 0 - /proc прочитать не удалось или не хватило
+ *		памяти.
+ */
+int walk_proc_parallel(proc_snapshot_t *snap, proc_snapshot_t *prev)
+{
+	proc_walker_t walker;
+	proc_pid_t pid;
+	scan_job_t job;
+	size_t count = 0, capacity = 0, kept = 0, i;
+	int *pids = NULL, *grown;
+	unsigned long long started;
+
+	TRACE_BEGIN(started);
+	if (open_proc_walker(&walker, module_config.proc_root) < 0)
+		return 0;
+
+	while (next_proc_pid(&walker, &pid)) {
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			grown = self_realloc(pids, capacity * sizeof(int));
+			if (grown == NULL) {
+				close_proc_walker(&walker);
+				free(pids);
+				return 0;
+			}
+			pids = grown;
+		}
+		pids[count++] = pid.pid;
+	}
+
+	close_proc_walker(&walker);
+
+	snap->count = 0;
+	if (!reserve_snapshot_entries(snap, count)) {
+		free(pids);
+		return 0;
+	}
+
+	memset(&job, 0, sizeof(scan_job_t));
+	job.snap = snap;
+	job.prev = prev;
+	job.pids = pids;
+	run_scan_pool(module_config.scan_threads, count, SCAN_CHUNK_PIDS,
+		scan_pids_task, &job);
+	close_scan_job(&job, &walker.stats);
+	free(pids);
+
+	for (i = 0; i < count; ++i) {
+		if (snap->entries[i].pid == 0)
+			continue;
+		if (kept != i)
+			snap->entries[kept] = snap->entries[i];
+		++kept;
+	}
+	snap->count = kept;
+	TRACE_END(started, TRACE_WALK, 0, walker.stats.pids);
+
+	pthread_mutex_lock(&snapshot_lock);
+	last_scan_stats = walker.stats;
+	pthread_mutex_unlock(&snapshot_lock);
+	count_scan_stats(&walker.stats);
+
+	return index_proc_snapshot(snap);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Порция параллельного обхода /proc: заполняет процессы снимка по
+ * PID-каталогам [begin, end). Ячейки завершившихся процессов помечаются
+ * нулевым PID.
+ * @param context	параллельная обработка, scan_job_t
+ * @param worker	номер потока пула
+ * @param begin		номер первого PID-каталога
+ * @param end		номер PID-каталога за последним
+ */
+void scan_pids_task(void *context, unsigned worker, size_t begin, size_t end)
+{
+	scan_job_t *job = (scan_job_t *) context;
+	proc_entry_t *entry;
+	proc_pid_t pid;
+	unsigned long long started;
+	size_t count = end - begin;
+	int opened;
+
+	TRACE_BEGIN(started);
+	opened = open_scan_worker(job, worker, 0);
+	for (; begin < end; ++begin) {
+		entry = job->snap->entries + begin;
+		set_proc_pid(&pid, job->pids[begin]);
+		if (!opened || !scan_proc_entry(job->walkers + worker, &pid, job->prev, 0, entry))
+			entry->pid = 0;
+	}
+	TRACE_END(started, TRACE_STAT, 0, count);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Заполняет процесс снимка по его PID-каталогу.
+ *
+ * @param walker	состояние обхода /proc
+ * @param pid		PID-каталог
+ * @param prev		предыдущий снимок, может быть NULL
+ * @param changed	1 - о процессе пришло событие (ProcEvents): он
+ *			читается как новый, с владельцем и именем, из prev
+ *			переносятся только счётчики
+ * @param entry		заполняемый процесс
+ * @return		1 - процесс заполнен. 0 - процесса уже нет.
+ */
+int scan_proc_entry(proc_walker_t *walker, proc_pid_t *pid, proc_snapshot_t *prev,
+	int changed, proc_entry_t *entry)
+{
+	proc_entry_t *known = prev != NULL ? find_snapshot_entry(prev, pid->pid) : NULL;
+	linux_stat_t stat;
+
+	// Владелец понадобится - сразу открываем PID-каталог, и stat
+	// читается относительно него. Иначе stat открывается по пути
+	// относительно /proc, без лишних open/close каталога
+	if ((changed || known == NULL || known->scans_seen < UID_STABLE_SCANS) &&
+		open_pid_dir(walker, pid) < 0)
+		return 0;
+
+	// Зомби памяти не занимают, а событие о завершении процесса приходит
+	// ещё до того, как его заберёт родитель - в снимок они не попадают
+	if (!read_linux_stat(walker, pid, &stat, STAT_UPTO_RSS) ||
+		stat.state == 'Z' || stat.state == 'X') {
+		release_proc_pid(walker, pid);
+		return 0;
+	}
+
+	if (!changed && known != NULL && known->starttime == stat.starttime &&
+		strcmp(known->comm, stat.comm) == 0) {
+		// Известный процесс - переносим, обновляем изменчивые поля.
+		// tracked может меняться запросами, его перечитываем атомарно
+		*entry = *known;
+		entry->tracked = __sync_fetch_and_add(&known->tracked, 0);
+	} else {
+		// Новый процесс, повторно выданный PID, exec() или событие
+		entry->pid = pid->pid;
+		entry->starttime = stat.starttime;
+		entry->scans_seen = 0;
+		memcpy(entry->comm, stat.comm, PROC_COMM_SIZE);
+
+		// После exec() и событий pidfd остаётся прежним
+		entry->tracked = known != NULL && known->starttime == stat.starttime ?
+			__sync_fetch_and_add(&known->tracked, 0) : 0;
+
+		// После exec() и событий процесс тот же и счётчики продолжаются.
+		// Процесс, которого не было при прошлом обходе, набрал их
+		// с момента запуска. При первом обходе отсчёт только начинается
+		memset(&entry->counters, 0, sizeof(proc_counters_t));
+		if (known != NULL && known->starttime == stat.starttime)
+			entry->counters = known->counters;
+		else if (prev != NULL && prev->valid)
+			entry->counters.stat_read = entry->counters.status_read =
+				entry->counters.io_read = stat.starttime * 1000000000ULL /
+				(unsigned long long) sysconf(_SC_CLK_TCK);
+	}
+
+	if (entry->scans_seen < UID_STABLE_SCANS &&
+		read_pid_owner(walker, pid, &entry->uid) < 0) {
+		release_proc_pid(walker, pid);
+		return 0;
+	}
+	release_proc_pid(walker, pid);
+
+	++(entry->scans_seen);
+	entry->ppid = stat.ppid;
+	entry->rss = (unsigned long) stat.rss * get_page_size();
+	entry->vsize = stat.vsize;
+	update_entry_rates(entry, &stat);
+	entry->stat_state = MAPS_READY;
+	entry->status_state = MAPS_NONE;
+	entry->io_state = MAPS_NONE;
+	entry->fds_state = MAPS_NONE;
+	entry->maps_state = MAPS_NONE;
+	entry->smaps_state = MAPS_NONE;
+	entry->check_state = MAPS_NONE;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Отмечает, какие файлы нужно прочитать у процессов снимка, попавших
+ * в запрос. Уже прочитанные и не читающиеся файлы не отмечаются.
+ *
+ * @param snap		снимок /proc
+ * @param matcher	условие отбора процессов
+ * @param filter	фильтр по владельцу процесса
+ * @param sources	какие файлы нужны, из proc_sources
+ * @return		число процессов, у которых есть что читать
+ */
+size_t want_proc_entries(proc_snapshot_t *snap, proc_matcher_t *matcher, const uid_filter_t *filter,
+	unsigned sources)
+{
+	proc_entry_t *entry;
+	size_t i, wanted = 0;
+
+	for (i = 0; i < snap->count; ++i) {
+		entry = snap->entries + i;
+
+		// Командная строка здесь не сверяется: лишний процесс будет
+		// прочитан, но в сумму не попадёт
+		if (!match_uid_filter(filter, entry->uid))
+			continue;
+		if (!match_proc_comm(matcher, entry->comm))
+			continue;
+
+		wanted += want_entry_sources(entry, sources);
+	}
+
+	return wanted;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Отмечает, какие файлы нужно прочитать у процесса снимка. Уже прочитанные
+ * и не читающиеся файлы не отмечаются.
+ *
+ * @param entry		процесс из снимка
+ * @param sources	какие файлы нужны, из proc_sources
+ * @return		1 - у процесса есть что читать. 0 - нет.
+ */
+int want_entry_sources(proc_entry_t *entry, unsigned sources)
+{
+	if ((sources & SOURCE_STAT) && entry->stat_state == MAPS_NONE)
+		entry->stat_state = MAPS_WANTED;
+	if ((sources & SOURCE_STATUS) && entry->status_state == MAPS_NONE)
+		entry->status_state = MAPS_WANTED;
+	if ((sources & SOURCE_IO) && entry->io_state == MAPS_NONE)
+		entry->io_state = MAPS_WANTED;
+	if ((sources & SOURCE_FDS) && entry->fds_state == MAPS_NONE)
+		entry->fds_state = MAPS_WANTED;
+	if ((sources & SOURCE_MAPS) && entry->maps_state == MAPS_NONE)
+		entry->maps_state = MAPS_WANTED;
+	if ((sources & SOURCE_SMAPS) && entry->smaps_state == MAPS_NONE)
+		entry->smaps_state = MAPS_WANTED;
+	if (module_config.validate_sources && entry->check_state == MAPS_NONE)
+		entry->check_state = MAPS_WANTED;
+
+	return entry->stat_state == MAPS_WANTED || entry->status_state == MAPS_WANTED ||
+		entry->io_state == MAPS_WANTED || entry->fds_state == MAPS_WANTED ||
+		entry->maps_state == MAPS_WANTED || entry->smaps_state == MAPS_WANTED ||
+		entry->check_state == MAPS_WANTED;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Читает stat, maps, smaps и файлы для сверки у отмеченных процессов снимка.
+ * При ScanThreads > 1 процессы разбираются пулом потоков порциями, так
+ * что процессы с большими maps-файлами не задерживают остальных.
+ *
+ * @param snap	снимок /proc
+ */
+void load_wanted_entries(proc_snapshot_t *snap)
+{
+	proc_scan_stats_t stats;
+	scan_job_t job;
+	unsigned long long started;
+
+	TRACE_BEGIN(started);
+	memset(&job, 0, sizeof(scan_job_t));
+	memset(&stats, 0, sizeof(proc_scan_stats_t));
+	job.snap = snap;
+	run_scan_pool(module_config.scan_threads, snap->count, SCAN_CHUNK_ENTRIES,
+		load_entries_task, &job);
+	close_scan_job(&job, &stats);
+	count_scan_stats(&stats);
+	TRACE_END(started, TRACE_LOAD, 0, snap->count);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Порция чтения maps и smaps: обрабатывает процессы снимка [begin, end).
+ * @param context	параллельная обработка, scan_job_t
+ * @param worker	номер потока пула
+ * @param begin		номер первого процесса
+ * @param end		номер процесса за последним
+ */
+void load_entries_task(void *context, unsigned worker, size_t begin, size_t end)
+{
+	scan_job_t *job = (scan_job_t *) context;
+	proc_walker_t *walker = job->walkers + worker;
+	proc_entry_t *entry;
+
+	for (; begin < end; ++begin) {
+		entry = job->snap->entries + begin;
+		if (entry->stat_state != MAPS_WANTED && entry->status_state != MAPS_WANTED &&
+			entry->io_state != MAPS_WANTED && entry->fds_state != MAPS_WANTED &&
+			entry->maps_state != MAPS_WANTED && entry->smaps_state != MAPS_WANTED &&
+			entry->check_state != MAPS_WANTED)
+			continue;
+
+		// Не удалось открыть - процесс остаётся отмеченным и будет
+		// прочитан запросом
+		if (!open_scan_worker(job, worker, 1))
+			return;
+
+		if (entry->stat_state == MAPS_WANTED)
+			load_entry_stat(entry, walker);
+		if (entry->status_state == MAPS_WANTED)
+			load_entry_status(entry, walker, job->fbufs[worker]);
+		if (entry->io_state == MAPS_WANTED)
+			load_entry_io(entry, walker, job->fbufs[worker]);
+		if (entry->fds_state == MAPS_WANTED)
+			load_entry_fds(entry, walker, job->fbufs[worker]);
+		if (entry->maps_state == MAPS_WANTED)
+			load_entry_maps(entry, walker, job->fbufs[worker]);
+		if (entry->smaps_state == MAPS_WANTED)
+			get_entry_smaps(entry, walker, job->fbufs[worker], PROC_PSS);
+		if (entry->check_state == MAPS_WANTED)
+			check_entry_sources(entry, walker, job->fbufs[worker]);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Открывает состояние обхода /proc и, при необходимости, буфер потока
+ * пула, если они ещё не открыты.
+ * @param job		параллельная обработка
+ * @param worker	номер потока пула
+ * @param need_buffer	1 - нужен буфер размером MBUF_SIZE
+ * @return		1 - успешно. 0 - /proc открыть не удалось или не
+ *			хватило памяти.
+ */
+int open_scan_worker(scan_job_t *job, unsigned worker, int need_buffer)
+{
+	if (!job->opened[worker]) {
+		if (open_proc_walker(job->walkers + worker, module_config.proc_root) < 0)
+			return 0;
+		job->opened[worker] = 1;
+	}
+
+	if (need_buffer && job->fbufs[worker] == NULL) {
+		job->fbufs[worker] = self_malloc(sizeof(char) * MBUF_SIZE);
+		if (job->fbufs[worker] == NULL)
+			return 0;
+	}
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Закрывает состояния обхода и освобождает буферы потоков пула.
+ * @param job	параллельная обработка
+ * @param stats	сюда добавляются счётчики обходов потоков, может быть NULL
+ */
+void close_scan_job(scan_job_t *job, proc_scan_stats_t *stats)
+{
+	unsigned i;
+
+	for (i = 0; i < SCAN_POOL_MAX_THREADS; ++i) {
+		if (job->opened[i]) {
+			close_proc_walker(job->walkers + i);
+			if (stats != NULL)
+				add_scan_stats(stats, &job->walkers[i].stats);
+		}
+		free(job->fbufs[i]);
+	}
+}
 
-/*
-int main()
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет счётчики обхода /proc к общим.
+ * @param total	общие счётчики
+ * @param stats	добавляемые счётчики
+ */
+void add_scan_stats(proc_scan_stats_t *total, const proc_scan_stats_t *stats)
 {
-	printf("bash: %lu\n", get_proc_value_summ("java", "tomcat", PROC_VMRSS));
-	return 0;
+	total->pids += stats->pids;
+	total->syscalls += stats->syscalls;
+	total->files_opened += stats->files_opened;
+	total->bytes_read += stats->bytes_read;
 }
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет в снимок новый процесс, при необходимости расширяя таблицу.
+ * @param snap	снимок
+ * @return	указатель на добавленный процесс. NULL - нехватка памяти.
  */
+proc_entry_t *add_snapshot_entry(proc_snapshot_t *snap)
+{
+	if (snap->count == snap->capacity) {
+		size_t capacity = snap->capacity ? snap->capacity * 2 : 1024;
+		proc_entry_t *entries = self_realloc(snap->entries, capacity * sizeof(proc_entry_t));
+		if (entries == NULL)
+			return NULL;
+
+		snap->entries = entries;
+		snap->capacity = capacity;
+	}
+
+	return snap->entries + snap->count++;
+}
+
+//------------------------------------------------------------------------------
 
 /**
- * Просчитывает сумму значений параметра одноимённых процессов.
- * Для Unix-систем.
- * Сейчас поддерживается:
- * - Linux, Cygwin-Windows, Solaris (VmRSS, подсчёт размера областей памяти)
- * // дополнять список по мере разработки
- *
- * @param proc_name	имя процесса
- * @param user_name	имя пользователя, может быть NULL.
- *                      Если указанный пользователь не будет найден, то
- *                      функция вернёт 0. Если будет указан NULL, то фильтрации
- *                      по имени пользователя производиться не будет.
- * @param param		рассчитываемый параметр.
- * 			Берётся из proc_params
- * @return 		значений параметра одноимённого процесса.
+ * Расширяет таблицу процессов снимка так, чтобы в неё поместилось
+ * count процессов.
+ * @param snap	снимок
+ * @param count	нужное число процессов
+ * @return	1 - успешно. 0 - нехватка памяти.
  */
-unsigned long get_proc_value_summ(char *proc_name, char *user_name, int param)
+int reserve_snapshot_entries(proc_snapshot_t *snap, size_t count)
 {
-	// Определяем параметры и необходимость фильтрации по uid
-	long uid;
-	int uid_filtering = use_filter(user_name, &uid);
+	size_t capacity = snap->capacity ? snap->capacity : 1024;
+	proc_entry_t *entries;
 
-	if (uid_filtering < 0)
-		return 0;
+	if (count <= snap->capacity)
+		return 1;
 
-	DIR *directory;
-	struct dirent *direntry;
+	while (capacity < count)
+		capacity *= 2;
 
-	directory = opendir(proc_path);
-	if (directory == NULL) {
+	entries = self_realloc(snap->entries, capacity * sizeof(proc_entry_t));
+	if (entries == NULL)
 		return 0;
-	}
 
-	unsigned long result = 0;
-	char *fbuf = malloc(sizeof(char) * NBUF_SIZE);
+	snap->entries = entries;
+	snap->capacity = capacity;
+	return 1;
+}
 
-	// Обрабатываем список pid-каталогов в /proc
-	while ((direntry = readdir(directory))) {
-		if (strcmp(".", direntry->d_name) == 0 || strcmp("..", direntry->d_name) == 0)
-			continue;
+//------------------------------------------------------------------------------
 
-		if (is_valid_dir(direntry, uid_filtering, uid)) {
-			switch (param) {
-			case PROC_VMRSS:
-#if defined(__linux__) || (defined(__CYGWIN__) && !defined(_WIN32))
-				// реализация для linux и cygwin в режиме cygwin
-				result += get_vmrss_linux(direntry->d_name, fbuf, proc_name);
-#endif
-#if defined(__sun) && defined(__SVR4)
-				// реализация для solaris и opensolaris/openindiana
-				result += get_vmrss_solaris(direntry->d_name, fbuf, proc_name);
-#endif
-				break;
-			case PROC_MAP:
-			case PROC_MAP_SHARED:
-			case PROC_MAP_RW:
-#if defined(__linux__) || (defined(__CYGWIN__) && !defined(_WIN32))
-				result += calc_linux_proc_map(direntry->d_name, proc_name, fbuf, param);
-#endif
-#if defined(__sun) && defined(__SVR4)
-				result += calc_solaris_proc_map(direntry->d_name, proc_name, fbuf, param);
-#endif
-				break;
-			}
-		}
+/**
+ * Строит индекс снимка по PID (открытая адресация, линейное пробирование).
+ * @param snap	снимок
+ * @return	1 - успешно. 0 - нехватка памяти.
+ */
+int index_proc_snapshot(proc_snapshot_t *snap)
+{
+	size_t size = 1024, i, slot;
+
+	while (size < snap->count * 2)
+		size *= 2;
+
+	if (size != snap->index_size) {
+		unsigned *index = self_realloc(snap->index, size * sizeof(unsigned));
+		if (index == NULL)
+			return 0;
+
+		snap->index = index;
+		snap->index_size = size;
 	}
 
-	free(fbuf);
-	closedir(directory);
+	memset(snap->index, 0, size * sizeof(unsigned));
+	for (i = 0; i < snap->count; ++i) {
+		slot = ((unsigned) snap->entries[i].pid * 2654435761U) & (size - 1);
+		while (snap->index[slot] != 0)
+			slot = (slot + 1) & (size - 1);
+		snap->index[slot] = i + 1;
+	}
 
-	return result;
+	return 1;
 }
 
 //------------------------------------------------------------------------------
 
 /**
- * Определение, является ли элемент директории поддиректорией.
- * Фильтрует директорию по uid владельца, если необходимо.
- *
- * @param dir_entry	подэлемент каталога
- * @param uid_filter	фильтрация по uid. 1 - включено. 0 - нет
- * @param uid		UID пользователя.
- * @return		1 - если это подходящая поддиректория.
- * 			0 - если иначе
+ * Ищет процесс в снимке по PID.
+ * @param snap	снимок
+ * @param pid	PID процесса
+ * @return	указатель на процесс. NULL - процесса в снимке нет.
  */
-int is_valid_dir(struct dirent *dir_entry, int uid_filter, long uid)
+proc_entry_t *find_snapshot_entry(proc_snapshot_t *snap, int pid)
 {
-#if DEBUG
-	printf("DEBUG: check is valid dir %s: ", dir_entry->d_name);
-#endif
-	struct stat status;
-	char *fname = str_summ("/proc/", dir_entry->d_name);
-#if DEBUG
-	printf("file name is [%s], ", fname);
-#endif
+	size_t slot;
+	proc_entry_t *entry;
 
-	if (stat(fname, &status) >= 0) {
-#if DEBUG
-		printf("stat() is ok\n");
-#endif
-		free(fname);
+	if (!snap->valid || snap->index_size == 0)
+		return NULL;
 
-		if (uid_filter)
-			return S_ISDIR(status.st_mode) && status.st_uid == uid;
-		else
-			return S_ISDIR(status.st_mode);
-	} else {
-#if DEBUG
-		printf("stat() is not ok.\n");
-#endif
-		free(fname);
-		return 0;
+	slot = ((unsigned) pid * 2654435761U) & (snap->index_size - 1);
+	while (snap->index[slot] != 0) {
+		entry = snap->entries + snap->index[slot] - 1;
+		if (entry->pid == pid)
+			return entry;
+		slot = (slot + 1) & (snap->index_size - 1);
 	}
+
+	return NULL;
 }
 
 //------------------------------------------------------------------------------
 
 /**
- * Определение необходимости фильтрации процессов по uid
- *
- * @param user_name	имя пользователя. Может быть NULL
- * @param uid		uid пользователя. Сюда будет записан
- * 			реальный uid, если он будет удачно определён.
- * @return 		1 - необходимо, 0 - нет необходимости. -1 - ошибка
+ * Считывает stat-файл процесса linux. Файл читается одним вызовом read()
+ * в буфер на стеке и разбирается до поля last_field, память не выделяется.
  *
+ * @param walker	Состояние обхода /proc
+ * @param pid		PID-каталог процесса
+ * @param stat		Сюда будет помещён результат
+ * @param last_field	Номер последнего нужного поля stat,
+ *			из linux_stat_last_field
+ * @return		1 - успешно. 0 - stat прочитать не удалось.
  */
-int use_filter(char *user_name, long *uid)
+int read_linux_stat(proc_walker_t *walker, proc_pid_t *pid, linux_stat_t *stat, int last_field)
 {
-	int uid_filtering = user_name == NULL ? 0 : 1;
-	struct passwd *user;
+	char buf[LINUX_STAT_BUF_SIZE];
+	ssize_t length = read_pid_file(walker, pid, "stat", buf, sizeof(buf));
 
-	if (uid_filtering) {
-		user = getpwnam(user_name);
-		if (user != NULL) {
-			*uid = user -> pw_uid;
-		} else {
-			uid_filtering = -1;
-		}
-	} else
-		*uid = 0;
+	if (length <= 0)
+		return 0;
 
-	return uid_filtering;
+	return parse_linux_stat(buf, length, stat, last_field);
 }
 
 //------------------------------------------------------------------------------
 
 /**
- * Сбор значения vmrss для linux-систем
- * @param pid_dir
- * @param fbuf
- * @param proc_name
- * @return
+ * Возвращает сумму областей памяти процесса из снимка.
+ * Области памяти считаются один раз за время жизни снимка, сразу
+ * для всех режимов.
+ *
+ * @param entry	процесс из снимка
+ * @param walker	состояние обхода /proc, относительно которого
+ *			открывается maps
+ * @param fbuf		буфер размером MBUF_SIZE
+ * @param mode		режим сбора, из proc_params
+ * @return		сумма областей памяти. 0 - если maps прочитать
+ *			не удалось.
  */
-unsigned long get_vmrss_linux(char *pid_dir, char *fbuf, char *proc_name)
+unsigned long get_entry_maps(proc_entry_t *entry, proc_walker_t *walker, char *fbuf, int mode)
 {
-#if DEBUG
-	printf("DEBUG: get vmrss from %s using pid dir %s\n", proc_name, pid_dir);
-#endif
-	unsigned long result = 0;
+	if (!load_entry_maps(entry, walker, fbuf))
+		return 0;
 
-	linux_stat_t *stat = read_linux_stat(pid_dir, fbuf);
-	if (stat != NULL) {
-#if DEBUG
-		printf("DEBUG: getting process status is ok, status proc name is [%s]\n", stat->comm);
-#endif
-		if (strcmp(stat->comm, proc_name) == 0) {
-#if DEBUG
-			printf("DEBUG: rss pages cound: %ld\n", stat->rss);
-			printf("DEBUG: _SC_PAGESIZE is: %lu\n", sysconf(_SC_PAGESIZE));
-#endif
-			result = (unsigned long) stat->rss * (unsigned long) sysconf(_SC_PAGESIZE);
-#if defined(__CYGWIN__) && !defined(_WIN32)
-			// У cygwin pagesize == 64k, для корректного рассчёта map.
-			// Что не подходит в нашем случае
-			result = (unsigned long) stat->rss * 4096;
-#endif
-		}
+	return select_maps_total(&entry->maps, mode);
+}
+
+//------------------------------------------------------------------------------
 
-		free(stat);
+/**
+ * Перечитывает rss, VmSize и загрузку процессора процесса из снимка, если
+ * они ещё не прочитаны.
+ * Если под тем же PID уже другой процесс, значения не читаются.
+ *
+ * @param entry		процесс из снимка
+ * @param walker	состояние обхода /proc, относительно которого
+ *			открывается stat
+ * @return		1 - rss и VmSize в entry готовы. 0 - процесса уже нет.
+ */
+int load_entry_stat(proc_entry_t *entry, proc_walker_t *walker)
+{
+	linux_stat_t stat;
+	proc_pid_t pid;
+
+	if (entry->stat_state == MAPS_NONE || entry->stat_state == MAPS_WANTED) {
+		set_proc_pid(&pid, entry->pid);
+		if (read_linux_stat(walker, &pid, &stat, STAT_UPTO_RSS) &&
+			stat.starttime == entry->starttime) {
+			entry->rss = (unsigned long) stat.rss * get_page_size();
+			entry->vsize = stat.vsize;
+			update_entry_rates(entry, &stat);
+			entry->stat_state = MAPS_READY;
+		} else {
+			entry->stat_state = MAPS_FAILED;
+		}
 	}
 
-	return result;
+	return entry->stat_state == MAPS_READY;
 }
 
 //------------------------------------------------------------------------------
 
 /**
- * Считывает stat-файл процесса. Для linux-систем
+ * Читает status процесса из снимка, если он ещё не прочитан, и
+ * пересчитывает скорость переключений контекста. status читается только
+ * для процессов, попавших в запрос переключений контекста, поэтому
+ * отсчёт ведётся от прошлого чтения status, а не от прошлого обхода.
  *
- * @param pid_dir	PID процесса, имя каталога в /proc
- * @param fbuf		Файловый буфер
- * @return 		Указатель на stat при успешном чтении.
- * 			NULL - при неудачном.
+ * @param entry		процесс из снимка
+ * @param walker	состояние обхода /proc, относительно которого
+ *			открывается status
+ * @param fbuf		буфер размером MBUF_SIZE
+ * @return		1 - скорость переключений контекста в entry готова.
+ *			0 - процесса уже нет.
  */
-linux_stat_t *read_linux_stat(char *pid_dir, char *fbuf)
+int load_entry_status(proc_entry_t *entry, proc_walker_t *walker, char *fbuf)
 {
-	static char linux_stat_path[] = "stat";
-	static char linux_stat_fmt[] =
-		"%d %s %c %d %d %d %d %d %u %lu %lu %lu %lu %lu %lu %ld %ld %ld %ld %ld %ld %llu %lu %ld ";
+	proc_counters_t *counters = &entry->counters;
+	linux_status_t status;
+	proc_pid_t pid;
+	ssize_t length;
+	unsigned long long now, switches;
+
+	if (entry->status_state != MAPS_NONE && entry->status_state != MAPS_WANTED)
+		return entry->status_state == MAPS_READY;
+
+	set_proc_pid(&pid, entry->pid);
+	length = read_pid_file(walker, &pid, "status", fbuf, MBUF_SIZE);
+	if (length <= 0 || !parse_linux_status(fbuf, length, &status)) {
+		entry->status_state = MAPS_FAILED;
+		return 0;
+	}
+
+	now = get_boot_clock();
+	switches = status.voluntary_ctxt_switches + status.nonvoluntary_ctxt_switches;
+	if (counters->status_read == 0 || now >= counters->status_read + RATE_SAMPLE_MIN_NS) {
+		if (counters->status_read != 0)
+			counters->ctxsw_rate = get_counter_rate(counters->ctxsw, switches,
+				now - counters->status_read, 1);
+		counters->ctxsw = switches;
+		counters->status_read = now;
+	}
+	entry->status_state = MAPS_READY;
 
-	// Открываем файл
-	char *stat_path = str_builder(5,
-		proc_path, path_separator, pid_dir, path_separator, linux_stat_path);
-	FILE *stat_file = fopen(stat_path, "rt");
-	free(stat_path);
+	return 1;
+}
 
-	if (stat_file == NULL)
-		return NULL;
+//------------------------------------------------------------------------------
 
-	setvbuf(stat_file, fbuf, _IOFBF, NBUF_SIZE);
+/**
+ * Читает io процесса из снимка, если он ещё не прочитан, и пересчитывает
+ * скорости ввода-вывода. Как и status, io читается только для процессов,
+ * попавших в запрос, и скорости считаются от его прошлого чтения.
+ * io доступен только владельцу процесса и root - у чужих процессов
+ * чтение не удаётся, и они в сумму не входят.
+ *
+ * @param entry		процесс из снимка
+ * @param walker	состояние обхода /proc, относительно которого
+ *			открывается io
+ * @param fbuf		буфер размером MBUF_SIZE
+ * @return		1 - счётчики ввода-вывода в entry готовы.
+ *			0 - io прочитать не удалось.
+ */
+int load_entry_io(proc_entry_t *entry, proc_walker_t *walker, char *fbuf)
+{
+	proc_counters_t *counters = &entry->counters;
+	proc_pid_t pid;
+	ssize_t length;
+	unsigned long long now, elapsed;
+
+	if (entry->io_state != MAPS_NONE && entry->io_state != MAPS_WANTED)
+		return entry->io_state == MAPS_READY;
+
+	set_proc_pid(&pid, entry->pid);
+	length = read_pid_file(walker, &pid, "io", fbuf, MBUF_SIZE);
+	if (length <= 0 || !parse_linux_io(fbuf, length, &entry->io)) {
+		entry->io_state = MAPS_FAILED;
+		return 0;
+	}
 
-	linux_stat_t *stat = calloc(1, sizeof(linux_stat_t));
+	now = get_boot_clock();
+	elapsed = now - counters->io_read;
+	if (counters->io_read == 0 || elapsed >= RATE_SAMPLE_MIN_NS) {
+		if (counters->io_read != 0) {
+			counters->io_rates.read_bytes = get_counter_rate(counters->io.read_bytes,
+				entry->io.read_bytes, elapsed, 1);
+			counters->io_rates.write_bytes = get_counter_rate(counters->io.write_bytes,
+				entry->io.write_bytes, elapsed, 1);
+			counters->io_rates.syscr = get_counter_rate(counters->io.syscr,
+				entry->io.syscr, elapsed, 1);
+			counters->io_rates.syscw = get_counter_rate(counters->io.syscw,
+				entry->io.syscw, elapsed, 1);
+		}
+		counters->io = entry->io;
+		counters->io_read = now;
+	}
+	entry->io_state = MAPS_READY;
 
-	int result = fscanf(stat_file, linux_stat_fmt,
-		&stat->pid, stat->comm, &stat->state, &stat->ppid,
-		&stat->pgrp, &stat->session, &stat->tty_nr, &stat->tpgid,
-		&stat->flags, &stat->minflt, &stat->cminflt, &stat->majflt,
-		&stat->cmajflt, &stat->utime, &stat->stime, &stat->cutime,
-		&stat->cstime, &stat->priority, &stat->nice, &stat->num_threads,
-		&stat->itrealvalue, &stat->starttime, &stat->vsize, &stat->rss);
+	return 1;
+}
 
-	fclose(stat_file);
+//------------------------------------------------------------------------------
 
-	if (result >= 2) {
-		// Удаляем открывающую скобку в имени процесса
-		left_shift(stat->comm);
-		// и закрывающую скобку
-		(stat->comm)[strlen(stat->comm) - 1] = '\0';
-#if DEBUG
-		printf("DEBUG: readed stat pid: %d\n", stat->pid);
-		printf("DEBUG: readed stat proc name: [%s]\n", stat->comm);
-#endif
-		return stat;
+/**
+ * Считает открытые дескрипторы процесса из снимка и читает их предел,
+ * если они ещё не подсчитаны. Как и io, каталог fd доступен только
+ * владельцу процесса и root.
+ *
+ * @param entry		процесс из снимка
+ * @param walker	состояние обхода /proc, относительно которого
+ *			открываются fd и limits
+ * @param fbuf		буфер размером MBUF_SIZE
+ * @return		1 - дескрипторы и предел в entry готовы.
+ *			0 - прочитать их не удалось.
+ */
+int load_entry_fds(proc_entry_t *entry, proc_walker_t *walker, char *fbuf)
+{
+	proc_pid_t pid;
+	ssize_t length;
+	long fds;
+
+	if (entry->fds_state != MAPS_NONE && entry->fds_state != MAPS_WANTED)
+		return entry->fds_state == MAPS_READY;
+
+	set_proc_pid(&pid, entry->pid);
+	fds = count_pid_fds(walker, &pid, fbuf, MBUF_SIZE);
+	length = fds >= 0 ? read_pid_file(walker, &pid, "limits", fbuf, MBUF_SIZE) : -1;
+	if (length <= 0 || !parse_linux_nofile_limit(fbuf, length, &entry->fds_limit)) {
+		entry->fds_state = MAPS_FAILED;
+		return 0;
 	}
 
-	free(stat);
-	return NULL;
+	entry->fds = (unsigned long) fds;
+	entry->fds_state = MAPS_READY;
+
+	return 1;
 }
 
 //------------------------------------------------------------------------------
 
 /**
- * Определение, соответствует ли каталог PID в /proc имени процесса.
- * Для linux - систем.
+ * Подсчитывает области памяти процесса из снимка, если они ещё
+ * не подсчитаны.
  *
- * @param pid_dir	PID-каталог в /proc
- * @param proc_name	Имя процесса
- * @param fbuf		Файловый буфер чтения
- * @return 		1 - PID-каталог в /proc соответствует имени процессе.
- * 			0 - не соответствует.
+ * @param entry		процесс из снимка
+ * @param walker	состояние обхода /proc, относительно которого
+ *			открывается maps
+ * @param fbuf		буфер размером MBUF_SIZE
+ * @return		1 - суммы областей памяти в entry->maps готовы.
+ *			0 - maps прочитать не удалось.
  */
-int is_valid_linux_proc(char *pid_dir, char *proc_name, char *fbuf)
+int load_entry_maps(proc_entry_t *entry, proc_walker_t *walker, char *fbuf)
 {
-	int valid = 0;
+	proc_pid_t pid;
+	unsigned long long started;
+	unsigned long bytes_read;
+
+	if (entry->maps_state == MAPS_NONE || entry->maps_state == MAPS_WANTED) {
+		TRACE_BEGIN(started);
+		bytes_read = walker->stats.bytes_read;
+		set_proc_pid(&pid, entry->pid);
+		if (read_linux_maps_totals(walker, &pid, fbuf, &entry->maps))
+			entry->maps_state = MAPS_READY;
+		else
+			entry->maps_state = MAPS_FAILED;
+		TRACE_END(started, TRACE_MAPS, entry->pid, walker->stats.bytes_read - bytes_read);
+	}
+
+	return entry->maps_state == MAPS_READY;
+}
 
-	linux_stat_t *stat = read_linux_stat(pid_dir, fbuf);
-	if (stat != NULL) {
-		if (strcmp(stat->comm, proc_name) == 0)
-			valid = 1;
+//------------------------------------------------------------------------------
 
-		free(stat);
+/**
+ * Возвращает PSS, USS, swap или THP процесса из снимка.
+ * smaps читается один раз за время жизни снимка, сразу для всех режимов.
+ *
+ * @param entry		процесс из снимка
+ * @param walker	состояние обхода /proc, относительно которого
+ *			открывается smaps
+ * @param fbuf		буфер размером MBUF_SIZE
+ * @param mode		режим сбора, из proc_params
+ * @return		значение в байтах. 0 - если smaps прочитать
+ *			не удалось.
+ */
+unsigned long get_entry_smaps(proc_entry_t *entry, proc_walker_t *walker, char *fbuf, int mode)
+{
+	proc_pid_t pid;
+	unsigned long long started;
+	unsigned long bytes_read;
+
+	if (entry->smaps_state == MAPS_NONE || entry->smaps_state == MAPS_WANTED) {
+		TRACE_BEGIN(started);
+		bytes_read = walker->stats.bytes_read;
+		set_proc_pid(&pid, entry->pid);
+		if (read_linux_smaps_totals(walker, &pid, fbuf, &entry->smaps))
+			entry->smaps_state = MAPS_READY;
+		else
+			entry->smaps_state = MAPS_FAILED;
+		TRACE_END(started, TRACE_SMAPS, entry->pid, walker->stats.bytes_read - bytes_read);
 	}
 
-	return valid;
+	if (entry->smaps_state != MAPS_READY)
+		return 0;
+
+	return select_smaps_total(&entry->smaps, mode);
 }
 
+#endif /* LINUX_PROC */
+
 //------------------------------------------------------------------------------
 
 /**
- * Суммирует размер областей памяти процесса linux.
- * @param pid_dir	PID-каталог процесса в /proc
- * @param proc_name	Имя процесса.
- * @param fbuf		Файловый буфер
- * @param mode		Режим сбора.
- * @return		Если имя процесса соответствует pid, то вернётся сумма
- * 			областей памяти данного процесса. Иначе возвращается 0.
+ * Определение, является ли элемент директории поддиректорией.
+ * Фильтрует директорию по uid владельца, если необходимо.
+ *
+ * @param directory	открытый каталог ProcRoot, в котором лежит элемент
+ * @param dir_entry	подэлемент каталога
+ * @param filter	фильтр по владельцу процесса
+ * @return		1 - если это подходящая поддиректория.
+ * 			0 - если иначе
  */
-unsigned long calc_linux_proc_map(char *pid_dir, char *proc_name, char* fbuf, int mode)
+int is_valid_dir(DIR *directory, struct dirent *dir_entry, const uid_filter_t *filter)
 {
-	if (!is_valid_linux_proc(pid_dir, proc_name, fbuf))
+	struct stat status;
+
+	if (fstatat(dirfd(directory), dir_entry->d_name, &status, 0) < 0)
 		return 0;
 
-	static char maps_file_name[] = "maps";
+	return S_ISDIR(status.st_mode) && match_uid_filter(filter, status.st_uid);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Суммирует размеры областей памяти процесса linux сразу для всех режимов
+ * сбора. maps читается блоками по MBUF_SIZE байт и разбирается без
+ * выделения памяти.
+ * @param walker	Состояние обхода /proc
+ * @param pid		PID-каталог процесса
+ * @param fbuf		Буфер размером MBUF_SIZE
+ * @param totals	Суммы областей памяти, сюда будет помещён результат
+ * @return		1 - успешно. 0 - maps прочитать не удалось.
+ */
+int read_linux_maps_totals(proc_walker_t *walker, proc_pid_t *pid, char *fbuf,
+	linux_maps_totals_t *totals)
+{
+	linux_maps_parser_t parser;
+	ssize_t length;
+	int fd = open_pid_file(walker, pid, "maps");
+
+	if (fd < 0)
+		return 0;
 
-	char *maps_path = str_builder(5,
-		proc_path, path_separator, pid_dir, path_separator, maps_file_name);
-	FILE *maps_file = fopen(maps_path, "rt");
-	free(maps_path);
+	init_linux_maps(&parser);
+	while ((length = read_pid_fd(walker, fd, fbuf, MBUF_SIZE)) > 0)
+		feed_linux_maps(&parser, fbuf, length);
+	finish_linux_maps(&parser);
+	close_pid_fd(walker, fd);
 
-	if (maps_file == NULL)
+	if (length < 0)
 		return 0;
 
-	unsigned long result = 0;
-	setvbuf(maps_file, fbuf, _IOFBF, NBUF_SIZE);
-	char *lbuf = malloc(sizeof(char) * NLINE_SIZE);
-
-	char *sbegin_addr, *send_addr, *perms;
-	unsigned long begin, end;
-	linux_maps_perms_t *flags;
-	while (read_line(maps_file, lbuf, NLINE_SIZE)) {
-		// Разбиваем строку
-		sbegin_addr = strtok(lbuf, "-");
-		if (sbegin_addr == NULL) continue;
-		begin = htol(sbegin_addr);
-
-		send_addr = strtok(NULL, " ");
-		if (send_addr == NULL) continue;
-		end = htol(send_addr);
-
-		perms = strtok(NULL, " ");
-		if (perms == NULL) continue;
-		flags = parse_linux_perms(perms);
-		if (flags == NULL) continue;
-
-#if DEBUG
-		printf("DEBUG: raw perms: %s\n", perms);
-		printf("DEBUG: parsed perms: r:%u, w:%u, x:%u, s:%u, p:%u\n",
-			flags->read, flags->write, flags->executable,
-			flags->shared, flags->private);
-#endif
+	*totals = parser.totals;
+	return 1;
+}
 
-		if (mode == PROC_MAP)
-			result += end - begin;
-		else if (mode == PROC_MAP_RW && flags->read && flags->write)
-			result += end - begin;
-		else if (mode == PROC_MAP_SHARED && flags->shared)
-			result += end - begin;
+//------------------------------------------------------------------------------
+
+/**
+ * Считывает PSS, USS, swap и THP процесса linux. smaps_rollup содержит уже
+ * просуммированные ядром значения и намного дешевле smaps, поэтому
+ * smaps читается, только если ядро старше 4.14 и smaps_rollup не знает.
+ * @param walker	Состояние обхода /proc
+ * @param pid		PID-каталог процесса
+ * @param fbuf		Буфер размером MBUF_SIZE
+ * @param totals	Сюда будет помещён результат
+ * @return		1 - успешно. 0 - smaps прочитать не удалось.
+ */
+int read_linux_smaps_totals(proc_walker_t *walker, proc_pid_t *pid, char *fbuf,
+	linux_smaps_totals_t *totals)
+{
+	linux_smaps_parser_t parser;
+	ssize_t length;
+	int fd = -1, rollup_errno = 0;
 
-		free(flags);
+	if (!smaps_rollup_missing) {
+		fd = open_pid_file(walker, pid, "smaps_rollup");
+		rollup_errno = errno;
 	}
 
-	free(lbuf);
-	fclose(maps_file);
+	if (fd < 0) {
+		fd = open_pid_file(walker, pid, "smaps");
+		if (fd < 0)
+			return 0;
 
-	return result;
+		// smaps есть, а smaps_rollup нет - больше его не пробуем
+		if (!smaps_rollup_missing && rollup_errno == ENOENT)
+			smaps_rollup_missing = 1;
+	}
+
+	init_linux_smaps(&parser);
+	while ((length = read_pid_fd(walker, fd, fbuf, MBUF_SIZE)) > 0)
+		feed_linux_smaps(&parser, fbuf, length);
+	finish_linux_smaps(&parser);
+	close_pid_fd(walker, fd);
+
+	if (length < 0)
+		return 0;
+
+	*totals = parser.totals;
+	return 1;
 }
 
 //------------------------------------------------------------------------------
 
 /**
- * Преобразует флаги-разрешения процесса linux в структуру linux_maps_perms
- * @param str_perms	подстрока с флагами из /proc/pid/maps
- * @return 		указатель на стрктуру с флагами в случае удачного чтения.
- * 			NULL - в случае неудачного разбора
+ * Выбирает значение из stat, соответствующее режиму сбора.
+ * @param entry		Процесс из снимка
+ * @param mode		Режим сбора
+ * @return		Значение для данного режима, в байтах или, для
+ *			PROC_CPU, в сотых долях процента
  */
-linux_maps_perms_t *parse_linux_perms(const char *str_perms)
+unsigned long select_stat_total(proc_entry_t *entry, int mode)
 {
-	if (substr_len(str_perms) == 0)
-		return NULL;
-	int i = 0;
+	switch (mode) {
+	case PROC_VMRSS:
+		return entry->rss;
+	case PROC_MAP:
+		return entry->vsize;
+	case PROC_CPU:
+		return entry->counters.cpu;
+	case PROC_MINFLT_RATE:
+		return entry->counters.minflt_rate;
+	case PROC_MAJFLT_RATE:
+		return entry->counters.majflt_rate;
+	}
 
-	linux_maps_perms_t *perms = (linux_maps_perms_t *) calloc(1, sizeof(linux_maps_perms_t));
+	return 0;
+}
 
-	while (str_perms[i] != '\0') {
-		switch (str_perms[i]) {
-		case 'r':
-			perms->read = 1;
-			break;
-		case 'w':
-			perms->write = 1;
-			break;
-		case 'e':
-			perms->executable = 1;
-			break;
-		case 's':
-			perms->shared = 1;
-			break;
-		case 'p':
-			perms->private = 1;
-		}
+//------------------------------------------------------------------------------
 
-		++i;
+/**
+ * Выбирает сумму агрегата, соответствующую режиму сбора.
+ * @param item	агрегат процессов
+ * @param mode	режим сбора, из proc_params
+ * @return	сумма для данного режима
+ */
+unsigned long select_aggregate_total(const proc_aggregate_t *item, int mode)
+{
+	switch (mode) {
+	case PROC_VMRSS:
+		return item->totals.rss;
+	case PROC_MAP:
+		return item->totals.vsize;
+	case PROC_CPU:
+		return item->totals.cpu;
+	case PROC_MINFLT_RATE:
+		return item->totals.minflt;
+	case PROC_MAJFLT_RATE:
+		return item->totals.majflt;
 	}
 
-	return perms;
+	return 0;
 }
 
 //------------------------------------------------------------------------------
 
 /**
- * Конвертирование hex-строки в unsigned long
- * @param hex	hex-строка
- * @return 	результат конвертации.
- * 		Неудачная конвертация вернёт 0
+ * Выбирает счётчик ввода-вывода процесса или его скорость, соответствующие
+ * режиму сбора.
+ * @param entry		процесс из снимка
+ * @param mode		режим сбора, из proc_params
+ * @return		значение счётчика или скорость в сотых долях
+ *			в секунду
  */
-unsigned long htol(const char *hex)
+unsigned long select_io_total(proc_entry_t *entry, int mode)
 {
-#if DEBUG
-	printf("DEBUG: htol string: [%s]\n", hex);
-#endif
-	int i = 0, n;
-	// Пропускаем первые 0x, если они есть
-	if (substr_len(hex) >= 2 && hex[0] == '0')
-		if (tolower(hex[1]) == 'x') {
-			i = 2;
-		}
+	switch (mode) {
+	case PROC_IO_READ_BYTES:
+		return (unsigned long) entry->io.read_bytes;
+	case PROC_IO_WRITE_BYTES:
+		return (unsigned long) entry->io.write_bytes;
+	case PROC_IO_SYSCR:
+		return (unsigned long) entry->io.syscr;
+	case PROC_IO_SYSCW:
+		return (unsigned long) entry->io.syscw;
+	case PROC_IO_READ_BYTES_RATE:
+		return (unsigned long) entry->counters.io_rates.read_bytes;
+	case PROC_IO_WRITE_BYTES_RATE:
+		return (unsigned long) entry->counters.io_rates.write_bytes;
+	case PROC_IO_SYSCR_RATE:
+		return (unsigned long) entry->counters.io_rates.syscr;
+	case PROC_IO_SYSCW_RATE:
+		return (unsigned long) entry->counters.io_rates.syscw;
+	}
 
-	unsigned long result = 0;
-	// Конвертируем
-	while (hex[i] != '\0') {
-#if DEBUG
-		printf("[%c|", hex[i]);
-#endif
-		if (isdigit(hex[i]))
-			n = hex[i] - '0';
-		else if (isalpha(hex[i]) && tolower(hex[i]) >= 'a' && tolower(hex[i]) <= 'h')
-			n = tolower(hex[i]) - 'a' + 10;
-		else
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Выбирает число дескрипторов процесса или их долю от предела,
+ * соответствующие режиму сбора.
+ * @param entry		процесс из снимка
+ * @param mode		режим сбора, из proc_params
+ * @return		число дескрипторов или доля от предела в сотых
+ *			долях процента. 0 - предела нет.
+ */
+unsigned long select_fds_total(proc_entry_t *entry, int mode)
+{
+	switch (mode) {
+	case PROC_FDS:
+		return entry->fds;
+	case PROC_FDS_MAXPCT:
+		if (entry->fds_limit == 0)
 			return 0;
+		return (unsigned long) ((unsigned long long) entry->fds * 100 * PROC_RATE_SCALE /
+			entry->fds_limit);
+	}
 
-		result = result * 16 + n;
-#if DEBUG
-		printf("%i:%lu]", n, result);
-#endif
-		++i;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Выбирает сумму областей памяти, соответствующую режиму сбора.
+ * @param totals	Суммы областей памяти процесса
+ * @param mode		Режим сбора
+ * @return		Сумма областей памяти для данного режима
+ */
+unsigned long select_maps_total(linux_maps_totals_t *totals, int mode)
+{
+	switch (mode) {
+	case PROC_MAP:
+		return totals->all;
+	case PROC_MAP_RW:
+		return totals->rw;
+	case PROC_MAP_SHARED:
+		return totals->shared;
 	}
 
-#if DEBUG
-	printf("\nDEBUG: htol result: %lu\n", result);
-#endif
+	return 0;
+}
 
-	return result;
+//------------------------------------------------------------------------------
+
+/**
+ * Выбирает значение из smaps, соответствующее режиму сбора.
+ * @param totals	Суммы из smaps процесса
+ * @param mode		Режим сбора
+ * @return		Значение для данного режима, в байтах
+ */
+unsigned long select_smaps_total(linux_smaps_totals_t *totals, int mode)
+{
+	switch (mode) {
+	case PROC_PSS:
+		return totals->pss;
+	case PROC_USS:
+		return totals->uss;
+	case PROC_SWAP:
+		return totals->swap;
+	case PROC_ANONHUGE:
+		return totals->anonhuge;
+	}
+
+	return 0;
 }
 
 //------------------------------------------------------------------------------
@@ -569,26 +3623,20 @@ unsigned long htol(const char *hex)
  * Получение значения VmRSS для процесса solaris-систем.
  * @param pid_dir
  * @param fbuf
- * @param proc_name
+ * @param matcher
  * @return
  */
-unsigned long get_vmrss_solaris(char *pid_dir, char *fbuf, char *proc_name)
+unsigned long get_vmrss_solaris(char *pid_dir, char *fbuf, proc_matcher_t *matcher)
 {
-#if DEBUG
-	printf("DEBUG: trying get vmrss of pid %s\n", pid_dir);
-#endif
 	psinfo_t *psinfo = read_solaris_psinfo(pid_dir, fbuf);
 
 	if (psinfo == NULL)
 		return 0;
 
 	unsigned long result = 0;
-#if DEBUG
-	printf("DEBUG: process name is [%s]\n", psinfo->pr_fname);
-	printf("DEBUG: process rss size is [%zu]\n", psinfo->pr_rssize);
-#endif
 
-	if (strcmp(proc_name, psinfo->pr_fname) == 0)
+	if (match_proc_comm(matcher, psinfo->pr_fname) &&
+		match_proc_cmdline(matcher, psinfo->pr_psargs))
 		result = psinfo->pr_rssize * 1024;
 
 	free(psinfo);
@@ -612,7 +3660,7 @@ psinfo_t *read_solaris_psinfo(char *pid_dir, char *fbuf)
 
 	// Открываем файл /proc/pid/psinfo
 	char *psinfo_path = str_builder(5,
-		proc_path, path_separator, pid_dir, path_separator, solaris_psinfo_path);
+		module_config.proc_root, path_separator, pid_dir, path_separator, solaris_psinfo_path);
 	FILE *psinfo_file = fopen(psinfo_path, "rb");
 	free(psinfo_path);
 
@@ -621,7 +3669,7 @@ psinfo_t *read_solaris_psinfo(char *pid_dir, char *fbuf)
 
 	// Считываем
 	setvbuf(psinfo_file, fbuf, _IOFBF, NBUF_SIZE);
-	psinfo_t *psinfo = (psinfo_t *) malloc(sizeof(psinfo_t));
+	psinfo_t *psinfo = (psinfo_t *) self_malloc(sizeof(psinfo_t));
 	int result = fread(psinfo, sizeof(psinfo_t), 1, psinfo_file);
 	fclose(psinfo_file);
 
@@ -637,19 +3685,19 @@ psinfo_t *read_solaris_psinfo(char *pid_dir, char *fbuf)
 /**
  * Суммирует размер областей памяти процесса solaris.
  * @param pid_dir	PID-каталог процесса в /proc
- * @param proc_name	Имя процесса.
+ * @param matcher	Условие отбора процессов.
  * @param fbuf		Файловый буфер
  * @param mode		Режим сбора.
  * @return		Если имя процесса соответствует pid, то вернётся сумма
  * 			областей памяти данного процесса. Иначе возвращается 0.
  */
-unsigned long calc_solaris_proc_map(char *pid_dir, char *proc_name, char* fbuf, int mode)
+unsigned long calc_solaris_proc_map(char *pid_dir, proc_matcher_t *matcher, char* fbuf, int mode)
 {
-	if (!is_valid_solaris_proc(pid_dir, proc_name, fbuf))
+	if (!is_valid_solaris_proc(pid_dir, matcher, fbuf))
 		return 0;
 
 	static char map_name[] = "map";
-	char *map_path = str_builder(5, proc_path, path_separator,
+	char *map_path = str_builder(5, module_config.proc_root, path_separator,
 		pid_dir, path_separator,
 		map_name);
 	FILE *map_file = fopen(map_path, "rb");
@@ -658,17 +3706,18 @@ unsigned long calc_solaris_proc_map(char *pid_dir, char *proc_name, char* fbuf,
 	if (map_file == NULL)
 		return 0;
 
-#if DEBUG
-	printf("DEBUG: calculating map for %s\n", proc_name);
-#endif
 
-	unsigned long result = 0;
+	unsigned long result = 0, regions = 0;
+	unsigned long long started;
 	setvbuf(map_file, fbuf, _IOFBF, NBUF_SIZE);
-	prmap_t *pmap = (prmap_t *) malloc(sizeof(prmap_t));
+	prmap_t *pmap = (prmap_t *) self_malloc(sizeof(prmap_t));
 	int mflags, readed;
 
+	TRACE_BEGIN(started);
+
 	while ((readed = fread(pmap, sizeof(prmap_t), 1, map_file)) >= 1) {
 		mflags = pmap->pr_mflags;
+		++regions;
 
 		if (mode == PROC_MAP)
 			result += pmap -> pr_size;
@@ -684,17 +3733,10 @@ unsigned long calc_solaris_proc_map(char *pid_dir, char *proc_name, char* fbuf,
 		if (feof(map_file))
 			break;
 	}
-#if DEBUG
-	if (ferror(map_file)) {
-		printf("DEBUG: reading error\n");
-		perror("err:");
-	}
-
-	printf("DEBUG: readed: %d\n", readed);
-#endif
 
 	fclose(map_file);
 	free(pmap);
+	TRACE_END(started, TRACE_MAPS, atoi(pid_dir), regions * sizeof(prmap_t));
 
 	return result;
 }
@@ -704,27 +3746,22 @@ unsigned long calc_solaris_proc_map(char *pid_dir, char *proc_name, char* fbuf,
 /**
  * Проверка, соответствует ли PID-каталог из /proc имени процесса.
  * @param pid_dir	PID-каталог
- * @param proc_name	имя процесса
+ * @param matcher	условие отбора процессов
  * @param fbuf		файловый буфер
  * @return		1 - PID-каталог соответствует имени процесса
  * 			0 - не соответствует.
  */
-int is_valid_solaris_proc(char *pid_dir, char *proc_name, char *fbuf)
+int is_valid_solaris_proc(char *pid_dir, proc_matcher_t *matcher, char *fbuf)
 {
-#if DEBUG
-	printf("DEBUG: validating proc name: %s\n", proc_name);
-#endif
 	psinfo_t *psinfo = read_solaris_psinfo(pid_dir, fbuf);
 	if (psinfo == NULL)
 		return 0;
 
 	int valid = 0;
-	if (strcmp(proc_name, psinfo->pr_fname) == 0)
+	if (match_proc_comm(matcher, psinfo->pr_fname) &&
+		match_proc_cmdline(matcher, psinfo->pr_psargs))
 		valid = 1;
 
-#if DEBUG
-	printf("DEBUG: %s is %s - %d\n", proc_name, psinfo->pr_fname, valid);
-#endif
 	free(psinfo);
 
 	return valid;
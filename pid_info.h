@@ -22,16 +22,39 @@
 #ifndef PID_INFO_H
 #define PID_INFO_H
 
+#include "proc_walker.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define PROC_RATE_SCALE 100 // Во сколько раз PROC_CPU и скорости мельче процента и событий в секунду
+
 	extern enum proc_params /* параметры, которые можно просчитывать при вызове
 			 * get_proc_value_summ */ {
 		PROC_VMRSS, /* подсчёт резидентной памяти */
 		PROC_MAP, /* подсчёт маппинга, целиком */
 		PROC_MAP_SHARED, /* подсчёт маппинга, только shared-области */
-		PROC_MAP_RW /* подсчёт маппинга, только rw-области */
+		PROC_MAP_RW, /* подсчёт маппинга, только rw-области */
+		PROC_PSS, /* пропорциональная доля резидентной памяти */
+		PROC_USS, /* память, принадлежащая только процессу */
+		PROC_SWAP, /* выгруженная память */
+		PROC_ANONHUGE, /* анонимные huge-страницы */
+		PROC_CPU, /* загрузка процессора, в сотых долях процента */
+		PROC_MINFLT_RATE, /* ошибки страниц без чтения с диска в секунду */
+		PROC_MAJFLT_RATE, /* ошибки страниц с чтением с диска в секунду */
+		PROC_CTXSW_RATE, /* переключения контекста в секунду */
+		PROC_IO_READ_BYTES, /* прочитано с диска, в байтах */
+		PROC_IO_WRITE_BYTES, /* записано на диск, в байтах */
+		PROC_IO_SYSCR, /* вызовов чтения */
+		PROC_IO_SYSCW, /* вызовов записи */
+		PROC_IO_READ_BYTES_RATE, /* прочитано с диска, в байтах в секунду */
+		PROC_IO_WRITE_BYTES_RATE, /* записано на диск, в байтах в секунду */
+		PROC_IO_SYSCR_RATE, /* вызовов чтения в секунду */
+		PROC_IO_SYSCW_RATE, /* вызовов записи в секунду */
+		PROC_FDS, /* открытые дескрипторы */
+		PROC_FDS_MAXPCT /* наибольшая доля открытых дескрипторов от предела,
+				 * в сотых долях процента */
 	};
 
 	/**
@@ -39,18 +62,139 @@ extern "C" {
 	 * Для Unix-систем.
 	 * Сейчас поддерживается:
 	 * - Linux, Cygwin-Windows, Solaris (VmRSS, подсчёт размера областей памяти)
+	 * - Linux (PSS, USS, swap и THP по smaps_rollup или smaps)
+	 * - Linux (загрузка процессора в процентах одного ядра и скорости
+	 *   ошибок страниц и переключений контекста в секунду между двумя
+	 *   последними пересчётами, умноженные на PROC_RATE_SCALE)
+	 * - Linux (счётчики ввода-вывода из io и их скорости)
+	 * - Linux (открытые дескрипторы; для PROC_FDS_MAXPCT вместо суммы
+	 *   возвращается наибольшая по процессам доля от предела)
 	 * // дополнять список по мере разработки
 	 *
-	 * @param proc_name	имя процесса
+	 * @param proc_name	имя процесса. Имя с *, ? или [ - шаблон оболочки,
+	 *			re:выражение - регулярное выражение.
 	 * @param user_name	имя пользователя, может быть NULL.
 	 *                      Если указанный пользователь не будет найден, то
 	 *                      функция вернёт 0. Если будет указан NULL, то фильтрации
 	 *                      по имени пользователя производиться не будет.
+	 * @param cmdline	шаблон полной командной строки, в том же формате,
+	 *			что и proc_name. NULL - не сверять.
 	 * @param param		рассчитываемый параметр.
 	 * 			Берётся из proc_params
 	 * @return 		значений параметра одноимённого процесса.
 	 */
-	extern unsigned long get_proc_value_summ(char *proc_name, char *user_name, int param);
+	extern unsigned long get_proc_value_summ(char *proc_name, char *user_name, char *cmdline,
+		int param);
+
+	/**
+	 * Просчитывает сумму значений параметра процессов, подходящих под
+	 * условие, и всех их потомков, с любыми именами и владельцами.
+	 * Процесс, попавший в несколько деревьев, учитывается один раз.
+	 * Только для Linux.
+	 *
+	 * @param proc_name	имя процесса или шаблон имени, как у
+	 *			get_proc_value_summ()
+	 * @param user_name	владелец отбираемых процессов, может быть NULL
+	 * @param cmdline	шаблон командной строки, может быть NULL
+	 * @param param		рассчитываемый параметр, из proc_params
+	 * @return		сумма значений параметра по деревьям процессов
+	 */
+	extern unsigned long get_proc_tree_summ(char *proc_name, char *user_name, char *cmdline,
+		int param);
+
+	/**
+	 * Возвращает число запросов, на которые был дан ответ по уже собранному
+	 * снимку /proc, т.е. число сэкономленных обходов /proc.
+	 * @return	число сэкономленных обходов
+	 */
+	extern unsigned long get_snapshot_walks_saved(void);
+
+	/**
+	 * Возвращает число расхождений между дешёвыми и дорогими источниками
+	 * значений, найденных в режиме ValidateSources.
+	 * @return	число расхождений
+	 */
+	extern unsigned long get_source_mismatches(void);
+
+	/**
+	 * Возвращает число процессов, убранных из снимка сразу после
+	 * завершения в режиме PidfdTracking.
+	 * @return	число убранных процессов
+	 */
+	extern unsigned long get_exits_dropped(void);
+
+	/**
+	 * Собирает JSON низкоуровневого обнаружения Zabbix: по одной записи
+	 * {#PROCNAME}, {#USER}, {#INSTANCES} на каждую пару (имя процесса,
+	 * владелец). Строится по одному снимку /proc, группировка выполняется
+	 * через хеш-таблицу за один проход по снимку.
+	 *
+	 * @param include	шаблон имён процессов (fnmatch), которые попадают
+	 *			в результат. NULL или "" - все имена.
+	 * @param exclude	шаблон имён процессов, которые в результат не
+	 *			попадают. NULL или "" - не отбрасывать ничего.
+	 * @return		JSON, освобождается через free(). NULL - не хватило
+	 *			памяти.
+	 */
+	extern char *get_proc_discovery(const char *include, const char *exclude);
+
+	/**
+	 * Собирает JSON со сводкой по одноимённым процессам:
+	 * {"instances":N,"vmrss":..,"allmap":..,"rwmap":..,"shmap":..,
+	 * "execmap":..,"privmap":..}. Все значения берутся из одного снимка
+	 * /proc, maps-файл каждого процесса разбирается один раз.
+	 *
+	 * @param proc_name	имя процесса или шаблон имени
+	 * @param user_name	имя пользователя, может быть NULL
+	 * @param cmdline	шаблон командной строки, может быть NULL
+	 * @return		JSON, освобождается через free(). NULL - не хватило
+	 *			памяти.
+	 */
+	extern char *get_proc_summary(char *proc_name, char *user_name, char *cmdline);
+
+	/**
+	 * Освобождает память, занятую снимками /proc.
+	 * Сборщик к этому моменту должен быть остановлен.
+	 */
+	extern void release_proc_snapshot(void);
+
+	/**
+	 * Собирает новый снимок /proc и делает его текущим.
+	 * Вызывается фоновым сборщиком.
+	 *
+	 * @return	1 - снимок обновлён. 0 - /proc прочитать не удалось.
+	 */
+	extern int refresh_proc_snapshot(void);
+
+	/**
+	 * Возвращает счётчики последнего обхода /proc.
+	 * @param stats	сюда будут помещены счётчики
+	 */
+	extern void get_last_scan_stats(proc_scan_stats_t *stats);
+
+	/**
+	 * Возвращает счётчики всех чтений /proc с запуска: обходов и чтения
+	 * stat, maps и smaps процессов, попавших в запросы.
+	 * @param stats	сюда будут помещены счётчики
+	 */
+	extern void get_total_scan_stats(proc_scan_stats_t *stats);
+
+	/**
+	 * Возвращает долю запросов, ответивших по уже собранному снимку
+	 * /proc, без обхода /proc и без ожидания сборщика.
+	 * @return	доля, от 0 до 1. 0 - запросов ещё не было.
+	 */
+	extern double get_cache_hit_ratio(void);
+
+	/**
+	 * Захватывает блокировку текущего снимка /proc.
+	 */
+	extern void lock_proc_snapshot(void);
+
+	/**
+	 * Освобождает блокировку текущего снимка /proc.
+	 */
+	extern void unlock_proc_snapshot(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,272 @@
+/*
+ * Отслеживание завершения процессов через pidfd и epoll.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include "proc_parse.h"
+#include "pid_tracker.h"
+#include "self_stats.h"
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+#include <sys/epoll.h>
+#define PID_TRACKER 1 // pidfd и epoll доступны
+#endif
+
+#define TRACKER_EVENTS 64 // Сколько событий epoll забирается за раз
+#define PATH_MAX_SIZE 256 // Размер пути к stat-файлу процесса
+
+/* Отслеживаемый процесс. Номер ячейки передаётся в epoll вместо PID */
+typedef struct tracker_slot_s {
+	tracked_pid_t process; /* процесс */
+	int fd; /* pidfd. -1 - ячейка свободна */
+	int next_free; /* следующая свободная ячейка, -1 - нет */
+} tracker_slot_t;
+
+static pthread_mutex_t tracker_lock = PTHREAD_MUTEX_INITIALIZER;
+static tracker_slot_t *tracker_slots = NULL; // Ячейки, PID_TRACKER_MAX штук
+static int tracker_free = -1; // Первая свободная ячейка
+static int tracker_epoll = -1; // Дескриптор epoll. -1 - не открыт
+static pid_t tracker_owner = 0; // Процесс, открывший дескрипторы
+static pid_t tracker_failed = 0; // Процесс, у которого pidfd недоступен
+
+int track_pid(const char *proc_path, int pid, unsigned long long starttime);
+size_t take_exited_pids(tracked_pid_t *exited, size_t size);
+void release_pid_tracker(void);
+int open_pid_tracker(void);
+void close_pid_tracker(void);
+int is_same_process(const char *proc_path, int pid, unsigned long long starttime);
+
+/**
+ * Начинает отслеживать завершение процесса.
+ * @param proc_path	путь к /proc
+ * @param pid		PID процесса
+ * @param starttime	время старта процесса, в тактах
+ * @return		1 - отслеживается. 0 - отслеживание недоступно.
+ *			-1 - процесса уже нет.
+ */
+int track_pid(const char *proc_path, int pid, unsigned long long starttime)
+{
+#ifdef PID_TRACKER
+	struct epoll_event event;
+	tracker_slot_t *slot;
+	int fd, result = 0;
+
+	pthread_mutex_lock(&tracker_lock);
+	if (!open_pid_tracker() || tracker_free < 0) {
+		pthread_mutex_unlock(&tracker_lock);
+		return 0;
+	}
+
+	fd = syscall(SYS_pidfd_open, pid, 0);
+	if (fd < 0) {
+		if (errno == ENOSYS)
+			tracker_failed = tracker_owner;
+		pthread_mutex_unlock(&tracker_lock);
+		return errno == ESRCH ? -1 : 0;
+	}
+
+	// pidfd мог открыться уже для другого процесса с тем же PID
+	if (!is_same_process(proc_path, pid, starttime)) {
+		close(fd);
+		pthread_mutex_unlock(&tracker_lock);
+		return -1;
+	}
+
+	slot = tracker_slots + tracker_free;
+	event.events = EPOLLIN;
+	event.data.u64 = (uint64_t) tracker_free;
+	if (epoll_ctl(tracker_epoll, EPOLL_CTL_ADD, fd, &event) == 0) {
+		tracker_free = slot->next_free;
+		slot->process.pid = pid;
+		slot->process.starttime = starttime;
+		slot->fd = fd;
+		result = 1;
+	} else {
+		close(fd);
+	}
+	pthread_mutex_unlock(&tracker_lock);
+
+	return result;
+#else
+	return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Забирает завершившиеся процессы, не блокируясь.
+ * @param exited	сюда помещаются завершившиеся процессы
+ * @param size		размер exited
+ * @return		число завершившихся процессов
+ */
+size_t take_exited_pids(tracked_pid_t *exited, size_t size)
+{
+#ifdef PID_TRACKER
+	struct epoll_event events[TRACKER_EVENTS];
+	tracker_slot_t *slot;
+	size_t count = 0;
+	int ready, i;
+
+	pthread_mutex_lock(&tracker_lock);
+	if (tracker_epoll < 0 || tracker_owner != getpid()) {
+		pthread_mutex_unlock(&tracker_lock);
+		return 0;
+	}
+
+	while (count < size) {
+		ready = epoll_wait(tracker_epoll, events,
+			size - count < TRACKER_EVENTS ? (int) (size - count) : TRACKER_EVENTS, 0);
+		if (ready <= 0)
+			break;
+
+		for (i = 0; i < ready; ++i) {
+			slot = tracker_slots + events[i].data.u64;
+			exited[count++] = slot->process;
+
+			// Закрытие pidfd убирает его и из epoll
+			close(slot->fd);
+			slot->fd = -1;
+			slot->next_free = tracker_free;
+			tracker_free = (int) events[i].data.u64;
+		}
+	}
+	pthread_mutex_unlock(&tracker_lock);
+
+	return count;
+#else
+	return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Прекращает отслеживание всех процессов.
+ */
+void release_pid_tracker(void)
+{
+	pthread_mutex_lock(&tracker_lock);
+	close_pid_tracker();
+	pthread_mutex_unlock(&tracker_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Открывает epoll и ячейки текущего процесса, если они ещё не открыты.
+ * Вызывается под tracker_lock.
+ * @return	1 - успешно. 0 - отслеживание недоступно.
+ */
+int open_pid_tracker(void)
+{
+#ifdef PID_TRACKER
+	pid_t self = getpid();
+	int i;
+
+	if (tracker_epoll >= 0 && tracker_owner == self)
+		return 1;
+	if (tracker_failed == self)
+		return 0;
+
+	// Дескрипторы унаследованы от родителя - отслеживание принадлежит ему
+	close_pid_tracker();
+
+	tracker_slots = self_malloc(PID_TRACKER_MAX * sizeof(tracker_slot_t));
+	tracker_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (tracker_slots == NULL || tracker_epoll < 0) {
+		close_pid_tracker();
+		tracker_failed = self;
+		return 0;
+	}
+
+	for (i = 0; i < PID_TRACKER_MAX; ++i) {
+		tracker_slots[i].fd = -1;
+		tracker_slots[i].next_free = i + 1 < PID_TRACKER_MAX ? i + 1 : -1;
+	}
+	tracker_free = 0;
+	tracker_owner = self;
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Закрывает все pidfd и epoll. Вызывается под tracker_lock.
+ */
+void close_pid_tracker(void)
+{
+	int i;
+
+	if (tracker_slots != NULL) {
+		for (i = 0; i < PID_TRACKER_MAX; ++i)
+			if (tracker_slots[i].fd >= 0)
+				close(tracker_slots[i].fd);
+		free(tracker_slots);
+		tracker_slots = NULL;
+	}
+
+	if (tracker_epoll >= 0)
+		close(tracker_epoll);
+	tracker_epoll = -1;
+	tracker_free = -1;
+	tracker_owner = 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет, что под PID всё ещё тот же процесс: сверяет время старта.
+ * @param proc_path	путь к /proc
+ * @param pid		PID процесса
+ * @param starttime	ожидаемое время старта, в тактах
+ * @return		1 - тот же процесс. 0 - процесса нет или он другой.
+ */
+int is_same_process(const char *proc_path, int pid, unsigned long long starttime)
+{
+	char path[PATH_MAX_SIZE], buf[LINUX_STAT_BUF_SIZE];
+	linux_stat_t stat;
+	ssize_t length;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%d/stat", proc_path, pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	length = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (length <= 0)
+		return 0;
+	buf[length] = '\0';
+
+	return parse_linux_stat(buf, length, &stat, STAT_UPTO_RSS) &&
+		stat.starttime == starttime;
+}
@@ -0,0 +1,73 @@
+/*
+ * Отслеживание завершения процессов через pidfd и epoll.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef PID_TRACKER_H
+#define PID_TRACKER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PID_TRACKER_MAX 4096 // Наибольшее число отслеживаемых процессов
+
+	/* Процесс, завершение которого отслеживается */
+	typedef struct tracked_pid_s {
+		int pid; /* PID процесса */
+		unsigned long long starttime; /* время старта процесса, в тактах */
+	} tracked_pid_t;
+
+	/**
+	 * Начинает отслеживать завершение процесса: открывает pidfd
+	 * (pidfd_open, linux 5.3+, привилегий не требует) и добавляет его
+	 * в epoll. После открытия pidfd время старта процесса сверяется
+	 * со stat, чтобы не следить за чужим процессом, получившим тот же PID.
+	 *
+	 * Дескрипторы, унаследованные через fork(), в потомке закрываются,
+	 * и отслеживание начинается заново.
+	 *
+	 * @param proc_path	путь к /proc
+	 * @param pid		PID процесса
+	 * @param starttime	время старта процесса из stat, в тактах
+	 * @return		1 - процесс отслеживается. 0 - отслеживание
+	 *			недоступно или достигнут PID_TRACKER_MAX.
+	 *			-1 - процесса с таким PID и временем старта
+	 *			уже нет.
+	 */
+	extern int track_pid(const char *proc_path, int pid, unsigned long long starttime);
+
+	/**
+	 * Забирает завершившиеся процессы, не блокируясь, и закрывает их pidfd.
+	 * @param exited	сюда помещаются завершившиеся процессы
+	 * @param size		размер exited
+	 * @return		число завершившихся процессов
+	 */
+	extern size_t take_exited_pids(tracked_pid_t *exited, size_t size);
+
+	/**
+	 * Прекращает отслеживание всех процессов, закрывает дескрипторы.
+	 */
+	extern void release_pid_tracker(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PID_TRACKER_H */
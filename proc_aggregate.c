@@ -0,0 +1,323 @@
+/*
+ * Агрегаты снимка /proc по паре (имя процесса, владелец).
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "self_stats.h"
+#include "proc_aggregate.h"
+
+int begin_proc_aggregates(proc_aggregates_t *table, size_t processes);
+int add_proc_aggregate(proc_aggregates_t *table, const char *comm, long uid,
+	const proc_aggregate_values_t *values);
+unsigned find_proc_aggregate_name(const proc_aggregates_t *table, const char *comm);
+const char *get_proc_aggregate_name(const proc_aggregates_t *table, unsigned name);
+const proc_aggregate_t *first_proc_aggregate(const proc_aggregates_t *table, unsigned name);
+const proc_aggregate_t *next_proc_aggregate(const proc_aggregates_t *table,
+	const proc_aggregate_t *item);
+void release_proc_aggregates(proc_aggregates_t *table);
+unsigned intern_proc_name(proc_aggregates_t *table, const char *comm);
+unsigned hash_proc_name(const char *comm);
+unsigned hash_proc_aggregate(unsigned name, long uid);
+int reserve_aggregate_index(unsigned **index, size_t *index_size, size_t count);
+
+/**
+ * Очищает агрегаты перед заполнением. Хеш-таблицы подбираются под
+ * число процессов, так что при заполнении они не перестраиваются.
+ * @param table		агрегаты
+ * @param processes	число процессов снимка
+ * @return		0 - успешно. -1 - не хватило памяти.
+ */
+int begin_proc_aggregates(proc_aggregates_t *table, size_t processes)
+{
+	table->valid = 0;
+	table->names_length = 0;
+	table->name_count = 0;
+	table->count = 0;
+
+	// Имён и агрегатов не больше, чем процессов: таблицы заполнены
+	// не больше, чем наполовину
+	if (reserve_aggregate_index(&table->name_index, &table->name_index_size, processes) < 0 ||
+		reserve_aggregate_index(&table->index, &table->index_size, processes) < 0)
+		return -1;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет процесс к агрегату его имени и владельца.
+ * @param table		агрегаты
+ * @param comm		имя процесса
+ * @param uid		UID владельца
+ * @param values	значения процесса. NULL - stat процесса ещё
+ *			не прочитан
+ * @return		0 - успешно. -1 - не хватило памяти.
+ */
+int add_proc_aggregate(proc_aggregates_t *table, const char *comm, long uid,
+	const proc_aggregate_values_t *values)
+{
+	proc_aggregate_t *item, *larger;
+	unsigned name, slot;
+	size_t mask = table->index_size - 1;
+
+	name = intern_proc_name(table, comm);
+	if (name == 0)
+		return -1;
+	--name;
+
+	slot = hash_proc_aggregate(name, uid) & mask;
+	while (table->index[slot] != 0) {
+		item = table->items + table->index[slot] - 1;
+		if (item->name == name && item->uid == uid)
+			break;
+		slot = (slot + 1) & mask;
+	}
+
+	if (table->index[slot] == 0) {
+		if (table->count == table->capacity) {
+			size_t capacity = table->capacity ? table->capacity * 2 : AGGREGATE_INDEX_MIN;
+			larger = self_realloc(table->items, capacity * sizeof(proc_aggregate_t));
+			if (larger == NULL)
+				return -1;
+			table->items = larger;
+			table->capacity = capacity;
+		}
+
+		// Новый агрегат встаёт в начало списка агрегатов имени
+		item = table->items + table->count;
+		memset(item, 0, sizeof(proc_aggregate_t));
+		item->name = name;
+		item->uid = uid;
+		item->next = table->name_heads[name];
+		table->name_heads[name] = table->index[slot] = (unsigned) ++table->count;
+	} else {
+		item = table->items + table->index[slot] - 1;
+	}
+
+	++item->count;
+	if (values == NULL) {
+		++item->pending;
+	} else {
+		item->totals.rss += values->rss;
+		item->totals.vsize += values->vsize;
+		item->totals.cpu += values->cpu;
+		item->totals.minflt += values->minflt;
+		item->totals.majflt += values->majflt;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Ищет имя в таблице имён.
+ * @param table		агрегаты
+ * @param comm		имя процесса
+ * @return		номер имени + 1. 0 - процессов с таким именем нет.
+ */
+unsigned find_proc_aggregate_name(const proc_aggregates_t *table, const char *comm)
+{
+	size_t mask = table->name_index_size - 1;
+	unsigned slot;
+
+	if (table->name_index_size == 0)
+		return 0;
+
+	slot = hash_proc_name(comm) & mask;
+	while (table->name_index[slot] != 0) {
+		if (strcmp(table->names + table->name_offsets[table->name_index[slot] - 1], comm) == 0)
+			return table->name_index[slot];
+		slot = (slot + 1) & mask;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает имя по номеру.
+ * @param table		агрегаты
+ * @param name		номер имени
+ * @return		имя процесса
+ */
+const char *get_proc_aggregate_name(const proc_aggregates_t *table, unsigned name)
+{
+	return table->names + table->name_offsets[name];
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает первый агрегат имени.
+ * @param table		агрегаты
+ * @param name		номер имени
+ * @return		агрегат
+ */
+const proc_aggregate_t *first_proc_aggregate(const proc_aggregates_t *table, unsigned name)
+{
+	return table->items + table->name_heads[name] - 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает следующий агрегат того же имени.
+ * @param table		агрегаты
+ * @param item		текущий агрегат
+ * @return		агрегат. NULL - агрегаты имени закончились.
+ */
+const proc_aggregate_t *next_proc_aggregate(const proc_aggregates_t *table,
+	const proc_aggregate_t *item)
+{
+	return item->next != 0 ? table->items + item->next - 1 : NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Освобождает память агрегатов.
+ * @param table		агрегаты
+ */
+void release_proc_aggregates(proc_aggregates_t *table)
+{
+	free(table->names);
+	free(table->name_offsets);
+	free(table->name_heads);
+	free(table->name_index);
+	free(table->items);
+	free(table->index);
+	memset(table, 0, sizeof(proc_aggregates_t));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает номер имени в таблице имён, добавляя имя при первой встрече.
+ * @param table		агрегаты
+ * @param comm		имя процесса
+ * @return		номер имени + 1. 0 - не хватило памяти.
+ */
+unsigned intern_proc_name(proc_aggregates_t *table, const char *comm)
+{
+	size_t mask = table->name_index_size - 1, length = strlen(comm) + 1, capacity;
+	unsigned slot;
+	void *larger;
+
+	slot = hash_proc_name(comm) & mask;
+	while (table->name_index[slot] != 0) {
+		if (strcmp(table->names + table->name_offsets[table->name_index[slot] - 1], comm) == 0)
+			return table->name_index[slot];
+		slot = (slot + 1) & mask;
+	}
+
+	if (table->names_length + length > table->names_capacity) {
+		capacity = table->names_capacity ? table->names_capacity : AGGREGATE_INDEX_MIN * 16;
+		while (capacity < table->names_length + length)
+			capacity *= 2;
+		larger = self_realloc(table->names, capacity);
+		if (larger == NULL)
+			return 0;
+		table->names = larger;
+		table->names_capacity = capacity;
+	}
+
+	if (table->name_count == table->name_capacity) {
+		capacity = table->name_capacity ? table->name_capacity * 2 : AGGREGATE_INDEX_MIN;
+		larger = self_realloc(table->name_offsets, capacity * sizeof(size_t));
+		if (larger == NULL)
+			return 0;
+		table->name_offsets = larger;
+		larger = self_realloc(table->name_heads, capacity * sizeof(unsigned));
+		if (larger == NULL)
+			return 0;
+		table->name_heads = larger;
+		table->name_capacity = capacity;
+	}
+
+	memcpy(table->names + table->names_length, comm, length);
+	table->name_offsets[table->name_count] = table->names_length;
+	table->name_heads[table->name_count] = 0;
+	table->names_length += length;
+
+	return table->name_index[slot] = (unsigned) ++table->name_count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Хеш имени процесса, FNV-1a.
+ * @param comm	имя процесса
+ * @return	хеш
+ */
+unsigned hash_proc_name(const char *comm)
+{
+	unsigned hash = 2166136261U;
+
+	for (; *comm != '\0'; ++comm)
+		hash = (hash ^ (unsigned char) *comm) * 16777619U;
+
+	return hash;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Хеш пары (номер имени, владелец).
+ * @param name	номер имени
+ * @param uid	UID владельца
+ * @return	хеш
+ */
+unsigned hash_proc_aggregate(unsigned name, long uid)
+{
+	return (name + 1) * 2654435761U ^ (unsigned) uid * 2246822519U;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Подбирает размер хеш-таблицы не меньше удвоенного числа элементов и
+ * очищает её. Память прошлого снимка переиспользуется.
+ * @param index		хеш-таблица
+ * @param index_size	размер хеш-таблицы, степень двойки
+ * @param count		наибольшее число элементов
+ * @return		0 - успешно. -1 - не хватило памяти.
+ */
+int reserve_aggregate_index(unsigned **index, size_t *index_size, size_t count)
+{
+	size_t size = *index_size ? *index_size : AGGREGATE_INDEX_MIN;
+	unsigned *larger;
+
+	while (size < 2 * count)
+		size *= 2;
+
+	if (size != *index_size) {
+		larger = self_realloc(*index, size * sizeof(unsigned));
+		if (larger == NULL)
+			return -1;
+		*index = larger;
+		*index_size = size;
+	}
+
+	memset(*index, 0, size * sizeof(unsigned));
+
+	return 0;
+}
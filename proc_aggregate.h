@@ -0,0 +1,143 @@
+/*
+ * Агрегаты снимка /proc по паре (имя процесса, владелец).
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef PROC_AGGREGATE_H
+#define PROC_AGGREGATE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AGGREGATE_INDEX_MIN 64 // Начальное число ячеек хеш-таблиц, степень двойки
+
+	/* Значения процесса из stat, которые суммируются в агрегате */
+	typedef struct proc_aggregate_values_s {
+		unsigned long rss; /* резидентная память, в байтах */
+		unsigned long vsize; /* виртуальная память, в байтах */
+		unsigned long cpu; /* загрузка процессора, в сотых долях процента */
+		unsigned long minflt; /* ошибки страниц без чтения с диска, в сотых
+				       * долях в секунду */
+		unsigned long majflt; /* ошибки страниц с чтением с диска, в сотых
+				       * долях в секунду */
+	} proc_aggregate_values_t;
+
+	/* Процессы снимка с одним именем и одним владельцем */
+	typedef struct proc_aggregate_s {
+		unsigned name; /* номер имени в таблице имён */
+		long uid; /* UID владельца */
+		unsigned long count; /* число процессов */
+		unsigned long pending; /* из них процессов, stat которых
+					* ещё не прочитан */
+		proc_aggregate_values_t totals; /* суммы по прочитанным процессам */
+		unsigned next; /* следующий агрегат с тем же именем + 1,
+				* 0 - последний */
+	} proc_aggregate_t;
+
+	/* Агрегаты снимка по паре (имя, владелец). Каждое имя хранится один
+	 * раз, агрегат ссылается на него по номеру, поэтому ключ агрегата -
+	 * два числа и строки при поиске агрегата не сравниваются. Обе
+	 * хеш-таблицы - с открытой адресацией. Память переиспользуется между
+	 * снимками */
+	typedef struct proc_aggregates_s {
+		char *names; /* имена подряд, каждое завершено '\0' */
+		size_t names_length; /* занято байт в names */
+		size_t names_capacity; /* размер names */
+		size_t *name_offsets; /* смещение имени в names, по номеру имени */
+		unsigned *name_heads; /* первый агрегат имени + 1, по номеру имени */
+		size_t name_count; /* число имён */
+		size_t name_capacity; /* размер name_offsets и name_heads */
+		unsigned *name_index; /* номер имени + 1, 0 - свободная ячейка */
+		size_t name_index_size; /* размер name_index, степень двойки */
+		proc_aggregate_t *items; /* агрегаты */
+		size_t count; /* число агрегатов */
+		size_t capacity; /* размер items */
+		unsigned *index; /* номер агрегата + 1, 0 - свободная ячейка */
+		size_t index_size; /* размер index, степень двойки */
+		int valid; /* 1 - собраны по текущему содержимому снимка */
+	} proc_aggregates_t;
+
+	/**
+	 * Очищает агрегаты перед заполнением. Хеш-таблицы подбираются под
+	 * число процессов, так что при заполнении они не перестраиваются.
+	 * @param table		агрегаты
+	 * @param processes	число процессов снимка
+	 * @return		0 - успешно. -1 - не хватило памяти.
+	 */
+	extern int begin_proc_aggregates(proc_aggregates_t *table, size_t processes);
+
+	/**
+	 * Добавляет процесс к агрегату его имени и владельца.
+	 * @param table		агрегаты
+	 * @param comm		имя процесса
+	 * @param uid		UID владельца
+	 * @param values	значения процесса. NULL - stat процесса ещё
+	 *			не прочитан
+	 * @return		0 - успешно. -1 - не хватило памяти.
+	 */
+	extern int add_proc_aggregate(proc_aggregates_t *table, const char *comm, long uid,
+		const proc_aggregate_values_t *values);
+
+	/**
+	 * Ищет имя в таблице имён.
+	 * @param table		агрегаты
+	 * @param comm		имя процесса
+	 * @return		номер имени + 1. 0 - процессов с таким именем нет.
+	 */
+	extern unsigned find_proc_aggregate_name(const proc_aggregates_t *table, const char *comm);
+
+	/**
+	 * Возвращает имя по номеру.
+	 * @param table		агрегаты
+	 * @param name		номер имени
+	 * @return		имя процесса
+	 */
+	extern const char *get_proc_aggregate_name(const proc_aggregates_t *table, unsigned name);
+
+	/**
+	 * Возвращает первый агрегат имени. Остальные агрегаты имени, по
+	 * одному на владельца, перебираются через next_proc_aggregate().
+	 * @param table		агрегаты
+	 * @param name		номер имени
+	 * @return		агрегат
+	 */
+	extern const proc_aggregate_t *first_proc_aggregate(const proc_aggregates_t *table,
+		unsigned name);
+
+	/**
+	 * Возвращает следующий агрегат того же имени.
+	 * @param table		агрегаты
+	 * @param item		текущий агрегат
+	 * @return		агрегат. NULL - агрегаты имени закончились.
+	 */
+	extern const proc_aggregate_t *next_proc_aggregate(const proc_aggregates_t *table,
+		const proc_aggregate_t *item);
+
+	/**
+	 * Освобождает память агрегатов.
+	 * @param table		агрегаты
+	 */
+	extern void release_proc_aggregates(proc_aggregates_t *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROC_AGGREGATE_H */
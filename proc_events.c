@@ -0,0 +1,275 @@
+/*
+ * Подписка на события процессов linux (proc connector, CN_PROC).
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "proc_events.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#define EVENTS_BUF_SIZE 16384 // Размер буфера приёма событий
+#define EVENTS_RCVBUF_SIZE (4 * 1024 * 1024) // Размер очереди сокета событий
+
+static int events_fd = -1; // Сокет proc connector. -1 - не открыт
+static pid_t events_owner = 0; // Процесс, открывший сокет
+static pid_t events_failed = 0; // Процесс, которому подписаться не удалось
+#endif
+
+int open_proc_events(void);
+int read_proc_events(proc_change_handler_t handler, void *context);
+void close_proc_events(void);
+#ifdef __linux__
+int send_proc_events_op(int fd, int op);
+int dispatch_proc_event(struct proc_event *event, proc_change_handler_t handler,
+	void *context);
+#endif
+
+/**
+ * Подписывает текущий процесс на события процессов.
+ * @return	1 - подписка выполнена только что. 0 - подписка уже действует.
+ *		-1 - события недоступны.
+ */
+int open_proc_events(void)
+{
+#ifdef __linux__
+	struct sockaddr_nl address;
+	pid_t self = getpid();
+	int size = EVENTS_RCVBUF_SIZE;
+
+	if (events_fd >= 0 && events_owner == self)
+		return 0;
+	if (events_failed == self)
+		return -1;
+
+	// Сокет унаследован от родителя - очередь событий принадлежит ему
+	if (events_fd >= 0) {
+		close(events_fd);
+		events_fd = -1;
+	}
+
+	events_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		NETLINK_CONNECTOR);
+	if (events_fd < 0) {
+		events_failed = self;
+		return -1;
+	}
+
+	// Очередь побольше, чтобы переждать всплеск fork/exit между обновлениями
+	// снимка. SO_RCVBUFFORCE обходит rmem_max, но требует привилегий
+	if (setsockopt(events_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+		setsockopt(events_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	memset(&address, 0, sizeof(address));
+	address.nl_family = AF_NETLINK;
+	address.nl_groups = CN_IDX_PROC;
+	if (bind(events_fd, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+		send_proc_events_op(events_fd, PROC_CN_MCAST_LISTEN) < 0) {
+		close(events_fd);
+		events_fd = -1;
+		events_failed = self;
+		return -1;
+	}
+
+	events_owner = self;
+	return 1;
+#else
+	return -1;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Забирает все накопившиеся события, не блокируясь.
+ * @param handler	обработчик, может быть NULL
+ * @param context	данные, передаваемые обработчику
+ * @return		0 - успешно. -1 - часть событий потеряна или сокет
+ *			не открыт.
+ */
+int read_proc_events(proc_change_handler_t handler, void *context)
+{
+#ifdef __linux__
+	long buf[EVENTS_BUF_SIZE / sizeof(long)]; // long - для выравнивания nlmsghdr
+	struct sockaddr_nl sender;
+	socklen_t sender_length;
+	struct nlmsghdr *header;
+	struct cn_msg *message;
+	ssize_t length;
+	int result = 0;
+
+	if (events_fd < 0 || events_owner != getpid())
+		return -1;
+
+	for (;;) {
+		sender_length = sizeof(sender);
+		length = recvfrom(events_fd, buf, sizeof(buf), 0,
+			(struct sockaddr *) &sender, &sender_length);
+		if (length < 0) {
+			if (errno == EINTR)
+				continue;
+			// Очередь переполнилась - события потеряны, но сокет
+			// работает, дочитываем оставшиеся
+			if (errno == ENOBUFS) {
+				result = -1;
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				result = -1;
+			break;
+		}
+
+		// События рассылает только ядро
+		if (sender.nl_pid != 0)
+			continue;
+
+		for (header = (struct nlmsghdr *) buf; NLMSG_OK(header, length);
+			header = NLMSG_NEXT(header, length)) {
+			if (header->nlmsg_type == NLMSG_NOOP)
+				continue;
+			if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_OVERRUN) {
+				result = -1;
+				continue;
+			}
+
+			message = (struct cn_msg *) NLMSG_DATA(header);
+			if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC)
+				continue;
+			if (message->len < sizeof(struct proc_event))
+				continue;
+
+			dispatch_proc_event((struct proc_event *) message->data, handler, context);
+		}
+	}
+
+	return result;
+#else
+	return -1;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Отписывается от событий и закрывает сокет.
+ */
+void close_proc_events(void)
+{
+#ifdef __linux__
+	if (events_fd < 0)
+		return;
+
+	// Унаследованный сокет отписывать нельзя - подписка принадлежит
+	// родителю
+	if (events_owner == getpid())
+		send_proc_events_op(events_fd, PROC_CN_MCAST_IGNORE);
+	close(events_fd);
+	events_fd = -1;
+	events_owner = 0;
+#endif
+}
+
+#ifdef __linux__
+//------------------------------------------------------------------------------
+
+/**
+ * Отправляет proc connector команду подписки или отписки.
+ * @param fd	сокет proc connector
+ * @param op	команда, из proc_cn_mcast_op
+ * @return	0 - успешно. -1 - команду отправить не удалось.
+ */
+int send_proc_events_op(int fd, int op)
+{
+	long buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op)) /
+		sizeof(long) + 1];
+	struct nlmsghdr *header = (struct nlmsghdr *) buf;
+	struct cn_msg *message;
+	enum proc_cn_mcast_op value = (enum proc_cn_mcast_op) op;
+
+	memset(buf, 0, sizeof(buf));
+	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(value));
+	header->nlmsg_type = NLMSG_DONE;
+	header->nlmsg_pid = 0;
+
+	message = (struct cn_msg *) NLMSG_DATA(header);
+	message->id.idx = CN_IDX_PROC;
+	message->id.val = CN_VAL_PROC;
+	message->len = sizeof(value);
+	memcpy(message->data, &value, sizeof(value));
+
+	return send(fd, header, header->nlmsg_len, 0) < 0 ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Передаёт событие процесса обработчику. События потоков, кроме
+ * главного, процессов не меняют и отбрасываются.
+ * @param event		событие proc connector
+ * @param handler	обработчик, может быть NULL
+ * @param context	данные, передаваемые обработчику
+ * @return		1 - событие передано. 0 - событие отброшено.
+ */
+int dispatch_proc_event(struct proc_event *event, proc_change_handler_t handler,
+	void *context)
+{
+	int pid, kind;
+
+	switch (event->what) {
+	case PROC_EVENT_FORK:
+		if (event->event_data.fork.child_pid != event->event_data.fork.child_tgid)
+			return 0;
+		pid = event->event_data.fork.child_tgid;
+		kind = PROC_CHANGE_UPDATED;
+		break;
+	case PROC_EVENT_EXEC:
+		pid = event->event_data.exec.process_tgid;
+		kind = PROC_CHANGE_UPDATED;
+		break;
+	case PROC_EVENT_UID:
+		pid = event->event_data.id.process_tgid;
+		kind = PROC_CHANGE_UPDATED;
+		break;
+	case PROC_EVENT_COMM:
+		if (event->event_data.comm.process_pid != event->event_data.comm.process_tgid)
+			return 0;
+		pid = event->event_data.comm.process_tgid;
+		kind = PROC_CHANGE_UPDATED;
+		break;
+	case PROC_EVENT_EXIT:
+		if (event->event_data.exit.process_pid != event->event_data.exit.process_tgid)
+			return 0;
+		pid = event->event_data.exit.process_tgid;
+		kind = PROC_CHANGE_EXITED;
+		break;
+	default:
+		return 0;
+	}
+
+	if (handler != NULL)
+		handler(context, pid, kind);
+
+	return 1;
+}
+#endif
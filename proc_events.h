@@ -0,0 +1,79 @@
+/*
+ * Подписка на события процессов linux (proc connector, CN_PROC).
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef PROC_EVENTS_H
+#define PROC_EVENTS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/* Что произошло с процессом */
+	enum proc_change_kind {
+		PROC_CHANGE_UPDATED = 1, /* новый процесс, exec(), смена имени
+					  * или владельца - процесс нужно
+					  * перечитать */
+		PROC_CHANGE_EXITED = 2 /* процесс завершился */
+	};
+
+	/**
+	 * Обработчик события процесса.
+	 * @param context	данные вызывающей стороны
+	 * @param pid		PID процесса (не потока)
+	 * @param kind		что произошло, из proc_change_kind
+	 */
+	typedef void (*proc_change_handler_t)(void *context, int pid, int kind);
+
+	/**
+	 * Подписывает текущий процесс на события fork/exec/exit через
+	 * netlink-сокет proc connector. Для подписки нужна привилегия
+	 * CAP_NET_ADMIN в исходном пространстве имён.
+	 *
+	 * Сокет, унаследованный через fork(), закрывается и открывается
+	 * заново: иначе родитель и потомок делили бы одну очередь событий.
+	 * Неудачная подписка в этом процессе не повторяется.
+	 *
+	 * @return	1 - подписка выполнена только что, события до этого
+	 *		момента неизвестны. 0 - подписка уже действует.
+	 *		-1 - события недоступны.
+	 */
+	extern int open_proc_events(void);
+
+	/**
+	 * Забирает все накопившиеся события, не блокируясь. События потоков
+	 * отбрасываются, обработчику передаются только события процессов,
+	 * в порядке их поступления.
+	 *
+	 * @param handler	обработчик, NULL - события отбрасываются
+	 * @param context	данные, передаваемые обработчику
+	 * @return		0 - успешно. -1 - часть событий потеряна
+	 *			(переполнение очереди сокета) или сокет не открыт.
+	 */
+	extern int read_proc_events(proc_change_handler_t handler, void *context);
+
+	/**
+	 * Отписывается от событий и закрывает сокет.
+	 */
+	extern void close_proc_events(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROC_EVENTS_H */
@@ -0,0 +1,594 @@
+/*
+ * Образ файлов /proc для воспроизведения замеров без живого хоста.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "proc_walker.h"
+#include "proc_image.h"
+
+#define IMAGE_MAGIC "PIDIMG3\n" // Заголовок образа
+#define IMAGE_MAGIC_SIZE 8 // Длина заголовка образа
+#define IMAGE_MISSING UINT32_MAX // Длина файла, которого в образе нет
+#define IMAGE_READ_SIZE 65536 // Начальный размер буфера чтения файла процесса
+#define IMAGE_PATH_SIZE 4096 // Размер пути к файлу дерева
+#define IMAGE_DENTS_SIZE 4096 // Размер буфера записей каталога дескрипторов
+
+/* Заголовок процесса в образе, за ним - содержимое файлов подряд */
+typedef struct image_record_s {
+	uint32_t pid; /* PID процесса */
+	uint32_t uid; /* UID владельца */
+	uint32_t fds; /* число открытых дескрипторов, IMAGE_MISSING - неизвестно */
+	uint32_t lengths[PROC_IMAGE_FILES]; /* длины файлов, IMAGE_MISSING - нет */
+} image_record_t;
+
+/* Процесс подключённого образа */
+typedef struct image_process_s {
+	int pid; /* PID процесса */
+	long uid; /* UID владельца */
+	long fds; /* число открытых дескрипторов, -1 - неизвестно */
+	const char *files[PROC_IMAGE_FILES]; /* содержимое файлов, NULL - нет */
+	size_t lengths[PROC_IMAGE_FILES]; /* длины файлов */
+} image_process_t;
+
+/* Файлы процесса, сохраняемые в образе, по номеру в image_record_t */
+static const char *image_files[PROC_IMAGE_FILES] = {
+	"stat", "statm", "status", "maps", "smaps_rollup", "cmdline", "io", "limits"
+};
+
+/* Подключённый образ. После подключения только читается */
+static char *image_map = NULL; // Отображённый в память файл образа
+static size_t image_size = 0; // Размер файла образа
+static image_process_t *image_processes = NULL; // Процессы, по возрастанию PID
+static size_t image_count = 0; // Число процессов
+
+int capture_proc_image(const char *proc_path, const char *image_path,
+	proc_image_stats_t *stats);
+int attach_proc_image(const char *image_path);
+void detach_proc_image(void);
+int is_proc_image_attached(void);
+int get_image_process(size_t number, int *pid);
+int get_image_owner(int pid, long *uid);
+int get_image_fds(int pid, long *fds);
+int find_image_file(int pid, const char *name, const char **data, size_t *length);
+int extract_proc_image(const char *image_path, const char *root,
+	proc_image_stats_t *stats);
+ssize_t read_whole_pid_file(proc_walker_t *walker, proc_pid_t *pid, const char *name,
+	char **buf, size_t *size);
+int index_proc_image(void);
+int compare_image_processes(const void *first, const void *second);
+const image_process_t *find_image_process(int pid);
+int write_tree_file(const char *path, const char *data, size_t length);
+int extract_image_fds(const char *root, const image_process_t *process);
+
+/**
+ * Снимает образ /proc в один файл.
+ * @param proc_path	путь к /proc
+ * @param image_path	путь к файлу образа
+ * @param stats		сюда будут помещены счётчики, может быть NULL
+ * @return		0 - успешно. -1 - ошибка чтения /proc или записи.
+ */
+int capture_proc_image(const char *proc_path, const char *image_path,
+	proc_image_stats_t *stats)
+{
+	proc_image_stats_t counters;
+	proc_walker_t walker;
+	proc_pid_t pid;
+	image_record_t record;
+	char *data[PROC_IMAGE_FILES];
+	size_t sizes[PROC_IMAGE_FILES];
+	char dents[IMAGE_DENTS_SIZE];
+	ssize_t length;
+	uint32_t count = 0;
+	long uid, fds;
+	int i, result = 0;
+	FILE *image;
+
+	if (open_proc_walker(&walker, proc_path) < 0)
+		return -1;
+
+	image = fopen(image_path, "wb");
+	if (image == NULL) {
+		close_proc_walker(&walker);
+		return -1;
+	}
+
+	memset(&counters, 0, sizeof(proc_image_stats_t));
+	memset(data, 0, sizeof(data));
+	memset(sizes, 0, sizeof(sizes));
+
+	// Число процессов записывается в конце, когда оно известно
+	if (fwrite(IMAGE_MAGIC, 1, IMAGE_MAGIC_SIZE, image) != IMAGE_MAGIC_SIZE ||
+		fwrite(&count, sizeof(count), 1, image) != 1)
+		result = -1;
+
+	while (result == 0 && next_proc_pid(&walker, &pid)) {
+		if (read_pid_owner(&walker, &pid, &uid) < 0) {
+			release_proc_pid(&walker, &pid);
+			continue;
+		}
+
+		record.pid = (uint32_t) pid.pid;
+		record.uid = (uint32_t) uid;
+		for (i = 0; i < PROC_IMAGE_FILES; ++i) {
+			length = read_whole_pid_file(&walker, &pid, image_files[i], data + i, sizes + i);
+			record.lengths[i] = length < 0 ? IMAGE_MISSING : (uint32_t) length;
+		}
+		fds = count_pid_fds(&walker, &pid, dents, sizeof(dents));
+		record.fds = fds < 0 ? IMAGE_MISSING : (uint32_t) fds;
+		release_proc_pid(&walker, &pid);
+
+		// Процесс завершился, пока его читали
+		if (record.lengths[0] == IMAGE_MISSING)
+			continue;
+
+		if (fwrite(&record, sizeof(record), 1, image) != 1) {
+			result = -1;
+			break;
+		}
+
+		for (i = 0; i < PROC_IMAGE_FILES; ++i) {
+			if (record.lengths[i] == IMAGE_MISSING)
+				continue;
+			if (fwrite(data[i], 1, record.lengths[i], image) != record.lengths[i]) {
+				result = -1;
+				break;
+			}
+			++counters.files;
+			counters.bytes += record.lengths[i];
+		}
+
+		++count;
+	}
+	counters.processes = count;
+
+	if (result == 0 && (fseek(image, IMAGE_MAGIC_SIZE, SEEK_SET) != 0 ||
+		fwrite(&count, sizeof(count), 1, image) != 1))
+		result = -1;
+	if (fclose(image) != 0)
+		result = -1;
+
+	for (i = 0; i < PROC_IMAGE_FILES; ++i)
+		free(data[i]);
+	close_proc_walker(&walker);
+
+	if (stats != NULL)
+		*stats = counters;
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Подключает образ: отображает его в память и строит индекс по PID.
+ * @param image_path	путь к файлу образа
+ * @return		0 - успешно. -1 - файл не открыт или это не образ.
+ */
+int attach_proc_image(const char *image_path)
+{
+	struct stat status;
+	void *map;
+	int fd;
+
+	detach_proc_image();
+
+	fd = open(image_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &status) < 0 || status.st_size < IMAGE_MAGIC_SIZE + (off_t) sizeof(uint32_t)) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	image_map = map;
+	image_size = status.st_size;
+
+	if (memcmp(image_map, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) != 0 || !index_proc_image()) {
+		detach_proc_image();
+		return -1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Отключает образ, освобождает память.
+ */
+void detach_proc_image(void)
+{
+	if (image_map != NULL)
+		munmap(image_map, image_size);
+	image_map = NULL;
+	image_size = 0;
+
+	free(image_processes);
+	image_processes = NULL;
+	image_count = 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет, подключён ли образ.
+ * @return	1 - подключён. 0 - нет.
+ */
+int is_proc_image_attached(void)
+{
+	return image_map != NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает процесс образа по номеру.
+ * @param number	номер процесса
+ * @param pid		сюда будет помещён PID
+ * @return		1 - процесс есть. 0 - процессы закончились.
+ */
+int get_image_process(size_t number, int *pid)
+{
+	if (number >= image_count)
+		return 0;
+
+	*pid = image_processes[number].pid;
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Определяет владельца процесса образа.
+ * @param pid	PID процесса
+ * @param uid	сюда будет помещён UID
+ * @return	0 - успешно. -1 - процесса в образе нет.
+ */
+int get_image_owner(int pid, long *uid)
+{
+	const image_process_t *process = find_image_process(pid);
+
+	if (process == NULL)
+		return -1;
+
+	*uid = process->uid;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Определяет число открытых дескрипторов процесса образа.
+ * @param pid	PID процесса
+ * @param fds	сюда будет помещено число дескрипторов
+ * @return	0 - успешно. -1 - процесса или числа дескрипторов в образе нет.
+ */
+int get_image_fds(int pid, long *fds)
+{
+	const image_process_t *process = find_image_process(pid);
+
+	if (process == NULL || process->fds < 0)
+		return -1;
+
+	*fds = process->fds;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Находит файл процесса в образе.
+ * @param pid		PID процесса
+ * @param name		имя файла в PID-каталоге
+ * @param data		сюда будет помещён указатель на содержимое
+ * @param length	сюда будет помещена длина содержимого
+ * @return		0 - успешно. -1 - процесса или файла в образе нет.
+ */
+int find_image_file(int pid, const char *name, const char **data, size_t *length)
+{
+	const image_process_t *process = find_image_process(pid);
+	int i;
+
+	if (process == NULL)
+		return -1;
+
+	for (i = 0; i < PROC_IMAGE_FILES; ++i) {
+		if (strcmp(image_files[i], name) != 0)
+			continue;
+		if (process->files[i] == NULL)
+			return -1;
+
+		*data = process->files[i];
+		*length = process->lengths[i];
+		return 0;
+	}
+
+	return -1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Записывает образ деревом каталогов. Владелец процесса переносится на
+ * PID-каталог, если хватает прав.
+ * @param image_path	путь к файлу образа
+ * @param root		каталог дерева, создаётся
+ * @param stats		сюда будут помещены счётчики, может быть NULL
+ * @return		0 - успешно. -1 - ошибка чтения образа или записи.
+ */
+int extract_proc_image(const char *image_path, const char *root,
+	proc_image_stats_t *stats)
+{
+	proc_image_stats_t counters;
+	char path[IMAGE_PATH_SIZE];
+	const image_process_t *process;
+	size_t n;
+	int i, result = 0;
+
+	if (attach_proc_image(image_path) < 0)
+		return -1;
+
+	memset(&counters, 0, sizeof(proc_image_stats_t));
+	if (mkdir(root, 0755) < 0 && errno != EEXIST)
+		result = -1;
+
+	for (n = 0; result == 0 && n < image_count; ++n) {
+		process = image_processes + n;
+
+		snprintf(path, sizeof(path), "%s/%d", root, process->pid);
+		if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+			result = -1;
+			break;
+		}
+
+		for (i = 0; i < PROC_IMAGE_FILES; ++i) {
+			if (process->files[i] == NULL)
+				continue;
+
+			snprintf(path, sizeof(path), "%s/%d/%s", root, process->pid, image_files[i]);
+			if (write_tree_file(path, process->files[i], process->lengths[i]) < 0) {
+				result = -1;
+				break;
+			}
+			++counters.files;
+			counters.bytes += process->lengths[i];
+		}
+
+		if (result == 0 && process->fds >= 0 && extract_image_fds(root, process) < 0) {
+			result = -1;
+			break;
+		}
+
+		// Без прав владельца дерево всё равно читается, только под своим UID
+		snprintf(path, sizeof(path), "%s/%d", root, process->pid);
+		if (chown(path, (uid_t) process->uid, (gid_t) -1) < 0)
+			errno = 0;
+
+		++counters.processes;
+	}
+
+	detach_proc_image();
+
+	if (stats != NULL)
+		*stats = counters;
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Считывает файл процесса целиком, увеличивая буфер при необходимости.
+ * @param walker	состояние обхода
+ * @param pid		PID-каталог
+ * @param name		имя файла в PID-каталоге
+ * @param buf		буфер, может быть перевыделен
+ * @param size		размер буфера
+ * @return		длина файла. -1 - файл прочитать не удалось.
+ */
+ssize_t read_whole_pid_file(proc_walker_t *walker, proc_pid_t *pid, const char *name,
+	char **buf, size_t *size)
+{
+	ssize_t length = 0, chunk;
+	char *grown;
+	int fd = open_pid_file(walker, pid, name);
+
+	if (fd < 0)
+		return -1;
+
+	for (;;) {
+		if (*size - length < IMAGE_READ_SIZE / 4) {
+			grown = realloc(*buf, *size > 0 ? *size * 2 : IMAGE_READ_SIZE);
+			if (grown == NULL) {
+				length = -1;
+				break;
+			}
+			*buf = grown;
+			*size = *size > 0 ? *size * 2 : IMAGE_READ_SIZE;
+		}
+
+		chunk = read_pid_fd(walker, fd, *buf + length, *size - length);
+		if (chunk < 0)
+			length = -1;
+		if (chunk <= 0)
+			break;
+		length += chunk;
+	}
+
+	close_pid_fd(walker, fd);
+
+	return length;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Строит индекс процессов подключённого образа и проверяет, что записи
+ * не выходят за конец файла.
+ * @return	1 - успешно. 0 - образ повреждён или не хватило памяти.
+ */
+int index_proc_image(void)
+{
+	image_record_t record;
+	size_t offset = IMAGE_MAGIC_SIZE + sizeof(uint32_t);
+	uint32_t count;
+	size_t n;
+	int i;
+
+	memcpy(&count, image_map + IMAGE_MAGIC_SIZE, sizeof(count));
+	if (count > (image_size - offset) / sizeof(image_record_t))
+		return 0;
+
+	image_processes = malloc((count > 0 ? count : 1) * sizeof(image_process_t));
+	if (image_processes == NULL)
+		return 0;
+
+	for (n = 0; n < count; ++n) {
+		if (image_size - offset < sizeof(image_record_t))
+			return 0;
+
+		// Записи не выровнены - копируем заголовок
+		memcpy(&record, image_map + offset, sizeof(record));
+		offset += sizeof(record);
+
+		image_processes[n].pid = (int) record.pid;
+		image_processes[n].uid = (long) record.uid;
+		image_processes[n].fds = record.fds == IMAGE_MISSING ? -1 : (long) record.fds;
+		for (i = 0; i < PROC_IMAGE_FILES; ++i) {
+			image_processes[n].files[i] = NULL;
+			image_processes[n].lengths[i] = 0;
+			if (record.lengths[i] == IMAGE_MISSING)
+				continue;
+			if (image_size - offset < record.lengths[i])
+				return 0;
+
+			image_processes[n].files[i] = image_map + offset;
+			image_processes[n].lengths[i] = record.lengths[i];
+			offset += record.lengths[i];
+		}
+	}
+
+	image_count = count;
+	qsort(image_processes, image_count, sizeof(image_process_t), compare_image_processes);
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сравнивает процессы образа по PID, для qsort.
+ * @param first		первый процесс
+ * @param second	второй процесс
+ * @return		<0, 0, >0
+ */
+int compare_image_processes(const void *first, const void *second)
+{
+	int a = ((const image_process_t *) first)->pid;
+	int b = ((const image_process_t *) second)->pid;
+
+	return (a > b) - (a < b);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Ищет процесс подключённого образа по PID двоичным поиском.
+ * @param pid	PID процесса
+ * @return	процесс. NULL - процесса в образе нет.
+ */
+const image_process_t *find_image_process(int pid)
+{
+	size_t low = 0, high = image_count, middle;
+
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (image_processes[middle].pid < pid)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low < image_count && image_processes[low].pid == pid ?
+		image_processes + low : NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Записывает файл дерева.
+ * @param path		путь к файлу
+ * @param data		содержимое
+ * @param length	длина содержимого
+ * @return		0 - успешно. -1 - ошибка записи.
+ */
+int write_tree_file(const char *path, const char *data, size_t length)
+{
+	FILE *file = fopen(path, "wb");
+	size_t written;
+
+	if (file == NULL)
+		return -1;
+
+	written = fwrite(data, 1, length, file);
+	if (fclose(file) != 0 || written != length)
+		return -1;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Записывает дескрипторы процесса образа каталогом fd с пустыми файлами
+ * по номерам дескрипторов: при обходе дерева они только считаются.
+ * @param root		каталог дерева
+ * @param process	процесс образа
+ * @return		0 - успешно. -1 - ошибка записи.
+ */
+int extract_image_fds(const char *root, const image_process_t *process)
+{
+	char path[IMAGE_PATH_SIZE];
+	long fd;
+
+	snprintf(path, sizeof(path), "%s/%d/fd", root, process->pid);
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+		return -1;
+
+	for (fd = 0; fd < process->fds; ++fd) {
+		snprintf(path, sizeof(path), "%s/%d/fd/%ld", root, process->pid, fd);
+		if (write_tree_file(path, "", 0) < 0)
+			return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Образ файлов /proc для воспроизведения замеров без живого хоста.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef PROC_IMAGE_H
+#define PROC_IMAGE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROC_IMAGE_FILES 8 // Сколько файлов процесса сохраняется в образе
+
+	/* Счётчики снятия образа */
+	typedef struct proc_image_stats_s {
+		unsigned long processes; /* сохранено процессов */
+		unsigned long files; /* сохранено файлов */
+		unsigned long bytes; /* сохранено байт файлов */
+	} proc_image_stats_t;
+
+	/**
+	 * Снимает образ /proc: stat, statm, status, maps, smaps_rollup, cmdline,
+	 * io и limits всех процессов, их владельцев и число открытых
+	 * дескрипторов, в один файл. Файлы, которые прочитать не удалось,
+	 * отмечаются в образе как отсутствующие.
+	 *
+	 * Образ - заголовок "PIDIMG3\n" и число процессов, затем по каждому
+	 * процессу PID, UID, число дескрипторов и длины файлов, за которыми идёт содержимое
+	 * файлов подряд. Числа - 32-битные, в порядке байт хоста, поэтому
+	 * образ воспроизводится на той же архитектуре.
+	 *
+	 * @param proc_path	путь к /proc
+	 * @param image_path	путь к файлу образа
+	 * @param stats		сюда будут помещены счётчики, может быть NULL
+	 * @return		0 - успешно. -1 - ошибка чтения /proc или записи.
+	 */
+	extern int capture_proc_image(const char *proc_path, const char *image_path,
+		proc_image_stats_t *stats);
+
+	/**
+	 * Отображает образ в память (mmap) и строит индекс по PID. Пока образ
+	 * подключён, обход /proc (proc_walker) читает процессы из него, без
+	 * системных вызовов. Подключается до первого обхода.
+	 *
+	 * @param image_path	путь к файлу образа
+	 * @return		0 - успешно. -1 - файл не открыт или это не образ.
+	 */
+	extern int attach_proc_image(const char *image_path);
+
+	/**
+	 * Отключает образ, освобождает память.
+	 */
+	extern void detach_proc_image(void);
+
+	/**
+	 * Проверяет, подключён ли образ.
+	 * @return	1 - подключён. 0 - нет.
+	 */
+	extern int is_proc_image_attached(void);
+
+	/**
+	 * Возвращает процесс образа по номеру, в порядке возрастания PID.
+	 * @param number	номер процесса
+	 * @param pid		сюда будет помещён PID
+	 * @return		1 - процесс есть. 0 - процессы закончились.
+	 */
+	extern int get_image_process(size_t number, int *pid);
+
+	/**
+	 * Определяет владельца процесса образа.
+	 * @param pid	PID процесса
+	 * @param uid	сюда будет помещён UID
+	 * @return	0 - успешно. -1 - процесса в образе нет.
+	 */
+	extern int get_image_owner(int pid, long *uid);
+
+	/**
+	 * Определяет число открытых дескрипторов процесса образа.
+	 * @param pid	PID процесса
+	 * @param fds	сюда будет помещено число дескрипторов
+	 * @return	0 - успешно. -1 - процесса в образе нет или каталог
+	 *		дескрипторов при снятии образа прочитать не удалось.
+	 */
+	extern int get_image_fds(int pid, long *fds);
+
+	/**
+	 * Находит файл процесса в образе. Содержимое не копируется.
+	 * @param pid		PID процесса
+	 * @param name		имя файла в PID-каталоге
+	 * @param data		сюда будет помещён указатель на содержимое
+	 * @param length	сюда будет помещена длина содержимого
+	 * @return		0 - успешно. -1 - процесса или файла в образе нет.
+	 */
+	extern int find_image_file(int pid, const char *name, const char **data, size_t *length);
+
+	/**
+	 * Записывает образ деревом каталогов, которое можно читать как /proc
+	 * (ProcRoot). Дескрипторы процесса записываются пустыми файлами
+	 * каталога fd, по числу дескрипторов.
+	 * @param image_path	путь к файлу образа
+	 * @param root		каталог дерева, создаётся
+	 * @param stats		сюда будут помещены счётчики, может быть NULL
+	 * @return		0 - успешно. -1 - ошибка чтения образа или записи.
+	 */
+	extern int extract_proc_image(const char *image_path, const char *root,
+		proc_image_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROC_IMAGE_H */
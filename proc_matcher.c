@@ -0,0 +1,396 @@
+/*
+ * Сопоставление процессов с шаблонами имени и командной строки.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include "string_util.h"
+#include "self_stats.h"
+#include "proc_matcher.h"
+
+/* Командная строка процесса в кэше */
+typedef struct cmdline_slot_s {
+	int pid; /* PID процесса. 0 - ячейка свободна */
+	unsigned long long starttime; /* время запуска процесса */
+	char *text; /* командная строка, аргументы через пробел */
+} cmdline_slot_t;
+
+static pthread_mutex_t matcher_lock = PTHREAD_MUTEX_INITIALIZER;
+static proc_matcher_t *matcher_cache[MATCHER_CACHE_SIZE]; // NULL - ячейка свободна
+static unsigned long matcher_clock = 0; // Счётчик обращений к кэшу, для вытеснения
+
+static pthread_mutex_t cmdline_lock = PTHREAD_MUTEX_INITIALIZER;
+static cmdline_slot_t *cmdline_cache = NULL; // CMDLINE_CACHE_SIZE ячеек, по PID
+
+proc_matcher_t *acquire_proc_matcher(const char *name, const char *cmdline);
+void release_proc_matcher(proc_matcher_t *matcher);
+int match_proc_comm(const proc_matcher_t *matcher, const char *comm);
+int needs_proc_cmdline(const proc_matcher_t *matcher);
+int match_proc_cmdline(const proc_matcher_t *matcher, const char *cmdline);
+ssize_t read_proc_cmdline(proc_walker_t *walker, int pid,
+	unsigned long long starttime, char *buf, size_t size);
+void release_matcher_cache(void);
+proc_matcher_t *compile_proc_matcher(const char *key, const char *name, const char *cmdline);
+int compile_proc_pattern(proc_pattern_t *pattern, const char *text);
+void free_proc_pattern(proc_pattern_t *pattern);
+int match_proc_pattern(const proc_pattern_t *pattern, const char *str);
+void store_cmdline(int pid, unsigned long long starttime, const char *text);
+
+/**
+ * Возвращает скомпилированное условие отбора из кэша.
+ * @param name		шаблон имени процесса. NULL или "" - любое
+ * @param cmdline	шаблон командной строки. NULL или "" - любая
+ * @return		условие. NULL - ошибка в шаблоне или не хватило памяти.
+ */
+proc_matcher_t *acquire_proc_matcher(const char *name, const char *cmdline)
+{
+	proc_matcher_t *matcher = NULL, **slot = matcher_cache;
+	size_t i;
+	char *key;
+
+	if (name == NULL)
+		name = "";
+	if (cmdline == NULL)
+		cmdline = "";
+
+	// Перевод строки в параметрах элемента данных не встречается
+	key = str_builder(3, name, "\n", cmdline);
+	if (key == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&matcher_lock);
+	for (i = 0; i < MATCHER_CACHE_SIZE; ++i) {
+		if (matcher_cache[i] != NULL && strcmp(matcher_cache[i]->key, key) == 0) {
+			matcher = matcher_cache[i];
+			break;
+		}
+		// Свободная ячейка или та, что дольше всех не использовалась
+		if (*slot != NULL && (matcher_cache[i] == NULL ||
+			matcher_cache[i]->used < (*slot)->used))
+			slot = matcher_cache + i;
+	}
+
+	if (matcher == NULL) {
+		// Ссылка, с которой условие создано, принадлежит кэшу
+		matcher = compile_proc_matcher(key, name, cmdline);
+		if (matcher != NULL) {
+			release_proc_matcher(*slot);
+			*slot = matcher;
+		}
+	}
+
+	if (matcher != NULL) {
+		matcher->used = ++matcher_clock;
+		__sync_fetch_and_add(&matcher->refs, 1);
+	}
+	pthread_mutex_unlock(&matcher_lock);
+
+	free(key);
+	return matcher;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Освобождает условие, полученное от acquire_proc_matcher().
+ * @param matcher	условие, может быть NULL
+ */
+void release_proc_matcher(proc_matcher_t *matcher)
+{
+	if (matcher == NULL || __sync_sub_and_fetch(&matcher->refs, 1) > 0)
+		return;
+
+	free_proc_pattern(&matcher->comm);
+	free_proc_pattern(&matcher->cmdline);
+	free(matcher->long_name);
+	free(matcher->key);
+	free(matcher);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверяет имя процесса с условием.
+ * @param matcher	условие
+ * @param comm		имя процесса из stat
+ * @return		1 - имя подходит. 0 - нет.
+ */
+int match_proc_comm(const proc_matcher_t *matcher, const char *comm)
+{
+	// Ядро обрезает имя, так что длинное имя сверяется по началу
+	if (matcher->long_name != NULL)
+		return strncmp(comm, matcher->long_name, KERNEL_COMM_LEN) == 0 &&
+			comm[KERNEL_COMM_LEN] == '\0';
+
+	return match_proc_pattern(&matcher->comm, comm);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет, нужна ли условию командная строка процесса.
+ * @param matcher	условие
+ * @return		1 - нужна. 0 - достаточно имени.
+ */
+int needs_proc_cmdline(const proc_matcher_t *matcher)
+{
+	return matcher->cmdline.kind != PATTERN_ANY || matcher->long_name != NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверяет командную строку процесса с условием.
+ * @param matcher	условие
+ * @param cmdline	командная строка, аргументы через пробел
+ * @return		1 - подходит. 0 - нет.
+ */
+int match_proc_cmdline(const proc_matcher_t *matcher, const char *cmdline)
+{
+	const char *end, *base;
+
+	if (matcher->long_name != NULL) {
+		// Имя файла argv[0]: от последнего '/' до первого пробела
+		end = strchr(cmdline, ' ');
+		if (end == NULL)
+			end = cmdline + strlen(cmdline);
+		for (base = end; base > cmdline && base[-1] != '/'; --base)
+			;
+		if ((size_t) (end - base) != strlen(matcher->long_name) ||
+			strncmp(base, matcher->long_name, end - base) != 0)
+			return 0;
+	}
+
+	return match_proc_pattern(&matcher->cmdline, cmdline);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Читает командную строку процесса через кэш.
+ * @param walker	состояние обхода /proc
+ * @param pid		PID процесса
+ * @param starttime	время запуска процесса
+ * @param buf		буфер
+ * @param size		размер буфера, с учётом '\0'
+ * @return		длина строки. -1 - процесса уже нет.
+ */
+ssize_t read_proc_cmdline(proc_walker_t *walker, int pid,
+	unsigned long long starttime, char *buf, size_t size)
+{
+	cmdline_slot_t *slot;
+	proc_pid_t dir;
+	ssize_t length, i;
+
+	pthread_mutex_lock(&cmdline_lock);
+	if (cmdline_cache != NULL) {
+		slot = cmdline_cache + (pid & (CMDLINE_CACHE_SIZE - 1));
+		if (slot->pid == pid && slot->starttime == starttime) {
+			snprintf(buf, size, "%s", slot->text);
+			pthread_mutex_unlock(&cmdline_lock);
+			return strlen(buf);
+		}
+	}
+	pthread_mutex_unlock(&cmdline_lock);
+
+	set_proc_pid(&dir, pid);
+	length = read_pid_file(walker, &dir, "cmdline", buf, size);
+	if (length < 0)
+		return -1;
+
+	// Аргументы разделены '\0', последний завершён им же
+	while (length > 0 && buf[length - 1] == '\0')
+		--length;
+	for (i = 0; i < length; ++i)
+		if (buf[i] == '\0')
+			buf[i] = ' ';
+	buf[length] = '\0';
+
+	store_cmdline(pid, starttime, buf);
+
+	return length;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Очищает кэши условий и командных строк.
+ */
+void release_matcher_cache(void)
+{
+	size_t i;
+
+	pthread_mutex_lock(&matcher_lock);
+	for (i = 0; i < MATCHER_CACHE_SIZE; ++i) {
+		release_proc_matcher(matcher_cache[i]);
+		matcher_cache[i] = NULL;
+	}
+	pthread_mutex_unlock(&matcher_lock);
+
+	pthread_mutex_lock(&cmdline_lock);
+	if (cmdline_cache != NULL) {
+		for (i = 0; i < CMDLINE_CACHE_SIZE; ++i)
+			free(cmdline_cache[i].text);
+		free(cmdline_cache);
+		cmdline_cache = NULL;
+	}
+	pthread_mutex_unlock(&cmdline_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Компилирует условие отбора.
+ * @param key		ключ кэша
+ * @param name		шаблон имени процесса
+ * @param cmdline	шаблон командной строки
+ * @return		условие с одной ссылкой. NULL - ошибка в шаблоне
+ *			или не хватило памяти.
+ */
+proc_matcher_t *compile_proc_matcher(const char *key, const char *name, const char *cmdline)
+{
+	proc_matcher_t *matcher = self_calloc(1, sizeof(proc_matcher_t));
+
+	if (matcher == NULL)
+		return NULL;
+
+	matcher->refs = 1;
+	matcher->key = self_strdup(key);
+	if (matcher->key == NULL || compile_proc_pattern(&matcher->comm, name) < 0 ||
+		compile_proc_pattern(&matcher->cmdline, cmdline) < 0) {
+		release_proc_matcher(matcher);
+		return NULL;
+	}
+
+	if (matcher->comm.kind == PATTERN_EXACT && strlen(name) > KERNEL_COMM_LEN) {
+		matcher->long_name = self_strdup(name);
+		if (matcher->long_name == NULL) {
+			release_proc_matcher(matcher);
+			return NULL;
+		}
+	}
+
+	return matcher;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Компилирует шаблон.
+ * @param pattern	сюда будет помещён шаблон
+ * @param text		шаблон: точный, шаблон оболочки или re:выражение
+ * @return		0 - успешно. -1 - ошибка в выражении или не хватило
+ *			памяти.
+ */
+int compile_proc_pattern(proc_pattern_t *pattern, const char *text)
+{
+	size_t prefix = strlen(MATCHER_REGEX_PREFIX);
+
+	if (*text == '\0') {
+		pattern->kind = PATTERN_ANY;
+		return 0;
+	}
+
+	if (strncmp(text, MATCHER_REGEX_PREFIX, prefix) == 0) {
+		if (regcomp(&pattern->regex, text + prefix, REG_EXTENDED | REG_NOSUB) != 0)
+			return -1;
+		pattern->kind = PATTERN_REGEX;
+		return 0;
+	}
+
+	pattern->text = self_strdup(text);
+	if (pattern->text == NULL)
+		return -1;
+	pattern->kind = strpbrk(text, "*?[") != NULL ? PATTERN_GLOB : PATTERN_EXACT;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Освобождает шаблон.
+ * @param pattern	шаблон
+ */
+void free_proc_pattern(proc_pattern_t *pattern)
+{
+	if (pattern->kind == PATTERN_REGEX)
+		regfree(&pattern->regex);
+	free(pattern->text);
+	pattern->text = NULL;
+	pattern->kind = PATTERN_ANY;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Сверяет строку с шаблоном.
+ * @param pattern	шаблон
+ * @param str		строка
+ * @return		1 - подходит. 0 - нет.
+ */
+int match_proc_pattern(const proc_pattern_t *pattern, const char *str)
+{
+	switch (pattern->kind) {
+	case PATTERN_EXACT:
+		return strcmp(pattern->text, str) == 0;
+	case PATTERN_GLOB:
+		return fnmatch(pattern->text, str, 0) == 0;
+	case PATTERN_REGEX:
+		return regexec(&pattern->regex, str, 0, NULL, 0) == 0;
+	default:
+		return 1;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Запоминает командную строку процесса. Ячейка выбирается по PID,
+ * прежний процесс в ней вытесняется.
+ * @param pid		PID процесса
+ * @param starttime	время запуска процесса
+ * @param text		командная строка
+ */
+void store_cmdline(int pid, unsigned long long starttime, const char *text)
+{
+	cmdline_slot_t *slot;
+	char *copy = self_strdup(text);
+
+	if (copy == NULL)
+		return;
+
+	pthread_mutex_lock(&cmdline_lock);
+	if (cmdline_cache == NULL)
+		cmdline_cache = self_calloc(CMDLINE_CACHE_SIZE, sizeof(cmdline_slot_t));
+
+	if (cmdline_cache != NULL) {
+		slot = cmdline_cache + (pid & (CMDLINE_CACHE_SIZE - 1));
+		free(slot->text);
+		slot->pid = pid;
+		slot->starttime = starttime;
+		slot->text = copy;
+		copy = NULL;
+	}
+	pthread_mutex_unlock(&cmdline_lock);
+
+	free(copy);
+}
@@ -0,0 +1,134 @@
+/*
+ * Сопоставление процессов с шаблонами имени и командной строки.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef PROC_MATCHER_H
+#define PROC_MATCHER_H
+
+#include <regex.h>
+#include <sys/types.h>
+#include "proc_walker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KERNEL_COMM_LEN 15 // Сколько символов имени процесса хранит ядро
+#define MATCHER_CACHE_SIZE 64 // Сколько скомпилированных шаблонов хранится в кэше
+#define CMDLINE_CACHE_SIZE 4096 // Число ячеек кэша командных строк, степень двойки
+#define MATCHER_REGEX_PREFIX "re:" // Префикс шаблона - регулярного выражения
+
+	/* Вид шаблона */
+	enum pattern_kinds {
+		PATTERN_ANY, /* шаблона нет, подходит всё */
+		PATTERN_EXACT, /* точное совпадение */
+		PATTERN_GLOB, /* шаблон оболочки, fnmatch */
+		PATTERN_REGEX /* расширенное регулярное выражение POSIX */
+	};
+
+	/* Скомпилированный шаблон */
+	typedef struct proc_pattern_s {
+		int kind; /* вид шаблона, из pattern_kinds */
+		char *text; /* шаблон, для PATTERN_EXACT и PATTERN_GLOB */
+		regex_t regex; /* выражение, для PATTERN_REGEX */
+	} proc_pattern_t;
+
+	/* Условие отбора процессов запроса: шаблон имени (comm) и шаблон
+	 * командной строки. Хранится в кэше и используется повторно */
+	typedef struct proc_matcher_s {
+		char *key; /* имя и командная строка запроса, ключ кэша */
+		proc_pattern_t comm; /* шаблон имени */
+		proc_pattern_t cmdline; /* шаблон командной строки */
+		char *long_name; /* имя длиннее KERNEL_COMM_LEN, сверяется с
+				  * argv[0]. NULL - нет */
+		unsigned refs; /* число ссылок: кэш и запросы */
+		unsigned long used; /* когда шаблон использовался, для вытеснения */
+	} proc_matcher_t;
+
+	/**
+	 * Возвращает скомпилированное условие отбора из кэша, компилирует
+	 * его при первом обращении.
+	 *
+	 * Шаблон без *, ? и [ сравнивается точно, иначе - как шаблон оболочки.
+	 * С префиксом re: - как расширенное регулярное выражение. Точное имя
+	 * длиннее KERNEL_COMM_LEN сверяется с comm по первым KERNEL_COMM_LEN
+	 * символам и с именем файла argv[0].
+	 *
+	 * @param name		шаблон имени процесса. NULL или "" - любое
+	 * @param cmdline	шаблон командной строки. NULL или "" - любая
+	 * @return		условие, освобождается через
+	 *			release_proc_matcher(). NULL - ошибка в регулярном
+	 *			выражении или не хватило памяти.
+	 */
+	extern proc_matcher_t *acquire_proc_matcher(const char *name, const char *cmdline);
+
+	/**
+	 * Освобождает условие, полученное от acquire_proc_matcher().
+	 * @param matcher	условие, может быть NULL
+	 */
+	extern void release_proc_matcher(proc_matcher_t *matcher);
+
+	/**
+	 * Сверяет имя процесса с условием. Дешёвая проверка, выполняется
+	 * до чтения командной строки.
+	 * @param matcher	условие
+	 * @param comm		имя процесса из stat
+	 * @return		1 - имя подходит. 0 - нет.
+	 */
+	extern int match_proc_comm(const proc_matcher_t *matcher, const char *comm);
+
+	/**
+	 * Проверяет, нужна ли условию командная строка процесса.
+	 * @param matcher	условие
+	 * @return		1 - нужна. 0 - достаточно имени.
+	 */
+	extern int needs_proc_cmdline(const proc_matcher_t *matcher);
+
+	/**
+	 * Сверяет командную строку процесса с условием.
+	 * @param matcher	условие
+	 * @param cmdline	командная строка, аргументы через пробел
+	 * @return		1 - подходит. 0 - нет.
+	 */
+	extern int match_proc_cmdline(const proc_matcher_t *matcher, const char *cmdline);
+
+	/**
+	 * Читает командную строку процесса, аргументы через пробел. Строка
+	 * кэшируется по паре (PID, starttime), так что /proc/pid/cmdline
+	 * читается один раз за время жизни процесса.
+	 * @param walker	состояние обхода /proc
+	 * @param pid		PID процесса
+	 * @param starttime	время запуска процесса, из stat
+	 * @param buf		буфер
+	 * @param size		размер буфера, с учётом '\0'
+	 * @return		длина строки. -1 - процесса уже нет.
+	 */
+	extern ssize_t read_proc_cmdline(proc_walker_t *walker, int pid,
+		unsigned long long starttime, char *buf, size_t size);
+
+	/**
+	 * Очищает кэши условий и командных строк. Выданные условия остаются
+	 * действительными.
+	 */
+	extern void release_matcher_cache(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROC_MATCHER_H */
@@ -0,0 +1,680 @@
+/*
+ * Разбор файлов /proc/pid без выделения памяти.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <string.h>
+#include <stddef.h>
+#include "proc_parse.h"
+
+/* Типы полей stat-файла */
+enum stat_field_type {
+	FIELD_CHAR,
+	FIELD_INT,
+	FIELD_UINT,
+	FIELD_LONG,
+	FIELD_ULONG,
+	FIELD_ULLONG
+};
+
+/* Описание поля stat-файла: где оно лежит в linux_stat_t и какого типа */
+typedef struct stat_field_s {
+	size_t offset; /* смещение поля в linux_stat_t */
+	int type; /* тип поля, из stat_field_type */
+} stat_field_t;
+
+/* Поля stat-файла, начиная с (3) */
+static const stat_field_t stat_fields[] = {
+	{offsetof(linux_stat_t, state), FIELD_CHAR}, /* (3) */
+	{offsetof(linux_stat_t, ppid), FIELD_INT}, /* (4) */
+	{offsetof(linux_stat_t, pgrp), FIELD_INT}, /* (5) */
+	{offsetof(linux_stat_t, session), FIELD_INT}, /* (6) */
+	{offsetof(linux_stat_t, tty_nr), FIELD_INT}, /* (7) */
+	{offsetof(linux_stat_t, tpgid), FIELD_INT}, /* (8) */
+	{offsetof(linux_stat_t, flags), FIELD_UINT}, /* (9) */
+	{offsetof(linux_stat_t, minflt), FIELD_ULONG}, /* (10) */
+	{offsetof(linux_stat_t, cminflt), FIELD_ULONG}, /* (11) */
+	{offsetof(linux_stat_t, majflt), FIELD_ULONG}, /* (12) */
+	{offsetof(linux_stat_t, cmajflt), FIELD_ULONG}, /* (13) */
+	{offsetof(linux_stat_t, utime), FIELD_ULONG}, /* (14) */
+	{offsetof(linux_stat_t, stime), FIELD_ULONG}, /* (15) */
+	{offsetof(linux_stat_t, cutime), FIELD_LONG}, /* (16) */
+	{offsetof(linux_stat_t, cstime), FIELD_LONG}, /* (17) */
+	{offsetof(linux_stat_t, priority), FIELD_LONG}, /* (18) */
+	{offsetof(linux_stat_t, nice), FIELD_LONG}, /* (19) */
+	{offsetof(linux_stat_t, num_threads), FIELD_LONG}, /* (20) */
+	{offsetof(linux_stat_t, itrealvalue), FIELD_LONG}, /* (21) */
+	{offsetof(linux_stat_t, starttime), FIELD_ULLONG}, /* (22) */
+	{offsetof(linux_stat_t, vsize), FIELD_ULONG}, /* (23) */
+	{offsetof(linux_stat_t, rss), FIELD_LONG} /* (24) */
+};
+
+/* Обработчик строки файла /proc. Возвращает 1, если строка учтена */
+typedef int (*proc_line_handler_t)(const char *line, const char *end, void *context);
+
+/* Значения шестнадцатеричных цифр, увеличенные на 1. 0 - не цифра */
+static const unsigned char hex_values[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+int parse_linux_stat(const char *buf, size_t length, linux_stat_t *stat, int last_field);
+const char *parse_decimal(const char *pos, const char *end, unsigned long long *value, int *negative);
+int parse_linux_statm(const char *buf, size_t length, linux_statm_t *statm);
+int parse_linux_status(const char *buf, size_t length, linux_status_t *status);
+int parse_linux_io(const char *buf, size_t length, linux_io_t *io);
+int parse_linux_nofile_limit(const char *buf, size_t length, unsigned long long *limit);
+void init_linux_maps(linux_maps_parser_t *parser);
+void feed_linux_maps(linux_maps_parser_t *parser, const char *buf, size_t length);
+void finish_linux_maps(linux_maps_parser_t *parser);
+void init_linux_smaps(linux_smaps_parser_t *parser);
+void feed_linux_smaps(linux_smaps_parser_t *parser, const char *buf, size_t length);
+void finish_linux_smaps(linux_smaps_parser_t *parser);
+unsigned long feed_proc_lines(proc_line_head_t *head, const char *buf, size_t length,
+	proc_line_handler_t handler, void *context);
+unsigned long finish_proc_lines(proc_line_head_t *head, proc_line_handler_t handler, void *context);
+int parse_maps_line(const char *line, const char *end, void *context);
+int parse_smaps_line(const char *line, const char *end, void *context);
+int parse_status_line(const char *line, const char *end, void *context);
+int parse_io_line(const char *line, const char *end, void *context);
+int parse_limits_line(const char *line, const char *end, void *context);
+const char *parse_hex(const char *pos, const char *end, unsigned long *value);
+
+/**
+ * Разбирает содержимое stat-файла процесса linux.
+ *
+ * @param buf		содержимое stat-файла
+ * @param length	длина содержимого
+ * @param stat		сюда будет помещён результат
+ * @param last_field	номер последнего нужного поля
+ * @return		1 - успешно. 0 - формат не распознан.
+ */
+int parse_linux_stat(const char *buf, size_t length, linux_stat_t *stat, int last_field)
+{
+	const char *end = buf + length;
+	const char *comm_begin, *comm_end, *pos;
+	unsigned long long value;
+	int negative, field;
+	char *target;
+
+	// (1) pid
+	pos = parse_decimal(buf, end, &value, &negative);
+	if (pos == NULL)
+		return 0;
+	stat->pid = (int) value;
+
+	// (2) comm - до последней закрывающей скобки
+	comm_begin = memchr(pos, '(', end - pos);
+	if (comm_begin == NULL)
+		return 0;
+	for (comm_end = end - 1; comm_end > comm_begin && *comm_end != ')'; --comm_end)
+		;
+	if (comm_end == comm_begin)
+		return 0;
+
+	length = comm_end - comm_begin - 1;
+	if (length >= PROC_COMM_SIZE)
+		length = PROC_COMM_SIZE - 1;
+	memcpy(stat->comm, comm_begin + 1, length);
+	stat->comm[length] = '\0';
+
+	// (3) и далее, до last_field
+	pos = comm_end + 1;
+	for (field = 3; field <= last_field && field <= STAT_UPTO_RSS; ++field) {
+		while (pos < end && *pos == ' ')
+			++pos;
+		if (pos >= end)
+			return 0;
+
+		target = (char *) stat + stat_fields[field - 3].offset;
+		if (stat_fields[field - 3].type == FIELD_CHAR) {
+			*target = *(pos++);
+			continue;
+		}
+
+		pos = parse_decimal(pos, end, &value, &negative);
+		if (pos == NULL)
+			return 0;
+
+		switch (stat_fields[field - 3].type) {
+		case FIELD_INT:
+			*(int *) target = negative ? -(int) value : (int) value;
+			break;
+		case FIELD_UINT:
+			*(unsigned *) target = (unsigned) value;
+			break;
+		case FIELD_LONG:
+			*(long *) target = negative ? -(long) value : (long) value;
+			break;
+		case FIELD_ULONG:
+			*(unsigned long *) target = (unsigned long) value;
+			break;
+		case FIELD_ULLONG:
+			*(unsigned long long *) target = value;
+			break;
+		}
+	}
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает десятичное число, возможно со знаком минус.
+ * Пробелы и табуляции перед числом пропускаются.
+ *
+ * @param pos		начало числа
+ * @param end		конец буфера
+ * @param value		сюда будет помещено абсолютное значение числа
+ * @param negative	сюда будет помещён признак отрицательного числа
+ * @return		указатель на символ после числа. NULL - числа нет.
+ */
+const char *parse_decimal(const char *pos, const char *end, unsigned long long *value, int *negative)
+{
+	unsigned long long result = 0;
+	const char *digits;
+
+	while (pos < end && (*pos == ' ' || *pos == '\t'))
+		++pos;
+
+	*negative = pos < end && *pos == '-';
+	if (*negative)
+		++pos;
+
+	for (digits = pos; pos < end && (unsigned) (*pos - '0') <= 9; ++pos)
+		result = result * 10 + (unsigned) (*pos - '0');
+
+	if (pos == digits)
+		return NULL;
+
+	*value = result;
+	return pos;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает содержимое statm-файла процесса linux.
+ * @param buf		содержимое statm-файла
+ * @param length	длина содержимого
+ * @param statm		сюда будет помещён результат
+ * @return		1 - успешно. 0 - формат не распознан.
+ */
+int parse_linux_statm(const char *buf, size_t length, linux_statm_t *statm)
+{
+	unsigned long *fields[] = {&statm->size, &statm->resident, &statm->shared,
+		&statm->text, &statm->lib, &statm->data, &statm->dt};
+	const char *pos = buf, *end = buf + length;
+	unsigned long long value;
+	size_t i;
+	int negative;
+
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+		pos = parse_decimal(pos, end, &value, &negative);
+		if (pos == NULL)
+			return 0;
+		*fields[i] = (unsigned long) value;
+	}
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает содержимое status-файла процесса linux.
+ * @param buf		содержимое status-файла
+ * @param length	длина содержимого
+ * @param status	сюда будет помещён результат
+ * @return		1 - успешно. 0 - в файле нет счётчиков
+ *			переключений контекста.
+ */
+int parse_linux_status(const char *buf, size_t length, linux_status_t *status)
+{
+	proc_line_head_t head;
+
+	memset(&head, 0, sizeof(proc_line_head_t));
+	memset(status, 0, sizeof(linux_status_t));
+
+	return feed_proc_lines(&head, buf, length, parse_status_line, status) +
+		finish_proc_lines(&head, parse_status_line, status) == 2;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает содержимое io-файла процесса linux.
+ * @param buf		содержимое io-файла
+ * @param length	длина содержимого
+ * @param io		сюда будет помещён результат
+ * @return		1 - успешно. 0 - в файле нет нужных счётчиков.
+ */
+int parse_linux_io(const char *buf, size_t length, linux_io_t *io)
+{
+	proc_line_head_t head;
+
+	memset(&head, 0, sizeof(proc_line_head_t));
+	memset(io, 0, sizeof(linux_io_t));
+
+	return feed_proc_lines(&head, buf, length, parse_io_line, io) +
+		finish_proc_lines(&head, parse_io_line, io) == 4;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Находит в содержимом limits-файла процесса linux мягкий предел числа
+ * открытых дескрипторов.
+ * @param buf		содержимое limits-файла
+ * @param length	длина содержимого
+ * @param limit		сюда будет помещён предел. 0 - не ограничен
+ * @return		1 - успешно. 0 - строки с пределом нет.
+ */
+int parse_linux_nofile_limit(const char *buf, size_t length, unsigned long long *limit)
+{
+	proc_line_head_t head;
+
+	memset(&head, 0, sizeof(proc_line_head_t));
+	*limit = 0;
+
+	return feed_proc_lines(&head, buf, length, parse_limits_line, limit) +
+		finish_proc_lines(&head, parse_limits_line, limit) == 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Подготавливает разбор maps-файла.
+ * @param parser	состояние разбора
+ */
+void init_linux_maps(linux_maps_parser_t *parser)
+{
+	memset(parser, 0, sizeof(linux_maps_parser_t));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает очередной блок maps-файла.
+ * @param parser	состояние разбора
+ * @param buf		блок maps-файла
+ * @param length	длина блока
+ */
+void feed_linux_maps(linux_maps_parser_t *parser, const char *buf, size_t length)
+{
+	parser->mappings += feed_proc_lines(&parser->head, buf, length,
+		parse_maps_line, &parser->totals);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Завершает разбор maps-файла: учитывает разорванную строку.
+ * @param parser	состояние разбора
+ */
+void finish_linux_maps(linux_maps_parser_t *parser)
+{
+	parser->mappings += finish_proc_lines(&parser->head, parse_maps_line, &parser->totals);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Подготавливает разбор smaps или smaps_rollup.
+ * @param parser	состояние разбора
+ */
+void init_linux_smaps(linux_smaps_parser_t *parser)
+{
+	memset(parser, 0, sizeof(linux_smaps_parser_t));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает очередной блок smaps или smaps_rollup.
+ * @param parser	состояние разбора
+ * @param buf		блок файла
+ * @param length	длина блока
+ */
+void feed_linux_smaps(linux_smaps_parser_t *parser, const char *buf, size_t length)
+{
+	parser->lines += feed_proc_lines(&parser->head, buf, length,
+		parse_smaps_line, &parser->totals);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Завершает разбор smaps или smaps_rollup: учитывает разорванную строку.
+ * @param parser	состояние разбора
+ */
+void finish_linux_smaps(linux_smaps_parser_t *parser)
+{
+	parser->lines += finish_proc_lines(&parser->head, parse_smaps_line, &parser->totals);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Делит блок файла /proc на строки и передаёт их обработчику. Строки
+ * ищутся через memchr. Для разбора достаточно начала строки, поэтому от
+ * строки, разорванной границей блока, сохраняется только начало.
+ *
+ * @param head		строка, разорванная границей предыдущего блока
+ * @param buf		блок файла
+ * @param length	длина блока
+ * @param handler	обработчик строки
+ * @param context	аргумент обработчика
+ * @return		число учтённых строк
+ */
+unsigned long feed_proc_lines(proc_line_head_t *head, const char *buf, size_t length,
+	proc_line_handler_t handler, void *context)
+{
+	const char *pos = buf, *end = buf + length;
+	const char *newline;
+	unsigned long lines = 0;
+	size_t tail;
+
+	while (pos < end) {
+		newline = memchr(pos, '\n', end - pos);
+
+		if (head->partial || newline == NULL) {
+			tail = (newline != NULL ? newline : end) - pos;
+			if (tail > PROC_LINE_HEAD_SIZE - head->length)
+				tail = PROC_LINE_HEAD_SIZE - head->length;
+			memcpy(head->data + head->length, pos, tail);
+			head->length += tail;
+			head->partial = 1;
+
+			if (newline == NULL)
+				break;
+
+			lines += finish_proc_lines(head, handler, context);
+			pos = newline + 1;
+			continue;
+		}
+
+		lines += handler(pos, newline, context);
+		pos = newline + 1;
+	}
+
+	return lines;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Передаёт обработчику строку, разорванную границей блока, если она есть.
+ * @param head		строка, разорванная границей блока
+ * @param handler	обработчик строки
+ * @param context	аргумент обработчика
+ * @return		число учтённых строк
+ */
+unsigned long finish_proc_lines(proc_line_head_t *head, proc_line_handler_t handler, void *context)
+{
+	int counted;
+
+	if (!head->partial)
+		return 0;
+
+	counted = handler(head->data, head->data + head->length, context);
+	head->length = 0;
+	head->partial = 0;
+
+	return counted;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает строку maps-файла вида
+ * "начало-конец rwxp смещение устройство inode путь"
+ * и добавляет размер области к суммам.
+ *
+ * @param line		начало строки
+ * @param end		конец строки, без перевода строки
+ * @param context	суммы областей памяти, linux_maps_totals_t
+ * @return		1 - строка разобрана. 0 - формат не распознан.
+ */
+int parse_maps_line(const char *line, const char *end, void *context)
+{
+	linux_maps_totals_t *totals = (linux_maps_totals_t *) context;
+	unsigned long begin, finish, size;
+	const char *perms;
+
+	line = parse_hex(line, end, &begin);
+	if (line == NULL || line >= end || *line != '-')
+		return 0;
+
+	perms = parse_hex(line + 1, end, &finish);
+	if (perms == NULL || end - perms < 5 || *perms != ' ')
+		return 0;
+
+	// Области в половине адресного пространства ядра ([vsyscall]) не
+	// принадлежат процессу и не входят в его VmSize
+	if (sizeof(unsigned long) > 4 && begin >> (sizeof(unsigned long) * 8 - 1))
+		return 1;
+
+	// Права доступа всегда занимают 4 символа: r, w, x, s/p
+	++perms;
+	size = finish - begin;
+	totals->all += size;
+	if (perms[0] == 'r' && perms[1] == 'w')
+		totals->rw += size;
+	if (perms[2] == 'x')
+		totals->exec += size;
+	if (perms[3] == 's')
+		totals->shared += size;
+	else if (perms[3] == 'p')
+		totals->priv += size;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает строку smaps вида "Ключ:   значение kB" и добавляет значение
+ * к соответствующей сумме. Строки с описанием областей и ненужными
+ * ключами пропускаются по первому символу.
+ *
+ * @param line		начало строки
+ * @param end		конец строки, без перевода строки
+ * @param context	суммы, linux_smaps_totals_t
+ * @return		1 - строка учтена. 0 - строка не нужна.
+ */
+int parse_smaps_line(const char *line, const char *end, void *context)
+{
+	linux_smaps_totals_t *totals = (linux_smaps_totals_t *) context;
+	unsigned long *target;
+	unsigned long long value;
+	const char *colon;
+	size_t key_length;
+	int negative;
+
+	switch (*line) {
+	case 'P':
+	case 'S':
+	case 'A':
+		break;
+	default:
+		return 0;
+	}
+
+	colon = memchr(line, ':', end - line);
+	if (colon == NULL)
+		return 0;
+	key_length = colon - line;
+
+#define SMAPS_KEY_IS(key) (key_length == sizeof(key) - 1 && memcmp(line, key, key_length) == 0)
+	if (SMAPS_KEY_IS("Pss"))
+		target = &totals->pss;
+	else if (SMAPS_KEY_IS("Private_Clean") || SMAPS_KEY_IS("Private_Dirty"))
+		target = &totals->uss;
+	else if (SMAPS_KEY_IS("Swap"))
+		target = &totals->swap;
+	else if (SMAPS_KEY_IS("AnonHugePages"))
+		target = &totals->anonhuge;
+	else
+		return 0;
+#undef SMAPS_KEY_IS
+
+	if (parse_decimal(colon + 1, end, &value, &negative) == NULL)
+		return 0;
+
+	// Значения в smaps всегда в килобайтах
+	*target += (unsigned long) value * 1024;
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает строку status вида "Ключ:\tзначение" и запоминает счётчик
+ * переключений контекста. Остальные строки пропускаются по первому символу.
+ *
+ * @param line		начало строки
+ * @param end		конец строки, без перевода строки
+ * @param context	счётчики, linux_status_t
+ * @return		1 - строка учтена. 0 - строка не нужна.
+ */
+int parse_status_line(const char *line, const char *end, void *context)
+{
+	linux_status_t *status = (linux_status_t *) context;
+	unsigned long long *target;
+	const char *colon;
+	size_t key_length;
+	int negative;
+
+	if (*line != 'v' && *line != 'n')
+		return 0;
+
+	colon = memchr(line, ':', end - line);
+	if (colon == NULL)
+		return 0;
+	key_length = colon - line;
+
+#define STATUS_KEY_IS(key) (key_length == sizeof(key) - 1 && memcmp(line, key, key_length) == 0)
+	if (STATUS_KEY_IS("voluntary_ctxt_switches"))
+		target = &status->voluntary_ctxt_switches;
+	else if (STATUS_KEY_IS("nonvoluntary_ctxt_switches"))
+		target = &status->nonvoluntary_ctxt_switches;
+	else
+		return 0;
+#undef STATUS_KEY_IS
+
+	return parse_decimal(colon + 1, end, target, &negative) != NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает строку io вида "ключ: значение" и запоминает нужный счётчик.
+ * Ненужные строки отсекаются по первому символу и длине ключа.
+ *
+ * @param line		начало строки
+ * @param end		конец строки, без перевода строки
+ * @param context	счётчики, linux_io_t
+ * @return		1 - строка учтена. 0 - строка не нужна.
+ */
+int parse_io_line(const char *line, const char *end, void *context)
+{
+	linux_io_t *io = (linux_io_t *) context;
+	unsigned long long *target;
+	const char *colon;
+	size_t key_length;
+	int negative;
+
+	if (*line != 'r' && *line != 'w' && *line != 's')
+		return 0;
+
+	colon = memchr(line, ':', end - line);
+	if (colon == NULL)
+		return 0;
+	key_length = colon - line;
+
+#define IO_KEY_IS(key) (key_length == sizeof(key) - 1 && memcmp(line, key, key_length) == 0)
+	if (IO_KEY_IS("read_bytes"))
+		target = &io->read_bytes;
+	else if (IO_KEY_IS("write_bytes"))
+		target = &io->write_bytes;
+	else if (IO_KEY_IS("syscr"))
+		target = &io->syscr;
+	else if (IO_KEY_IS("syscw"))
+		target = &io->syscw;
+	else
+		return 0;
+#undef IO_KEY_IS
+
+	return parse_decimal(colon + 1, end, target, &negative) != NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает строку limits вида "Max open files  мягкий  жёсткий  files".
+ * Остальные пределы пропускаются.
+ *
+ * @param line		начало строки
+ * @param end		конец строки, без перевода строки
+ * @param context	мягкий предел, unsigned long long
+ * @return		1 - строка учтена. 0 - строка не нужна.
+ */
+int parse_limits_line(const char *line, const char *end, void *context)
+{
+	static const char name[] = "Max open files";
+	unsigned long long *limit = (unsigned long long *) context;
+	const char *pos = line + sizeof(name) - 1;
+	int negative;
+
+	if (end < pos || memcmp(line, name, sizeof(name) - 1) != 0)
+		return 0;
+
+	// "unlimited" числом не разбирается - предела нет
+	if (parse_decimal(pos, end, limit, &negative) == NULL)
+		*limit = 0;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает шестнадцатеричное число без префикса 0x.
+ * @param pos	начало числа
+ * @param end	конец буфера
+ * @param value	сюда будет помещено значение
+ * @return	указатель на символ после числа. NULL - числа нет.
+ */
+const char *parse_hex(const char *pos, const char *end, unsigned long *value)
+{
+	const char *digits = pos;
+	unsigned long result = 0;
+	unsigned digit;
+
+	for (; pos < end && (digit = hex_values[(unsigned char) *pos]) != 0; ++pos)
+		result = (result << 4) | (digit - 1);
+
+	if (pos == digits)
+		return NULL;
+
+	*value = result;
+	return pos;
+}
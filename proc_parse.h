@@ -0,0 +1,281 @@
+/*
+ * Разбор файлов /proc/pid без выделения памяти.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef PROC_PARSE_H
+#define PROC_PARSE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROC_COMM_SIZE 64 // Размер имени процесса, с учётом '\0'
+#define LINUX_STAT_BUF_SIZE 2048 // Размер буфера под stat-файл процесса
+#define PROC_LINE_HEAD_SIZE 64 // Сколько байт начала строки maps и smaps нужно для разбора
+
+	/* Номера полей stat-файла, до которых нужно разбирать файл */
+	enum linux_stat_last_field {
+		STAT_UPTO_COMM = 2, /* pid и имя процесса */
+		STAT_UPTO_PPID = 4, /* ... и родительский процесс */
+		STAT_UPTO_RSS = 24 /* все поля linux_stat_t */
+	};
+
+	typedef struct linux_stat_s {
+		int pid; /* (1) %d ID процесса. */
+		char comm[PROC_COMM_SIZE]; /* (2) %s Имя исполнимого файла,
+					 * без скобок */
+		char state; /* (3) %c Состояние процесса */
+		int ppid; /* (4) %d PID родительского процесса */
+		int pgrp; /* (5) %d ID группы процесса */
+		int session; /* (6) %d ID сессии процесса */
+		int tty_nr; /* (7) %d Номер терминала (tty),
+					 * контроллирующего процесс */
+		int tpgid; /* (8) %d ID группы приоритетного процесса
+					 *  терминала управления процессов */
+		unsigned flags; /* (9) %u Флаги ядра процесса */
+		unsigned long minflt; /* (10) %lu Число незначительных отказов,
+					 * произведённых процессом, которые не
+					 * потребовали загрузки страницы памяти с
+					 * диска. */
+		unsigned long cminflt; /* (11) %lu Число незначительных отказов,
+					 * которые произошли при ожидании выполнения
+					 * действий дочерних процессов */
+		unsigned long majflt; /* (12) %lu Число значительных отказов,
+					 * проиведённых процессом, которые
+					 * потребовали загрузки страниц памяти с
+					 * диска */
+		unsigned long cmajflt; /* (13) %lu Число значительных отказов,
+					 * которые произошли при ожидании выполнения
+					 * действий дочерних процессов */
+		unsigned long utime; /* (14) %lu Время выполнения процесса в
+					 * пространстве пользователя
+					 * (непривелегированный режим). Измеряется
+					 * в тактах */
+		unsigned long stime; /* (15) %lu Время выполнения процесса в
+					 * пространстве ядра. Измеряется в тактах */
+		long cutime; /* (16) %ld Время ожидания исполнения действий
+					 * доверних процессов в пространсве пользователя.
+					 * Измеряется в тактах */
+		long cstime; /* (17) %ld Время ожидания исполнения действия
+					 * дочерних процессов в пространстве ядра.
+					 * Измеряется в тактах */
+		long priority; /* (18) %ld Приоритет процесса. Измеряется
+					 * по-разному, в зависимости от параметров
+					 * планировщика процессов */
+		long nice; /* (19) %ld Приоритет процесса */
+		long num_threads; /* (20) %ld Число потоков процесса
+					 * (подпроцессов) */
+		long itrealvalue; /* (21) %ld Не используется, здесь всегда 0 */
+		unsigned long long starttime; /* (22) %llu Время старта процесса после
+					   * загрузки системы. Измеряется в тактах */
+		unsigned long vsize; /* (23) %lu Размер виртуальной памяти, в
+					 * байтах. */
+		long rss; /* (24) %ld Расход резидентной памяти. Показывает,
+					 * сколько процесс использует реальной физической
+					 * памяти за вычетом свопа и выгруженных данных */
+	} linux_stat_t;
+
+	/**
+	 * Разбирает содержимое stat-файла процесса linux.
+	 *
+	 * Имя процесса берётся между первой открывающей и последней
+	 * закрывающей скобкой, поэтому корректно разбираются имена с
+	 * пробелами и скобками. Поля разбираются только до last_field
+	 * включительно, остальные поля stat не заполняются.
+	 * Память не выделяется.
+	 *
+	 * @param buf		содержимое stat-файла
+	 * @param length	длина содержимого
+	 * @param stat		сюда будет помещён результат
+	 * @param last_field	номер последнего нужного поля,
+	 *			из linux_stat_last_field
+	 * @return		1 - успешно. 0 - формат не распознан.
+	 */
+	extern int parse_linux_stat(const char *buf, size_t length, linux_stat_t *stat, int last_field);
+
+	/* Размеры памяти процесса linux из statm, в страницах */
+	typedef struct linux_statm_s {
+		unsigned long size; /* виртуальная память (VmSize) */
+		unsigned long resident; /* резидентная память (VmRSS) */
+		unsigned long shared; /* резидентная память, отображённая
+				       * из файлов и shmem */
+		unsigned long text; /* код */
+		unsigned long lib; /* не используется, всегда 0 */
+		unsigned long data; /* данные и стек */
+		unsigned long dt; /* не используется, всегда 0 */
+	} linux_statm_t;
+
+	/* Суммы размеров областей памяти процесса linux */
+	typedef struct linux_maps_totals_s {
+		unsigned long all; /* все области */
+		unsigned long rw; /* области, доступные на чтение и запись */
+		unsigned long shared; /* разделяемые области */
+		unsigned long exec; /* исполняемые области */
+		unsigned long priv; /* частные области (copy-on-write) */
+	} linux_maps_totals_t;
+
+	/* Начало строки файла /proc, разорванной границей блока */
+	typedef struct proc_line_head_s {
+		char data[PROC_LINE_HEAD_SIZE]; /* начало строки */
+		size_t length; /* число байт в data */
+		int partial; /* 1 - последняя строка блока не закончена */
+	} proc_line_head_t;
+
+	/* Состояние разбора maps-файла, читаемого блоками */
+	typedef struct linux_maps_parser_s {
+		linux_maps_totals_t totals; /* суммы областей памяти */
+		unsigned long mappings; /* число разобранных областей */
+		proc_line_head_t head; /* строка, разорванная границей блока */
+	} linux_maps_parser_t;
+
+	/* Суммы из smaps или smaps_rollup процесса linux, в байтах */
+	typedef struct linux_smaps_totals_s {
+		unsigned long pss; /* Pss - пропорциональная доля резидентной
+				    * памяти */
+		unsigned long uss; /* Private_Clean + Private_Dirty - память,
+				    * принадлежащая только процессу */
+		unsigned long swap; /* Swap - выгруженная память */
+		unsigned long anonhuge; /* AnonHugePages - анонимные
+					 * huge-страницы */
+	} linux_smaps_totals_t;
+
+	/* Состояние разбора smaps или smaps_rollup, читаемого блоками */
+	typedef struct linux_smaps_parser_s {
+		linux_smaps_totals_t totals; /* суммы */
+		unsigned long lines; /* число учтённых строк */
+		proc_line_head_t head; /* строка, разорванная границей блока */
+	} linux_smaps_parser_t;
+
+	/* Переключения контекста процесса linux из status */
+	typedef struct linux_status_s {
+		unsigned long long voluntary_ctxt_switches; /* процесс сам отдал
+							     * процессор */
+		unsigned long long nonvoluntary_ctxt_switches; /* процессор
+								* отобрал планировщик */
+	} linux_status_t;
+
+	/* Счётчики ввода-вывода процесса linux из io */
+	typedef struct linux_io_s {
+		unsigned long long read_bytes; /* прочитано с блочных устройств,
+						* в байтах */
+		unsigned long long write_bytes; /* отправлено на запись на блочные
+						 * устройства, в байтах */
+		unsigned long long syscr; /* вызовов чтения */
+		unsigned long long syscw; /* вызовов записи */
+	} linux_io_t;
+
+	/**
+	 * Разбирает содержимое statm-файла процесса linux.
+	 * @param buf		содержимое statm-файла
+	 * @param length	длина содержимого
+	 * @param statm		сюда будет помещён результат
+	 * @return		1 - успешно. 0 - формат не распознан.
+	 */
+	extern int parse_linux_statm(const char *buf, size_t length, linux_statm_t *statm);
+
+	/**
+	 * Разбирает содержимое status-файла процесса linux. Из файла берутся
+	 * только строки voluntary_ctxt_switches и nonvoluntary_ctxt_switches,
+	 * остальные пропускаются по первому символу.
+	 * @param buf		содержимое status-файла
+	 * @param length	длина содержимого
+	 * @param status	сюда будет помещён результат
+	 * @return		1 - успешно. 0 - в файле нет счётчиков
+	 *			переключений контекста.
+	 */
+	extern int parse_linux_status(const char *buf, size_t length, linux_status_t *status);
+
+	/**
+	 * Разбирает содержимое io-файла процесса linux. Ключи сравниваются
+	 * прямо в буфере файла, без копирования строк; rchar, wchar и
+	 * cancelled_write_bytes пропускаются.
+	 * @param buf		содержимое io-файла
+	 * @param length	длина содержимого
+	 * @param io		сюда будет помещён результат
+	 * @return		1 - успешно. 0 - в файле нет нужных счётчиков.
+	 */
+	extern int parse_linux_io(const char *buf, size_t length, linux_io_t *io);
+
+	/**
+	 * Находит в содержимом limits-файла процесса linux мягкий предел
+	 * числа открытых дескрипторов (строка "Max open files").
+	 * @param buf		содержимое limits-файла
+	 * @param length	длина содержимого
+	 * @param limit		сюда будет помещён предел. 0 - не ограничен
+	 * @return		1 - успешно. 0 - строки с пределом нет.
+	 */
+	extern int parse_linux_nofile_limit(const char *buf, size_t length, unsigned long long *limit);
+
+	/**
+	 * Подготавливает разбор maps-файла.
+	 * @param parser	состояние разбора
+	 */
+	extern void init_linux_maps(linux_maps_parser_t *parser);
+
+	/**
+	 * Разбирает очередной блок maps-файла и добавляет размеры областей
+	 * к суммам. Строки ищутся через memchr, из строки читаются только
+	 * адреса и права доступа, память не выделяется. Строка может быть
+	 * разорвана границей блока - её начало сохраняется в состоянии разбора.
+	 * Области из половины адресного пространства ядра ([vsyscall]) в
+	 * суммы не входят, как и в VmSize процесса.
+	 *
+	 * @param parser	состояние разбора
+	 * @param buf		блок maps-файла
+	 * @param length	длина блока
+	 */
+	extern void feed_linux_maps(linux_maps_parser_t *parser, const char *buf, size_t length);
+
+	/**
+	 * Завершает разбор maps-файла: учитывает последнюю строку, если
+	 * файл не закончился переводом строки.
+	 * @param parser	состояние разбора
+	 */
+	extern void finish_linux_maps(linux_maps_parser_t *parser);
+
+	/**
+	 * Подготавливает разбор smaps или smaps_rollup.
+	 * @param parser	состояние разбора
+	 */
+	extern void init_linux_smaps(linux_smaps_parser_t *parser);
+
+	/**
+	 * Разбирает очередной блок smaps или smaps_rollup. У smaps_rollup
+	 * формат тот же, что у smaps с единственной областью, поэтому оба
+	 * файла разбираются одинаково: значения Pss, Private_Clean,
+	 * Private_Dirty, Swap и AnonHugePages суммируются по всем областям.
+	 *
+	 * @param parser	состояние разбора
+	 * @param buf		блок файла
+	 * @param length	длина блока
+	 */
+	extern void feed_linux_smaps(linux_smaps_parser_t *parser, const char *buf, size_t length);
+
+	/**
+	 * Завершает разбор smaps или smaps_rollup.
+	 * @param parser	состояние разбора
+	 */
+	extern void finish_linux_smaps(linux_smaps_parser_t *parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROC_PARSE_H */
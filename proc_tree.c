@@ -0,0 +1,186 @@
+/*
+ * Дерево процессов снимка /proc: дочерние процессы по родителю.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "self_stats.h"
+#include "proc_tree.h"
+
+int reserve_proc_tree(proc_tree_t *tree, size_t count);
+void build_proc_tree(proc_tree_t *tree);
+void begin_proc_tree_walk(proc_tree_t *tree);
+size_t add_proc_subtree(proc_tree_t *tree, unsigned root);
+void release_proc_tree(proc_tree_t *tree);
+int grow_tree_array(unsigned **array, size_t size);
+
+/**
+ * Готовит дерево к заполнению родителей.
+ * @param tree		дерево
+ * @param count		число процессов снимка
+ * @return		0 - успешно. -1 - не хватило памяти.
+ */
+int reserve_proc_tree(proc_tree_t *tree, size_t count)
+{
+	size_t capacity = tree->capacity ? tree->capacity : 256;
+
+	tree->valid = 0;
+	tree->queued = 0;
+
+	if (count > tree->capacity) {
+		while (capacity < count)
+			capacity *= 2;
+
+		if (grow_tree_array(&tree->parents, capacity) < 0 ||
+			grow_tree_array(&tree->first, capacity + 1) < 0 ||
+			grow_tree_array(&tree->children, capacity) < 0 ||
+			grow_tree_array(&tree->marks, capacity) < 0 ||
+			grow_tree_array(&tree->queue, capacity) < 0)
+			return -1;
+
+		tree->capacity = capacity;
+	}
+
+	// Новые процессы не должны считаться отобранными
+	memset(tree->marks, 0, count * sizeof(unsigned));
+	tree->mark = 0;
+	tree->count = count;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Строит списки детей по заполненным родителям: сначала считает детей
+ * каждого процесса, затем раскладывает их по местам.
+ * @param tree		дерево
+ */
+void build_proc_tree(proc_tree_t *tree)
+{
+	size_t i;
+	unsigned total = 0, children;
+
+	memset(tree->first, 0, (tree->count + 1) * sizeof(unsigned));
+	for (i = 0; i < tree->count; ++i)
+		if (tree->parents[i] != 0)
+			++tree->first[tree->parents[i] - 1];
+
+	// first[p] - конец детей p; при раскладке он сдвигается к началу
+	for (i = 0; i < tree->count; ++i) {
+		children = tree->first[i];
+		total += children;
+		tree->first[i] = total;
+	}
+	tree->first[tree->count] = total;
+
+	for (i = tree->count; i-- > 0; )
+		if (tree->parents[i] != 0)
+			tree->children[--tree->first[tree->parents[i] - 1]] = (unsigned) i;
+
+	tree->valid = 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Начинает новый обход.
+ * @param tree		дерево
+ */
+void begin_proc_tree_walk(proc_tree_t *tree)
+{
+	tree->queued = 0;
+
+	// После переполнения номера старые отметки могли бы совпасть
+	if (++tree->mark == 0) {
+		memset(tree->marks, 0, tree->count * sizeof(unsigned));
+		tree->mark = 1;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет в queue процесс и всех его ещё не отобранных потомков. Обход
+ * в ширину, очередью служит сама queue, так что дополнительная память
+ * не нужна и глубина дерева не ограничена.
+ * @param tree		дерево
+ * @param root		номер процесса
+ * @return		число добавленных процессов
+ */
+size_t add_proc_subtree(proc_tree_t *tree, unsigned root)
+{
+	size_t head = tree->queued, start = tree->queued;
+	unsigned node, i;
+
+	if (tree->marks[root] == tree->mark)
+		return 0;
+
+	tree->marks[root] = tree->mark;
+	tree->queue[tree->queued++] = root;
+
+	for (; head < tree->queued; ++head) {
+		node = tree->queue[head];
+		for (i = tree->first[node]; i < tree->first[node + 1]; ++i) {
+			if (tree->marks[tree->children[i]] == tree->mark)
+				continue;
+
+			tree->marks[tree->children[i]] = tree->mark;
+			tree->queue[tree->queued++] = tree->children[i];
+		}
+	}
+
+	return tree->queued - start;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Освобождает память дерева.
+ * @param tree		дерево
+ */
+void release_proc_tree(proc_tree_t *tree)
+{
+	free(tree->parents);
+	free(tree->first);
+	free(tree->children);
+	free(tree->marks);
+	free(tree->queue);
+	memset(tree, 0, sizeof(proc_tree_t));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Увеличивает массив дерева. Содержимое не сохраняется.
+ * @param array		массив
+ * @param size		новый размер, в элементах
+ * @return		0 - успешно. -1 - не хватило памяти.
+ */
+int grow_tree_array(unsigned **array, size_t size)
+{
+	unsigned *larger = self_malloc(size * sizeof(unsigned));
+
+	if (larger == NULL)
+		return -1;
+
+	free(*array);
+	*array = larger;
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Дерево процессов снимка /proc: дочерние процессы по родителю.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef PROC_TREE_H
+#define PROC_TREE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/* Дерево процессов снимка. Процессы задаются номерами в снимке.
+	 * Дети каждого процесса лежат подряд в одном массиве (сжатые
+	 * списки смежности), так что дерево строится за два прохода по
+	 * снимку и обходится за время, линейное по числу процессов поддерева */
+	typedef struct proc_tree_s {
+		unsigned *parents; /* родитель процесса + 1, 0 - родителя нет
+				    * в снимке. Заполняет вызывающий */
+		unsigned *first; /* начало детей процесса в children, по
+				  * номеру процесса; count + 1 элементов */
+		unsigned *children; /* номера дочерних процессов */
+		unsigned *marks; /* номер обхода, в котором процесс уже попал
+				  * в queue, по номеру процесса */
+		unsigned mark; /* номер текущего обхода */
+		unsigned *queue; /* процессы, отобранные текущим обходом */
+		size_t queued; /* число процессов в queue */
+		size_t count; /* число процессов */
+		size_t capacity; /* размер массивов, в процессах */
+		int valid; /* 1 - построено по текущему содержимому снимка */
+	} proc_tree_t;
+
+	/**
+	 * Готовит дерево к заполнению родителей: выделяет память под count
+	 * процессов. Память прошлого снимка переиспользуется.
+	 * @param tree		дерево
+	 * @param count		число процессов снимка
+	 * @return		0 - успешно. -1 - не хватило памяти.
+	 */
+	extern int reserve_proc_tree(proc_tree_t *tree, size_t count);
+
+	/**
+	 * Строит списки детей по заполненным родителям, подсчётом за два
+	 * прохода.
+	 * @param tree		дерево
+	 */
+	extern void build_proc_tree(proc_tree_t *tree);
+
+	/**
+	 * Начинает новый обход: очищает queue. Процессы, отобранные прошлыми
+	 * обходами, снова могут быть отобраны.
+	 * @param tree		дерево
+	 */
+	extern void begin_proc_tree_walk(proc_tree_t *tree);
+
+	/**
+	 * Добавляет в queue процесс и всех его потомков, которые ещё не были
+	 * отобраны текущим обходом. Поддерево, уже отобранное через другой
+	 * корень, второй раз не добавляется.
+	 * @param tree		дерево
+	 * @param root		номер процесса
+	 * @return		число добавленных процессов
+	 */
+	extern size_t add_proc_subtree(proc_tree_t *tree, unsigned root);
+
+	/**
+	 * Освобождает память дерева.
+	 * @param tree		дерево
+	 */
+	extern void release_proc_tree(proc_tree_t *tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROC_TREE_H */
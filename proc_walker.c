@@ -0,0 +1,514 @@
+/*
+ * Обход /proc с минимальным числом системных вызовов.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "proc_walker.h"
+#include "proc_image.h"
+#include "self_stats.h"
+
+#define DENTS_SIZE 65536 // Размер буфера записей каталога /proc
+
+#ifdef SYS_getdents64
+/* Запись каталога, возвращаемая getdents64 */
+struct linux_dirent64 {
+	uint64_t d_ino; /* номер inode */
+	int64_t d_off; /* смещение следующей записи */
+	unsigned short d_reclen; /* длина этой записи */
+	unsigned char d_type; /* тип файла */
+	char d_name[]; /* имя, завершается '\0' */
+};
+#endif
+
+int open_proc_walker(proc_walker_t *walker, const char *proc_path);
+void close_proc_walker(proc_walker_t *walker);
+int next_proc_pid(proc_walker_t *walker, proc_pid_t *pid);
+const char *next_proc_name(proc_walker_t *walker);
+int parse_pid_name(const char *name, int *pid);
+void set_proc_pid(proc_pid_t *pid, int number);
+int open_pid_dir(proc_walker_t *walker, proc_pid_t *pid);
+void release_proc_pid(proc_walker_t *walker, proc_pid_t *pid);
+int read_pid_owner(proc_walker_t *walker, proc_pid_t *pid, long *uid);
+int open_pid_file(proc_walker_t *walker, proc_pid_t *pid, const char *name);
+int open_pid_path(proc_walker_t *walker, proc_pid_t *pid, const char *name, int flags);
+ssize_t read_pid_fd(proc_walker_t *walker, int fd, char *buf, size_t size);
+void close_pid_fd(proc_walker_t *walker, int fd);
+ssize_t read_pid_file(proc_walker_t *walker, proc_pid_t *pid,
+	const char *name, char *buf, size_t size);
+long count_pid_fds(proc_walker_t *walker, proc_pid_t *pid, char *buf, size_t size);
+
+/**
+ * Начинает обход /proc.
+ * @param walker	состояние обхода
+ * @param proc_path	путь к /proc
+ * @return		0 - успешно. -1 - /proc открыть не удалось.
+ */
+int open_proc_walker(proc_walker_t *walker, const char *proc_path)
+{
+	memset(walker, 0, sizeof(proc_walker_t));
+
+	if (is_proc_image_attached()) {
+		walker->proc_fd = -1;
+		walker->image = 1;
+		return 0;
+	}
+
+	walker->proc_fd = open(proc_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	++walker->stats.syscalls;
+	if (walker->proc_fd < 0)
+		return -1;
+	++walker->stats.files_opened;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Завершает обход /proc, освобождает ресурсы.
+ * @param walker	состояние обхода
+ */
+void close_proc_walker(proc_walker_t *walker)
+{
+	if (walker->dir != NULL) {
+		// closedir() закрывает и дескриптор /proc
+		closedir((DIR *) walker->dir);
+		walker->dir = NULL;
+		walker->proc_fd = -1;
+		++walker->stats.syscalls;
+	}
+
+	if (walker->proc_fd >= 0) {
+		close(walker->proc_fd);
+		walker->proc_fd = -1;
+		++walker->stats.syscalls;
+	}
+
+	free(walker->dents);
+	walker->dents = NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает следующий PID-каталог /proc.
+ * @param walker	состояние обхода
+ * @param pid		сюда будет помещён PID-каталог
+ * @return		1 - каталог найден. 0 - обход закончен.
+ */
+int next_proc_pid(proc_walker_t *walker, proc_pid_t *pid)
+{
+	const char *name;
+	int number;
+
+	if (walker->image) {
+		if (!get_image_process(walker->image_pos, &number))
+			return 0;
+
+		++walker->image_pos;
+		set_proc_pid(pid, number);
+		++walker->stats.pids;
+		return 1;
+	}
+
+	while ((name = next_proc_name(walker)) != NULL) {
+		if (!parse_pid_name(name, &number))
+			continue;
+
+		set_proc_pid(pid, number);
+		++walker->stats.pids;
+		return 1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает имя следующего элемента каталога /proc.
+ * Каталоги, не являющиеся PID-каталогами, по возможности отбрасываются
+ * по типу записи.
+ *
+ * @param walker	состояние обхода
+ * @return		имя элемента. NULL - элементов больше нет.
+ */
+const char *next_proc_name(proc_walker_t *walker)
+{
+#ifdef SYS_getdents64
+	struct linux_dirent64 *dent;
+
+	for (;;) {
+		if (walker->dents_pos >= walker->dents_len) {
+			if (walker->dents == NULL) {
+				walker->dents = self_malloc(DENTS_SIZE);
+				if (walker->dents == NULL)
+					return NULL;
+			}
+
+			walker->dents_len = syscall(SYS_getdents64, walker->proc_fd,
+				walker->dents, DENTS_SIZE);
+			walker->dents_pos = 0;
+			++walker->stats.syscalls;
+			if (walker->dents_len <= 0)
+				return NULL;
+		}
+
+		dent = (struct linux_dirent64 *) (walker->dents + walker->dents_pos);
+		walker->dents_pos += dent->d_reclen;
+
+		if (dent->d_type == DT_DIR || dent->d_type == DT_UNKNOWN)
+			return dent->d_name;
+	}
+#else
+	struct dirent *direntry;
+
+	if (walker->dir == NULL) {
+		walker->dir = fdopendir(walker->proc_fd);
+		if (walker->dir == NULL)
+			return NULL;
+	}
+
+	direntry = readdir((DIR *) walker->dir);
+	++walker->stats.syscalls;
+
+	return direntry != NULL ? direntry->d_name : NULL;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает имя PID-каталога.
+ * @param name	имя элемента каталога /proc
+ * @param pid	сюда будет помещён PID
+ * @return	1 - это PID-каталог. 0 - имя не является числом.
+ */
+int parse_pid_name(const char *name, int *pid)
+{
+	int result = 0;
+
+	if (*name < '1' || *name > '9')
+		return 0;
+
+	for (; *name != '\0'; ++name) {
+		if (*name < '0' || *name > '9' || result > 99999999)
+			return 0;
+		result = result * 10 + (*name - '0');
+	}
+
+	*pid = result;
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Заполняет описание PID-каталога по номеру процесса, без обхода.
+ * @param pid		описание PID-каталога
+ * @param number	PID процесса
+ */
+void set_proc_pid(proc_pid_t *pid, int number)
+{
+	pid->pid = number;
+	snprintf(pid->name, PROC_PID_NAME_SIZE, "%d", number);
+	pid->dir_fd = -1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Открывает PID-каталог.
+ * @param walker	состояние обхода
+ * @param pid		PID-каталог
+ * @return		0 - успешно. -1 - процесса уже нет.
+ */
+int open_pid_dir(proc_walker_t *walker, proc_pid_t *pid)
+{
+	long uid;
+
+	if (pid->dir_fd >= 0)
+		return 0;
+	if (walker->image)
+		return get_image_owner(pid->pid, &uid);
+
+	pid->dir_fd = openat(walker->proc_fd, pid->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	++walker->stats.syscalls;
+	if (pid->dir_fd < 0)
+		return -1;
+	++walker->stats.files_opened;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Закрывает PID-каталог, если он был открыт.
+ * @param walker	состояние обхода
+ * @param pid		PID-каталог
+ */
+void release_proc_pid(proc_walker_t *walker, proc_pid_t *pid)
+{
+	if (pid->dir_fd < 0)
+		return;
+
+	close(pid->dir_fd);
+	pid->dir_fd = -1;
+	++walker->stats.syscalls;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Определяет владельца процесса по дескриптору PID-каталога.
+ * @param walker	состояние обхода
+ * @param pid		PID-каталог, открывается при необходимости
+ * @param uid		сюда будет помещён UID владельца
+ * @return		0 - успешно. -1 - процесса уже нет.
+ */
+int read_pid_owner(proc_walker_t *walker, proc_pid_t *pid, long *uid)
+{
+	struct stat status;
+
+	if (walker->image)
+		return get_image_owner(pid->pid, uid);
+
+	if (open_pid_dir(walker, pid) < 0)
+		return -1;
+
+	++walker->stats.syscalls;
+	if (fstat(pid->dir_fd, &status) < 0)
+		return -1;
+
+	*uid = status.st_uid;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Открывает файл процесса.
+ * @param walker	состояние обхода
+ * @param pid		PID-каталог
+ * @param name		имя файла в PID-каталоге
+ * @return		дескриптор файла. -1 - файл открыть не удалось.
+ */
+int open_pid_file(proc_walker_t *walker, proc_pid_t *pid, const char *name)
+{
+	proc_image_file_t *file;
+	int fd;
+
+	if (walker->image) {
+		for (fd = 0; fd < PROC_IMAGE_OPEN_FILES; ++fd) {
+			file = walker->image_files + fd;
+			if (file->data != NULL)
+				continue;
+			if (find_image_file(pid->pid, name, &file->data, &file->length) < 0)
+				return -1;
+
+			file->offset = 0;
+			++walker->stats.files_opened;
+			return PROC_IMAGE_FD_BASE + fd;
+		}
+		return -1;
+	}
+
+	return open_pid_path(walker, pid, name, O_RDONLY | O_CLOEXEC);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Открывает файл или каталог в PID-каталоге /proc.
+ * @param walker	состояние обхода
+ * @param pid		PID-каталог
+ * @param name		имя в PID-каталоге
+ * @param flags		флаги open
+ * @return		дескриптор. -1 - открыть не удалось.
+ */
+int open_pid_path(proc_walker_t *walker, proc_pid_t *pid, const char *name, int flags)
+{
+	char path[PROC_PID_NAME_SIZE + 32];
+	int fd;
+
+	if (pid->dir_fd >= 0) {
+		fd = openat(pid->dir_fd, name, flags);
+	} else {
+		snprintf(path, sizeof(path), "%s/%s", pid->name, name);
+		fd = openat(walker->proc_fd, path, flags);
+	}
+
+	++walker->stats.syscalls;
+	if (fd >= 0)
+		++walker->stats.files_opened;
+
+	return fd;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Читает данные из файла процесса.
+ * @param walker	состояние обхода
+ * @param fd		дескриптор файла
+ * @param buf		буфер
+ * @param size		размер буфера
+ * @return		число прочитанных байт. -1 - ошибка чтения.
+ */
+ssize_t read_pid_fd(proc_walker_t *walker, int fd, char *buf, size_t size)
+{
+	proc_image_file_t *file;
+	ssize_t length;
+
+	if (walker->image) {
+		file = walker->image_files + (fd - PROC_IMAGE_FD_BASE);
+		length = file->length - file->offset < size ? file->length - file->offset : size;
+		memcpy(buf, file->data + file->offset, length);
+		file->offset += length;
+		walker->stats.bytes_read += length;
+		return length;
+	}
+
+	length = read(fd, buf, size);
+
+	++walker->stats.syscalls;
+	if (length > 0)
+		walker->stats.bytes_read += length;
+
+	return length;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Закрывает файл процесса.
+ * @param walker	состояние обхода
+ * @param fd		дескриптор файла
+ */
+void close_pid_fd(proc_walker_t *walker, int fd)
+{
+	if (walker->image) {
+		walker->image_files[fd - PROC_IMAGE_FD_BASE].data = NULL;
+		return;
+	}
+
+	close(fd);
+	++walker->stats.syscalls;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Считывает файл процесса целиком одним вызовом read().
+ * @param walker	состояние обхода
+ * @param pid		PID-каталог
+ * @param name		имя файла в PID-каталоге
+ * @param buf		буфер
+ * @param size		размер буфера, с учётом '\0'
+ * @return		число прочитанных байт. -1 - файл прочитать
+ *			не удалось.
+ */
+ssize_t read_pid_file(proc_walker_t *walker, proc_pid_t *pid,
+	const char *name, char *buf, size_t size)
+{
+	int fd = open_pid_file(walker, pid, name);
+	if (fd < 0)
+		return -1;
+
+	ssize_t length = read_pid_fd(walker, fd, buf, size - 1);
+	close_pid_fd(walker, fd);
+
+	if (length < 0)
+		return -1;
+	buf[length] = '\0';
+
+	return length;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Считает открытые дескрипторы процесса по каталогу fd.
+ * @param walker	состояние обхода
+ * @param pid		PID-каталог
+ * @param buf		буфер под записи каталога
+ * @param size		размер буфера
+ * @return		число дескрипторов. -1 - каталог прочитать не удалось.
+ */
+long count_pid_fds(proc_walker_t *walker, proc_pid_t *pid, char *buf, size_t size)
+{
+	long count = 0;
+	int fd;
+
+	// В образе /proc каталогов дескрипторов нет, хранится только их число
+	if (walker->image)
+		return get_image_fds(pid->pid, &count) < 0 ? -1 : count;
+
+	fd = open_pid_path(walker, pid, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+#ifdef SYS_getdents64
+	struct linux_dirent64 *dent;
+	long length, pos;
+
+	// Записи только считаются: имя дескриптора - его номер, "." и ".."
+	// отличаются по первому символу
+	for (;;) {
+		length = syscall(SYS_getdents64, fd, buf, size);
+		++walker->stats.syscalls;
+		if (length <= 0)
+			break;
+
+		for (pos = 0; pos < length; pos += dent->d_reclen) {
+			dent = (struct linux_dirent64 *) (buf + pos);
+			if (dent->d_name[0] != '.')
+				++count;
+		}
+	}
+	close_pid_fd(walker, fd);
+
+	return length < 0 ? -1 : count;
+#else
+	struct dirent *direntry;
+	DIR *dir = fdopendir(fd);
+
+	if (dir == NULL) {
+		close_pid_fd(walker, fd);
+		return -1;
+	}
+
+	while ((direntry = readdir(dir)) != NULL) {
+		if (direntry->d_name[0] != '.')
+			++count;
+	}
+	closedir(dir);
+	++walker->stats.syscalls;
+
+	return count;
+#endif
+}
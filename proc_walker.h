@@ -0,0 +1,191 @@
+/*
+ * Обход /proc с минимальным числом системных вызовов.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef PROC_WALKER_H
+#define PROC_WALKER_H
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROC_PID_NAME_SIZE 16 // Размер имени PID-каталога
+#define PROC_IMAGE_OPEN_FILES 4 // Сколько файлов образа обход держит открытыми одновременно
+#define PROC_IMAGE_FD_BASE 0x40000000 // С этого числа начинаются дескрипторы файлов образа
+
+	/* Счётчики одного обхода /proc */
+	typedef struct proc_scan_stats_s {
+		unsigned long pids; /* просмотрено PID-каталогов */
+		unsigned long syscalls; /* выполнено системных вызовов */
+		unsigned long files_opened; /* открыто файлов и каталогов */
+		unsigned long bytes_read; /* прочитано байт */
+	} proc_scan_stats_t;
+
+	/* Файл образа /proc (proc_image), открытый при обходе */
+	typedef struct proc_image_file_s {
+		const char *data; /* содержимое. NULL - ячейка свободна */
+		size_t length; /* длина содержимого */
+		size_t offset; /* сколько уже прочитано */
+	} proc_image_file_t;
+
+	/* Состояние обхода /proc */
+	typedef struct proc_walker_s {
+		int proc_fd; /* дескриптор каталога /proc */
+		void *dir; /* поток каталога, если getdents64 недоступен */
+		char *dents; /* буфер записей каталога */
+		long dents_len; /* число байт в буфере записей */
+		long dents_pos; /* текущая позиция в буфере записей */
+		proc_scan_stats_t stats; /* счётчики обхода */
+		int image; /* 1 - процессы читаются из подключённого образа,
+			    * системные вызовы не выполняются и не считаются */
+		size_t image_pos; /* номер следующего процесса образа */
+		proc_image_file_t image_files[PROC_IMAGE_OPEN_FILES]; /* открытые
+			    * файлы образа, дескриптор - PROC_IMAGE_FD_BASE
+			    * плюс номер ячейки */
+	} proc_walker_t;
+
+	/* PID-каталог, найденный при обходе */
+	typedef struct proc_pid_s {
+		int pid; /* PID процесса */
+		char name[PROC_PID_NAME_SIZE]; /* имя PID-каталога */
+		int dir_fd; /* дескриптор PID-каталога. -1 - не открыт */
+	} proc_pid_t;
+
+	/**
+	 * Начинает обход /proc. Если подключён образ /proc (proc_image),
+	 * обход читает процессы из него, а proc_path не открывается.
+	 * @param walker	состояние обхода
+	 * @param proc_path	путь к /proc
+	 * @return		0 - успешно. -1 - /proc открыть не удалось.
+	 */
+	extern int open_proc_walker(proc_walker_t *walker, const char *proc_path);
+
+	/**
+	 * Завершает обход /proc, освобождает ресурсы.
+	 * @param walker	состояние обхода
+	 */
+	extern void close_proc_walker(proc_walker_t *walker);
+
+	/**
+	 * Возвращает следующий PID-каталог /proc.
+	 *
+	 * Записи каталога читаются большими пакетами через getdents64,
+	 * элементы с нечисловыми именами пропускаются без stat().
+	 *
+	 * @param walker	состояние обхода
+	 * @param pid		сюда будет помещён PID-каталог
+	 * @return		1 - каталог найден. 0 - обход закончен.
+	 */
+	extern int next_proc_pid(proc_walker_t *walker, proc_pid_t *pid);
+
+	/**
+	 * Заполняет описание PID-каталога по номеру процесса, без обхода.
+	 * @param pid		описание PID-каталога
+	 * @param number	PID процесса
+	 */
+	extern void set_proc_pid(proc_pid_t *pid, int number);
+
+	/**
+	 * Открывает PID-каталог. Последующие файлы процесса открываются
+	 * относительно него, без повторного разбора пути.
+	 * @param walker	состояние обхода
+	 * @param pid		PID-каталог
+	 * @return		0 - успешно. -1 - процесса уже нет.
+	 */
+	extern int open_pid_dir(proc_walker_t *walker, proc_pid_t *pid);
+
+	/**
+	 * Закрывает PID-каталог, если он был открыт.
+	 * @param walker	состояние обхода
+	 * @param pid		PID-каталог
+	 */
+	extern void release_proc_pid(proc_walker_t *walker, proc_pid_t *pid);
+
+	/**
+	 * Определяет владельца процесса по дескриптору PID-каталога.
+	 * @param walker	состояние обхода
+	 * @param pid		PID-каталог, открывается при необходимости
+	 * @param uid		сюда будет помещён UID владельца
+	 * @return		0 - успешно. -1 - процесса уже нет.
+	 */
+	extern int read_pid_owner(proc_walker_t *walker, proc_pid_t *pid, long *uid);
+
+	/**
+	 * Открывает файл процесса. Если PID-каталог открыт - относительно него,
+	 * иначе относительно /proc.
+	 * @param walker	состояние обхода
+	 * @param pid		PID-каталог
+	 * @param name		имя файла в PID-каталоге
+	 * @return		дескриптор файла. -1 - файл открыть не удалось.
+	 */
+	extern int open_pid_file(proc_walker_t *walker, proc_pid_t *pid, const char *name);
+
+	/**
+	 * Читает данные из файла процесса.
+	 * @param walker	состояние обхода
+	 * @param fd		дескриптор файла
+	 * @param buf		буфер
+	 * @param size		размер буфера
+	 * @return		число прочитанных байт. -1 - ошибка чтения.
+	 */
+	extern ssize_t read_pid_fd(proc_walker_t *walker, int fd, char *buf, size_t size);
+
+	/**
+	 * Закрывает файл процесса.
+	 * @param walker	состояние обхода
+	 * @param fd		дескриптор файла
+	 */
+	extern void close_pid_fd(proc_walker_t *walker, int fd);
+
+	/**
+	 * Считывает файл процесса целиком одним вызовом read() и завершает
+	 * его символом '\0'.
+	 * @param walker	состояние обхода
+	 * @param pid		PID-каталог
+	 * @param name		имя файла в PID-каталоге
+	 * @param buf		буфер
+	 * @param size		размер буфера, с учётом '\0'
+	 * @return		число прочитанных байт. -1 - файл прочитать
+	 *			не удалось.
+	 */
+	extern ssize_t read_pid_file(proc_walker_t *walker, proc_pid_t *pid,
+		const char *name, char *buf, size_t size);
+
+	/**
+	 * Считает открытые дескрипторы процесса по каталогу fd. Записи
+	 * каталога читаются пакетами размером с буфер через getdents64 и
+	 * только считаются: ни stat(), ни readlink() для дескрипторов не
+	 * выполняются, так что процесс с сотнями тысяч дескрипторов стоит
+	 * сотни системных вызовов. В образе /proc каталога нет, число
+	 * дескрипторов берётся из образа.
+	 * @param walker	состояние обхода
+	 * @param pid		PID-каталог
+	 * @param buf		буфер под записи каталога
+	 * @param size		размер буфера
+	 * @return		число дескрипторов. -1 - каталог прочитать
+	 *			не удалось.
+	 */
+	extern long count_pid_fds(proc_walker_t *walker, proc_pid_t *pid, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROC_WALKER_H */
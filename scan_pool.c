@@ -0,0 +1,107 @@
+/*
+ * Пул потоков для параллельной обработки процессов /proc.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <pthread.h>
+#include "scan_pool.h"
+
+/* Общее состояние одного вызова run_scan_pool */
+typedef struct scan_pool_s {
+	scan_task_t task; /* обработчик порции */
+	void *context; /* данные обработчика */
+	size_t count; /* число элементов */
+	size_t chunk; /* размер порции */
+	size_t next; /* номер первого ещё не выданного элемента */
+} scan_pool_t;
+
+/* Поток пула */
+typedef struct scan_worker_s {
+	scan_pool_t *pool; /* общее состояние */
+	unsigned index; /* номер потока */
+	pthread_t thread; /* поток */
+} scan_worker_t;
+
+unsigned run_scan_pool(unsigned threads, size_t count, size_t chunk,
+	scan_task_t task, void *context);
+void *scan_worker_main(void *arg);
+
+/**
+ * Обрабатывает элементы в нескольких потоках, раздавая их порциями.
+ * @param threads	число потоков
+ * @param count		число элементов
+ * @param chunk		размер порции
+ * @param task		обработчик порции
+ * @param context	данные, передаваемые обработчику
+ * @return		число потоков, которые обрабатывали элементы
+ */
+unsigned run_scan_pool(unsigned threads, size_t count, size_t chunk,
+	scan_task_t task, void *context)
+{
+	scan_worker_t workers[SCAN_POOL_MAX_THREADS];
+	scan_pool_t pool = {task, context, count, chunk > 0 ? chunk : 1, 0};
+	unsigned started = 1, i;
+
+	if (threads > SCAN_POOL_MAX_THREADS)
+		threads = SCAN_POOL_MAX_THREADS;
+
+	// Больше потоков, чем порций, не нужно
+	if (threads > (count + pool.chunk - 1) / pool.chunk)
+		threads = (unsigned) ((count + pool.chunk - 1) / pool.chunk);
+
+	for (i = 1; i < threads; ++i) {
+		workers[started].pool = &pool;
+		workers[started].index = started;
+		if (pthread_create(&workers[started].thread, NULL, scan_worker_main,
+			workers + started) == 0)
+			++started;
+	}
+
+	workers[0].pool = &pool;
+	workers[0].index = 0;
+	scan_worker_main(workers);
+
+	for (i = 1; i < started; ++i)
+		pthread_join(workers[i].thread, NULL);
+
+	return started;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Цикл потока пула: забирает порции, пока элементы не кончатся.
+ * @param arg	поток пула, scan_worker_t
+ * @return	NULL
+ */
+void *scan_worker_main(void *arg)
+{
+	scan_worker_t *worker = (scan_worker_t *) arg;
+	scan_pool_t *pool = worker->pool;
+	size_t begin, end;
+
+	for (;;) {
+		begin = __sync_fetch_and_add(&pool->next, pool->chunk);
+		if (begin >= pool->count)
+			break;
+
+		end = begin + pool->chunk < pool->count ? begin + pool->chunk : pool->count;
+		pool->task(pool->context, worker->index, begin, end);
+	}
+
+	return NULL;
+}
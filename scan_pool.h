@@ -0,0 +1,69 @@
+/*
+ * Пул потоков для параллельной обработки процессов /proc.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef SCAN_POOL_H
+#define SCAN_POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCAN_POOL_MAX_THREADS 64 // Наибольшее число потоков пула
+
+	/**
+	 * Обработчик части элементов. Вызывается для полуинтервала
+	 * [begin, end) номеров элементов.
+	 *
+	 * @param context	данные вызывающей стороны
+	 * @param worker	номер потока пула, от 0 до threads - 1. По нему
+	 *			обработчик находит буферы и частичные суммы
+	 *			своего потока
+	 * @param begin		номер первого элемента
+	 * @param end		номер элемента за последним
+	 */
+	typedef void (*scan_task_t)(void *context, unsigned worker, size_t begin, size_t end);
+
+	/**
+	 * Обрабатывает count элементов в нескольких потоках.
+	 *
+	 * Элементы выдаются потокам порциями по chunk штук из общего счётчика:
+	 * поток, быстро закончивший свою порцию, сразу забирает следующую,
+	 * поэтому процессы с большими maps-файлами не задерживают остальных.
+	 * Вызывающий поток работает как поток с номером 0. Потоки создаются
+	 * на время вызова, так что после fork() пул не требует восстановления.
+	 * Если поток создать не удалось, элементы обрабатывают оставшиеся.
+	 *
+	 * @param threads	число потоков, не больше SCAN_POOL_MAX_THREADS.
+	 *			0 или 1 - всё обрабатывается в вызывающем потоке
+	 * @param count		число элементов
+	 * @param chunk		размер порции
+	 * @param task		обработчик порции
+	 * @param context	данные, передаваемые обработчику
+	 * @return		число потоков, которые обрабатывали элементы
+	 */
+	extern unsigned run_scan_pool(unsigned threads, size_t count, size_t chunk,
+		scan_task_t task, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_POOL_H */
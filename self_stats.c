@@ -0,0 +1,245 @@
+/*
+ * Счётчики собственных затрат модуля: обходы, задержки, выделения памяти.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "proc_parse.h"
+#include "self_stats.h"
+
+#define SELF_STATM_SIZE 256 // Размер буфера /proc/self/statm
+
+/* Счётчики изменяются только атомарными операциями, поэтому их можно
+ * обновлять из любого потока, в том числе под snapshot_lock */
+static unsigned long self_latency[SELF_LATENCY_BUCKETS]; // Гистограмма задержек обхода
+static unsigned long self_scans = 0; // Число обходов
+static unsigned long long self_latency_max = 0; // Наибольшая задержка, в наносекундах
+static unsigned long self_allocations = 0; // Число выделений памяти
+
+void count_self_scan(unsigned long long nanoseconds);
+unsigned long get_self_scans(void);
+double get_self_scan_latency(double percent);
+unsigned long get_self_allocations(void);
+unsigned long get_self_rss(void);
+void *self_malloc(size_t size);
+void *self_calloc(size_t count, size_t size);
+void *self_realloc(void *ptr, size_t size);
+char *self_strdup(const char *str);
+unsigned latency_bucket(unsigned long long microseconds);
+unsigned long long latency_bucket_limit(unsigned bucket);
+
+/**
+ * Учитывает один обход /proc в гистограмме задержек.
+ * @param nanoseconds	длительность обхода, в наносекундах
+ */
+void count_self_scan(unsigned long long nanoseconds)
+{
+	unsigned long long microseconds = nanoseconds / 1000, known;
+
+	__sync_fetch_and_add(self_latency + latency_bucket(microseconds), 1);
+	__sync_fetch_and_add(&self_scans, 1);
+
+	known = self_latency_max;
+	while (nanoseconds > known &&
+		!__sync_bool_compare_and_swap(&self_latency_max, known, nanoseconds))
+		known = self_latency_max;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число учтённых обходов /proc.
+ * @return	число обходов
+ */
+unsigned long get_self_scans(void)
+{
+	return __sync_fetch_and_add(&self_scans, 0);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает процентиль задержки обхода /proc по гистограмме.
+ * @param percent	процентиль, от 0 до 100
+ * @return		задержка, в миллисекундах. 0 - обходов не было.
+ */
+double get_self_scan_latency(double percent)
+{
+	unsigned long counts[SELF_LATENCY_BUCKETS], total = 0, seen = 0;
+	unsigned long long maximum = __sync_fetch_and_add(&self_latency_max, 0), limit;
+	unsigned i;
+
+	// Корзины читаются не одномоментно - итог считаем по прочитанным
+	for (i = 0; i < SELF_LATENCY_BUCKETS; ++i) {
+		counts[i] = __sync_fetch_and_add(self_latency + i, 0);
+		total += counts[i];
+	}
+
+	if (total == 0)
+		return 0;
+	if (percent >= 100)
+		return maximum / 1e6;
+
+	for (i = 0; i < SELF_LATENCY_BUCKETS; ++i) {
+		seen += counts[i];
+		if (seen * 100.0 >= percent * total)
+			break;
+	}
+
+	// Граница корзины не может быть больше наибольшей задержки
+	limit = latency_bucket_limit(i < SELF_LATENCY_BUCKETS ? i : SELF_LATENCY_BUCKETS - 1);
+	return (limit < maximum ? limit : maximum) / 1e6;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число выделений памяти модулем.
+ * @return	число выделений
+ */
+unsigned long get_self_allocations(void)
+{
+	return __sync_fetch_and_add(&self_allocations, 0);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Определяет резидентную память процесса, в котором работает модуль.
+ * @return	резидентная память, в байтах. 0 - прочитать не удалось.
+ */
+unsigned long get_self_rss(void)
+{
+	char buf[SELF_STATM_SIZE];
+	linux_statm_t statm;
+	ssize_t length;
+	int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return 0;
+
+	length = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (length <= 0)
+		return 0;
+	buf[length] = '\0';
+
+	if (!parse_linux_statm(buf, length, &statm))
+		return 0;
+
+	return statm.resident * (unsigned long) sysconf(_SC_PAGESIZE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * malloc() с учётом в счётчике выделений.
+ * @param size	размер памяти
+ * @return	выделенная память. NULL - памяти не хватило.
+ */
+void *self_malloc(size_t size)
+{
+	__sync_fetch_and_add(&self_allocations, 1);
+	return malloc(size);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * calloc() с учётом в счётчике выделений.
+ * @param count	число элементов
+ * @param size	размер элемента
+ * @return	выделенная обнулённая память. NULL - памяти не хватило.
+ */
+void *self_calloc(size_t count, size_t size)
+{
+	__sync_fetch_and_add(&self_allocations, 1);
+	return calloc(count, size);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * realloc() с учётом в счётчике выделений.
+ * @param ptr	ранее выделенная память, может быть NULL
+ * @param size	новый размер
+ * @return	выделенная память. NULL - памяти не хватило, ptr не изменён.
+ */
+void *self_realloc(void *ptr, size_t size)
+{
+	__sync_fetch_and_add(&self_allocations, 1);
+	return realloc(ptr, size);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * strdup() с учётом в счётчике выделений.
+ * @param str	строка
+ * @return	копия строки. NULL - памяти не хватило.
+ */
+char *self_strdup(const char *str)
+{
+	__sync_fetch_and_add(&self_allocations, 1);
+	return strdup(str);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Определяет корзину гистограммы для задержки. До 4 мкс корзина на
+ * каждую микросекунду, далее по четыре корзины на степень двойки.
+ * @param microseconds	задержка, в микросекундах
+ * @return		номер корзины
+ */
+unsigned latency_bucket(unsigned long long microseconds)
+{
+	unsigned bits = 0, bucket;
+
+	if (microseconds < 4)
+		return (unsigned) microseconds;
+
+	while ((microseconds >> bits) > 1)
+		++bits;
+
+	// Два бита после старшего выбирают четверть степени двойки
+	bucket = (bits - 1) * 4 + (unsigned) ((microseconds >> (bits - 2)) & 3);
+
+	return bucket < SELF_LATENCY_BUCKETS ? bucket : SELF_LATENCY_BUCKETS - 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает верхнюю границу корзины гистограммы.
+ * @param bucket	номер корзины
+ * @return		граница, в наносекундах
+ */
+unsigned long long latency_bucket_limit(unsigned bucket)
+{
+	unsigned bits;
+
+	if (bucket < 4)
+		return (bucket + 1) * 1000ULL;
+
+	bits = bucket / 4 + 1;
+	return ((4ULL + bucket % 4 + 1) << (bits - 2)) * 1000ULL;
+}
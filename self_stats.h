@@ -0,0 +1,93 @@
+/*
+ * Счётчики собственных затрат модуля: обходы, задержки, выделения памяти.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef SELF_STATS_H
+#define SELF_STATS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SELF_LATENCY_BUCKETS 160 // Число корзин гистограммы задержек обхода
+
+	/**
+	 * Учитывает один обход /proc в гистограмме задержек. Корзины - по
+	 * четыре на каждую степень двойки микросекунд, поэтому процентиль
+	 * определяется с точностью до 25%. Счётчики изменяются атомарно,
+	 * без блокировок.
+	 * @param nanoseconds	длительность обхода, в наносекундах
+	 */
+	extern void count_self_scan(unsigned long long nanoseconds);
+
+	/**
+	 * Возвращает число учтённых обходов /proc.
+	 * @return	число обходов
+	 */
+	extern unsigned long get_self_scans(void);
+
+	/**
+	 * Возвращает процентиль задержки обхода /proc по гистограмме -
+	 * верхнюю границу корзины, в которую он попал.
+	 * @param percent	процентиль, от 0 до 100. 100 - наибольшая
+	 *			задержка, она хранится точно
+	 * @return		задержка, в миллисекундах. 0 - обходов не было.
+	 */
+	extern double get_self_scan_latency(double percent);
+
+	/**
+	 * Возвращает число выделений памяти модулем через self_malloc,
+	 * self_calloc, self_realloc и self_strdup.
+	 * @return	число выделений
+	 */
+	extern unsigned long get_self_allocations(void);
+
+	/**
+	 * Определяет резидентную память процесса, в котором работает модуль.
+	 * Читается настоящий /proc/self/statm, независимо от ProcRoot.
+	 * @return	резидентная память, в байтах. 0 - прочитать не удалось.
+	 */
+	extern unsigned long get_self_rss(void);
+
+	/**
+	 * malloc() с учётом в счётчике выделений.
+	 */
+	extern void *self_malloc(size_t size);
+
+	/**
+	 * calloc() с учётом в счётчике выделений.
+	 */
+	extern void *self_calloc(size_t count, size_t size);
+
+	/**
+	 * realloc() с учётом в счётчике выделений.
+	 */
+	extern void *self_realloc(void *ptr, size_t size);
+
+	/**
+	 * strdup() с учётом в счётчике выделений.
+	 */
+	extern char *self_strdup(const char *str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SELF_STATS_H */
@@ -21,8 +21,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
-
-#define DEBUG 0
+#include "string_util.h"
+#include "self_stats.h"
 
 void trim_substring(char *substring);
 int substr_len(const char *substring);
@@ -30,6 +30,12 @@ int line_is_comment(const char *line);
 int read_line(FILE *file, char *lbuf, int lbuf_size);
 char *str_summ(const char *first, const char *second);
 char *str_builder(int num, ...);
+void left_shift(char * str);
+void str_buffer_init(str_buffer_t *buffer);
+int str_buffer_reserve(str_buffer_t *buffer, size_t length);
+int str_buffer_printf(str_buffer_t *buffer, const char *format, ...);
+int str_buffer_json(str_buffer_t *buffer, const char *str);
+char *str_buffer_take(str_buffer_t *buffer);
 
 /**
  * Удаляет пробелы в начале и в конце подстроки.
@@ -40,18 +46,10 @@ char *str_builder(int num, ...);
  */
 void trim_substring(char *substring)
 {
-#if DEBUG
-	printf("before trim: [%s], ", substring);
-#endif
-
 	// Сдвигаем указатель подстроки, пропуская пробелы
 	while (*substring != '\0' && *substring == ' ')
 		substring++;
 
-#if DEBUG
-	printf("after begin trim: [%s], ", substring);
-#endif
-
 	// Ищем конец подстроки
 	//int i = strlen(substring); Не подходит, возвращает размер, меньший чем у подстроки
 	int i = substr_len(substring);
@@ -59,10 +57,6 @@ void trim_substring(char *substring)
 	// Удаляем пробелы в конце
 	while (--i >= 0 && substring[i] == ' ')
 		substring[i] = '\0';
-
-#if DEBUG
-	printf("after end trim: [%s]\n", substring);
-#endif
 }
 
 //------------------------------------------------------------------------------
@@ -97,26 +91,13 @@ int substr_len(const char *substring)
  */
 int line_is_comment(const char *line)
 {
-
-#if DEBUG
-	printf("DEBUG: detecting line is comment [%s]: ", line);
-#endif
-
 	const char *pl = line;
 	char c;
 	while ((c = *(pl++)) != '\0') {
-
-#if DEBUG
-		printf("%c", c);
-#endif
-
 		switch (c) {
 			/* Ищем, начинается ли строка с решётки
 			 * пропуская начальные пробелы и табы */
 		case '#':
-#if DEBUG
-			printf(" - this is comment\n");
-#endif
 			return 1;
 			break;
 
@@ -126,17 +107,11 @@ int line_is_comment(const char *line)
 
 			/* Если не встретили и начались данные - это не коммент */
 		default:
-#if DEBUG
-			printf(" - is not comment, ok\n");
-#endif
 			return 0;
 			break;
 		}
 	}
 
-#if DEBUG
-	printf(" line is empty, skip it\n");
-#endif
 	return 1; // Пустую строку не обрабатываем, это отступ для красоты
 }
 
@@ -166,9 +141,6 @@ int read_line(FILE *file, char *lbuf, int lbuf_size)
 			// Дальнейшее поведение аналогично встрече символа переноса
 		case '\n':
 			lbuf[i] = '\0';
-#if DEBUG
-			printf("DEBUG: readed line: [%s]\n", lbuf);
-#endif
 			return 1;
 			break;
 
@@ -183,10 +155,10 @@ int read_line(FILE *file, char *lbuf, int lbuf_size)
 		}
 	}
 
-	lbuf[++i] = '\0';
-#if DEBUG
-	printf("DEBUG: readed line: [%s]\n", lbuf);
-#endif
+	// Строка длиннее буфера - остаток строки до переноса отбрасываем
+	lbuf[i] = '\0';
+	while ((c = fgetc(file)) != EOF && c != '\n')
+		;
 	return 1;
 }
 
@@ -209,7 +181,7 @@ int read_line(FILE *file, char *lbuf, int lbuf_size)
 char *str_summ(const char *first, const char *second)
 {
 	int common_length = strlen(first) + strlen(second) + 1;
-	char *new_str = malloc(sizeof(char) * common_length);
+	char *new_str = self_malloc(sizeof(char) * common_length);
 
 	strcpy(new_str, first);
 	strcat(new_str, second);
@@ -243,7 +215,7 @@ char *str_builder(int num, ...)
 
 	va_end(strs);
 
-	char *new_str = malloc(common_length);
+	char *new_str = self_malloc(common_length);
 	new_str[0] = '\0';
 
 	va_start(strs, num);
@@ -268,4 +240,147 @@ void left_shift(char * str)
 	int i;
 	for (i = 1; i <= strlen(str); ++i)
 		str[i - 1] = str[i];
-}
\ No newline at end of file
+}
+//------------------------------------------------------------------------------
+
+/**
+ * Подготавливает пустую растущую строку.
+ * @param buffer	растущая строка
+ */
+void str_buffer_init(str_buffer_t *buffer)
+{
+	memset(buffer, 0, sizeof(str_buffer_t));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Резервирует место в растущей строке.
+ * @param buffer	растущая строка
+ * @param length	сколько символов будет добавлено, без учёта '\0'
+ * @return		0 - успешно. -1 - не хватило памяти.
+ */
+int str_buffer_reserve(str_buffer_t *buffer, size_t length)
+{
+	size_t capacity = buffer->capacity ? buffer->capacity : 256;
+	char *data;
+
+	if (buffer->failed)
+		return -1;
+	if (buffer->length + length + 1 <= buffer->capacity)
+		return 0;
+
+	while (capacity < buffer->length + length + 1)
+		capacity *= 2;
+
+	data = self_realloc(buffer->data, capacity);
+	if (data == NULL) {
+		buffer->failed = 1;
+		return -1;
+	}
+
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет в конец растущей строки форматированный текст.
+ * @param buffer	растущая строка
+ * @param format	формат, как у printf
+ * @return		0 - успешно. -1 - не хватило памяти.
+ */
+int str_buffer_printf(str_buffer_t *buffer, const char *format, ...)
+{
+	va_list args;
+	int length;
+
+	va_start(args, format);
+	length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	if (length < 0 || str_buffer_reserve(buffer, length) < 0)
+		return -1;
+
+	va_start(args, format);
+	vsnprintf(buffer->data + buffer->length, length + 1, format, args);
+	va_end(args);
+	buffer->length += length;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет в конец растущей строки строку в кавычках, экранированную
+ * по правилам JSON.
+ * @param buffer	растущая строка
+ * @param str		строка
+ * @return		0 - успешно. -1 - не хватило памяти.
+ */
+int str_buffer_json(str_buffer_t *buffer, const char *str)
+{
+	unsigned char c;
+	char *out;
+
+	// Худший случай - каждый символ превращается в \u00XX
+	if (str_buffer_reserve(buffer, strlen(str) * 6 + 2) < 0)
+		return -1;
+
+	out = buffer->data + buffer->length;
+	*(out++) = '"';
+	for (; (c = (unsigned char) *str) != '\0'; ++str) {
+		switch (c) {
+		case '"':
+		case '\\':
+			*(out++) = '\\';
+			*(out++) = c;
+			break;
+		case '\n':
+			*(out++) = '\\';
+			*(out++) = 'n';
+			break;
+		case '\t':
+			*(out++) = '\\';
+			*(out++) = 't';
+			break;
+		default:
+			if (c < 0x20) {
+				out += sprintf(out, "\\u%04x", c);
+				break;
+			}
+			*(out++) = c;
+		}
+	}
+	*(out++) = '"';
+	*out = '\0';
+	buffer->length = out - buffer->data;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Забирает собранную строку. Растущая строка после этого пуста.
+ * @param buffer	растущая строка
+ * @return		строка, освобождается через free(). NULL - при
+ *			сборке не хватило памяти.
+ */
+char *str_buffer_take(str_buffer_t *buffer)
+{
+	char *data = buffer->data;
+
+	if (buffer->failed) {
+		free(data);
+		data = NULL;
+	} else if (data == NULL) {
+		data = self_strdup("");
+	}
+
+	str_buffer_init(buffer);
+	return data;
+}
@@ -20,10 +20,20 @@
 #ifndef STRING_UTIL_H
 #define STRING_UTIL_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+	/* Строка, растущая по мере добавления в неё данных */
+	typedef struct str_buffer_s {
+		char *data; /* строка, всегда завершается '\0' */
+		size_t length; /* длина строки без '\0' */
+		size_t capacity; /* размер выделенной памяти */
+		int failed; /* 1 - памяти не хватило, строка неполная */
+	} str_buffer_t;
+
 	/**
 	 * Удаляет пробелы в начале и в конце подстроки.
 	 *
@@ -96,6 +106,37 @@ extern "C" {
 	 */
 	extern void left_shift(char * str);
 
+	/**
+	 * Подготавливает пустую растущую строку.
+	 * @param buffer	растущая строка
+	 */
+	extern void str_buffer_init(str_buffer_t *buffer);
+
+	/**
+	 * Добавляет в конец растущей строки форматированный текст.
+	 * @param buffer	растущая строка
+	 * @param format	формат, как у printf
+	 * @return		0 - успешно. -1 - не хватило памяти.
+	 */
+	extern int str_buffer_printf(str_buffer_t *buffer, const char *format, ...);
+
+	/**
+	 * Добавляет в конец растущей строки строку в кавычках, экранированную
+	 * по правилам JSON.
+	 * @param buffer	растущая строка
+	 * @param str		строка
+	 * @return		0 - успешно. -1 - не хватило памяти.
+	 */
+	extern int str_buffer_json(str_buffer_t *buffer, const char *str);
+
+	/**
+	 * Забирает собранную строку. Растущая строка после этого пуста.
+	 * @param buffer	растущая строка
+	 * @return		строка, освобождается через free(). NULL - при
+	 *			сборке не хватило памяти.
+	 */
+	extern char *str_buffer_take(str_buffer_t *buffer);
+
 #ifdef __cplusplus
 }
 #endif
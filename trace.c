@@ -0,0 +1,135 @@
+/*
+ * Трассировка этапов сбора в кольцевой буфер, включаемая без пересборки.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "string_util.h"
+#include "trace.h"
+
+/* Интервал трассировки. seq - номер записи в буфере: нечётный, пока
+ * интервал записывается, чётный - когда записан. По нему читатель
+ * отбрасывает интервалы, затёртые во время чтения */
+typedef struct trace_span_s {
+	unsigned long seq; /* 2 * номер записи + 1 - пишется, + 2 - записан */
+	unsigned long long start; /* момент начала, в наносекундах */
+	unsigned long long duration; /* длительность, в наносекундах */
+	int stage; /* этап, из trace_stages */
+	int pid; /* PID процесса, 0 - нет */
+	unsigned long count; /* сколько обработано */
+} trace_span_t;
+
+/* Имена этапов в JSON, по trace_stages */
+static const char *trace_stage_names[] = {
+	"walk", "events", "stat", "maps", "smaps", "load", "aggregate"
+};
+
+int trace_enabled = 0;
+
+static trace_span_t trace_ring[TRACE_RING_SIZE]; // Кольцевой буфер интервалов
+static unsigned long trace_head = 0; // Номер следующей записи
+
+unsigned long long trace_clock(void);
+void record_trace_span(unsigned long long started, int stage, int pid,
+	unsigned long count);
+char *get_trace_json(unsigned limit);
+
+/**
+ * Возвращает момент времени для трассировки.
+ * @return	CLOCK_MONOTONIC, в наносекундах
+ */
+unsigned long long trace_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Записывает интервал в кольцевой буфер.
+ * @param started	момент начала, из trace_clock()
+ * @param stage		этап, из trace_stages
+ * @param pid		PID процесса, 0 - нет
+ * @param count		сколько обработано
+ */
+void record_trace_span(unsigned long long started, int stage, int pid,
+	unsigned long count)
+{
+	unsigned long long finished = trace_clock();
+	unsigned long ticket = __sync_fetch_and_add(&trace_head, 1);
+	trace_span_t *span = trace_ring + (ticket & (TRACE_RING_SIZE - 1));
+
+	span->seq = 2 * ticket + 1;
+	__sync_synchronize();
+	span->start = started;
+	span->duration = finished - started;
+	span->stage = stage;
+	span->pid = pid;
+	span->count = count;
+	__sync_synchronize();
+	span->seq = 2 * ticket + 2;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает JSON последних интервалов трассировки.
+ * @param limit	наибольшее число интервалов
+ * @return	JSON. NULL - не хватило памяти.
+ */
+char *get_trace_json(unsigned limit)
+{
+	unsigned long head = __sync_fetch_and_add(&trace_head, 0), ticket, first;
+	trace_span_t *slot, span;
+	str_buffer_t json;
+	int written = 0;
+
+	if (limit > TRACE_RING_SIZE)
+		limit = TRACE_RING_SIZE;
+	first = head > limit ? head - limit : 0;
+
+	str_buffer_init(&json);
+	str_buffer_printf(&json, "[");
+
+	for (ticket = first; ticket < head; ++ticket) {
+		slot = trace_ring + (ticket & (TRACE_RING_SIZE - 1));
+
+		// Копируем и убеждаемся, что интервал не перезаписали
+		if (slot->seq != 2 * ticket + 2)
+			continue;
+		__sync_synchronize();
+		span = *slot;
+		__sync_synchronize();
+		if (slot->seq != 2 * ticket + 2)
+			continue;
+
+		str_buffer_printf(&json, "%s{\"stage\":\"%s\",\"start\":%llu,\"duration\":%llu,"
+			"\"pid\":%d,\"count\":%lu}", written++ > 0 ? "," : "",
+			trace_stage_names[span.stage], span.start, span.duration,
+			span.pid, span.count);
+	}
+
+	str_buffer_printf(&json, "]");
+
+	return str_buffer_take(&json);
+}
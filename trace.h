@@ -0,0 +1,94 @@
+/*
+ * Трассировка этапов сбора в кольцевой буфер, включаемая без пересборки.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_RING_SIZE 4096 // Число интервалов в кольцевом буфере, степень двойки
+#define TRACE_DEFAULT_SPANS 100 // Сколько последних интервалов отдаёт procinf.self.trace
+
+	/* Этапы сбора, которые записываются в трассировку */
+	enum trace_stages {
+		TRACE_WALK, /* обход /proc целиком, count - PID-каталогов */
+		TRACE_EVENTS, /* обновление снимка по событиям, count - процессов */
+		TRACE_STAT, /* чтение и разбор stat порции процессов,
+			     * count - процессов */
+		TRACE_MAPS, /* чтение и разбор maps процесса, count - байт */
+		TRACE_SMAPS, /* чтение и разбор smaps процесса, count - байт */
+		TRACE_LOAD, /* чтение файлов процессов пулом потоков,
+			     * count - процессов снимка */
+		TRACE_AGGREGATE /* суммирование по снимку, count - процессов
+				 * с подходящим именем */
+	};
+
+	/* 1 - трассировка включена (Trace). Проверяется перед каждой точкой
+	 * трассировки, поэтому выключенная трассировка стоит одного
+	 * предсказуемого перехода */
+	extern int trace_enabled;
+
+	/* Начинает интервал трассировки: запоминает момент начала, если
+	 * трассировка включена, иначе 0 */
+#define TRACE_BEGIN(started) \
+	((started) = __builtin_expect(trace_enabled, 0) ? trace_clock() : 0)
+
+	/* Завершает интервал, начатый TRACE_BEGIN */
+#define TRACE_END(started, stage, pid, count) \
+	do { \
+		if (__builtin_expect((started) != 0, 0)) \
+			record_trace_span((started), (stage), (pid), (count)); \
+	} while (0)
+
+	/**
+	 * Возвращает момент времени для трассировки.
+	 * @return	CLOCK_MONOTONIC, в наносекундах
+	 */
+	extern unsigned long long trace_clock(void);
+
+	/**
+	 * Записывает интервал в кольцевой буфер. Не блокируется: место в
+	 * буфере выдаётся атомарным счётчиком, самые старые интервалы
+	 * затираются.
+	 * @param started	момент начала, из trace_clock()
+	 * @param stage		этап, из trace_stages
+	 * @param pid		PID процесса, 0 - этап не относится к процессу
+	 * @param count		сколько обработано, смысл зависит от этапа
+	 */
+	extern void record_trace_span(unsigned long long started, int stage, int pid,
+		unsigned long count);
+
+	/**
+	 * Собирает JSON последних интервалов трассировки, от старых к новым:
+	 * [{"stage":"walk","start":..,"duration":..,"pid":..,"count":..}],
+	 * start и duration - в наносекундах. Интервалы, которые затирались
+	 * во время чтения, пропускаются.
+	 * @param limit	наибольшее число интервалов
+	 * @return	JSON, освобождается вызывающей стороной.
+	 *		NULL - не хватило памяти.
+	 */
+	extern char *get_trace_json(unsigned limit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
@@ -0,0 +1,450 @@
+/*
+ * Кэш фильтров процессов по владельцу: пользователь, UID или группа.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "module_config.h"
+#include "self_stats.h"
+#include "user_cache.h"
+
+#define NSS_BUF_SIZE 16384 // Начальный размер буфера getpwnam_r и getgrnam_r
+#define NSS_BUF_MAX 1048576 // Наибольший размер буфера под группу с членами
+#define UID_SET_MIN 16 // Начальное число ячеек множества UID
+#define UID_SET_EMPTY -1 // Пустая ячейка множества UID
+
+/* Параметр пользователя в кэше */
+typedef struct user_cache_entry_s {
+	char user[USER_KEY_SIZE]; /* параметр. "" - ячейка свободна */
+	time_t expires; /* когда запись устаревает, CLOCK_MONOTONIC */
+	int found; /* 1 - пользователь или группа найдены. 0 - нет */
+	uid_filter_t filter; /* фильтр, если найдены */
+} user_cache_entry_t;
+
+static pthread_mutex_t user_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t passwd_enum_lock = PTHREAD_MUTEX_INITIALIZER; // getpwent() не реентерабелен
+static user_cache_entry_t user_cache[USER_CACHE_SIZE];
+
+int resolve_uid_filter(const char *user, uid_filter_t *filter);
+void release_uid_filter(uid_filter_t *filter);
+int match_uid_filter(const uid_filter_t *filter, long uid);
+void release_user_cache(void);
+int find_cached_filter(const char *user, time_t now, uid_filter_t *filter);
+void store_cached_filter(const char *user, time_t now, int found, const uid_filter_t *filter);
+int lookup_uid_filter(const char *user, uid_filter_t *filter);
+int lookup_group_filter(const char *group, uid_filter_t *filter);
+int parse_numeric_id(const char *str, long *id);
+time_t user_cache_clock(void);
+uid_set_t *create_uid_set(void);
+int add_uid_set(uid_set_t *set, long uid);
+void release_uid_set(uid_set_t *set);
+
+/**
+ * Строит фильтр процессов по параметру пользователя элемента данных.
+ * @param user		параметр пользователя. NULL или "" - без фильтра
+ * @param filter	сюда будет помещён фильтр
+ * @return		0 - успешно. -1 - пользователь или группа не найдены.
+ */
+int resolve_uid_filter(const char *user, uid_filter_t *filter)
+{
+	time_t now;
+	int result;
+
+	memset(filter, 0, sizeof(uid_filter_t));
+	filter->kind = UID_FILTER_ANY;
+
+	if (user == NULL || *user == '\0')
+		return 0;
+
+	// Числовой UID в NSS не нуждается
+	if (parse_numeric_id(user, &filter->uid)) {
+		filter->kind = UID_FILTER_UID;
+		return 0;
+	}
+
+	if (strlen(user) >= USER_KEY_SIZE)
+		return lookup_uid_filter(user, filter);
+
+	now = user_cache_clock();
+	result = find_cached_filter(user, now, filter);
+	if (result != 0)
+		return result > 0 ? 0 : -1;
+
+	// NSS может отвечать долго - запрашиваем без блокировки кэша
+	result = lookup_uid_filter(user, filter);
+	store_cached_filter(user, now, result == 0, filter);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Освобождает фильтр, полученный от resolve_uid_filter().
+ * @param filter	фильтр
+ */
+void release_uid_filter(uid_filter_t *filter)
+{
+	if (filter->kind == UID_FILTER_SET)
+		release_uid_set(filter->set);
+
+	filter->kind = UID_FILTER_ANY;
+	filter->set = NULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Проверяет владельца процесса по фильтру.
+ * @param filter	фильтр
+ * @param uid		UID владельца процесса
+ * @return		1 - процесс проходит фильтр. 0 - нет.
+ */
+int match_uid_filter(const uid_filter_t *filter, long uid)
+{
+	const uid_set_t *set;
+	size_t slot;
+
+	switch (filter->kind) {
+	case UID_FILTER_UID:
+		return uid == filter->uid;
+	case UID_FILTER_SET:
+		set = filter->set;
+		slot = (size_t) (uid * 2654435761UL) & (set->size - 1);
+		while (set->uids[slot] != UID_SET_EMPTY) {
+			if (set->uids[slot] == uid)
+				return 1;
+			slot = (slot + 1) & (set->size - 1);
+		}
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Очищает кэш фильтров. Выданные фильтры остаются действительными.
+ */
+void release_user_cache(void)
+{
+	size_t i;
+
+	pthread_mutex_lock(&user_cache_lock);
+	for (i = 0; i < USER_CACHE_SIZE; ++i) {
+		release_uid_filter(&user_cache[i].filter);
+		user_cache[i].user[0] = '\0';
+	}
+	pthread_mutex_unlock(&user_cache_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Ищет действующую запись кэша.
+ * @param user		параметр пользователя
+ * @param now		текущее время, из user_cache_clock()
+ * @param filter	сюда будет помещён фильтр из записи
+ * @return		1 - найдена запись о существующем пользователе.
+ *			-1 - найдена запись о том, что пользователя нет.
+ *			0 - записи нет или она устарела.
+ */
+int find_cached_filter(const char *user, time_t now, uid_filter_t *filter)
+{
+	user_cache_entry_t *entry;
+	int result = 0;
+	size_t i;
+
+	pthread_mutex_lock(&user_cache_lock);
+	for (i = 0; i < USER_CACHE_SIZE; ++i) {
+		entry = user_cache + i;
+		if (entry->user[0] == '\0' || entry->expires <= now ||
+			strcmp(entry->user, user) != 0)
+			continue;
+
+		if (entry->found) {
+			*filter = entry->filter;
+			if (filter->kind == UID_FILTER_SET)
+				__sync_fetch_and_add(&filter->set->refs, 1);
+			result = 1;
+		} else {
+			result = -1;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&user_cache_lock);
+
+	return result;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Запоминает результат разрешения параметра пользователя. Занимает
+ * запись того же параметра, свободную или ту, что устареет раньше всех.
+ * @param user		параметр пользователя
+ * @param now		время запроса, из user_cache_clock()
+ * @param found		1 - пользователь или группа найдены. 0 - нет
+ * @param filter	фильтр, если найдены
+ */
+void store_cached_filter(const char *user, time_t now, int found, const uid_filter_t *filter)
+{
+	unsigned ttl = found ? module_config.user_cache_ttl : module_config.user_cache_negative_ttl;
+	user_cache_entry_t *entry = NULL;
+	size_t i;
+
+	if (ttl == 0)
+		return;
+
+	pthread_mutex_lock(&user_cache_lock);
+	for (i = 0; i < USER_CACHE_SIZE; ++i) {
+		if (user_cache[i].user[0] != '\0' && strcmp(user_cache[i].user, user) == 0) {
+			entry = user_cache + i;
+			break;
+		}
+		if (entry == NULL || (entry->user[0] != '\0' &&
+			(user_cache[i].user[0] == '\0' || user_cache[i].expires < entry->expires)))
+			entry = user_cache + i;
+	}
+
+	release_uid_filter(&entry->filter);
+	strcpy(entry->user, user);
+	entry->expires = now + ttl;
+	entry->found = found;
+	if (found) {
+		entry->filter = *filter;
+		if (filter->kind == UID_FILTER_SET)
+			__sync_fetch_and_add(&filter->set->refs, 1);
+	}
+	pthread_mutex_unlock(&user_cache_lock);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разрешает параметр пользователя через NSS, без кэша.
+ * @param user		имя пользователя или group:группа
+ * @param filter	сюда будет помещён фильтр
+ * @return		0 - успешно. -1 - пользователь или группа не найдены.
+ */
+int lookup_uid_filter(const char *user, uid_filter_t *filter)
+{
+	size_t prefix = strlen(USER_GROUP_PREFIX);
+	struct passwd passwd, *found = NULL;
+	char buf[NSS_BUF_SIZE];
+
+	if (strncmp(user, USER_GROUP_PREFIX, prefix) == 0)
+		return lookup_group_filter(user + prefix, filter);
+
+	if (getpwnam_r(user, &passwd, buf, sizeof(buf), &found) != 0 || found == NULL)
+		return -1;
+
+	filter->kind = UID_FILTER_UID;
+	filter->uid = found->pw_uid;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Собирает множество UID пользователей группы: перечисленных в её
+ * списке членов и тех, для кого она основная.
+ * @param group		имя группы или GID
+ * @param filter	сюда будет помещён фильтр
+ * @return		0 - успешно. -1 - группа не найдена или не хватило
+ *			памяти.
+ */
+int lookup_group_filter(const char *group, uid_filter_t *filter)
+{
+	struct group entry, *found = NULL;
+	struct passwd passwd, *member;
+	char pbuf[NSS_BUF_SIZE], *buf = NULL, *larger, **name;
+	size_t size = NSS_BUF_SIZE;
+	uid_set_t *set;
+	long gid;
+	int numeric = parse_numeric_id(group, &gid), error;
+
+	// Большие группы не помещаются в буфер - увеличиваем его
+	do {
+		larger = self_realloc(buf, size);
+		if (larger == NULL)
+			break;
+		buf = larger;
+
+		if (numeric)
+			error = getgrgid_r((gid_t) gid, &entry, buf, size, &found);
+		else
+			error = getgrnam_r(group, &entry, buf, size, &found);
+		size *= 2;
+	} while (error == ERANGE && size <= NSS_BUF_MAX);
+
+	if (found == NULL || (set = create_uid_set()) == NULL) {
+		free(buf);
+		return -1;
+	}
+
+	gid = found->gr_gid;
+	for (name = found->gr_mem; *name != NULL; ++name) {
+		member = NULL;
+		if (getpwnam_r(*name, &passwd, pbuf, sizeof(pbuf), &member) == 0 &&
+			member != NULL)
+			add_uid_set(set, member->pw_uid);
+	}
+	free(buf);
+
+	// Пользователи с основной группой в её списке членов не значатся
+	pthread_mutex_lock(&passwd_enum_lock);
+	setpwent();
+	while ((member = getpwent()) != NULL)
+		if ((long) member->pw_gid == gid)
+			add_uid_set(set, member->pw_uid);
+	endpwent();
+	pthread_mutex_unlock(&passwd_enum_lock);
+
+	filter->kind = UID_FILTER_SET;
+	filter->set = set;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Разбирает числовой UID или GID.
+ * @param str	строка
+ * @param id	сюда будет помещено число
+ * @return	1 - строка состоит только из цифр. 0 - нет.
+ */
+int parse_numeric_id(const char *str, long *id)
+{
+	const char *c;
+
+	for (c = str; *c >= '0' && *c <= '9'; ++c)
+		;
+	if (c == str || *c != '\0' || c - str > 10)
+		return 0;
+
+	*id = strtol(str, NULL, 10);
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает время для сроков записей кэша.
+ * @return	CLOCK_MONOTONIC, в секундах
+ */
+time_t user_cache_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Создаёт пустое множество UID с одной ссылкой.
+ * @return	множество. NULL - не хватило памяти.
+ */
+uid_set_t *create_uid_set(void)
+{
+	uid_set_t *set = self_malloc(sizeof(uid_set_t));
+	size_t i;
+
+	if (set == NULL)
+		return NULL;
+
+	set->uids = self_malloc(UID_SET_MIN * sizeof(long));
+	if (set->uids == NULL) {
+		free(set);
+		return NULL;
+	}
+
+	for (i = 0; i < UID_SET_MIN; ++i)
+		set->uids[i] = UID_SET_EMPTY;
+	set->size = UID_SET_MIN;
+	set->count = 0;
+	set->refs = 1;
+
+	return set;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Добавляет UID в множество. Таблица заполняется не больше чем наполовину.
+ * @param set	множество
+ * @param uid	UID
+ * @return	0 - успешно. -1 - не хватило памяти.
+ */
+int add_uid_set(uid_set_t *set, long uid)
+{
+	long *uids, *old = set->uids;
+	size_t size = set->size, slot, i;
+
+	if (2 * (set->count + 1) > size) {
+		uids = self_malloc(2 * size * sizeof(long));
+		if (uids == NULL)
+			return -1;
+
+		for (i = 0; i < 2 * size; ++i)
+			uids[i] = UID_SET_EMPTY;
+		set->uids = uids;
+		set->size = 2 * size;
+		set->count = 0;
+		for (i = 0; i < size; ++i)
+			if (old[i] != UID_SET_EMPTY)
+				add_uid_set(set, old[i]);
+		free(old);
+	}
+
+	slot = (size_t) (uid * 2654435761UL) & (set->size - 1);
+	while (set->uids[slot] != UID_SET_EMPTY) {
+		if (set->uids[slot] == uid)
+			return 0;
+		slot = (slot + 1) & (set->size - 1);
+	}
+
+	set->uids[slot] = uid;
+	++set->count;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Снимает ссылку на множество UID, освобождает его с последней ссылкой.
+ * @param set	множество
+ */
+void release_uid_set(uid_set_t *set)
+{
+	if (set == NULL || __sync_sub_and_fetch(&set->refs, 1) > 0)
+		return;
+
+	free(set->uids);
+	free(set);
+}
@@ -0,0 +1,95 @@
+/*
+ * Кэш фильтров процессов по владельцу: пользователь, UID или группа.
+ *
+ * Copyright (C) 2016  Oleg Bobukh <o.bobukh@yandex.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USER_CACHE_SIZE 64 // Сколько фильтров хранится в кэше
+#define USER_KEY_SIZE 256 // Размер параметра пользователя, с учётом '\0'
+#define USER_GROUP_PREFIX "group:" // Префикс параметра, задающего группу
+
+	/* Вид фильтра по владельцу процесса */
+	enum uid_filter_kinds {
+		UID_FILTER_ANY, /* фильтра нет */
+		UID_FILTER_UID, /* один UID */
+		UID_FILTER_SET /* множество UID членов группы */
+	};
+
+	/* Множество UID: хеш-таблица с открытой адресацией, пустая ячейка - -1 */
+	typedef struct uid_set_s {
+		long *uids; /* ячейки таблицы */
+		size_t size; /* число ячеек, степень двойки */
+		size_t count; /* число UID в таблице */
+		unsigned refs; /* число ссылок: кэш и выданные фильтры */
+	} uid_set_t;
+
+	/* Фильтр процессов по владельцу */
+	typedef struct uid_filter_s {
+		int kind; /* вид фильтра, из uid_filter_kinds */
+		long uid; /* UID владельца, для UID_FILTER_UID */
+		uid_set_t *set; /* UID членов группы, для UID_FILTER_SET */
+	} uid_filter_t;
+
+	/**
+	 * Строит фильтр процессов по параметру пользователя элемента данных.
+	 *
+	 * Параметр - имя пользователя, числовой UID или group:имя (group:GID)
+	 * - все пользователи, для которых группа основная или дополнительная.
+	 * Имена разрешаются через NSS и кэшируются на UserCacheTTL секунд,
+	 * ненайденные - на UserCacheNegativeTTL секунд, так что медленный
+	 * LDAP или SSSD опрашивается не на каждый запрос.
+	 *
+	 * @param user		параметр пользователя. NULL или "" - без фильтра
+	 * @param filter	сюда будет помещён фильтр, освобождается через
+	 *			release_uid_filter()
+	 * @return		0 - успешно. -1 - пользователь или группа
+	 *			не найдены.
+	 */
+	extern int resolve_uid_filter(const char *user, uid_filter_t *filter);
+
+	/**
+	 * Освобождает фильтр, полученный от resolve_uid_filter().
+	 * @param filter	фильтр
+	 */
+	extern void release_uid_filter(uid_filter_t *filter);
+
+	/**
+	 * Проверяет владельца процесса по фильтру, за O(1).
+	 * @param filter	фильтр
+	 * @param uid		UID владельца процесса
+	 * @return		1 - процесс проходит фильтр. 0 - нет.
+	 */
+	extern int match_uid_filter(const uid_filter_t *filter, long uid);
+
+	/**
+	 * Очищает кэш фильтров.
+	 */
+	extern void release_user_cache(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* USER_CACHE_H */
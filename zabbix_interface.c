@@ -19,10 +19,17 @@
  */
 
 #include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include "pid_info.h"
+#include "module_config.h"
+#include "collector.h"
+#include "self_stats.h"
+#include "trace.h"
+#include "user_cache.h"
+#include "proc_matcher.h"
 #include <module.h>
 #include <sysinc.h>
 
@@ -32,10 +39,62 @@ ZBX_METRIC *zbx_module_item_list(void);
 int zbx_module_uninit();
 
 int zbx_proc_summ(AGENT_REQUEST *request, AGENT_RESULT *result, int mode);
+int zbx_proc_summ_with(AGENT_REQUEST *request, AGENT_RESULT *result, int mode,
+	unsigned long (*summ)(char *, char *, char *, int));
 int zbx_proc_vmrss(AGENT_REQUEST *request, AGENT_RESULT *result);
 int zbx_proc_map_all(AGENT_REQUEST *request, AGENT_RESULT *result);
 int zbx_proc_map_rw(AGENT_REQUEST *request, AGENT_RESULT *result);
 int zbx_proc_map_shared(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_pss(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_uss(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_swap(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_anonhuge(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_rate(AGENT_REQUEST *request, AGENT_RESULT *result, int mode);
+int zbx_proc_cpu(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_minflt_rate(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_majflt_rate(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_ctxsw_rate(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_io_read_bytes(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_io_read_bytes_rate(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_io_write_bytes(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_io_write_bytes_rate(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_io_syscr(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_io_syscr_rate(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_io_syscw(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_io_syscw_rate(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_fds(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_fds_maxpct(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_tree_vmrss(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_tree_map_all(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_tree_map_rw(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_tree_map_shared(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_discovery(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_summary(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_walks_saved(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_source_mismatches(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_exits_dropped(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_counter(AGENT_REQUEST *request, AGENT_RESULT *result, int counter);
+int zbx_proc_self_scans(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_pids(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_syscalls(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_files_opened(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_bytes_read(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_allocations(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_rss(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_scan_latency(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_cache_hit_ratio(AGENT_REQUEST *request, AGENT_RESULT *result);
+int zbx_proc_self_trace(AGENT_REQUEST *request, AGENT_RESULT *result);
+
+/* Счётчики собственных затрат модуля для zbx_proc_self_counter */
+enum self_counters {
+	SELF_SCANS, /* число обходов /proc */
+	SELF_PIDS, /* просмотрено PID-каталогов */
+	SELF_SYSCALLS, /* выполнено системных вызовов */
+	SELF_FILES_OPENED, /* открыто файлов */
+	SELF_BYTES_READ, /* прочитано байт */
+	SELF_ALLOCATIONS, /* выделений памяти */
+	SELF_RSS /* резидентная память процесса агента */
+};
 
 /* Поддерживаемые метрики */
 static ZBX_METRIC keys[] =
@@ -44,6 +103,43 @@ static ZBX_METRIC keys[] =
 	{"procinf.allmap", CF_HAVEPARAMS, zbx_proc_map_all, "bash"},
 	{"procinf.rwmap", CF_HAVEPARAMS, zbx_proc_map_rw, "bash"},
 	{"procinf.shmap", CF_HAVEPARAMS, zbx_proc_map_shared, "bash"},
+	{"procinf.pss", CF_HAVEPARAMS, zbx_proc_pss, "bash"},
+	{"procinf.uss", CF_HAVEPARAMS, zbx_proc_uss, "bash"},
+	{"procinf.swap", CF_HAVEPARAMS, zbx_proc_swap, "bash"},
+	{"procinf.anonhuge", CF_HAVEPARAMS, zbx_proc_anonhuge, "bash"},
+	{"procinf.cpu", CF_HAVEPARAMS, zbx_proc_cpu, "bash"},
+	{"procinf.minflt.rate", CF_HAVEPARAMS, zbx_proc_minflt_rate, "bash"},
+	{"procinf.majflt.rate", CF_HAVEPARAMS, zbx_proc_majflt_rate, "bash"},
+	{"procinf.ctxsw.rate", CF_HAVEPARAMS, zbx_proc_ctxsw_rate, "bash"},
+	{"procinf.io.read_bytes", CF_HAVEPARAMS, zbx_proc_io_read_bytes, "bash"},
+	{"procinf.io.read_bytes.rate", CF_HAVEPARAMS, zbx_proc_io_read_bytes_rate, "bash"},
+	{"procinf.io.write_bytes", CF_HAVEPARAMS, zbx_proc_io_write_bytes, "bash"},
+	{"procinf.io.write_bytes.rate", CF_HAVEPARAMS, zbx_proc_io_write_bytes_rate, "bash"},
+	{"procinf.io.syscr", CF_HAVEPARAMS, zbx_proc_io_syscr, "bash"},
+	{"procinf.io.syscr.rate", CF_HAVEPARAMS, zbx_proc_io_syscr_rate, "bash"},
+	{"procinf.io.syscw", CF_HAVEPARAMS, zbx_proc_io_syscw, "bash"},
+	{"procinf.io.syscw.rate", CF_HAVEPARAMS, zbx_proc_io_syscw_rate, "bash"},
+	{"procinf.fds", CF_HAVEPARAMS, zbx_proc_fds, "bash"},
+	{"procinf.fds.maxpct", CF_HAVEPARAMS, zbx_proc_fds_maxpct, "bash"},
+	{"procinf.tree.vmrss", CF_HAVEPARAMS, zbx_proc_tree_vmrss, "bash"},
+	{"procinf.tree.allmap", CF_HAVEPARAMS, zbx_proc_tree_map_all, "bash"},
+	{"procinf.tree.rwmap", CF_HAVEPARAMS, zbx_proc_tree_map_rw, "bash"},
+	{"procinf.tree.shmap", CF_HAVEPARAMS, zbx_proc_tree_map_shared, "bash"},
+	{"procinf.discovery", CF_HAVEPARAMS, zbx_proc_discovery, NULL},
+	{"procinf.summary", CF_HAVEPARAMS, zbx_proc_summary, "bash"},
+	{"procinf.self.walks_saved", 0, zbx_proc_self_walks_saved, NULL},
+	{"procinf.self.source_mismatches", 0, zbx_proc_self_source_mismatches, NULL},
+	{"procinf.self.exits_dropped", 0, zbx_proc_self_exits_dropped, NULL},
+	{"procinf.self.scans", 0, zbx_proc_self_scans, NULL},
+	{"procinf.self.scan_latency", CF_HAVEPARAMS, zbx_proc_self_scan_latency, "p99"},
+	{"procinf.self.pids", 0, zbx_proc_self_pids, NULL},
+	{"procinf.self.syscalls", 0, zbx_proc_self_syscalls, NULL},
+	{"procinf.self.files_opened", 0, zbx_proc_self_files_opened, NULL},
+	{"procinf.self.bytes_read", 0, zbx_proc_self_bytes_read, NULL},
+	{"procinf.self.allocations", 0, zbx_proc_self_allocations, NULL},
+	{"procinf.self.cache_hit_ratio", 0, zbx_proc_self_cache_hit_ratio, NULL},
+	{"procinf.self.rss", 0, zbx_proc_self_rss, NULL},
+	{"procinf.self.trace", CF_HAVEPARAMS, zbx_proc_self_trace, "100"},
 	{NULL}
 };
 
@@ -61,11 +157,20 @@ int zbx_module_api_version()
 
 /**
  * Функция, вызов которой должен инициализировать
- * этот модуль. Инициализировать нечего. Возвращаем OK.
- * @return OK
+ * этот модуль. Считывает настройки модуля и, если он включен,
+ * запускает фоновый сборщик.
+ * @return OK, либо FAIL, если настройки содержат ошибку или сборщик
+ *         запустить не удалось
  */
 int zbx_module_init(void)
 {
+	if (load_module_config(MODULE_CONFIG_PATH) < 0)
+		return ZBX_MODULE_FAIL;
+
+	trace_enabled = module_config.trace;
+	if (module_config.collector_interval > 0 && start_collector() < 0)
+		return ZBX_MODULE_FAIL;
+
 	return ZBX_MODULE_OK;
 }
 
@@ -83,11 +188,16 @@ ZBX_METRIC *zbx_module_item_list(void)
 //------------------------------------------------------------------------------
 
 /**
- * Деинициализация. Ничего деинициализировать не нужно, просто возвращаем ОК
+ * Деинициализация. Останавливает сборщик и освобождает снимок /proc.
  * @return OK
  */
 int zbx_module_uninit()
 {
+	stop_collector();
+	release_proc_snapshot();
+	release_user_cache();
+	release_matcher_cache();
+
 	return ZBX_MODULE_OK;
 }
 
@@ -100,25 +210,51 @@ int zbx_module_uninit()
  * @return		результат обработки запроса
  */
 int zbx_proc_summ(AGENT_REQUEST *request, AGENT_RESULT *result, int mode)
+{
+	return zbx_proc_summ_with(request, result, mode, get_proc_value_summ);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает какой-либо параметр для процессов, посчитанный указанной
+ * функцией: по одноимённым процессам или по деревьям процессов.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @param mode		рассчитываемый параметр, из proc_params
+ * @param summ		функция подсчёта: get_proc_value_summ или
+ *			get_proc_tree_summ
+ * @return		результат обработки запроса
+ */
+int zbx_proc_summ_with(AGENT_REQUEST *request, AGENT_RESULT *result, int mode,
+	unsigned long (*summ)(char *, char *, char *, int))
 {
 	unsigned long value;
-	char *proc_name, *user_name;
+	char *proc_name, *user_name, *cmdline;
 	switch (request->nparam) {
 	case 1:
 		proc_name = get_rparam(request, 0);
-		value = get_proc_value_summ(proc_name, NULL, mode);
+		value = summ(proc_name, NULL, NULL, mode);
 		SET_UI64_RESULT(result, value);
 		return SYSINFO_RET_OK;
 		break;
 	case 2:
 		proc_name = get_rparam(request, 0);
 		user_name = get_rparam(request, 1);
-		value = get_proc_value_summ(proc_name, user_name, mode);
+		value = summ(proc_name, user_name, NULL, mode);
+		SET_UI64_RESULT(result, value);
+		return SYSINFO_RET_OK;
+		break;
+	case 3:
+		proc_name = get_rparam(request, 0);
+		user_name = get_rparam(request, 1);
+		cmdline = get_rparam(request, 2);
+		value = summ(proc_name, user_name, cmdline, mode);
 		SET_UI64_RESULT(result, value);
 		return SYSINFO_RET_OK;
 		break;
 	default:
-		SET_MSG_RESULT(result, strdup("You must set one or two parameters."));
+		SET_MSG_RESULT(result, strdup("You must set one to three parameters."));
 		return SYSINFO_RET_FAIL;
 	}
 }
@@ -179,3 +315,664 @@ int zbx_proc_map_shared(AGENT_REQUEST *request, AGENT_RESULT *result)
 {
 	return zbx_proc_summ(request, result, PROC_MAP_SHARED);
 }
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает сумму PSS для всех одноимённых процессов. Разделяемые страницы
+ * делятся между использующими их процессами, поэтому сумма не учитывает
+ * общую память несколько раз.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_pss(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_PSS);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает сумму USS (Private_Clean + Private_Dirty) для всех одноимённых
+ * процессов.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_uss(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_USS);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает сумму выгруженной памяти для всех одноимённых процессов.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_swap(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_SWAP);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает сумму анонимных huge-страниц (AnonHugePages) для всех
+ * одноимённых процессов.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_anonhuge(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_ANONHUGE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает значение, которое модуль считает в сотых долях: загрузку
+ * процессора, скорость или долю дескрипторов, дробным числом.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @param mode		режим сбора, из proc_params
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_rate(AGENT_REQUEST *request, AGENT_RESULT *result, int mode)
+{
+	unsigned long value;
+
+	if (request->nparam < 1 || request->nparam > 3) {
+		SET_MSG_RESULT(result, strdup("You must set one to three parameters."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	value = get_proc_value_summ(get_rparam(request, 0),
+		request->nparam > 1 ? get_rparam(request, 1) : NULL,
+		request->nparam > 2 ? get_rparam(request, 2) : NULL, mode);
+	SET_DBL_RESULT(result, (double) value / PROC_RATE_SCALE);
+
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает суммарную загрузку процессора одноимёнными процессами
+ * между двумя последними обходами /proc, в процентах одного ядра.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_cpu(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_CPU);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает суммарное число ошибок страниц без чтения с диска
+ * одноимённых процессов в секунду.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_minflt_rate(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_MINFLT_RATE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает суммарное число ошибок страниц с чтением с диска
+ * одноимённых процессов в секунду.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_majflt_rate(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_MAJFLT_RATE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает суммарное число переключений контекста одноимённых
+ * процессов в секунду, добровольных и принудительных.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_ctxsw_rate(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_CTXSW_RATE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает объём данных, прочитанных с диска одноимёнными процессами
+ * с момента их запуска, в байтах.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_io_read_bytes(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_IO_READ_BYTES);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает объём данных, прочитанных с диска одноимёнными процессами
+ * в секунду, в байтах.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_io_read_bytes_rate(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_IO_READ_BYTES_RATE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает объём данных, отправленных на запись на диск одноимёнными процессами
+ * с момента их запуска, в байтах.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_io_write_bytes(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_IO_WRITE_BYTES);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает объём данных, отправленных на запись на диск одноимёнными процессами
+ * в секунду, в байтах.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_io_write_bytes_rate(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_IO_WRITE_BYTES_RATE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число вызовов чтения одноимёнными процессами
+ * с момента их запуска.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_io_syscr(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_IO_SYSCR);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число вызовов чтения одноимёнными процессами
+ * в секунду.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_io_syscr_rate(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_IO_SYSCR_RATE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число вызовов записи одноимёнными процессами
+ * с момента их запуска.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_io_syscw(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_IO_SYSCW);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число вызовов записи одноимёнными процессами
+ * в секунду.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_io_syscw_rate(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_IO_SYSCW_RATE);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает суммарное число открытых дескрипторов одноимённых процессов.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_fds(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ(request, result, PROC_FDS);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает наибольшую среди одноимённых процессов долю открытых
+ * дескрипторов от мягкого предела RLIMIT_NOFILE, в процентах.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_fds_maxpct(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_rate(request, result, PROC_FDS_MAXPCT);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает сумму резидентной памяти процессов с указанным именем и всех
+ * их потомков, с любыми именами.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_tree_vmrss(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ_with(request, result, PROC_VMRSS, get_proc_tree_summ);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает сумму областей памяти процессов с указанным именем и всех
+ * их потомков.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_tree_map_all(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ_with(request, result, PROC_MAP, get_proc_tree_summ);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает сумму rw-областей памяти процессов с указанным именем и всех
+ * их потомков.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_tree_map_rw(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ_with(request, result, PROC_MAP_RW, get_proc_tree_summ);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает сумму разделяемых областей памяти процессов с указанным
+ * именем и всех их потомков.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_tree_map_shared(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_summ_with(request, result, PROC_MAP_SHARED, get_proc_tree_summ);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает JSON низкоуровневого обнаружения: пары (имя процесса,
+ * владелец) с числом процессов. Необязательные параметры - шаблоны имён,
+ * которые включаются в результат и исключаются из него.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_discovery(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	char *json;
+
+	if (request->nparam > 2) {
+		SET_MSG_RESULT(result, strdup("You must set no more than two parameters."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	json = get_proc_discovery(get_rparam(request, 0), get_rparam(request, 1));
+	if (json == NULL) {
+		SET_MSG_RESULT(result, strdup("Not enough memory."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	SET_TEXT_RESULT(result, json);
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает JSON со сводкой по одноимённым процессам: число процессов,
+ * резидентная память и суммы областей памяти, собранные за один обход
+ * /proc. Предназначен для зависимых элементов данных с JSONPath.
+ *
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_summary(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	char *json;
+
+	if (request->nparam < 1 || request->nparam > 3) {
+		SET_MSG_RESULT(result, strdup("You must set one to three parameters."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	json = get_proc_summary(get_rparam(request, 0),
+		request->nparam >= 2 ? get_rparam(request, 1) : NULL,
+		request->nparam == 3 ? get_rparam(request, 2) : NULL);
+	if (json == NULL) {
+		SET_MSG_RESULT(result, strdup("Not enough memory."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	SET_TEXT_RESULT(result, json);
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число запросов, на которые модуль ответил по уже собранному
+ * снимку /proc, без собственного обхода /proc.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_walks_saved(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	SET_UI64_RESULT(result, get_snapshot_walks_saved());
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число расхождений между дешёвыми и дорогими источниками
+ * значений, найденных в режиме ValidateSources.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_source_mismatches(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	SET_UI64_RESULT(result, get_source_mismatches());
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число процессов, убранных из снимка сразу после завершения
+ * в режиме PidfdTracking.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_exits_dropped(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	SET_UI64_RESULT(result, get_exits_dropped());
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает счётчик собственных затрат модуля.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @param counter	счётчик, из self_counters
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_counter(AGENT_REQUEST *request, AGENT_RESULT *result, int counter)
+{
+	proc_scan_stats_t stats;
+	unsigned long value = 0;
+
+	get_total_scan_stats(&stats);
+
+	switch (counter) {
+	case SELF_SCANS:
+		value = get_self_scans();
+		break;
+	case SELF_PIDS:
+		value = stats.pids;
+		break;
+	case SELF_SYSCALLS:
+		value = stats.syscalls;
+		break;
+	case SELF_FILES_OPENED:
+		value = stats.files_opened;
+		break;
+	case SELF_BYTES_READ:
+		value = stats.bytes_read;
+		break;
+	case SELF_ALLOCATIONS:
+		value = get_self_allocations();
+		break;
+	case SELF_RSS:
+		value = get_self_rss();
+		break;
+	}
+
+	SET_UI64_RESULT(result, value);
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число обходов /proc, выполненных модулем.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_scans(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_self_counter(request, result, SELF_SCANS);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число PID-каталогов, просмотренных модулем.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_pids(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_self_counter(request, result, SELF_PIDS);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число системных вызовов, выполненных модулем при чтении /proc.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_syscalls(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_self_counter(request, result, SELF_SYSCALLS);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число файлов и каталогов /proc, открытых модулем.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_files_opened(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_self_counter(request, result, SELF_FILES_OPENED);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число байт, прочитанных модулем из /proc.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_bytes_read(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_self_counter(request, result, SELF_BYTES_READ);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает число выделений памяти модулем.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_allocations(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_self_counter(request, result, SELF_ALLOCATIONS);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает резидентную память процесса агента, в котором работает модуль.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_rss(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return zbx_proc_self_counter(request, result, SELF_RSS);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает задержку обхода /proc, в миллисекундах. Параметр - p50, p99
+ * или max, по умолчанию p99.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_scan_latency(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	char *mode = request->nparam > 0 ? get_rparam(request, 0) : NULL;
+	double percent;
+
+	if (request->nparam > 1) {
+		SET_MSG_RESULT(result, strdup("You must set no more than one parameter."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (mode == NULL || *mode == '\0' || strcmp(mode, "p99") == 0)
+		percent = 99;
+	else if (strcmp(mode, "p50") == 0)
+		percent = 50;
+	else if (strcmp(mode, "max") == 0)
+		percent = 100;
+	else {
+		SET_MSG_RESULT(result, strdup("Parameter must be p50, p99 or max."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	SET_DBL_RESULT(result, get_self_scan_latency(percent));
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает долю запросов, ответивших по уже собранному снимку /proc.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_cache_hit_ratio(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	SET_DBL_RESULT(result, get_cache_hit_ratio());
+	return SYSINFO_RET_OK;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Возвращает JSON последних интервалов трассировки этапов сбора (Trace=1).
+ * Параметр - наибольшее число интервалов, по умолчанию 100.
+ * @param request	запрос агента
+ * @param result	ответ агенту
+ * @return 		результат обработки запроса
+ */
+int zbx_proc_self_trace(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	char *param = request->nparam > 0 ? get_rparam(request, 0) : NULL;
+	unsigned long limit = TRACE_DEFAULT_SPANS;
+	char *json, *end;
+
+	if (request->nparam > 1) {
+		SET_MSG_RESULT(result, strdup("You must set no more than one parameter."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (param != NULL && *param != '\0') {
+		limit = strtoul(param, &end, 10);
+		if (*end != '\0' || limit == 0 || limit > TRACE_RING_SIZE) {
+			SET_MSG_RESULT(result, strdup("Invalid number of spans."));
+			return SYSINFO_RET_FAIL;
+		}
+	}
+
+	json = get_trace_json((unsigned) limit);
+	if (json == NULL) {
+		SET_MSG_RESULT(result, strdup("Not enough memory."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	SET_TEXT_RESULT(result, json);
+	return SYSINFO_RET_OK;
+}